@@ -40,12 +40,50 @@ int main(int argc, char *argv[]) {
   // Output options
   psr.add_option("-f").dest("fluentd").metavar("STR")
     .help("Fluentd inet destination (e.g. 10.0.0.1:24224)");
+  psr.add_option("-P").dest("packed").action("store_true")
+    .help("Send events to fluentd in PackedForward mode");
+  psr.add_option("-z").dest("compress").metavar("STR")
+    .help("Compress PackedForward messages by 'gzip' or 'zstd'");
+  psr.add_option("-A").dest("ack").action("store_true")
+    .help("Wait for fluentd ack of each PackedForward message");
+  psr.add_option("-S").dest("spool").metavar("DIR")
+    .help("Spool fluentd output in DIR while fluentd is slow or down");
+  psr.add_option("-D").dest("spool_disk").metavar("INT")
+    .help("Disk budget of spool in MB (default 1024)");
   psr.add_option("-o").dest("output").metavar("STRING")
     .help("Output file path. '-' means stdout");
+  psr.add_option("-J").dest("json").action("store_true")
+    .help("Write output file as JSON lines instead of msgpack");
+  psr.add_option("-Z").dest("file_compress").metavar("STR")
+    .help("Compress output file by 'gzip' or 'zstd' (rotated, see -s)");
+  psr.add_option("-s").dest("rotate_size").metavar("INT")
+    .help("Rotate output file at size in MB (default 256 if -Z or -I)");
+  psr.add_option("-I").dest("rotate_interval").metavar("INT")
+    .help("Rotate output file every INT seconds");
+  psr.add_option("-y").dest("dictionary").metavar("STRING")
+    .help("File path of zstd dictionary for output file");
   psr.add_option("-t").dest("target").metavar("STRING")
     .help("File path of target list");
   psr.add_option("-H").dest("hexdata").action("store_true")
     .help("Enable hex format data log instead of binary data");
+  psr.add_option("-d").dest("decoded").action("store_true")
+    .help("Log decoded HTTP, TLS and SSH client messages instead of raw data");
+  psr.add_option("-p").dest("signature").metavar("STRING")
+    .help("File path of additional protocol signatures");
+  psr.add_option("-R").dest("rule").metavar("STRING")
+    .help("File path of payload tagging rules");
+  psr.add_option("-B").dest("banner").metavar("STRING")
+    .help("File path of server banners sent after handshake (active mode)");
+  psr.add_option("-T").dest("tarpit").action("store_true")
+    .help("Hold connections to targets open with zero window (active mode)");
+  psr.add_option("-q").dest("log_backlog").metavar("INT")
+    .help("Size of log event queue in KB (default 4096)");
+  psr.add_option("-W").dest("log_block").action("store_true")
+    .help("Wait for room in full log event queue instead of dropping");
+  psr.add_option("-x").dest("tx_ring").action("store_true")
+    .help("Send replies through PACKET_TX_RING (active mode, Linux)");
+  psr.add_option("-X").dest("qdisc_bypass").action("store_true")
+    .help("Same as -x, also bypassing qdisc layer");
   
   optparse::Values& opt = psr.parse_args(argc, argv);
   std::vector <std::string> args = psr.args();
@@ -71,16 +109,49 @@ int main(int argc, char *argv[]) {
       lurker->add_target(args[i]);
     }
 
+    if (opt.is_set("signature")) {
+      lurker->import_signature(opt["signature"]);
+    }
+    if (opt.is_set("rule")) {
+      lurker->import_rule(opt["rule"]);
+    }
+    if (opt.is_set("banner")) {
+      lurker->import_banner(opt["banner"]);
+    }
+
     if (!lurker->has_target()) {
       std::cerr << "Warning: No target is configured" << std::endl;
     }
     
     // Configure output
+    if (opt.is_set("spool")) {
+      size_t disk = lurker::SpoolSink::DEFAULT_DISK_BUDGET;
+      if (opt.is_set("spool_disk")) {
+        disk = static_cast<size_t>(opt.get("spool_disk")) << 20;
+      }
+      lurker->set_spool(opt["spool"], lurker::SpoolSink::DEFAULT_MEM_BUDGET,
+                        disk);
+    }
     if (opt.is_set("fluentd")) {
-      lurker->output_to_fluentd(opt["fluentd"]);
+      lurker->output_to_fluentd(opt["fluentd"], opt.get("packed"),
+                                opt["compress"], opt.get("ack"));
     }
     if (opt.is_set("output")) {
-      lurker->output_to_file(opt["output"]);
+      lurker->set_json_output(opt.get("json"));
+      size_t rotate_size = 0;
+      time_t rotate_interval = 0;
+      if (opt.is_set("rotate_size")) {
+        rotate_size = static_cast<size_t>(opt.get("rotate_size")) << 20;
+      } else if (opt.is_set("file_compress") ||
+                 opt.is_set("rotate_interval")) {
+        rotate_size = lurker::RotatingFileSink::DEFAULT_ROTATE_BYTES;
+      }
+      if (opt.is_set("rotate_interval")) {
+        rotate_interval = static_cast<time_t>(opt.get("rotate_interval"));
+      }
+      lurker->output_to_file(opt["output"], opt["file_compress"],
+                             rotate_size, rotate_interval,
+                             opt["dictionary"]);
     }
 
     if (opt.get("hexdata")) {
@@ -88,9 +159,42 @@ int main(int argc, char *argv[]) {
     } else {
       lurker->disable_hexdata_log();
     }
+    if (opt.get("decoded")) {
+      lurker->enable_decoded_log();
+    }
+    if (opt.get("tarpit")) {
+      lurker->enable_tarpit();
+    }
+    if (opt.is_set("log_backlog")) {
+      lurker->set_log_backlog(static_cast<size_t>(opt.get("log_backlog")) *
+                              1024);
+    }
+    if (opt.get("log_block")) {
+      lurker->set_log_blocking(true);
+    }
+    if (opt.get("qdisc_bypass")) {
+      lurker->enable_tx_ring(true);
+    } else if (opt.get("tx_ring")) {
+      lurker->enable_tx_ring();
+    }
     
+    // SIGHUP reloads targets from the command line and target file
+    lurker->enable_reload_signal();
+
     // Start
     lurker->run();
+    if (lurker->tx_drops() > 0) {
+      std::cerr << "Dropped " << lurker->tx_drops()
+                << " replies at full tx ring" << std::endl;
+    }
+    if (lurker->log_drops() > 0) {
+      std::cerr << "Dropped " << lurker->log_drops()
+                << " log events at full queue" << std::endl;
+    }
+    if (lurker->spool_drops() > 0) {
+      std::cerr << "Dropped " << lurker->spool_drops()
+                << " log batches at full spool" << std::endl;
+    }
   } catch (const lurker::Exception &e) {
     std::cerr << e.what() << std::endl;
     return EXIT_FAILURE;
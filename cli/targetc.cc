@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2014 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iostream>
+#include "../src/target.h"
+#include "./optparse.h"
+
+// Compiles target lists into an image file that lurker loads with mmap
+// instead of parsing and compiling them at startup.
+int main(int argc, char *argv[]) {
+  optparse::OptionParser psr = optparse::OptionParser();
+  psr.usage("%prog -o IMAGE [TARGET_FILE ...] [-a TARGET ...]");
+  psr.add_option("-o").dest("output").metavar("STRING")
+    .help("File path of compiled target image");
+  psr.add_option("-a").dest("target").action("append").metavar("STRING")
+    .help("Add a target (e.g. 10.0.0.0/24:80) besides target files");
+
+  optparse::Values& opt = psr.parse_args(argc, argv);
+  std::vector <std::string> args = psr.args();
+
+  if (!opt.is_set("output")) {
+    std::cerr << "Must set '-o' option" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  lurker::TargetSet target;
+  for (size_t i = 0; i < args.size(); i++) {
+    if (!target.import(args[i])) {
+      std::cerr << target.errmsg() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+  const std::list<std::string> &tgt = opt.all("target");
+  for (auto it = tgt.begin(); it != tgt.end(); it++) {
+    if (!target.insert(*it)) {
+      std::cerr << target.errmsg() << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!target.compile() || !target.save(opt["output"])) {
+    std::cerr << target.errmsg() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cerr << "Compiled " << target.count() << " targets into "
+            << opt["output"] << std::endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,314 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include "./debug.h"
+#include "./banner.h"
+#include "./protoid.h"
+#include "./pkt.h"
+
+namespace lurker {
+  static const size_t HDR_LEN = sizeof(struct ether_header) +
+    sizeof(struct ipv4_header) + sizeof(struct tcp_header);
+  static const size_t HDR6_LEN = sizeof(struct ether_header) +
+    sizeof(struct ipv6_header) + sizeof(struct tcp_header);
+
+  BannerHandler::BannerHandler(swarm::Swarm *sw, const TargetSet *target) :
+    sw_(sw), sock_(nullptr), target_(target), cookie_(nullptr), ip_id_(0) {
+    this->pkt_ev_ = this->sw_->lookup_event_id("tcp.packet");
+    this->pkt_hdlr_id_ = this->sw_->set_handler(this->pkt_ev_, this);
+    assert(this->pkt_ev_ != swarm::EV_NULL);
+    assert(this->pkt_hdlr_id_ != swarm::HDLR_NULL);
+
+    this->ether_src_     = this->sw_->lookup_value_id("ether.src");
+    this->ether_dst_     = this->sw_->lookup_value_id("ether.dst");
+    this->ipv4_src_      = this->sw_->lookup_value_id("ipv4.src");
+    this->ipv4_dst_      = this->sw_->lookup_value_id("ipv4.dst");
+    this->ipv4_pl_       = this->sw_->lookup_value_id("ipv4.payload");
+    this->ipv6_src_      = this->sw_->lookup_value_id("ipv6.src");
+    this->ipv6_dst_      = this->sw_->lookup_value_id("ipv6.dst");
+    this->ipv6_pl_       = this->sw_->lookup_value_id("ipv6.payload");
+    this->tcp_src_port_  = this->sw_->lookup_value_id("tcp.src_port");
+    this->tcp_flags_     = this->sw_->lookup_value_id("tcp.flags");
+    this->ssn_to_server_ = this->sw_->lookup_value_id("tcp_ssn.to_server");
+
+    BannerHandler::init_template(&this->ack_, std::string());
+  }
+  BannerHandler::~BannerHandler() {
+    this->sw_->unset_handler(this->pkt_hdlr_id_);
+    for (auto it = this->banner_.begin(); it != this->banner_.end(); it++) {
+      delete it->second;
+    }
+  }
+
+  void BannerHandler::set_sock(RawSock *sock) {
+    this->sock_ = sock;
+  }
+  void BannerHandler::set_syn_cookie(const SynCookie *cookie) {
+    this->cookie_ = cookie;
+  }
+
+  void BannerHandler::init_template(Template *t, const std::string &data) {
+    const size_t seg_len = sizeof(struct tcp_header) + data.length();
+    t->data_len_ = data.length();
+
+    ::memset(t->frame_, 0, sizeof(t->frame_));
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(t->frame_);
+    auto *ipv4_hdr = reinterpret_cast<struct ipv4_header*>(eth_hdr + 1);
+    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>(ipv4_hdr + 1);
+
+    eth_hdr->type_ = htons(ETHERTYPE_IP);
+
+    ipv4_hdr->hdrlen_ = 5;
+    ipv4_hdr->ver_ = 4;
+    ipv4_hdr->total_len_ = htons(sizeof(struct ipv4_header) + seg_len);
+    ipv4_hdr->ttl_ = 64;
+    ipv4_hdr->proto_ = IPPROTO_TCP;
+
+    tcp_hdr->offset_ = sizeof(struct tcp_header) / 4;
+    tcp_hdr->flags_ = data.empty() ? TCP_ACK : (TCP_PUSH | TCP_ACK);
+    tcp_hdr->window_ = htons(14480);
+    ::memcpy(tcp_hdr + 1, data.data(), data.length());
+
+    struct pseudo_ipv4_header pseudo;
+    ::memset(&pseudo, 0, sizeof(pseudo));
+    pseudo.proto_ = IPPROTO_TCP;
+    pseudo.th_off_ = htons(seg_len);
+
+    // Frames are zero-filled after data, so odd length can be rounded up.
+    t->ip_sum_ = chksum_add(0, ipv4_hdr, sizeof(struct ipv4_header));
+    t->tcp_sum_ = chksum_add(chksum_add(0, &pseudo, sizeof(pseudo)),
+                             tcp_hdr, (seg_len + 1) & ~1);
+
+    ::memset(t->frame6_, 0, sizeof(t->frame6_));
+    auto *eth6_hdr = reinterpret_cast<struct ether_header*>(t->frame6_);
+    auto *ipv6_hdr = reinterpret_cast<struct ipv6_header*>(eth6_hdr + 1);
+    auto *tcp6_hdr = reinterpret_cast<struct tcp_header*>(ipv6_hdr + 1);
+
+    eth6_hdr->type_ = htons(ETHERTYPE_IPV6);
+    ipv6_hdr->flags_ = htonl(0x60000000);
+    ipv6_hdr->data_len_ = htons(seg_len);
+    ipv6_hdr->next_hdr_ = IPPROTO_TCP;
+    ipv6_hdr->hop_limit_ = 64;
+    ::memcpy(tcp6_hdr, tcp_hdr, seg_len);
+
+    struct pseudo_ipv6_header pseudo6;
+    ::memset(&pseudo6, 0, sizeof(pseudo6));
+    pseudo6.len_ = htonl(seg_len);
+    pseudo6.next_hdr_ = IPPROTO_TCP;
+    t->tcp6_sum_ = chksum_add(chksum_add(0, &pseudo6, sizeof(pseudo6)),
+                              tcp6_hdr, (seg_len + 1) & ~1);
+  }
+
+  bool BannerHandler::add(int port, const std::string &banner) {
+    if (port <= 0 || port > 0xffff) {
+      this->errmsg_ = "invalid banner port";
+      return false;
+    }
+    if (banner.length() > BANNER_MAX) {
+      this->errmsg_ = "too long banner";
+      return false;
+    }
+
+    auto it = this->banner_.find(port);
+    Template *t = (it != this->banner_.end()) ? it->second : new Template;
+    BannerHandler::init_template(t, banner);
+    this->banner_[port] = t;
+    return true;
+  }
+
+  bool BannerHandler::load(const std::string &fpath) {
+    std::ifstream ifs(fpath);
+    if (ifs.fail()) {
+      this->errmsg_ = "can not open banner file: " + fpath;
+      return false;
+    }
+
+    std::string line;
+    size_t lineno = 0;
+    while (getline(ifs, line)) {
+      lineno++;
+      size_t s = line.find_first_not_of(" \t");
+      if (s == std::string::npos || line[s] == '#') {
+        continue;
+      }
+
+      std::stringstream ss(line);
+      std::string port;
+      ss >> port;
+      size_t q1 = line.find('"');
+      size_t q2 = line.rfind('"');
+      std::string banner;
+      char *e;
+      long n = strtol(port.c_str(), &e, 10);
+
+      if (port.empty() || *e != '\0' || q1 == std::string::npos ||
+          q1 == q2 ||
+          !unescape_pattern(line.substr(q1 + 1, q2 - q1 - 1), &banner)) {
+        std::stringstream es;
+        es << "invalid banner at " << fpath << ":" << lineno;
+        this->errmsg_ = es.str();
+        return false;
+      }
+
+      if (!this->add(static_cast<int>(n), banner)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  void BannerHandler::reply(Template *t, const swarm::Property &p,
+                            uint32_t seq, uint32_t ack) {
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(t->frame_);
+    auto *ipv4_hdr = reinterpret_cast<struct ipv4_header*>(eth_hdr + 1);
+    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>(ipv4_hdr + 1);
+
+    ::memcpy(eth_hdr->src_, p.value(this->ether_dst_).ptr(), ETHER_ADDR_LEN);
+    ::memcpy(eth_hdr->dst_, p.value(this->ether_src_).ptr(), ETHER_ADDR_LEN);
+    ::memcpy(&ipv4_hdr->src_, p.value(this->ipv4_dst_).ptr(), IPV4_ADDR_LEN);
+    ::memcpy(&ipv4_hdr->dst_, p.value(this->ipv4_src_).ptr(), IPV4_ADDR_LEN);
+    ipv4_hdr->id_ = htons(this->ip_id_++);
+
+    uint16_t src_port = htons(p.dst_port()), dst_port = htons(p.src_port());
+    tcp_hdr->src_port_ = src_port;
+    tcp_hdr->dst_port_ = dst_port;
+    tcp_hdr->seq_ = htonl(seq);
+    tcp_hdr->ack_ = htonl(ack);
+
+    uint32_t addr_sum = chksum_add(0, &ipv4_hdr->src_, 2 * IPV4_ADDR_LEN);
+    ipv4_hdr->chksum_ = chksum_fold(t->ip_sum_ + addr_sum + ipv4_hdr->id_);
+    uint32_t tcp_sum = chksum_add(t->tcp_sum_ + addr_sum, &tcp_hdr->src_port_,
+                                  sizeof(tcp_hdr->src_port_) +
+                                  sizeof(tcp_hdr->dst_port_) +
+                                  sizeof(tcp_hdr->seq_) +
+                                  sizeof(tcp_hdr->ack_));
+    tcp_hdr->chksum_ = chksum_fold(tcp_sum);
+
+    if (0 > this->sock_->enqueue(t->frame_, HDR_LEN + t->data_len_)) {
+      debug(DBG, "banner reply error: %s", this->sock_->errmsg().c_str());
+    }
+  }
+
+  void BannerHandler::reply6(Template *t, const swarm::Property &p,
+                             uint32_t seq, uint32_t ack) {
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(t->frame6_);
+    auto *ipv6_hdr = reinterpret_cast<struct ipv6_header*>(eth_hdr + 1);
+    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>(ipv6_hdr + 1);
+
+    ::memcpy(eth_hdr->src_, p.value(this->ether_dst_).ptr(), ETHER_ADDR_LEN);
+    ::memcpy(eth_hdr->dst_, p.value(this->ether_src_).ptr(), ETHER_ADDR_LEN);
+    ::memcpy(ipv6_hdr->src_, p.value(this->ipv6_dst_).ptr(), IPV6_ADDR_LEN);
+    ::memcpy(ipv6_hdr->dst_, p.value(this->ipv6_src_).ptr(), IPV6_ADDR_LEN);
+
+    uint16_t src_port = htons(p.dst_port()), dst_port = htons(p.src_port());
+    tcp_hdr->src_port_ = src_port;
+    tcp_hdr->dst_port_ = dst_port;
+    tcp_hdr->seq_ = htonl(seq);
+    tcp_hdr->ack_ = htonl(ack);
+
+    uint32_t tcp_sum = chksum_add(t->tcp6_sum_, ipv6_hdr->src_,
+                                  2 * IPV6_ADDR_LEN);
+    tcp_sum = chksum_add(tcp_sum, &tcp_hdr->src_port_,
+                         sizeof(tcp_hdr->src_port_) +
+                         sizeof(tcp_hdr->dst_port_) +
+                         sizeof(tcp_hdr->seq_) + sizeof(tcp_hdr->ack_));
+    tcp_hdr->chksum_ = chksum_fold(tcp_sum);
+
+    if (0 > this->sock_->enqueue(t->frame6_, HDR6_LEN + t->data_len_)) {
+      debug(DBG, "banner reply error: %s", this->sock_->errmsg().c_str());
+    }
+  }
+
+  void BannerHandler::recv(swarm::ev_id eid, const swarm::Property &p) {
+    if (this->sock_ == nullptr || this->cookie_ == nullptr) {
+      return;
+    }
+
+    auto it = this->banner_.find(p.dst_port());
+    if (it == this->banner_.end()) {
+      return;
+    }
+
+    // Only segments of a session that tcp_ssn admitted, i.e. whose
+    // handshake carried our cookie, are answered.
+    const swarm::Value &to_server = p.value(this->ssn_to_server_);
+    if (to_server.is_null() || !to_server.uint32() ||
+        !this->target_->has_dst(p)) {
+      return;
+    }
+
+    // Data length is taken from IP payload length, not captured length,
+    // because short frames may have ethernet padding. IPv6 payload may
+    // also have extension headers before TCP header.
+    const bool v6 = p.value(this->ipv4_pl_).is_null();
+    size_t pl_len;
+    const uint8_t *pl = p.value(v6 ? this->ipv6_pl_ : this->ipv4_pl_)
+      .ptr(&pl_len);
+    const uint8_t *seg = p.value(this->tcp_src_port_).ptr();
+    if (pl == nullptr || seg == nullptr || seg < pl ||
+        seg + sizeof(struct tcp_header) > pl + pl_len) {
+      return;
+    }
+    auto *hdr = reinterpret_cast<const struct tcp_header*>(seg);
+    size_t hdr_len = hdr->offset_ * 4;
+    size_t seg_len = pl + pl_len - seg;
+    uint8_t flags = p.value(this->tcp_flags_).uint32();
+    if (hdr_len > seg_len || (flags & (TCP_SYN | TCP_RST)) ||
+        !(flags & TCP_ACK)) {
+      return;
+    }
+
+    size_t data_len = seg_len - hdr_len;
+    uint32_t seq = ntohl(hdr->seq_);
+    uint32_t ack = ntohl(hdr->ack_);
+    uint32_t next = seq + data_len + ((flags & TCP_FIN) ? 1 : 0);
+    Template *t = nullptr;
+
+    if (this->cookie_->check(p)) {
+      // Client has not acknowledged anything after SYN-ACK yet: (re)send
+      // the banner right after our ISN.
+      if (it->second->data_len_ > 0 || next != seq) {
+        debug(DBG, "banner to %s:%d", p.src_addr().c_str(), p.src_port());
+        t = it->second;
+      }
+    } else if (next != seq) {
+      t = &this->ack_;
+    }
+
+    if (t) {
+      if (v6) {
+        this->reply6(t, p, ack, next);
+      } else {
+        this->reply(t, p, ack, next);
+      }
+    }
+  }
+}
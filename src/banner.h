@@ -0,0 +1,99 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_BANNER_H__
+#define SRC_BANNER_H__
+
+#include <map>
+#include <string>
+#include "./swarm/swarm.h"
+#include "./rawsock.h"
+#include "./target.h"
+#include "./syncookie.h"
+
+namespace lurker {
+  // ----------------------------------------------------------------
+  // class BannerHandler:
+  // Emulates the first message of servers that speak first (SSH, SMTP,
+  // FTP, ...) so that scanners waiting for a banner go on to send their
+  // payload. After a handshake validated by SynCookie, the banner of
+  // the port is sent, and client segments are acknowledged. Sequence
+  // and ack numbers are derived from the client's segment only, so no
+  // state is kept per connection: memory is one frame template per
+  // configured port.
+  //
+  class BannerHandler : public swarm::Handler {
+  public:
+    static const size_t BANNER_MAX = 1024;
+
+  private:
+    static const bool DBG = false;
+    struct Template {
+      uint8_t frame_[14 + 20 + 20 + BANNER_MAX];   // Ethernet, IPv4, TCP
+      uint8_t frame6_[14 + 40 + 20 + BANNER_MAX];  // Ethernet, IPv6, TCP
+      size_t data_len_;
+      uint32_t ip_sum_;    // partial sum of IPv4 header
+      uint32_t tcp_sum_;   // partial sum of pseudo header, TCP header, data
+      uint32_t tcp6_sum_;
+    };
+
+    swarm::Swarm *sw_;
+    swarm::ev_id pkt_ev_;
+    swarm::hdlr_id pkt_hdlr_id_;
+    swarm::val_id ether_src_, ether_dst_, ipv4_src_, ipv4_dst_, ipv4_pl_,
+      ipv6_src_, ipv6_dst_, ipv6_pl_, tcp_src_port_, tcp_flags_,
+      ssn_to_server_;
+
+    RawSock *sock_;
+    const TargetSet *target_;
+    const SynCookie *cookie_;
+    std::map<int, Template*> banner_;
+    Template ack_;
+    uint16_t ip_id_;
+    std::string errmsg_;
+
+    static void init_template(Template *t, const std::string &data);
+    void reply(Template *t, const swarm::Property &p, uint32_t seq,
+               uint32_t ack);
+    void reply6(Template *t, const swarm::Property &p, uint32_t seq,
+                uint32_t ack);
+
+  public:
+    BannerHandler(swarm::Swarm *sw, const TargetSet *target);
+    ~BannerHandler();
+    void set_sock(RawSock *sock);
+    void set_syn_cookie(const SynCookie *cookie);
+    // Empty banner means only acknowledging client data on the port.
+    bool add(int port, const std::string &banner);
+    // Lines of <port> "<banner>", banner may have escapes (e.g. \r\n).
+    bool load(const std::string &fpath);
+    size_t size() const { return this->banner_.size(); }
+    const std::string &errmsg() const { return this->errmsg_; }
+    void recv(swarm::ev_id eid, const swarm::Property &p);
+  };
+}
+
+#endif  // SRC_BANNER_H__
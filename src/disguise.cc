@@ -0,0 +1,169 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <assert.h>
+#include "./disguise.h"
+
+namespace lurker {
+  DisguiseTable::DisguiseTable(size_t capacity) :
+    free_(NIL), count_(0), tick_(0) {
+    assert(capacity > 0 && capacity < NIL);
+    assert(CLAIM_TIMEOUT < static_cast<time_t>(WHEEL_SIZE));
+    size_t n = 1;
+    while (n < capacity) {
+      n <<= 1;
+    }
+    this->bucket_.assign(n, static_cast<uint32_t>(NIL));
+
+    this->entry_.resize(capacity);
+    for (size_t i = capacity; i > 0; i--) {
+      Entry &e = this->entry_[i - 1];
+      e.stat_ = FREE;
+      e.hnext_ = this->free_;
+      e.wnext_ = NIL;
+      this->free_ = i - 1;
+    }
+    for (size_t i = 0; i < WHEEL_SIZE; i++) {
+      this->wheel_[i] = NIL;
+    }
+  }
+  DisguiseTable::~DisguiseTable() {
+  }
+
+  uint32_t DisguiseTable::addr_hash(uint32_t addr) {
+    return static_cast<uint32_t>((addr * 0x9e3779b97f4a7c15ULL) >> 32);
+  }
+
+  uint32_t DisguiseTable::lookup(uint32_t addr) const {
+    uint32_t h = DisguiseTable::addr_hash(addr) & (this->bucket_.size() - 1);
+    for (uint32_t i = this->bucket_[h]; i != NIL;
+         i = this->entry_[i].hnext_) {
+      if (this->entry_[i].addr_ == addr) {
+        return i;
+      }
+    }
+    return NIL;
+  }
+
+  void DisguiseTable::unlink(uint32_t idx) {
+    Entry &e = this->entry_[idx];
+    uint32_t h = DisguiseTable::addr_hash(e.addr_) &
+      (this->bucket_.size() - 1);
+    uint32_t *p = &this->bucket_[h];
+    while (*p != idx) {
+      assert(*p != NIL);
+      p = &this->entry_[*p].hnext_;
+    }
+    *p = e.hnext_;
+    e.hnext_ = NIL;
+  }
+
+  void DisguiseTable::schedule(uint32_t idx, time_t expire) {
+    Entry &e = this->entry_[idx];
+    size_t slot = expire % WHEEL_SIZE;
+    e.expire_ = static_cast<uint32_t>(expire);
+    e.wnext_ = this->wheel_[slot];
+    this->wheel_[slot] = idx;
+  }
+
+  void DisguiseTable::tick(time_t now) {
+    if (this->tick_ == 0 || now < this->tick_) {
+      this->tick_ = now;
+      return;
+    }
+
+    // After a long gap each slot needs to be visited only once; every
+    // record in the wheel expires within WHEEL_SIZE seconds.
+    size_t n = 0;
+    while (this->tick_ < now && n < WHEEL_SIZE) {
+      this->tick_++;
+      n++;
+      size_t slot = this->tick_ % WHEEL_SIZE;
+      uint32_t idx = this->wheel_[slot];
+      this->wheel_[slot] = NIL;
+      while (idx != NIL) {
+        Entry &e = this->entry_[idx];
+        uint32_t next = e.wnext_;
+        e.wnext_ = NIL;
+        if (e.stat_ == PROBING && e.asked_) {
+          e.stat_ = CLAIMED;
+          this->schedule(idx, e.expire_ + CLAIM_TIMEOUT);
+        } else {
+          if (e.stat_ != GONE) {
+            this->unlink(idx);
+          }
+          e.stat_ = FREE;
+          e.hnext_ = this->free_;
+          this->free_ = idx;
+          this->count_--;
+        }
+        idx = next;
+      }
+    }
+    this->tick_ = now;
+  }
+
+  DisguiseTable::State DisguiseTable::ask(uint32_t addr) {
+    uint32_t idx = this->lookup(addr);
+    if (idx == NIL) {
+      return FREE;
+    }
+    Entry &e = this->entry_[idx];
+    e.asked_ = true;
+    return e.stat_;
+  }
+
+  bool DisguiseTable::probe(uint32_t addr, time_t now) {
+    if (this->free_ == NIL || this->lookup(addr) != NIL) {
+      return false;
+    }
+
+    uint32_t idx = this->free_;
+    Entry &e = this->entry_[idx];
+    this->free_ = e.hnext_;
+    e.addr_ = addr;
+    e.stat_ = PROBING;
+    e.asked_ = false;
+
+    uint32_t h = DisguiseTable::addr_hash(addr) & (this->bucket_.size() - 1);
+    e.hnext_ = this->bucket_[h];
+    this->bucket_[h] = idx;
+    this->schedule(idx, now + PROBE_TIMEOUT);
+    this->count_++;
+    return true;
+  }
+
+  bool DisguiseTable::remove(uint32_t addr) {
+    uint32_t idx = this->lookup(addr);
+    if (idx == NIL) {
+      return false;
+    }
+    // The record stays in its wheel slot until it fires.
+    this->unlink(idx);
+    this->entry_[idx].stat_ = GONE;
+    return true;
+  }
+}
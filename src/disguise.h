@@ -0,0 +1,104 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_DISGUISE_H__
+#define SRC_DISGUISE_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+
+namespace lurker {
+  // ----------------------------------------------------------------
+  // class DisguiseTable:
+  // IPv4 addresses that DynamicSpoofer answers ARP for, keyed by binary
+  // address (network byte order). An address is probed with our own ARP
+  // request first and answered while the probe gets no reply. If the
+  // owner stays silent through the probe window and someone asked for
+  // the address meanwhile, it is claimed for a longer period before
+  // being probed again.
+  //
+  // Records are preallocated, so no memory is allocated per packet.
+  // Expiry is driven by packet time through a timer wheel of one second
+  // slots; records removed before expiry are reclaimed by their slot.
+  //
+  class DisguiseTable {
+  public:
+    static const size_t DEFAULT_CAPACITY = 1 << 16;
+    static const time_t PROBE_TIMEOUT = 5;
+    static const time_t CLAIM_TIMEOUT = 60;
+
+    enum State : uint8_t {
+      FREE = 0,
+      PROBING,   // our ARP request is out, owner has not replied
+      CLAIMED,   // owner stayed silent through probing
+      GONE,      // removed, released when taken out of the wheel
+    };
+
+  private:
+    static const size_t WHEEL_SIZE = 64;
+    static const uint32_t NIL = 0xffffffff;
+
+    struct Entry {
+      uint32_t addr_;
+      uint32_t expire_;     // packet time
+      uint32_t hnext_;      // hash chain or free list
+      uint32_t wnext_;      // timer wheel slot list
+      State stat_;
+      bool asked_;          // requested by someone while probing
+    };
+
+    std::vector<Entry> entry_;
+    std::vector<uint32_t> bucket_;
+    uint32_t free_;
+    size_t count_;
+    uint32_t wheel_[WHEEL_SIZE];
+    time_t tick_;
+
+    static uint32_t addr_hash(uint32_t addr);
+    uint32_t lookup(uint32_t addr) const;
+    void unlink(uint32_t idx);
+    void schedule(uint32_t idx, time_t expire);
+
+  public:
+    explicit DisguiseTable(size_t capacity = DEFAULT_CAPACITY);
+    ~DisguiseTable();
+    // Advances the wheel to packet time, expiring records on the way.
+    void tick(time_t now);
+    // Returns PROBING or CLAIMED if ARP for the address should be
+    // answered, and notes the request; FREE otherwise.
+    State ask(uint32_t addr);
+    // Registers an address just probed. Fails if it is already known or
+    // the table is full.
+    bool probe(uint32_t addr, time_t now);
+    // Drops an address whose owner showed up. Returns false if unknown.
+    bool remove(uint32_t addr);
+    size_t count() const { return this->count_; }
+    size_t capacity() const { return this->entry_.size(); }
+  };
+}
+
+#endif  // SRC_DISGUISE_H__
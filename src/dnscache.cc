@@ -0,0 +1,238 @@
+/*-
+ * Copyright (c) 2013-2014 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "./dnscache.h"
+#include "./debug.h"
+#include "./swarm/proto/decode_name_service.h"
+
+namespace lurker {
+  DnsCache::DnsCache(size_t capacity) : count_(0) {
+    this->bucket_size_ = (capacity + WAYS - 1) / WAYS;
+    if (this->bucket_size_ == 0) {
+      this->bucket_size_ = 1;
+    }
+    this->table_.resize(this->bucket_size_ * WAYS);
+    ::memset(&this->table_[0], 0, sizeof(Entry) * this->table_.size());
+  }
+  DnsCache::~DnsCache() {
+  }
+
+  uint64_t DnsCache::hash(const void *addr, size_t len) {
+    // FNV-1a
+    const uint8_t *p = static_cast<const uint8_t*>(addr);
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+      h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    return h;
+  }
+
+  DnsCache::Entry *DnsCache::find(const void *addr, size_t len) {
+    const DnsCache *self = this;
+    return const_cast<Entry*>(self->find(addr, len));
+  }
+  const DnsCache::Entry *DnsCache::find(const void *addr, size_t len) const {
+    const size_t b = (hash(addr, len) % this->bucket_size_) * WAYS;
+    for (size_t i = b; i < b + WAYS; i++) {
+      const Entry &e = this->table_[i];
+      if (e.addr_len_ == len && 0 == ::memcmp(e.addr_, addr, len)) {
+        return &e;
+      }
+    }
+    return nullptr;
+  }
+
+  void DnsCache::insert(const void *addr, size_t addr_len, const char *name,
+                        size_t name_len, time_t ts, uint32_t ttl) {
+    if ((addr_len != 4 && addr_len != 16) || name_len == 0) {
+      return;
+    }
+
+    // Trailing dot of FQDN is not needed for log.
+    if (name[name_len - 1] == '.' && name_len > 1) {
+      name_len--;
+    }
+    if (name_len >= NAME_LEN) {
+      name_len = NAME_LEN - 1;
+    }
+
+    ttl = (ttl < MIN_TTL) ? MIN_TTL : ((ttl > MAX_TTL) ? MAX_TTL : ttl);
+
+    Entry *e = this->find(addr, addr_len);
+    if (e == nullptr) {
+      // Take empty way first, then the least recently updated one.
+      const size_t b = (hash(addr, addr_len) % this->bucket_size_) * WAYS;
+      e = &this->table_[b];
+      for (size_t i = b; i < b + WAYS; i++) {
+        Entry *c = &this->table_[i];
+        if (c->addr_len_ == 0) {
+          e = c;
+          this->count_++;
+          break;
+        }
+        if (c->last_ < e->last_) {
+          e = c;
+        }
+      }
+
+      ::memset(e, 0, sizeof(Entry));
+      ::memcpy(e->addr_, addr, addr_len);
+      e->addr_len_ = addr_len;
+    }
+
+    // Update the same name or replace the oldest one.
+    Name *n = &e->name_[0];
+    for (size_t i = 0; i < NAME_PER_ADDR; i++) {
+      Name *c = &e->name_[i];
+      if (c->len_ == name_len && 0 == ::memcmp(c->data_, name, name_len)) {
+        n = c;
+        break;
+      }
+      if (c->expire_ < n->expire_) {
+        n = c;
+      }
+    }
+
+    ::memcpy(n->data_, name, name_len);
+    n->len_ = name_len;
+    n->expire_ = ts + ttl;
+    e->last_ = ts;
+  }
+
+  size_t DnsCache::lookup(const void *addr, size_t addr_len, time_t ts,
+                          char *buf, size_t buf_len) const {
+    const Entry *e = this->find(addr, addr_len);
+    if (e == nullptr) {
+      return 0;
+    }
+
+    size_t w = 0;
+    for (size_t i = 0; i < NAME_PER_ADDR; i++) {
+      const Name &n = e->name_[i];
+      if (n.len_ == 0 || n.expire_ < ts) {
+        continue;
+      }
+      const size_t sep = (w > 0) ? 1 : 0;
+      if (w + sep + n.len_ > buf_len) {
+        break;
+      }
+      if (sep) {
+        buf[w++] = ',';
+      }
+      ::memcpy(buf + w, n.data_, n.len_);
+      w += n.len_;
+    }
+
+    return w;
+  }
+
+
+  DnsCacheHandler::DnsCacheHandler(swarm::Swarm *sw, DnsCache *cache) :
+    sw_(sw), cache_(cache) {
+    static const char *proto[] = {"dns", "mdns", "llmnr"};
+
+    for (size_t i = 0; i < sizeof(proto) / sizeof(proto[0]); i++) {
+      const std::string bn(proto[i]);
+      Source src;
+      src.ev_ = this->sw_->lookup_event_id(bn + ".an");
+      if (src.ev_ == swarm::EV_NULL) {
+        continue;
+      }
+
+      src.hdlr_ = this->sw_->set_handler(src.ev_, this);
+      src.qd_name_ = this->sw_->lookup_value_id(bn + ".qd_name");
+      src.an_name_ = this->sw_->lookup_value_id(bn + ".an_name");
+      src.an_data_ = this->sw_->lookup_value_id(bn + ".an_data");
+      src.an_ttl_  = this->sw_->lookup_value_id(bn + ".an_ttl");
+      assert(src.hdlr_ != swarm::HDLR_NULL);
+      this->src_.push_back(src);
+    }
+  }
+  DnsCacheHandler::~DnsCacheHandler() {
+    for (size_t i = 0; i < this->src_.size(); i++) {
+      this->sw_->unset_handler(this->src_[i].hdlr_);
+    }
+  }
+
+  void DnsCacheHandler::recv(swarm::ev_id eid, const swarm::Property &p) {
+    typedef swarm::NameServiceDecoder NSD;
+
+    const Source *src = nullptr;
+    for (size_t i = 0; i < this->src_.size(); i++) {
+      if (this->src_[i].ev_ == eid) {
+        src = &this->src_[i];
+        break;
+      }
+    }
+    if (src == nullptr) {
+      return;
+    }
+
+    // Names of A/AAAA answers are chained by CNAME, then question name is
+    // the name that client actually resolved.
+    const char *qname = nullptr;
+    size_t qname_len = 0;
+    const swarm::Value &qv = p.value(src->qd_name_);
+    if (!qv.is_null()) {
+      qname = static_cast<const NSD::VarNameServiceName&>(qv).name(&qname_len);
+    }
+
+    const size_t n = p.value_size(src->an_data_);
+    for (size_t i = 0; i < n; i++) {
+      const swarm::Value &dv = p.value(src->an_data_, i);
+      if (dv.is_null()) {
+        continue;
+      }
+
+      const NSD::VarNameServiceData &data =
+        static_cast<const NSD::VarNameServiceData&>(dv);
+      size_t addr_len;
+      void *addr = data.ptr(&addr_len);
+      if (!((data.type() == 1 && addr_len == 4) ||     // A
+            (data.type() == 28 && addr_len == 16))) {  // AAAA
+        continue;
+      }
+
+      // Fall back to owner name of the record (e.g. mDNS announcement).
+      const char *name = qname;
+      size_t name_len = qname_len;
+      if (name == nullptr) {
+        const swarm::Value &nv = p.value(src->an_name_, i);
+        if (nv.is_null() ||
+            nullptr == (name = static_cast<const NSD::VarNameServiceName&>
+                        (nv).name(&name_len))) {
+          continue;
+        }
+      }
+
+      uint32_t ttl = p.value(src->an_ttl_, i).uint32();
+      this->cache_->insert(addr, addr_len, name, name_len, p.tv_sec(), ttl);
+      debug(false, "cached: %.*s (ttl:%u)", static_cast<int>(name_len),
+            name, ttl);
+    }
+  }
+}
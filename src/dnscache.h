@@ -0,0 +1,102 @@
+/*-
+ * Copyright (c) 2013-2014 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_DNSCACHE_H__
+#define SRC_DNSCACHE_H__
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include "./swarm/swarm.h"
+
+namespace lurker {
+  // Passive DNS cache: IP address -> recently resolved names. It is filled
+  // only by DNS/mDNS/LLMNR answers observed on the wire and never sends any
+  // query. The table is set-associative and allocated once, so both insert
+  // and lookup cost O(1) and memory is bounded by capacity.
+  class DnsCache {
+  public:
+    static const size_t NAME_LEN = 256;
+    static const size_t NAME_PER_ADDR = 3;
+    static const size_t WAYS = 4;
+    static const size_t DEFAULT_CAPACITY = 8192;
+    static const uint32_t MIN_TTL = 30;
+    static const uint32_t MAX_TTL = 86400;
+
+  private:
+    struct Name {
+      time_t expire_;
+      uint16_t len_;
+      char data_[NAME_LEN];
+    };
+    struct Entry {
+      uint8_t addr_[16];
+      uint8_t addr_len_;
+      time_t last_;
+      Name name_[NAME_PER_ADDR];
+    };
+
+    std::vector<Entry> table_;
+    size_t bucket_size_;
+    size_t count_;
+
+    static uint64_t hash(const void *addr, size_t len);
+    Entry *find(const void *addr, size_t len);
+    const Entry *find(const void *addr, size_t len) const;
+
+  public:
+    explicit DnsCache(size_t capacity = DEFAULT_CAPACITY);
+    ~DnsCache();
+    void insert(const void *addr, size_t addr_len, const char *name,
+                size_t name_len, time_t ts, uint32_t ttl);
+    // Write names of addr that are not expired at ts into buf as comma
+    // separated string. Returns written length, 0 if no name is found.
+    size_t lookup(const void *addr, size_t addr_len, time_t ts,
+                  char *buf, size_t buf_len) const;
+    size_t count() const { return this->count_; }
+  };
+
+  // Handler to feed answer records of name service decoders to DnsCache.
+  class DnsCacheHandler : public swarm::Handler {
+  private:
+    struct Source {
+      swarm::ev_id ev_;
+      swarm::hdlr_id hdlr_;
+      swarm::val_id qd_name_, an_name_, an_data_, an_ttl_;
+    };
+    swarm::Swarm *sw_;
+    DnsCache *cache_;
+    std::vector<Source> src_;
+
+  public:
+    DnsCacheHandler(swarm::Swarm *sw, DnsCache *cache);
+    ~DnsCacheHandler();
+    void recv(swarm::ev_id eid, const swarm::Property &p);
+  };
+}
+
+
+#endif  // SRC_DNSCACHE_H__
@@ -0,0 +1,623 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <algorithm>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "./encoder.h"
+#include "./swarm/utils/hex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define JSON_HAS_SSE2_PATH
+#endif
+
+namespace lurker {
+  Encoder::Encoder() : size_(0), ref_min_(REF_MIN) {
+    this->buf_.reserve(1 << 16);
+  }
+  Encoder::~Encoder() {
+  }
+
+  char *Encoder::reserve(size_t len) {
+    size_t off = this->buf_.size();
+    this->buf_.resize(off + len);
+    // Extend the last piece if it ends at the end of buffer.
+    if (!this->piece_.empty() && this->piece_.back().ext_ == nullptr &&
+        this->piece_.back().off_ + this->piece_.back().len_ == off) {
+      this->piece_.back().len_ += len;
+    } else {
+      Piece pc = {nullptr, off, len};
+      this->piece_.push_back(pc);
+    }
+    this->size_ += len;
+    return reinterpret_cast<char*>(this->buf_.data() + off);
+  }
+
+  void Encoder::put(const void *ptr, size_t len) {
+    if (len > 0) {
+      memcpy(this->reserve(len), ptr, len);
+    }
+  }
+
+  void Encoder::put(uint8_t c) {
+    *this->reserve(1) = c;
+  }
+
+  void Encoder::ref(const void *ptr, size_t len) {
+    if (len < this->ref_min_) {
+      this->put(ptr, len);
+    } else {
+      Piece pc = {static_cast<const uint8_t*>(ptr), 0, len};
+      this->piece_.push_back(pc);
+      this->size_ += len;
+    }
+  }
+
+  int Encoder::iovec(const struct iovec **iov) {
+    // Buffer may have moved while growing, so addresses are taken here.
+    this->iov_.resize(this->piece_.size());
+    for (size_t i = 0; i < this->piece_.size(); i++) {
+      const Piece &pc = this->piece_[i];
+      const uint8_t *base = pc.ext_ ? pc.ext_ : &this->buf_[pc.off_];
+      this->iov_[i].iov_base = const_cast<uint8_t*>(base);
+      this->iov_[i].iov_len = pc.len_;
+    }
+    *iov = this->iov_.data();
+    return this->iov_.size();
+  }
+
+  void Encoder::clear() {
+    this->buf_.clear();
+    this->piece_.clear();
+    this->chunk_.clear();
+    this->size_ = 0;
+  }
+
+
+  static bool field_less(const EventField &a, const EventField &b) {
+    // Same order as std::string.
+    int r = memcmp(a.key_, b.key_, std::min(a.key_len_, b.key_len_));
+    return (r < 0 || (r == 0 && a.key_len_ < b.key_len_));
+  }
+
+  MsgpackEncoder::MsgpackEncoder(bool entry) : entry_(entry) {
+  }
+
+  void MsgpackEncoder::put_str_hdr(size_t len) {
+    uint8_t h[5];
+    if (len < 32) {
+      this->put(static_cast<uint8_t>(0xa0 | len));
+    } else if (len < 0x100) {
+      h[0] = 0xd9;
+      h[1] = len;
+      this->put(h, 2);
+    } else if (len < 0x10000) {
+      h[0] = 0xda;
+      h[1] = len >> 8;
+      h[2] = len;
+      this->put(h, 3);
+    } else {
+      h[0] = 0xdb;
+      h[1] = len >> 24;
+      h[2] = len >> 16;
+      h[3] = len >> 8;
+      h[4] = len;
+      this->put(h, 5);
+    }
+  }
+
+  void MsgpackEncoder::put_bin_hdr(size_t len) {
+    uint8_t h[5];
+    if (len < 0x100) {
+      h[0] = 0xc4;
+      h[1] = len;
+      this->put(h, 2);
+    } else if (len < 0x10000) {
+      h[0] = 0xc5;
+      h[1] = len >> 8;
+      h[2] = len;
+      this->put(h, 3);
+    } else {
+      h[0] = 0xc6;
+      h[1] = len >> 24;
+      h[2] = len >> 16;
+      h[3] = len >> 8;
+      h[4] = len;
+      this->put(h, 5);
+    }
+  }
+
+  void MsgpackEncoder::put_uint(uint64_t v) {
+    uint8_t h[9];
+    size_t n;
+    if (v < 0x80) {
+      this->put(static_cast<uint8_t>(v));
+      return;
+    } else if (v < 0x100) {
+      h[0] = 0xcc;
+      n = 1;
+    } else if (v < 0x10000) {
+      h[0] = 0xcd;
+      n = 2;
+    } else if (v < 0x100000000ULL) {
+      h[0] = 0xce;
+      n = 4;
+    } else {
+      h[0] = 0xcf;
+      n = 8;
+    }
+    for (size_t i = 0; i < n; i++) {
+      h[n - i] = v >> (i * 8);
+    }
+    this->put(h, n + 1);
+  }
+
+  void MsgpackEncoder::put_int(int64_t v) {
+    if (v >= 0) {
+      this->put_uint(v);
+      return;
+    }
+    uint8_t h[9];
+    size_t n;
+    if (v >= -32) {
+      this->put(static_cast<uint8_t>(v));
+      return;
+    } else if (v >= -0x80) {
+      h[0] = 0xd0;
+      n = 1;
+    } else if (v >= -0x8000) {
+      h[0] = 0xd1;
+      n = 2;
+    } else if (v >= -0x80000000LL) {
+      h[0] = 0xd2;
+      n = 4;
+    } else {
+      h[0] = 0xd3;
+      n = 8;
+    }
+    uint64_t u = v;
+    for (size_t i = 0; i < n; i++) {
+      h[n - i] = u >> (i * 8);
+    }
+    this->put(h, n + 1);
+  }
+
+  void MsgpackEncoder::encode(const uint8_t *rec, size_t len) {
+    EventReader rd(rec, len);
+    this->field_.clear();
+    EventField f;
+    while (rd.next(&f)) {
+      this->field_.push_back(f);
+    }
+    std::stable_sort(this->field_.begin(), this->field_.end(), field_less);
+
+    if (this->entry_) {
+      this->put(static_cast<uint8_t>(0x92));
+    } else {
+      size_t tag_len;
+      const char *tag = rd.tag(&tag_len);
+      this->put(static_cast<uint8_t>(0x93));
+      this->put_str_hdr(tag_len);
+      this->put(tag, tag_len);
+    }
+    this->put_uint(rd.ts() != 0 ? rd.ts() : time(nullptr));
+
+    size_t n = this->field_.size();
+    if (n < 16) {
+      this->put(static_cast<uint8_t>(0x80 | n));
+    } else {
+      uint8_t h[3] = {0xde, static_cast<uint8_t>(n >> 8),
+                      static_cast<uint8_t>(n)};
+      this->put(h, sizeof(h));
+    }
+
+    char buf[EventReader::TEXT_LEN];
+    for (size_t i = 0; i < n; i++) {
+      const EventField &fd = this->field_[i];
+      this->put_str_hdr(fd.key_len_);
+      this->put(fd.key_, fd.key_len_);
+
+      switch (fd.type_) {
+      case Event::STR:
+        this->put_str_hdr(fd.val_len_);
+        this->ref(fd.val_, fd.val_len_);
+        break;
+      case Event::INT: {
+        int64_t v;
+        memcpy(&v, fd.val_, sizeof(v));
+        this->put_int(v);
+        break;
+      }
+      case Event::UINT: {
+        uint64_t v;
+        memcpy(&v, fd.val_, sizeof(v));
+        this->put_uint(v);
+        break;
+      }
+      case Event::BOOL:
+        this->put(static_cast<uint8_t>(fd.val_[0] ? 0xc3 : 0xc2));
+        break;
+      case Event::ADDR:
+      case Event::MAC:
+      case Event::HASH: {
+        size_t text_len = EventReader::text(fd, buf);
+        this->put_str_hdr(text_len);
+        this->put(buf, text_len);
+        break;
+      }
+      case Event::HEX:
+        this->put_str_hdr(fd.val_len_ * 2);
+        swarm::hex_encode(fd.val_, fd.val_len_,
+                          this->reserve(fd.val_len_ * 2));
+        break;
+      }
+    }
+  }
+
+
+  PackedForwardEncoder::PackedForwardEncoder(Compress compress, bool ack) :
+    compress_(compress), ack_(ack), flush_bytes_(DEFAULT_FLUSH_BYTES),
+    flush_interval_(DEFAULT_FLUSH_INTERVAL), first_(0), pending_(0),
+    chunk_seq_(0) {
+    uint64_t key = (static_cast<uint64_t>(time(nullptr)) << 32) ^
+      (static_cast<uint64_t>(getpid()) << 16) ^ random();
+    memcpy(this->chunk_key_, &key, sizeof(this->chunk_key_));
+  }
+  PackedForwardEncoder::~PackedForwardEncoder() {
+    for (auto it = this->tag_.begin(); it != this->tag_.end(); it++) {
+      delete it->second;
+    }
+  }
+
+  bool PackedForwardEncoder::supported(Compress compress) {
+#ifdef HAVE_ZSTD
+    return true;
+#else
+    return (compress != ZSTD);
+#endif
+  }
+
+  void PackedForwardEncoder::set_flush(size_t bytes, time_t interval) {
+    this->flush_bytes_ = bytes;
+    this->flush_interval_ = interval;
+  }
+
+  void PackedForwardEncoder::encode(const uint8_t *rec, size_t len) {
+    EventReader rd(rec, len);
+    size_t tag_len;
+    const char *tag = rd.tag(&tag_len);
+    std::string key(tag, tag_len);
+    auto it = this->tag_.find(key);
+    if (it == this->tag_.end()) {
+      it = this->tag_.insert(std::make_pair(key, new Chunk())).first;
+    }
+
+    Chunk *c = it->second;
+    size_t before = c->entries_.size();
+    c->entries_.encode(rec, len);
+    c->count_++;
+    if (this->pending_ == 0) {
+      this->first_ = time(nullptr);
+    }
+    this->pending_ += c->entries_.size() - before;
+  }
+
+  bool PackedForwardEncoder::due(time_t now) const {
+    return (this->pending_ > 0 &&
+            (this->pending_ >= this->flush_bytes_ ||
+             now - this->first_ >= this->flush_interval_));
+  }
+
+  std::string PackedForwardEncoder::new_chunk_id() {
+    // 16 bytes of process key and sequence number in base64.
+    static const char b64[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    uint8_t raw[18] = {0};
+    uint64_t seq = ++this->chunk_seq_;
+    memcpy(raw, this->chunk_key_, sizeof(this->chunk_key_));
+    memcpy(raw + 8, &seq, sizeof(seq));
+    std::string id;
+    for (size_t i = 0; i < 16; i += 3) {
+      uint32_t v = (raw[i] << 16) | (raw[i + 1] << 8) | raw[i + 2];
+      id += b64[(v >> 18) & 0x3f];
+      id += b64[(v >> 12) & 0x3f];
+      id += (i + 1 < 16) ? b64[(v >> 6) & 0x3f] : '=';
+      id += (i + 2 < 16) ? b64[v & 0x3f] : '=';
+    }
+    return id;
+  }
+
+  bool PackedForwardEncoder::deflate(const std::vector<uint8_t> &src) {
+    if (this->compress_ == GZIP) {
+      z_stream zs;
+      memset(&zs, 0, sizeof(zs));
+      // 16 + window bits: gzip format.
+      if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+      }
+      this->zbuf_.resize(deflateBound(&zs, src.size()));
+      zs.next_in = const_cast<Bytef*>(src.data());
+      zs.avail_in = src.size();
+      zs.next_out = this->zbuf_.data();
+      zs.avail_out = this->zbuf_.size();
+      int rc = ::deflate(&zs, Z_FINISH);
+      this->zbuf_.resize(zs.total_out);
+      deflateEnd(&zs);
+      return (rc == Z_STREAM_END);
+    }
+#ifdef HAVE_ZSTD
+    if (this->compress_ == ZSTD) {
+      this->zbuf_.resize(ZSTD_compressBound(src.size()));
+      size_t n = ZSTD_compress(this->zbuf_.data(), this->zbuf_.size(),
+                               src.data(), src.size(), 3);
+      if (ZSTD_isError(n)) {
+        return false;
+      }
+      this->zbuf_.resize(n);
+      return true;
+    }
+#endif
+    return false;
+  }
+
+  int PackedForwardEncoder::iovec(const struct iovec **iov) {
+    static const char *compress_name[] = {"", "gzip", "zstd"};
+    // [tag, entries, option] per tag. Option has "size" (number of
+    // events), "chunk" if ack is requested and "compressed".
+    for (auto it = this->tag_.begin(); it != this->tag_.end(); it++) {
+      Chunk *c = it->second;
+      if (c->count_ == 0) {
+        continue;
+      }
+      const std::vector<uint8_t> &entries = c->entries_.buffer();
+      bool compressed = (this->compress_ != NONE && this->deflate(entries));
+      const std::vector<uint8_t> &body = compressed ? this->zbuf_ : entries;
+
+      this->put(static_cast<uint8_t>(0x93));
+      this->put_str_hdr(it->first.size());
+      this->put(it->first.data(), it->first.size());
+      this->put_bin_hdr(body.size());
+      this->put(body.data(), body.size());
+
+      this->put(static_cast<uint8_t>(0x80 | (1 + this->ack_ + compressed)));
+      this->put_str_hdr(4);
+      this->put("size", 4);
+      this->put_uint(c->count_);
+      if (this->ack_) {
+        std::string id = this->new_chunk_id();
+        this->put_str_hdr(5);
+        this->put("chunk", 5);
+        this->put_str_hdr(id.size());
+        this->put(id.data(), id.size());
+        this->chunk_.push_back(id);
+      }
+      if (compressed) {
+        const char *name = compress_name[this->compress_];
+        this->put_str_hdr(10);
+        this->put("compressed", 10);
+        this->put_str_hdr(strlen(name));
+        this->put(name, strlen(name));
+      }
+    }
+    return Encoder::iovec(iov);
+  }
+
+  void PackedForwardEncoder::clear() {
+    for (auto it = this->tag_.begin(); it != this->tag_.end(); it++) {
+      it->second->entries_.clear();
+      it->second->count_ = 0;
+    }
+    this->pending_ = 0;
+    Encoder::clear();
+  }
+
+
+  JsonEncoder::JsonEncoder() {
+  }
+
+  static inline bool json_plain(uint8_t c) {
+    return (c >= 0x20 && c < 0x80 && c != '"' && c != '\\');
+  }
+
+  // Each byte as written in JSON string, stored to be copied 8 bytes at
+  // once without branches on the byte.
+  struct JsonEsc {
+    char str_[7];
+    uint8_t len_;
+  };
+  static JsonEsc json_esc[256];
+
+  static bool init_json_esc() {
+    for (int c = 0; c < 256; c++) {
+      JsonEsc &e = json_esc[c];
+      memset(&e, 0, sizeof(e));
+      char s = 0;
+      switch (c) {
+      case '"':  s = '"';  break;
+      case '\\': s = '\\'; break;
+      case '\n': s = 'n';  break;
+      case '\r': s = 'r';  break;
+      case '\t': s = 't';  break;
+      }
+      if (json_plain(c)) {
+        e.str_[0] = c;
+        e.len_ = 1;
+      } else if (s != 0) {
+        e.str_[0] = '\\';
+        e.str_[1] = s;
+        e.len_ = 2;
+      } else {
+        snprintf(e.str_, sizeof(e.str_), "\\u%04X", c);
+        e.len_ = 6;
+      }
+    }
+    return true;
+  }
+  static const bool json_esc_ready = init_json_esc();
+
+  // Returns the first byte in [p, ep) to be escaped in JSON string.
+  static const uint8_t *json_special(const uint8_t *p, const uint8_t *ep) {
+#ifdef JSON_HAS_SSE2_PATH
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    for (; ep - p >= 16; p += 16) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      // Signed compare, so bytes from 0x80 are also less than space.
+      __m128i m = _mm_or_si128(_mm_cmplt_epi8(d, space),
+                               _mm_or_si128(_mm_cmpeq_epi8(d, quote),
+                                            _mm_cmpeq_epi8(d, bslash)));
+      int bits = _mm_movemask_epi8(m);
+      if (bits != 0) {
+        return p + __builtin_ctz(bits);
+      }
+    }
+#endif
+    while (p < ep && json_plain(*p)) {
+      p++;
+    }
+    return p;
+  }
+
+  void JsonEncoder::put_str(const void *ptr, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t*>(ptr);
+    const uint8_t *ep = p + len;
+    // Runs without escape are found 16 bytes at a time; long ones are
+    // referenced. From an escaped byte, the next 16 bytes go through the
+    // table into tmp, which suits binary data with escapes all over.
+    char tmp[1024 + sizeof(JsonEsc)];
+    size_t n = 0;
+    tmp[n++] = '"';
+    while (p < ep) {
+      const uint8_t *q = json_special(p, ep);
+      size_t run = q - p;
+      if (run >= REF_MIN) {
+        this->put(tmp, n);
+        n = 0;
+        this->ref(p, run);
+      } else if (run > 0) {
+        if (n + run > 1024) {
+          this->put(tmp, n);
+          n = 0;
+        }
+        memcpy(tmp + n, p, run);
+        n += run;
+      }
+      p = q;
+
+      const uint8_t *blk = (ep - p > 16) ? p + 16 : ep;
+      for (; p < blk; p++) {
+        if (n > 1024) {
+          this->put(tmp, n);
+          n = 0;
+        }
+        memcpy(tmp + n, &json_esc[*p], sizeof(JsonEsc));
+        n += json_esc[*p].len_;
+      }
+    }
+    tmp[n++] = '"';
+    this->put(tmp, n);
+  }
+
+  void JsonEncoder::encode(const uint8_t *rec, size_t len) {
+    EventReader rd(rec, len);
+    this->field_.clear();
+    EventField f;
+    while (rd.next(&f)) {
+      this->field_.push_back(f);
+    }
+    std::stable_sort(this->field_.begin(), this->field_.end(), field_less);
+
+    char buf[EventReader::TEXT_LEN + 1];
+    size_t tag_len;
+    const char *tag = rd.tag(&tag_len);
+    this->put("{\"tag\":", 7);
+    this->put_str(tag, tag_len);
+    int n = snprintf(buf, sizeof(buf), ",\"time\":%lld",
+                     static_cast<long long>(rd.ts() != 0 ?
+                                            rd.ts() : time(nullptr)));
+    this->put(buf, n);
+
+    for (size_t i = 0; i < this->field_.size(); i++) {
+      const EventField &fd = this->field_[i];
+      this->put(static_cast<uint8_t>(','));
+      this->put_str(fd.key_, fd.key_len_);
+      this->put(static_cast<uint8_t>(':'));
+
+      switch (fd.type_) {
+      case Event::STR:
+        this->put_str(fd.val_, fd.val_len_);
+        break;
+      case Event::INT: {
+        int64_t v;
+        memcpy(&v, fd.val_, sizeof(v));
+        n = snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(v));
+        this->put(buf, n);
+        break;
+      }
+      case Event::UINT: {
+        uint64_t v;
+        memcpy(&v, fd.val_, sizeof(v));
+        n = snprintf(buf, sizeof(buf), "%llu",
+                     static_cast<unsigned long long>(v));
+        this->put(buf, n);
+        break;
+      }
+      case Event::BOOL:
+        if (fd.val_[0]) {
+          this->put("true", 4);
+        } else {
+          this->put("false", 5);
+        }
+        break;
+      case Event::ADDR:
+      case Event::MAC:
+      case Event::HASH:
+        // No escape needed, and buf must be copied.
+        this->put(static_cast<uint8_t>('"'));
+        this->put(buf, EventReader::text(fd, buf));
+        this->put(static_cast<uint8_t>('"'));
+        break;
+      case Event::HEX: {
+        char *p = this->reserve(fd.val_len_ * 2 + 2);
+        p[0] = '"';
+        swarm::hex_encode(fd.val_, fd.val_len_, p + 1);
+        p[fd.val_len_ * 2 + 1] = '"';
+        break;
+      }
+      }
+    }
+    this->put("}\n", 2);
+  }
+}
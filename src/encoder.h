@@ -0,0 +1,187 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_ENCODER_H__
+#define SRC_ENCODER_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <sys/uio.h>
+#include "./eventlog.h"
+
+namespace lurker {
+  // ----------------------------------------------------------------
+  // class Encoder:
+  // Serializes EventLog records into a reusable buffer. Long string
+  // values are not copied but referenced as iovec pieces, so the records
+  // must stay valid until the output is written and clear() is called.
+  //
+  class Encoder {
+  public:
+    static const size_t REF_MIN = 64;     // shorter values are copied
+    static const size_t MAX_PIECES = 512;
+    static const size_t BATCH_BYTES = 1 << 18;
+
+  protected:
+    struct Piece {
+      const uint8_t *ext_;                // nullptr: in buf_ at off_
+      size_t off_;
+      size_t len_;
+    };
+    std::vector<uint8_t> buf_;
+    std::vector<Piece> piece_;
+    std::vector<struct iovec> iov_;
+    std::vector<std::string> chunk_;
+    size_t size_;
+    size_t ref_min_;
+
+    void put(const void *ptr, size_t len);
+    void put(uint8_t c);
+    char *reserve(size_t len);            // put() of len bytes to fill
+    void ref(const void *ptr, size_t len);
+
+  public:
+    Encoder();
+    virtual ~Encoder();
+    virtual void encode(const uint8_t *rec, size_t len) = 0;
+    size_t size() const { return this->size_; }
+    virtual bool empty() const { return (this->size_ == 0); }
+    // Batch should be written before encoding more.
+    virtual bool full() const {
+      return (this->size_ >= BATCH_BYTES ||
+              this->piece_.size() >= MAX_PIECES);
+    }
+    // Encoded data should be written now. Always true if records are
+    // referenced.
+    virtual bool due(time_t now) const { return true; }
+    virtual int iovec(const struct iovec **iov);
+    virtual void clear();
+    // Copy all values; then buffer() is the whole output.
+    void set_copy(bool copy) { this->ref_min_ = copy ? SIZE_MAX : REF_MIN; }
+    const std::vector<uint8_t> &buffer() const { return this->buf_; }
+    // Ids of chunks in the output to be acknowledged by the receiver.
+    const std::vector<std::string> &chunks() const { return this->chunk_; }
+  };
+
+  // ----------------------------------------------------------------
+  // class MsgpackEncoder:
+  // Fluentd event as written by libfluent: array of tag, time and a map,
+  // with keys in sorted order (fluent::Message keeps them in std::map),
+  // integers in their shortest format and text as str. In entry mode
+  // the tag is left out, as in entries of forward protocol.
+  //
+  class MsgpackEncoder : public Encoder {
+  private:
+    std::vector<EventField> field_;
+    bool entry_;
+
+  protected:
+    void put_str_hdr(size_t len);
+    void put_bin_hdr(size_t len);
+    void put_int(int64_t v);
+    void put_uint(uint64_t v);
+
+  public:
+    explicit MsgpackEncoder(bool entry = false);
+    void encode(const uint8_t *rec, size_t len);
+  };
+
+  // ----------------------------------------------------------------
+  // class PackedForwardEncoder:
+  // Fluentd forward protocol in PackedForward mode: events are grouped by
+  // tag, and a message per tag carries all its entries as one binary,
+  // optionally compressed (CompressedPackedForward). Output is due when
+  // flush_bytes are pending or the oldest pending event is flush_interval
+  // seconds old. With ack, each message has a chunk id that the receiver
+  // must return.
+  //
+  class PackedForwardEncoder : public MsgpackEncoder {
+  public:
+    enum Compress {
+      NONE = 0,
+      GZIP,
+      ZSTD,
+    };
+    static const size_t DEFAULT_FLUSH_BYTES = 1 << 20;
+    static const time_t DEFAULT_FLUSH_INTERVAL = 1;
+
+  private:
+    struct Chunk {
+      MsgpackEncoder entries_;
+      size_t count_;
+      Chunk() : entries_(true), count_(0) { this->entries_.set_copy(true); }
+    };
+    std::map<std::string, Chunk*> tag_;
+    Compress compress_;
+    bool ack_;
+    size_t flush_bytes_;
+    time_t flush_interval_;
+    time_t first_;                        // time of oldest pending event
+    size_t pending_;
+    uint64_t chunk_seq_;
+    uint8_t chunk_key_[8];
+    std::vector<uint8_t> zbuf_;
+    std::string new_chunk_id();
+    bool deflate(const std::vector<uint8_t> &src);
+
+  public:
+    PackedForwardEncoder(Compress compress = NONE, bool ack = false);
+    ~PackedForwardEncoder();
+    static bool supported(Compress compress);
+    void set_flush(size_t bytes, time_t interval);
+    void encode(const uint8_t *rec, size_t len);
+    bool empty() const { return (this->pending_ == 0); }
+    bool full() const { return (this->pending_ >= this->flush_bytes_); }
+    bool due(time_t now) const;
+    int iovec(const struct iovec **iov);
+    void clear();
+  };
+
+  // ----------------------------------------------------------------
+  // class JsonEncoder:
+  // JSON lines for outputs that can not take binary: an object per
+  // event with "tag", "time" and the fields in the order of
+  // MsgpackEncoder. Bytes that are not printable ASCII are escaped as
+  // \u00XX, so binary values map one to one to code points. Escaping
+  // scans 16 bytes at once with SSE2, and runs that need none are
+  // referenced like strings of MsgpackEncoder.
+  //
+  class JsonEncoder : public Encoder {
+  private:
+    std::vector<EventField> field_;
+    void put_str(const void *ptr, size_t len);
+
+  public:
+    JsonEncoder();
+    void encode(const uint8_t *rec, size_t len);
+  };
+}
+
+
+#endif  // SRC_ENCODER_H__
@@ -0,0 +1,452 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <fluent.hpp>
+#include <iostream>
+#include "./eventlog.h"
+#include "./encoder.h"
+#include "./swarm/utils/hex.h"
+#include "./logsink.h"
+
+namespace lurker {
+  // Record: u32 length, u32 zero, time_t (64 bit) timestamp, u8 tag
+  // length and tag, then fields of u8 type, u8 key length, u32 value
+  // length, key and value. Records in the ring start 8 byte aligned.
+  static const size_t REC_TS_OFF = 8;
+  static const size_t REC_TAG_OFF = 16;
+  static const size_t FIELD_HDR_LEN = 6;
+  static const uint32_t REC_WRAP = 0xffffffff;  // rest of ring is unused
+
+  static inline size_t rec_align(size_t len) {
+    return (len + 7) & ~static_cast<size_t>(7);
+  }
+
+  Event::Event() {
+    this->buf_.reserve(1 << 16);
+  }
+
+  void Event::init(const char *tag) {
+    size_t tag_len = strlen(tag);
+    if (tag_len > 255) {
+      tag_len = 255;
+    }
+    this->buf_.assign(REC_TAG_OFF + 1, 0);
+    this->buf_[REC_TAG_OFF] = tag_len;
+    this->buf_.insert(this->buf_.end(), tag, tag + tag_len);
+  }
+
+  void Event::append(Type type, const char *key, const void *ptr,
+                     size_t len) {
+    size_t key_len = strlen(key);
+    if (key_len > 255) {
+      key_len = 255;
+    }
+    uint32_t val_len = len;
+    uint8_t hdr[FIELD_HDR_LEN] = {type, static_cast<uint8_t>(key_len)};
+    memcpy(&hdr[2], &val_len, sizeof(val_len));
+    this->buf_.insert(this->buf_.end(), hdr, hdr + sizeof(hdr));
+    this->buf_.insert(this->buf_.end(), key, key + key_len);
+    const uint8_t *val = static_cast<const uint8_t*>(ptr);
+    this->buf_.insert(this->buf_.end(), val, val + len);
+  }
+
+  void Event::set_ts(time_t ts) {
+    int64_t v = ts;
+    memcpy(&this->buf_[REC_TS_OFF], &v, sizeof(v));
+  }
+  void Event::set(const char *key, const std::string &val) {
+    this->append(STR, key, val.data(), val.size());
+  }
+  void Event::set(const char *key, const char *val) {
+    this->append(STR, key, val, strlen(val));
+  }
+  void Event::set(const char *key, const void *ptr, size_t len) {
+    this->append(STR, key, ptr, len);
+  }
+  void Event::set(const char *key, int val) {
+    int64_t v = val;
+    this->append(INT, key, &v, sizeof(v));
+  }
+  void Event::set(const char *key, unsigned int val) {
+    uint64_t v = val;
+    this->append(UINT, key, &v, sizeof(v));
+  }
+  void Event::set(const char *key, bool val) {
+    uint8_t v = val;
+    this->append(BOOL, key, &v, sizeof(v));
+  }
+  void Event::set_addr(const char *key, const void *addr, size_t len) {
+    this->append(ADDR, key, addr, (addr ? len : 0));
+  }
+  void Event::set_mac(const char *key, const void *hw, size_t len) {
+    this->append(MAC, key, hw, (hw ? len : 0));
+  }
+  void Event::set_hash(const char *key, uint64_t hash) {
+    this->append(HASH, key, &hash, sizeof(hash));
+  }
+  void Event::set_hex(const char *key, const void *ptr, size_t len) {
+    this->append(HEX, key, ptr, (ptr ? len : 0));
+  }
+
+
+  EventReader::EventReader(const uint8_t *rec, size_t len) :
+    ptr_(rec + REC_TAG_OFF + 1 + rec[REC_TAG_OFF]), end_(rec + len),
+    tag_(reinterpret_cast<const char*>(rec + REC_TAG_OFF + 1)),
+    tag_len_(rec[REC_TAG_OFF]) {
+    int64_t ts;
+    memcpy(&ts, rec + REC_TS_OFF, sizeof(ts));
+    this->ts_ = ts;
+  }
+
+  bool EventReader::next(EventField *f) {
+    if (this->ptr_ + FIELD_HDR_LEN > this->end_) {
+      return false;
+    }
+    uint32_t val_len;
+    f->type_ = static_cast<Event::Type>(this->ptr_[0]);
+    f->key_len_ = this->ptr_[1];
+    memcpy(&val_len, this->ptr_ + 2, sizeof(val_len));
+    f->key_ = reinterpret_cast<const char*>(this->ptr_ + FIELD_HDR_LEN);
+    f->val_ = this->ptr_ + FIELD_HDR_LEN + f->key_len_;
+    f->val_len_ = val_len;
+    this->ptr_ = f->val_ + val_len;
+    return true;
+  }
+
+  size_t EventReader::text(const EventField &f, char *buf) {
+    static const char none[] = "(none)";
+    switch (f.type_) {
+    case Event::ADDR:
+      if (f.val_len_ == 4 || f.val_len_ == 16) {
+        ::inet_ntop((f.val_len_ == 4) ? AF_INET : AF_INET6, f.val_, buf,
+                    TEXT_LEN);
+        return strlen(buf);
+      }
+      break;
+    case Event::MAC:
+      if (f.val_len_ == 6) {
+        return swarm::hex_encode(f.val_, f.val_len_, ':', buf);
+      }
+      break;
+    case Event::HASH: {
+      uint64_t h;
+      memcpy(&h, f.val_, sizeof(h));
+      return snprintf(buf, TEXT_LEN, "%016llX",
+                      static_cast<unsigned long long>(h));
+    }
+    default:
+      break;
+    }
+    memcpy(buf, none, sizeof(none) - 1);
+    return sizeof(none) - 1;
+  }
+
+
+  EventLog::EventLog() :
+    logger_(nullptr), write_errors_(0),
+    ring_(nullptr), ring_size_(0), head_(0), tail_(0),
+    waiting_(false), stopping_(false), drops_(0), overflow_(DROP),
+    running_(false) {
+    sem_init(&this->sem_, 0, 0);
+    this->set_backlog(DEFAULT_BACKLOG);
+  }
+  EventLog::~EventLog() {
+    this->stop();
+    delete [] this->ring_;
+    for (size_t i = 0; i < this->out_.size(); i++) {
+      delete this->out_[i].sink_;
+      delete this->out_[i].enc_;
+    }
+    sem_destroy(&this->sem_);
+  }
+
+  void EventLog::add_sink(LogSink *sink, Encoder *enc) {
+    Output out = {sink, (enc ? enc : new MsgpackEncoder()), true};
+    this->out_.push_back(out);
+  }
+
+  void EventLog::set_backlog(size_t size) {
+    if (this->running_) {
+      return;
+    }
+    size_t n = 1 << 12;
+    while (n < size) {
+      n <<= 1;
+    }
+    delete [] this->ring_;
+    this->ring_ = new uint8_t[n];
+    this->ring_size_ = n;
+    this->head_ = 0;
+    this->tail_ = 0;
+  }
+
+  bool EventLog::start() {
+    if (this->running_) {
+      return true;
+    }
+    this->stopping_ = false;
+    if (pthread_create(&this->th_, nullptr, EventLog::writer_thread,
+                       this) != 0) {
+      return false;
+    }
+    this->running_ = true;
+    return true;
+  }
+
+  void EventLog::stop() {
+    if (!this->running_) {
+      return;
+    }
+    this->stopping_ = true;
+    sem_post(&this->sem_);
+    pthread_join(this->th_, nullptr);
+    this->running_ = false;
+  }
+
+  size_t EventLog::backlog() const {
+    return this->head_.load() - this->tail_.load();
+  }
+
+  Event *EventLog::retain_message(const char *tag) {
+    this->ev_.init(tag);
+    return &this->ev_;
+  }
+
+  bool EventLog::emit(Event *ev) {
+    uint32_t len = ev->buf_.size();
+    memcpy(&ev->buf_[0], &len, sizeof(len));
+
+    if (!this->running_) {
+      this->write(ev->buf_.data(), len);
+      this->flush(true);
+      return true;
+    }
+
+    while (!this->push(ev->buf_.data(), len)) {
+      if (this->overflow_ != BLOCK || rec_align(len) > this->ring_size_ / 2) {
+        this->drops_++;
+        return false;
+      }
+      if (this->waiting_.exchange(false)) {
+        sem_post(&this->sem_);
+      }
+      sched_yield();
+    }
+
+    if (this->waiting_.load() && this->waiting_.exchange(false)) {
+      sem_post(&this->sem_);
+    }
+    return true;
+  }
+
+  bool EventLog::push(const uint8_t *rec, size_t len) {
+    size_t need = rec_align(len);
+    if (need > this->ring_size_ / 2) {
+      return false;
+    }
+    size_t head = this->head_.load(std::memory_order_relaxed);
+    size_t tail = this->tail_.load(std::memory_order_acquire);
+    size_t off = head & (this->ring_size_ - 1);
+    size_t contig = this->ring_size_ - off;
+    size_t skip = (contig < need) ? contig : 0;
+    if (head + skip + need - tail > this->ring_size_) {
+      return false;
+    }
+    if (skip > 0) {
+      memcpy(this->ring_ + off, &REC_WRAP, sizeof(REC_WRAP));
+      head += skip;
+      off = 0;
+    }
+    memcpy(this->ring_ + off, rec, len);
+    this->head_.store(head + need);
+    return true;
+  }
+
+  // Record at *pos (skipping wrap marker) without releasing it.
+  const uint8_t *EventLog::peek(size_t *pos, size_t *len) {
+    while (*pos != this->head_.load()) {
+      size_t off = *pos & (this->ring_size_ - 1);
+      uint32_t rec_len;
+      memcpy(&rec_len, this->ring_ + off, sizeof(rec_len));
+      if (rec_len == REC_WRAP) {
+        *pos += this->ring_size_ - off;
+        continue;
+      }
+      *len = rec_len;
+      return this->ring_ + off;
+    }
+    return nullptr;
+  }
+
+  void* EventLog::writer_thread(void *obj) {
+    EventLog *log = static_cast<EventLog*>(obj);
+    size_t len;
+    while (true) {
+      // Encoded output may refer to records in the ring, so they are
+      // released after the batch is written.
+      size_t pos = log->tail_.load(std::memory_order_relaxed);
+      const uint8_t *rec;
+      bool found = false;
+      while (!log->full() && (rec = log->peek(&pos, &len)) != nullptr) {
+        log->write(rec, len);
+        pos += rec_align(len);
+        found = true;
+      }
+      if (found) {
+        log->flush(false);
+        log->tail_.store(pos, std::memory_order_release);
+        continue;
+      }
+      if (log->stopping_) {
+        log->flush(true);
+        break;
+      }
+
+      // Sleep until the producer sees the flag after its next push, or
+      // for a while if an output waits for timed flush.
+      log->waiting_ = true;
+      if (log->peek(&pos, &len) == nullptr && !log->stopping_) {
+        if (log->pending()) {
+          struct timespec ts;
+          clock_gettime(CLOCK_REALTIME, &ts);
+          ts.tv_nsec += IDLE_FLUSH_MS * 1000000;
+          if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+          }
+          sem_timedwait(&log->sem_, &ts);
+        } else {
+          sem_wait(&log->sem_);
+        }
+      }
+      log->waiting_ = false;
+      log->flush(false);
+    }
+    return nullptr;
+  }
+
+  void EventLog::write(const uint8_t *rec, size_t len) {
+    for (size_t i = 0; i < this->out_.size(); i++) {
+      this->out_[i].enc_->encode(rec, len);
+    }
+    if (this->logger_) {
+      this->write_fluent(rec, len);
+    }
+  }
+
+  bool EventLog::full() const {
+    for (size_t i = 0; i < this->out_.size(); i++) {
+      if (this->out_[i].enc_->full()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool EventLog::pending() const {
+    for (size_t i = 0; i < this->out_.size(); i++) {
+      if (!this->out_[i].enc_->empty()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void EventLog::flush(bool force) {
+    time_t now = time(nullptr);
+    for (size_t i = 0; i < this->out_.size(); i++) {
+      Output &out = this->out_[i];
+      if (out.enc_->empty() || !(force || out.enc_->due(now))) {
+        continue;
+      }
+      bool ok = out.sink_->write(out.enc_);
+      if (!ok) {
+        this->write_errors_++;
+        if (out.ok_) {
+          std::cerr << "log output error: " << out.sink_->errmsg()
+                    << std::endl;
+        }
+      }
+      out.ok_ = ok;
+      out.enc_->clear();
+    }
+  }
+
+  void EventLog::write_fluent(const uint8_t *rec, size_t len) {
+    EventReader rd(rec, len);
+    size_t tag_len;
+    const char *tag = rd.tag(&tag_len);
+    fluent::Message *msg =
+      this->logger_->retain_message(std::string(tag, tag_len));
+    if (rd.ts() != 0) {
+      msg->set_ts(rd.ts());
+    }
+
+    EventField f;
+    std::string key, val;
+    char buf[EventReader::TEXT_LEN];
+    while (rd.next(&f)) {
+      key.assign(f.key_, f.key_len_);
+      switch (f.type_) {
+      case Event::STR:
+        msg->set(key, std::string(reinterpret_cast<const char*>(f.val_),
+                                  f.val_len_));
+        break;
+      case Event::INT: {
+        int64_t n;
+        memcpy(&n, f.val_, sizeof(n));
+        msg->set(key, static_cast<int>(n));
+        break;
+      }
+      case Event::UINT: {
+        uint64_t n;
+        memcpy(&n, f.val_, sizeof(n));
+        msg->set(key, static_cast<unsigned int>(n));
+        break;
+      }
+      case Event::BOOL:
+        msg->set(key, (f.val_[0] != 0));
+        break;
+      case Event::ADDR:
+      case Event::MAC:
+      case Event::HASH:
+        msg->set(key, std::string(buf, EventReader::text(f, buf)));
+        break;
+      case Event::HEX:
+        val.resize(f.val_len_ * 2);
+        swarm::hex_encode(f.val_, f.val_len_, &val[0]);
+        msg->set(key, val);
+        break;
+      }
+    }
+    this->logger_->emit(msg);
+  }
+}
@@ -0,0 +1,203 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_EVENTLOG_H__
+#define SRC_EVENTLOG_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
+
+namespace fluent {
+  class Logger;
+}
+
+namespace lurker {
+  class EventLog;
+  class Encoder;
+  class LogSink;
+
+  // ----------------------------------------------------------------
+  // class Event:
+  // Log record under construction, the counterpart of fluent::Message.
+  // Values are appended in binary form and converted to strings by the
+  // writer thread of EventLog: addresses, MAC addresses, flow hashes and
+  // hex data are only copied on the capture path.
+  //
+  class Event {
+  public:
+    enum Type : uint8_t {
+      STR = 1,
+      INT,
+      UINT,
+      BOOL,
+      ADDR,     // IPv4 or IPv6 address, 4 or 16 bytes
+      MAC,      // 6 bytes
+      HASH,     // 64 bit flow hash as 16 hex digits
+      HEX,      // bytes as hex digits
+    };
+
+  private:
+    std::vector<uint8_t> buf_;
+    friend class EventLog;
+    void init(const char *tag);
+    void append(Type type, const char *key, const void *ptr, size_t len);
+
+  public:
+    Event();
+    void set_ts(time_t ts);
+    void set(const char *key, const std::string &val);
+    void set(const char *key, const char *val);
+    void set(const char *key, const void *ptr, size_t len);
+    void set(const char *key, int val);
+    void set(const char *key, unsigned int val);
+    void set(const char *key, bool val);
+    void set_addr(const char *key, const void *addr, size_t len);
+    void set_mac(const char *key, const void *hw, size_t len);
+    void set_hash(const char *key, uint64_t hash);
+    void set_hex(const char *key, const void *ptr, size_t len);
+  };
+
+  // ----------------------------------------------------------------
+  // class EventReader:
+  // Walks fields of a record made by Event, for encoders.
+  //
+  struct EventField {
+    Event::Type type_;
+    const char *key_;
+    size_t key_len_;
+    const uint8_t *val_;
+    size_t val_len_;
+  };
+
+  class EventReader {
+  private:
+    const uint8_t *ptr_, *end_;
+    const char *tag_;
+    size_t tag_len_;
+    time_t ts_;
+
+  public:
+    EventReader(const uint8_t *rec, size_t len);
+    const char *tag(size_t *len) const {
+      *len = this->tag_len_;
+      return this->tag_;
+    }
+    time_t ts() const { return this->ts_; }  // 0 if not set
+    bool next(EventField *f);
+    // Text of ADDR, MAC and HASH values (at most TEXT_LEN bytes).
+    static const size_t TEXT_LEN = 64;
+    static size_t text(const EventField &f, char *buf);
+  };
+
+  // ----------------------------------------------------------------
+  // class EventLog:
+  // Moves logging off the capture thread. Events are copied as compact
+  // records into a single producer, single consumer ring buffer, and a
+  // writer thread encodes them in batches and writes each batch to the
+  // sinks (file, fluentd) with one writev(). Values are not copied again
+  // for the output; see Encoder. A slow output therefore fills the ring
+  // instead of stalling capture; when the ring is full, events are
+  // dropped and counted, or the capture thread waits for room if so
+  // configured.
+  //
+  // Events can also be emitted to a fluent::Logger as fluent::Message,
+  // used for in-process message queue.
+  //
+  // retain_message() and emit() must be called by one thread only, and
+  // sinks and the fluent::Logger must not be used by others while
+  // running.
+  //
+  class EventLog {
+  public:
+    static const size_t DEFAULT_BACKLOG = 1 << 22;  // bytes
+    static const long IDLE_FLUSH_MS = 100;  // check of timed flush
+    enum Overflow {
+      DROP = 0,
+      BLOCK,
+    };
+
+  private:
+    fluent::Logger *logger_;
+    struct Output {
+      LogSink *sink_;
+      Encoder *enc_;
+      bool ok_;
+    };
+    std::vector<Output> out_;
+    std::atomic<uint64_t> write_errors_;
+    uint8_t *ring_;
+    size_t ring_size_;                 // power of 2
+    std::atomic<size_t> head_;         // written by producer
+    std::atomic<size_t> tail_;         // written by writer thread
+    std::atomic<bool> waiting_;        // writer thread sleeps
+    std::atomic<bool> stopping_;
+    std::atomic<uint64_t> drops_;
+    Overflow overflow_;
+    Event ev_;
+    bool running_;
+    pthread_t th_;
+    sem_t sem_;
+
+    static void* writer_thread(void *obj);
+    bool push(const uint8_t *rec, size_t len);
+    const uint8_t *peek(size_t *pos, size_t *len);
+    void write(const uint8_t *rec, size_t len);
+    void write_fluent(const uint8_t *rec, size_t len);
+    void flush(bool force);
+    bool full() const;
+    bool pending() const;
+
+  public:
+    EventLog();
+    ~EventLog();
+    // Takes ownership of sink and its encoder (MsgpackEncoder if not
+    // given). Not while running.
+    void add_sink(LogSink *sink, Encoder *enc = nullptr);
+    void set_logger(fluent::Logger *logger) { this->logger_ = logger; }
+    // Ring size in bytes, rounded up to a power of 2. Not while running.
+    void set_backlog(size_t size);
+    void set_overflow(Overflow overflow) { this->overflow_ = overflow; }
+    bool start();
+    // Writes out all queued events and stops the writer thread.
+    void stop();
+
+    Event *retain_message(const char *tag);
+    bool emit(Event *ev);
+
+    size_t backlog_size() const { return this->ring_size_; }
+    size_t backlog() const;            // bytes queued
+    uint64_t drops() const { return this->drops_.load(); }
+    uint64_t write_errors() const { return this->write_errors_.load(); }
+  };
+}
+
+
+#endif  // SRC_EVENTLOG_H__
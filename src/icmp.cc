@@ -0,0 +1,265 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "./debug.h"
+#include "./icmp.h"
+#include "./pkt.h"
+
+namespace lurker {
+  static const size_t V4_HDR_LEN = sizeof(struct ether_header) +
+    sizeof(struct ipv4_header) + sizeof(struct icmp_header);
+  static const size_t V6_HDR_LEN = sizeof(struct ether_header) +
+    sizeof(struct ipv6_header) + sizeof(struct icmp_header);
+
+  IcmpHandler::IcmpHandler(swarm::Swarm *sw, const TargetSet *target) :
+    sw_(sw), sock_(nullptr), target_(target), logger_(nullptr),
+    dns_cache_(nullptr), ip_id_(0), echo_rate_(DEFAULT_ECHO_RATE),
+    rate_sec_(0), rate_count_(0) {
+    this->echo_ev_  = this->sw_->lookup_event_id("icmp.echo");
+    this->echo6_ev_ = this->sw_->lookup_event_id("icmp6.echo");
+    this->echo_hdlr_id_  = this->sw_->set_handler(this->echo_ev_, this);
+    this->echo6_hdlr_id_ = this->sw_->set_handler(this->echo6_ev_, this);
+    assert(this->echo_ev_ != swarm::EV_NULL);
+    assert(this->echo6_ev_ != swarm::EV_NULL);
+    assert(this->echo_hdlr_id_ != swarm::HDLR_NULL);
+    assert(this->echo6_hdlr_id_ != swarm::HDLR_NULL);
+
+    this->ether_src_    = this->sw_->lookup_value_id("ether.src");
+    this->ether_dst_    = this->sw_->lookup_value_id("ether.dst");
+    this->ipv4_src_     = this->sw_->lookup_value_id("ipv4.src");
+    this->ipv4_dst_     = this->sw_->lookup_value_id("ipv4.dst");
+    this->ipv6_src_     = this->sw_->lookup_value_id("ipv6.src");
+    this->ipv6_dst_     = this->sw_->lookup_value_id("ipv6.dst");
+    this->icmp_code_    = this->sw_->lookup_value_id("icmp.code");
+    this->icmp_chksum_  = this->sw_->lookup_value_id("icmp.chksum");
+    this->icmp_id_      = this->sw_->lookup_value_id("icmp.id");
+    this->icmp_seq_     = this->sw_->lookup_value_id("icmp.seq");
+    this->icmp_data_    = this->sw_->lookup_value_id("icmp.data");
+    this->icmp6_code_   = this->sw_->lookup_value_id("icmp6.code");
+    this->icmp6_chksum_ = this->sw_->lookup_value_id("icmp6.chksum");
+    this->icmp6_id_     = this->sw_->lookup_value_id("icmp6.id");
+    this->icmp6_seq_    = this->sw_->lookup_value_id("icmp6.seq");
+    this->icmp6_data_   = this->sw_->lookup_value_id("icmp6.data");
+
+    // Templates of echo reply headers. Fields filled per reply are zero.
+    ::memset(this->tmpl4_, 0, sizeof(this->tmpl4_));
+    auto *eth4 = reinterpret_cast<struct ether_header*>(this->tmpl4_);
+    auto *ipv4 = reinterpret_cast<struct ipv4_header*>(eth4 + 1);
+    auto *icmp4 = reinterpret_cast<struct icmp_header*>(ipv4 + 1);
+    eth4->type_ = htons(ETHERTYPE_IP);
+    ipv4->hdrlen_ = 5;
+    ipv4->ver_ = 4;
+    ipv4->ttl_ = 64;
+    ipv4->proto_ = IPPROTO_ICMP;
+    icmp4->type_ = ICMP_ECHO_REPLY;
+    this->tmpl4_sum_ = chksum_add(0, ipv4, sizeof(struct ipv4_header));
+
+    ::memset(this->tmpl6_, 0, sizeof(this->tmpl6_));
+    auto *eth6 = reinterpret_cast<struct ether_header*>(this->tmpl6_);
+    auto *ipv6 = reinterpret_cast<struct ipv6_header*>(eth6 + 1);
+    auto *icmp6 = reinterpret_cast<struct icmp_header*>(ipv6 + 1);
+    eth6->type_ = htons(ETHERTYPE_IPV6);
+    ipv6->flags_ = htonl(0x60000000);
+    ipv6->next_hdr_ = IPPROTO_ICMPV6;
+    ipv6->hop_limit_ = 64;
+    icmp6->type_ = ICMP6_ECHO_REPLY;
+  }
+  IcmpHandler::~IcmpHandler() {
+    this->sw_->unset_handler(this->echo_hdlr_id_);
+    this->sw_->unset_handler(this->echo6_hdlr_id_);
+  }
+
+  void IcmpHandler::set_sock(RawSock *sock) {
+    this->sock_ = sock;
+  }
+  void IcmpHandler::set_logger(EventLog *logger) {
+    this->logger_ = logger;
+  }
+  void IcmpHandler::set_dns_cache(const DnsCache *dns_cache) {
+    this->dns_cache_ = dns_cache;
+  }
+
+  void IcmpHandler::set_dst_names(Event *msg,
+                                  const swarm::Property &p) {
+    if (this->dns_cache_) {
+      char buf[512];
+      size_t addr_len;
+      void *addr = p.dst_addr(&addr_len);
+      size_t len = this->dns_cache_->lookup(addr, addr_len, p.tv_sec(),
+                                            buf, sizeof(buf));
+      if (len > 0) {
+        msg->set("dst_names", buf, len);
+      }
+    }
+  }
+
+  bool IcmpHandler::allow_reply(const swarm::Property &p) {
+    // Fixed window per second of packet time.
+    if (this->echo_rate_ == 0) {
+      return true;
+    }
+    if (p.tv_sec() != this->rate_sec_) {
+      this->rate_sec_ = p.tv_sec();
+      this->rate_count_ = 0;
+    }
+    return (this->rate_count_++ < this->echo_rate_);
+  }
+
+  size_t IcmpHandler::build_echo_reply(const swarm::Property &p) {
+    size_t data_len;
+    const uint8_t *data = p.value(this->icmp_data_).ptr(&data_len);
+    if (V4_HDR_LEN + data_len > BUF_SIZE) {
+      return 0;
+    }
+
+    ::memcpy(this->buf_, this->tmpl4_, V4_HDR_LEN);
+    auto *eth = reinterpret_cast<struct ether_header*>(this->buf_);
+    auto *ipv4 = reinterpret_cast<struct ipv4_header*>(eth + 1);
+    auto *icmp = reinterpret_cast<struct icmp_header*>(ipv4 + 1);
+
+    ::memcpy(eth->src_, p.value(this->ether_dst_).ptr(), ETHER_ADDR_LEN);
+    ::memcpy(eth->dst_, p.value(this->ether_src_).ptr(), ETHER_ADDR_LEN);
+
+    ipv4->total_len_ = htons(sizeof(struct ipv4_header) +
+                             sizeof(struct icmp_header) + data_len);
+    ipv4->id_ = htons(this->ip_id_++);
+    ::memcpy(&ipv4->src_, p.value(this->ipv4_dst_).ptr(), IPV4_ADDR_LEN);
+    ::memcpy(&ipv4->dst_, p.value(this->ipv4_src_).ptr(), IPV4_ADDR_LEN);
+    uint32_t sum = this->tmpl4_sum_;
+    sum = chksum_add(sum, &ipv4->total_len_, sizeof(ipv4->total_len_));
+    sum = chksum_add(sum, &ipv4->id_, sizeof(ipv4->id_));
+    sum = chksum_add(sum, &ipv4->src_, sizeof(ipv4->src_));
+    sum = chksum_add(sum, &ipv4->dst_, sizeof(ipv4->dst_));
+    ipv4->chksum_ = chksum_fold(sum);
+
+    // Only type and code differ from the request.
+    const uint8_t req_tc[2] = {ICMP_ECHO_REQUEST,
+                               p.value(this->icmp_code_).ptr()[0]};
+    uint16_t m, m1, hc;
+    ::memcpy(&m, req_tc, sizeof(m));
+    ::memcpy(&m1, icmp, sizeof(m1));
+    ::memcpy(&hc, p.value(this->icmp_chksum_).ptr(), sizeof(hc));
+    icmp->chksum_ = chksum_update(hc, m, m1);
+    ::memcpy(&icmp->id_, p.value(this->icmp_id_).ptr(), sizeof(icmp->id_));
+    ::memcpy(&icmp->seq_, p.value(this->icmp_seq_).ptr(), sizeof(icmp->seq_));
+
+    if (data_len > 0) {
+      ::memcpy(icmp + 1, data, data_len);
+    }
+    return V4_HDR_LEN + data_len;
+  }
+
+  size_t IcmpHandler::build_echo6_reply(const swarm::Property &p) {
+    size_t data_len;
+    const uint8_t *data = p.value(this->icmp6_data_).ptr(&data_len);
+    if (V6_HDR_LEN + data_len > BUF_SIZE) {
+      return 0;
+    }
+
+    ::memcpy(this->buf_, this->tmpl6_, V6_HDR_LEN);
+    auto *eth = reinterpret_cast<struct ether_header*>(this->buf_);
+    auto *ipv6 = reinterpret_cast<struct ipv6_header*>(eth + 1);
+    auto *icmp = reinterpret_cast<struct icmp_header*>(ipv6 + 1);
+
+    ::memcpy(eth->src_, p.value(this->ether_dst_).ptr(), ETHER_ADDR_LEN);
+    ::memcpy(eth->dst_, p.value(this->ether_src_).ptr(), ETHER_ADDR_LEN);
+
+    ipv6->data_len_ = htons(sizeof(struct icmp_header) + data_len);
+    ::memcpy(ipv6->src_, p.value(this->ipv6_dst_).ptr(), IPV6_ADDR_LEN);
+    ::memcpy(ipv6->dst_, p.value(this->ipv6_src_).ptr(), IPV6_ADDR_LEN);
+
+    // Pseudo header has the same sum because addresses are just swapped,
+    // so only type and code need to be updated.
+    const uint8_t req_tc[2] = {ICMP6_ECHO_REQUEST,
+                               p.value(this->icmp6_code_).ptr()[0]};
+    uint16_t m, m1, hc;
+    ::memcpy(&m, req_tc, sizeof(m));
+    ::memcpy(&m1, icmp, sizeof(m1));
+    ::memcpy(&hc, p.value(this->icmp6_chksum_).ptr(), sizeof(hc));
+    icmp->chksum_ = chksum_update(hc, m, m1);
+    ::memcpy(&icmp->id_, p.value(this->icmp6_id_).ptr(), sizeof(icmp->id_));
+    ::memcpy(&icmp->seq_, p.value(this->icmp6_seq_).ptr(),
+             sizeof(icmp->seq_));
+
+    if (data_len > 0) {
+      ::memcpy(icmp + 1, data, data_len);
+    }
+    return V6_HDR_LEN + data_len;
+  }
+
+  void IcmpHandler::reply(size_t len) {
+    if (0 > this->sock_->enqueue(this->buf_, len) && this->logger_) {
+      Event *msg = this->logger_->retain_message("lurker.error");
+      msg->set("message", this->sock_->errmsg());
+      msg->set("event", "icmp-echo-reply");
+      this->logger_->emit(msg);
+    }
+  }
+
+  void IcmpHandler::handle_echo(const swarm::Property &p, bool v6) {
+    size_t addr_len;
+    const void *addr = p.dst_addr(&addr_len);
+    if (!this->target_->has(addr, addr_len)) {
+      return;
+    }
+
+    if (this->logger_) {
+      Event *msg = this->logger_->retain_message("lurker.icmp_echo");
+      msg->set_ts(p.tv_sec());
+      const void *src = p.src_addr(&addr_len);
+      msg->set_addr("src_addr", src, addr_len);
+      msg->set_addr("dst_addr", addr, addr_len);
+      if (v6) {
+        msg->set("id", static_cast<int>(p.value(this->icmp6_id_).uint32()));
+        msg->set("seq", static_cast<int>(p.value(this->icmp6_seq_).uint32()));
+      } else {
+        msg->set("id", static_cast<int>(p.value(this->icmp_id_).uint32()));
+        msg->set("seq", static_cast<int>(p.value(this->icmp_seq_).uint32()));
+      }
+      this->set_dst_names(msg, p);
+      this->logger_->emit(msg);
+    }
+
+    if (this->sock_ && this->allow_reply(p)) {
+      size_t len = v6 ? this->build_echo6_reply(p) :
+        this->build_echo_reply(p);
+      if (len > 0) {
+        this->reply(len);
+      } else {
+        debug(DBG, "too large echo request");
+      }
+    }
+  }
+
+  void IcmpHandler::recv(swarm::ev_id eid, const swarm::Property &p) {
+    if (eid == this->echo_ev_) {
+      this->handle_echo(p, false);
+    } else if (eid == this->echo6_ev_) {
+      this->handle_echo(p, true);
+    }
+  }
+}
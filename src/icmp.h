@@ -0,0 +1,98 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_ICMP_H__
+#define SRC_ICMP_H__
+
+#include "./eventlog.h"
+#include "./swarm/swarm.h"
+#include "./rawsock.h"
+#include "./target.h"
+#include "./dnscache.h"
+
+namespace lurker {
+  // ----------------------------------------------------------------
+  // class IcmpHandler:
+  // Logs ICMP and ICMPv6 echo requests to target addresses and replies
+  // to them, so that ping sweeps see the targets as alive. A reply is
+  // built in a preallocated buffer from a header template. IPv4 header
+  // checksum is completed from the precomputed sum of the template, and
+  // ICMP checksum is updated incrementally from the request's one, so
+  // echo data is copied but never summed.
+  //
+  class IcmpHandler : public swarm::Handler {
+  public:
+    static const size_t DEFAULT_ECHO_RATE = 1000;  // replies per second
+
+  private:
+    static const size_t BUF_SIZE = 1514;
+    static const bool DBG = false;
+
+    swarm::Swarm *sw_;
+    swarm::ev_id echo_ev_, echo6_ev_;
+    swarm::hdlr_id echo_hdlr_id_, echo6_hdlr_id_;
+    swarm::val_id ether_src_, ether_dst_, ipv4_src_, ipv4_dst_, ipv6_src_,
+      ipv6_dst_;
+    swarm::val_id icmp_code_, icmp_chksum_, icmp_id_, icmp_seq_, icmp_data_;
+    swarm::val_id icmp6_code_, icmp6_chksum_, icmp6_id_, icmp6_seq_,
+      icmp6_data_;
+
+    RawSock *sock_;
+    const TargetSet *target_;
+    EventLog *logger_;
+    const DnsCache *dns_cache_;
+
+    uint8_t tmpl4_[BUF_SIZE];
+    uint8_t tmpl6_[BUF_SIZE];
+    uint32_t tmpl4_sum_;   // partial sum of IPv4 header template
+    uint8_t buf_[BUF_SIZE];
+    uint16_t ip_id_;
+
+    size_t echo_rate_;
+    time_t rate_sec_;
+    size_t rate_count_;
+
+    void set_dst_names(Event *msg, const swarm::Property &p);
+    bool allow_reply(const swarm::Property &p);
+    size_t build_echo_reply(const swarm::Property &p);
+    size_t build_echo6_reply(const swarm::Property &p);
+    void reply(size_t len);
+
+  public:
+    IcmpHandler(swarm::Swarm *sw, const TargetSet *target);
+    ~IcmpHandler();
+    void set_sock(RawSock *sock);
+    void set_logger(EventLog *logger);
+    void set_dns_cache(const DnsCache *dns_cache);
+    // Max number of echo replies in a second, 0 means unlimited.
+    void set_echo_rate(size_t rate) { this->echo_rate_ = rate; }
+    void recv(swarm::ev_id eid, const swarm::Property &p);
+    void handle_echo(const swarm::Property &p, bool v6);
+  };
+}
+
+
+#endif  // SRC_ICMP_H__
@@ -0,0 +1,286 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <time.h>
+#include <vector>
+#include <set>
+#include "./logsink.h"
+#include "./encoder.h"
+
+namespace lurker {
+  bool LogSink::writev_all(int fd, const struct iovec *iov, int iovcnt,
+                           bool sock) {
+    std::vector<struct iovec> v(iov, iov + iovcnt);
+    size_t i = 0;
+    while (i < v.size()) {
+      int n = (v.size() - i > IOV_MAX) ? IOV_MAX : v.size() - i;
+      ssize_t len;
+      if (sock) {
+        // No SIGPIPE when the peer has closed.
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = &v[i];
+        mh.msg_iovlen = n;
+        len = ::sendmsg(fd, &mh, MSG_NOSIGNAL);
+      } else {
+        len = ::writev(fd, &v[i], n);
+      }
+      if (len < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      // Skip written pieces and advance a partially written one.
+      size_t rest = len;
+      while (i < v.size() && rest >= v[i].iov_len) {
+        rest -= v[i].iov_len;
+        i++;
+      }
+      if (rest > 0) {
+        v[i].iov_base = static_cast<char*>(v[i].iov_base) + rest;
+        v[i].iov_len -= rest;
+      }
+    }
+    return true;
+  }
+
+
+  bool LogSink::write(Encoder *enc) {
+    const struct iovec *iov;
+    int iovcnt = enc->iovec(&iov);
+    return this->write(iov, iovcnt, enc->chunks());
+  }
+
+
+  FileSink::FileSink(int fd) : fd_(fd), own_(false) {
+  }
+  FileSink::FileSink() : fd_(-1), own_(false) {
+  }
+  FileSink::~FileSink() {
+    if (this->own_ && this->fd_ >= 0) {
+      ::close(this->fd_);
+    }
+  }
+
+  bool FileSink::open(const std::string &fpath) {
+    int fd = ::open(fpath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) {
+      this->errmsg_ = "can not open log file: " + fpath + ": " +
+        strerror(errno);
+      return false;
+    }
+    if (this->own_ && this->fd_ >= 0) {
+      ::close(this->fd_);
+    }
+    this->fd_ = fd;
+    this->own_ = true;
+    return true;
+  }
+
+  bool FileSink::write(const struct iovec *iov, int iovcnt) {
+    if (!LogSink::writev_all(this->fd_, iov, iovcnt)) {
+      this->errmsg_ = std::string("log file write error: ") +
+        strerror(errno);
+      return false;
+    }
+    return true;
+  }
+
+
+  ForwardSink::ForwardSink(const std::string &host, const std::string &port)
+    : host_(host), port_(port), sock_(-1),
+      ack_timeout_(DEFAULT_ACK_TIMEOUT) {
+  }
+  ForwardSink::~ForwardSink() {
+    this->disconnect();
+  }
+
+  bool ForwardSink::connect() {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int rc = getaddrinfo(this->host_.c_str(), this->port_.c_str(), &hints,
+                         &res);
+    if (rc != 0) {
+      this->errmsg_ = "can not resolve fluentd host " + this->host_ + ": " +
+        gai_strerror(rc);
+      return false;
+    }
+
+    for (struct addrinfo *ai = res; ai != nullptr; ai = ai->ai_next) {
+      int sock = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (sock < 0) {
+        continue;
+      }
+      if (::connect(sock, ai->ai_addr, ai->ai_addrlen) == 0) {
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        this->sock_ = sock;
+        break;
+      }
+      ::close(sock);
+    }
+    freeaddrinfo(res);
+
+    if (this->sock_ < 0) {
+      this->errmsg_ = "can not connect to fluentd " + this->host_ + ":" +
+        this->port_ + ": " + strerror(errno);
+      return false;
+    }
+    return true;
+  }
+
+  void ForwardSink::disconnect() {
+    if (this->sock_ >= 0) {
+      ::close(this->sock_);
+      this->sock_ = -1;
+    }
+    this->rbuf_.clear();
+  }
+
+  // Response {"ack": "<chunk id>"} at p. Returns its length, or 0 if
+  // incomplete; sets *bad if it is not a response.
+  static size_t parse_ack(const uint8_t *p, size_t len, std::string *id,
+                          bool *bad) {
+    size_t pos = 0;
+    std::string key;
+    if (len < 1) {
+      return 0;
+    }
+    if (p[pos++] != 0x81) {
+      *bad = true;
+      return 0;
+    }
+    for (int i = 0; i < 2; i++) {
+      std::string *dst = (i == 0) ? &key : id;
+      if (pos >= len) {
+        return 0;
+      }
+      size_t n;
+      uint8_t h = p[pos++];
+      if ((h & 0xe0) == 0xa0) {
+        n = h & 0x1f;
+      } else if (h == 0xd9 && pos + 1 <= len) {
+        n = p[pos++];
+      } else if (h == 0xd9) {
+        return 0;
+      } else {
+        *bad = true;
+        return 0;
+      }
+      if (pos + n > len) {
+        return 0;
+      }
+      dst->assign(reinterpret_cast<const char*>(p + pos), n);
+      pos += n;
+    }
+    if (key != "ack") {
+      *bad = true;
+      return 0;
+    }
+    return pos;
+  }
+
+  bool ForwardSink::wait_ack(const std::vector<std::string> &chunks) {
+    std::set<std::string> rest(chunks.begin(), chunks.end());
+    time_t limit = time(nullptr) + this->ack_timeout_;
+    uint8_t buf[512];
+    while (!rest.empty()) {
+      time_t now = time(nullptr);
+      struct pollfd pfd = {this->sock_, POLLIN, 0};
+      if (now >= limit || ::poll(&pfd, 1, (limit - now) * 1000) <= 0) {
+        this->errmsg_ = "no ack from fluentd " + this->host_;
+        return false;
+      }
+      ssize_t n = ::recv(this->sock_, buf, sizeof(buf), 0);
+      if (n <= 0) {
+        this->errmsg_ = "fluentd closed connection before ack";
+        return false;
+      }
+      this->rbuf_.insert(this->rbuf_.end(), buf, buf + n);
+
+      size_t pos = 0, len;
+      std::string id;
+      bool bad = false;
+      while ((len = parse_ack(this->rbuf_.data() + pos, this->rbuf_.size() - pos,
+                              &id, &bad)) > 0) {
+        rest.erase(id);
+        pos += len;
+      }
+      if (bad) {
+        this->errmsg_ = "invalid ack from fluentd " + this->host_;
+        return false;
+      }
+      this->rbuf_.erase(this->rbuf_.begin(), this->rbuf_.begin() + pos);
+    }
+    return true;
+  }
+
+  bool ForwardSink::write(const struct iovec *iov, int iovcnt) {
+    for (int retry = 0; retry < 2; retry++) {
+      if (this->sock_ < 0 && !this->connect()) {
+        return false;
+      }
+      if (LogSink::writev_all(this->sock_, iov, iovcnt, true)) {
+        return true;
+      }
+      this->errmsg_ = std::string("fluentd write error: ") + strerror(errno);
+      this->disconnect();
+    }
+    return false;
+  }
+
+  bool ForwardSink::write(const struct iovec *iov, int iovcnt,
+                          const std::vector<std::string> &chunks) {
+    if (chunks.empty()) {
+      return this->write(iov, iovcnt);
+    }
+
+    // Unacknowledged chunks are sent again on a new connection. The chunk
+    // id only selects the ack and fluentd does not deduplicate by it, so
+    // a batch that arrived but whose ack was lost is delivered twice
+    // (at-least-once delivery).
+    for (int retry = 0; retry < 2; retry++) {
+      if (this->write(iov, iovcnt) && this->wait_ack(chunks)) {
+        return true;
+      }
+      this->disconnect();
+    }
+    return false;
+  }
+}
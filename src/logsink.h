@@ -0,0 +1,106 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_LOGSINK_H__
+#define SRC_LOGSINK_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+namespace lurker {
+  class Encoder;
+
+  // ----------------------------------------------------------------
+  // class LogSink:
+  // Destination of encoded log events, written by the writer thread of
+  // EventLog one batch at a time.
+  //
+  class LogSink {
+  protected:
+    std::string errmsg_;
+    static bool writev_all(int fd, const struct iovec *iov, int iovcnt,
+                           bool sock = false);
+
+  public:
+    virtual ~LogSink() {}
+    virtual bool write(const struct iovec *iov, int iovcnt) = 0;
+    // Writes a batch with ids of chunks to be acknowledged by the
+    // receiver. Sinks without acknowledgment ignore chunks.
+    virtual bool write(const struct iovec *iov, int iovcnt,
+                       const std::vector<std::string> &chunks) {
+      return this->write(iov, iovcnt);
+    }
+    // Writes output of enc.
+    bool write(Encoder *enc);
+    const std::string &errmsg() const { return this->errmsg_; }
+  };
+
+  // Appends to a file, or writes to a given descriptor (e.g. stdout).
+  class FileSink : public LogSink {
+  private:
+    int fd_;
+    bool own_;
+
+  public:
+    explicit FileSink(int fd);
+    FileSink();
+    ~FileSink();
+    bool open(const std::string &fpath);
+    bool write(const struct iovec *iov, int iovcnt);
+  };
+
+  // Fluentd forward input over TCP. Connects on the first write and
+  // reconnects after an error; a batch failed twice is dropped. If the
+  // output has chunk ids (PackedForwardEncoder with ack), a batch is
+  // written only when all of them are acknowledged in ack_timeout.
+  // Delivery is at-least-once: a resent batch may be duplicated.
+  class ForwardSink : public LogSink {
+  public:
+    static const int DEFAULT_ACK_TIMEOUT = 30;  // seconds
+
+  private:
+    std::string host_, port_;
+    int sock_;
+    int ack_timeout_;
+    std::vector<uint8_t> rbuf_;
+    bool connect();
+    void disconnect();
+    bool wait_ack(const std::vector<std::string> &chunks);
+
+  public:
+    ForwardSink(const std::string &host, const std::string &port);
+    ~ForwardSink();
+    void set_ack_timeout(int sec) { this->ack_timeout_ = sec; }
+    bool write(const struct iovec *iov, int iovcnt);
+    bool write(const struct iovec *iov, int iovcnt,
+               const std::vector<std::string> &chunks);
+  };
+}
+
+
+#endif  // SRC_LOGSINK_H__
@@ -26,22 +26,52 @@
 
 #include <fstream>
 #include <iostream>
+#include <signal.h>
+#include <unistd.h>
 
 #include <fluent.hpp>
 #include "./lurker.h"
 #include "./debug.h"
+#include "./logsink.h"
+#include "./encoder.h"
 
 namespace lurker {
+  // sem_post() is async-signal-safe, so SIGHUP only wakes the reload
+  // thread of the Lurker that enabled it.
+  static sem_t *reload_signal_sem_ = nullptr;
+
+  static void reload_signal_handler(int signum) {
+    if (reload_signal_sem_) {
+      sem_post(reload_signal_sem_);
+    }
+  }
+
   Lurker::Lurker(const std::string &input, bool dry_run) : 
     sw_(nullptr), 
     spoofer_(nullptr),
     tcph_(nullptr),
+    icmph_(nullptr),
+    bannerh_(nullptr),
+    tarpit_(nullptr),
+    dnsh_(nullptr),
+    cookie_(nullptr),
     sock_(nullptr),
+    txflush_(nullptr),
+    tsync_(nullptr),
     dry_run_(dry_run),
-    logger_(nullptr)
+    stopping_(false),
+    logger_(nullptr),
+    evlog_(nullptr),
+    json_output_(false),
+    spool_(nullptr),
+    spool_mem_(SpoolSink::DEFAULT_MEM_BUDGET),
+    spool_disk_(SpoolSink::DEFAULT_DISK_BUDGET)
   {
+    sem_init(&this->reload_sem_, 0, 0);
+
     // Create Logger
     this->logger_ = new fluent::Logger();
+    this->evlog_ = new EventLog();
       
     // Create Swarm instance
     if (!this->dry_run_) {
@@ -52,59 +82,262 @@ namespace lurker {
     }
 
     this->tcph_ = new TcpHandler(this->sw_, &this->target_);
-    this->tcph_->set_logger(this->logger_);
+    this->tcph_->set_logger(this->evlog_);
+    this->icmph_ = new IcmpHandler(this->sw_, &this->target_);
+    this->icmph_->set_logger(this->evlog_);
+    this->bannerh_ = new BannerHandler(this->sw_, &this->target_);
+
+    // Passive DNS cache to annotate logs with names resolved to targets.
+    this->dnsh_ = new DnsCacheHandler(this->sw_, &this->dns_cache_);
+    this->tcph_->set_dns_cache(&this->dns_cache_);
+    this->icmph_->set_dns_cache(&this->dns_cache_);
+
+    // Lets replaced target tables be freed after each batch of packets,
+    // or after a while on an idle link.
+    this->tsync_ = new TargetSync(&this->target_);
+    this->sw_->set_batch_task(this->tsync_);
+    this->sw_->set_periodic_task(this->tsync_, 1.0);  // sec
     
     if (!this->dry_run_) {
+      this->txflush_ = new TxFlushTask(this->sock_);
+      this->sw_->set_batch_task(this->txflush_);
       this->tcph_->set_sock(this->sock_);
+      this->icmph_->set_sock(this->sock_);
+
+      // Sessions to targets are created only for handshakes completed
+      // with our SYN cookie.
+      this->cookie_ = new SynCookie(this->sw_, &this->target_);
+      this->tcph_->set_syn_cookie(this->cookie_);
+      this->bannerh_->set_syn_cookie(this->cookie_);
+      this->bannerh_->set_sock(this->sock_);
+      if (!this->sw_->set_session_filter("tcp_ssn", this->cookie_)) {
+        throw Exception("can not set session filter to tcp_ssn");
+      }
     }
   }
   Lurker::~Lurker() {
     delete this->tcph_;
+    delete this->icmph_;
+    delete this->bannerh_;
+    delete this->tarpit_;
+    delete this->dnsh_;
+    delete this->cookie_;
     delete this->spoofer_;
+    delete this->txflush_;
+    delete this->tsync_;
     delete this->sock_;
     delete this->sw_;
+    delete this->evlog_;
     delete this->logger_;
+    if (reload_signal_sem_ == &this->reload_sem_) {
+      signal(SIGHUP, SIG_DFL);
+      reload_signal_sem_ = nullptr;
+    }
+    sem_destroy(&this->reload_sem_);
   }
 
   void Lurker::add_target(const std::string &target) {
     if (!this->target_.insert(target)) {
       throw Exception(this->target_.errmsg());
     }    
+    this->target_arg_.push_back(target);
   }
 
   void Lurker::import_target(const std::string &target_file) {
-    std::ifstream ifs(target_file);
-    std::string buf;
-    
-    if (ifs.fail()) {
-      throw Exception("can not open target file: " + target_file);
+    if (!this->target_.import(target_file)) {
+      throw Exception(this->target_.errmsg());
+    }
+    this->target_file_.push_back(target_file);
+  }
+
+  void Lurker::reload_target() {
+    sem_post(&this->reload_sem_);
+  }
+
+  void Lurker::enable_reload_signal() {
+    reload_signal_sem_ = &this->reload_sem_;
+    signal(SIGHUP, reload_signal_handler);
+  }
+
+  void Lurker::reload() {
+    TargetSet fresh;
+    try {
+      for (size_t i = 0; i < this->target_arg_.size(); i++) {
+        if (!fresh.insert(this->target_arg_[i])) {
+          throw Exception(fresh.errmsg());
+        }
+      }
+      for (size_t i = 0; i < this->target_file_.size(); i++) {
+        if (!fresh.import(this->target_file_[i])) {
+          throw Exception(fresh.errmsg());
+        }
+      }
+      if (!fresh.compile()) {
+        throw Exception(fresh.errmsg());
+      }
+    } catch (const Exception &e) {
+      std::cerr << "target reload failed, keeping current targets: "
+                << e.what() << std::endl;
+      return;
     }
-    while (getline(ifs, buf)) {
-      if (buf.length() > 0) {
-        this->add_target(buf);
+
+    this->target_.replace(&fresh);
+    std::cerr << "Reloaded " << this->target_.count() << " targets"
+              << std::endl;
+  }
+
+  void* Lurker::reload_thread(void *obj) {
+    Lurker *lurker = static_cast<Lurker*>(obj);
+    while (true) {
+      if (sem_wait(&lurker->reload_sem_) != 0) {
+        continue;  // EINTR
       }
+      if (lurker->stopping_) {
+        break;
+      }
+      lurker->reload();
+
+      // Previous table is freed after capture thread passed a batch or a
+      // periodic tick.
+      lurker->target_.wait_reclaim();
+    }
+    return nullptr;
+  }
+
+  void Lurker::import_signature(const std::string &sig_file) {
+    if (!this->protoid_.load(sig_file)) {
+      throw Exception(this->protoid_.errmsg());
+    }
+  }
+
+  void Lurker::import_rule(const std::string &rule_file) {
+    if (!this->ruleset_.load(rule_file)) {
+      throw Exception(this->ruleset_.errmsg());
+    }
+  }
+
+  void Lurker::import_banner(const std::string &banner_file) {
+    if (!this->bannerh_->load(banner_file)) {
+      throw Exception(this->bannerh_->errmsg());
     }
   }
 
-  void Lurker::output_to_fluentd(const std::string &conf) {
+  void Lurker::enable_tarpit(size_t max_flows) {
+    if (this->dry_run_) {
+      return;
+    }
+    if (this->tarpit_ == nullptr) {
+      this->tarpit_ = new Tarpit(this->sw_, &this->target_);
+      this->tarpit_->set_sock(this->sock_);
+      this->tarpit_->set_syn_cookie(this->cookie_);
+    }
+    this->tarpit_->set_max_flows(max_flows);
+
+    // Tarpit keeps its own records, so tcp_ssn sessions are not needed.
+    this->cookie_->set_establish(false);
+    this->tcph_->set_synack_window(Tarpit::WINDOW);
+  }
+
+  void Lurker::enable_tx_ring(bool qdisc_bypass) {
+    if (this->dry_run_) {
+      return;
+    }
+    if (!this->sock_->enable_tx_ring(RawSock::DEFAULT_RING_FRAMES,
+                                     qdisc_bypass)) {
+      throw Exception(this->sock_->errmsg());
+    }
+  }
+
+  static PackedForwardEncoder::Compress
+  parse_compress(const std::string &compress) {
+    PackedForwardEncoder::Compress c = PackedForwardEncoder::NONE;
+    if (compress == "gzip") {
+      c = PackedForwardEncoder::GZIP;
+    } else if (compress == "zstd") {
+      c = PackedForwardEncoder::ZSTD;
+    } else if (!compress.empty()) {
+      throw Exception("unknown compression: " + compress);
+    }
+    if (!PackedForwardEncoder::supported(c)) {
+      throw Exception("compression not supported in this build: " +
+                      compress);
+    }
+    return c;
+  }
+
+  void Lurker::output_to_fluentd(const std::string &conf, bool packed,
+                                 const std::string &compress, bool ack) {
+    Encoder *enc = nullptr;
+    if (packed || !compress.empty() || ack) {
+      enc = new PackedForwardEncoder(parse_compress(compress), ack);
+    }
+
+    LogSink *sink;
     size_t p = conf.find(":");
     if (p != std::string::npos) {
       const std::string host = conf.substr(0, p);
       const std::string port = conf.substr(p + 1);
-      this->logger_->new_forward(host, port);
+      sink = new ForwardSink(host, port);
     } else {
       // conf is just hostname
-      this->logger_->new_forward(conf);
+      sink = new ForwardSink(conf, "24224");
+    }
+
+    if (!this->spool_dir_.empty()) {
+      SpoolSink *spool = new SpoolSink(sink, this->spool_dir_);
+      spool->set_budget(this->spool_mem_, this->spool_disk_);
+      if (!spool->open()) {
+        std::string errmsg = spool->errmsg();
+        delete spool;
+        delete enc;
+        throw Exception(errmsg);
+      }
+      this->spool_ = spool;
+      sink = spool;
     }
+    this->evlog_->add_sink(sink, enc);
   }
-  void Lurker::output_to_file(const std::string &fpath) {
-    if (fpath == "-") {
-      this->logger_->new_dumpfile(1); // Stdout
+  void Lurker::set_spool(const std::string &dir, size_t mem_budget,
+                         size_t disk_budget) {
+    this->spool_dir_ = dir;
+    this->spool_mem_ = mem_budget;
+    this->spool_disk_ = disk_budget;
+  }
+  void Lurker::output_to_file(const std::string &fpath,
+                              const std::string &compress,
+                              size_t rotate_bytes, time_t rotate_interval,
+                              const std::string &dict) {
+    LogSink *sink;
+    if (!compress.empty() || rotate_bytes > 0 || rotate_interval > 0) {
+      if (fpath == "-") {
+        throw Exception("stdout output can not be rotated or compressed");
+      }
+      RotatingFileSink *rsink =
+        new RotatingFileSink(fpath, parse_compress(compress));
+      rsink->set_rotate(rotate_bytes, rotate_interval);
+      if ((!dict.empty() && !rsink->load_dictionary(dict)) ||
+          !rsink->open()) {
+        std::string errmsg = rsink->errmsg();
+        delete rsink;
+        throw Exception(errmsg);
+      }
+      sink = rsink;
+    } else if (fpath == "-") {
+      sink = new FileSink(1); // Stdout
     } else {
-      this->logger_->new_dumpfile(fpath);
+      FileSink *fsink = new FileSink();
+      if (!fsink->open(fpath)) {
+        std::string errmsg = fsink->errmsg();
+        delete fsink;
+        throw Exception(errmsg);
+      }
+      sink = fsink;
     }
+    this->evlog_->add_sink(sink, this->json_output_ ?
+                           new JsonEncoder() : nullptr);
   }
   fluent::MsgQueue* Lurker::output_to_queue() {
+    this->evlog_->set_logger(this->logger_);
     return this->logger_->new_msgqueue();
   }
 
@@ -112,13 +345,51 @@ namespace lurker {
     if (this->target_.count() > 0) {
       RawSock *sock = (this->dry_run_ ? nullptr : this->sock_);
       this->spoofer_ = new StaticSpoofer(this->sw_, &this->target_,
-                                         this->logger_, sock);
+                                         this->evlog_, sock);
+      this->spoofer_->set_dns_cache(&this->dns_cache_);
+    }
+
+    if (!this->target_.compile()) {
+      throw Exception(this->target_.errmsg());
+    }
+
+    if (!this->protoid_.compile()) {
+      throw Exception(this->protoid_.errmsg());
+    }
+    this->tcph_->set_protoid(&this->protoid_);
+
+    if (this->ruleset_.size() > 0) {
+      if (!this->ruleset_.compile()) {
+        throw Exception(this->ruleset_.errmsg());
+      }
+      this->tcph_->set_ruleset(&this->ruleset_);
     }
     
     if (!this->sw_->ready()) {
       Exception("not ready");
     }
 
+    if (!this->evlog_->start()) {
+      throw Exception("can not start log writer thread");
+    }
+    if (pthread_create(&this->reload_th_, nullptr, Lurker::reload_thread,
+                       this) != 0) {
+      this->evlog_->stop();
+      throw Exception("can not start target reload thread");
+    }
+
     this->sw_->start();
+
+    this->stopping_ = true;
+    this->target_.interrupt();
+    sem_post(&this->reload_sem_);
+    pthread_join(this->reload_th_, nullptr);
+
+    // Queued events are written before returning, and the spool saves
+    // what it could not send, so that spool_drops() is final.
+    this->evlog_->stop();
+    if (this->spool_) {
+      this->spool_->close();
+    }
   }
 }
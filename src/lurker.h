@@ -29,15 +29,30 @@
 
 #include <sstream>
 #include <ostream>
+#include <vector>
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
 
 #include "./swarm/swarm.h"
 #include "./debug.h"
 #include "./rawsock.h"
 #include "./spoof.h"
 #include "./tcp.h"
+#include "./dnscache.h"
+#include "./protoid.h"
+#include "./rule.h"
+#include "./icmp.h"
+#include "./syncookie.h"
+#include "./banner.h"
+#include "./tarpit.h"
+#include "./eventlog.h"
+#include "./spool.h"
+#include "./rotate.h"
 
 namespace fluent {
   class Logger;
+  class MsgQueue;
 }
 
 namespace lurker {
@@ -55,26 +70,104 @@ namespace lurker {
     swarm::Swarm *sw_;
     Spoofer *spoofer_;
     TcpHandler *tcph_;
+    IcmpHandler *icmph_;
+    BannerHandler *bannerh_;
+    Tarpit *tarpit_;
+    DnsCacheHandler *dnsh_;
+    SynCookie *cookie_;
     RawSock *sock_;
+    TxFlushTask *txflush_;
+    TargetSync *tsync_;
     bool dry_run_;
     TargetSet target_;
+    std::vector<std::string> target_arg_;   // sources to reload targets
+    std::vector<std::string> target_file_;
+    pthread_t reload_th_;
+    sem_t reload_sem_;
+    std::atomic<bool> stopping_;
+    DnsCache dns_cache_;
+    ProtoIdent protoid_;
+    RuleSet ruleset_;
     fluent::Logger *logger_;
+    EventLog *evlog_;
+    bool json_output_;
+    SpoolSink *spool_;                 // owned by evlog_
+    std::string spool_dir_;
+    size_t spool_mem_, spool_disk_;
+
+    static void* reload_thread(void *obj);
+    void reload();
 
   public:
     Lurker(const std::string &tgt, bool dry_run=false);
     ~Lurker();
     void add_target(const std::string &target);
     void import_target(const std::string &target_file);
+    void import_signature(const std::string &sig_file);
+    void import_rule(const std::string &rule_file);
+    void import_banner(const std::string &banner_file);
     bool has_target() const { return (this->target_.count() > 0); }
-    void output_to_fluentd(const std::string &conf);
-    void output_to_file(const std::string &fpath);       
+    // With packed, events are sent in PackedForward messages, compressed
+    // by "gzip" or "zstd" if compress is given. ack waits for the
+    // receiver to acknowledge each message.
+    void output_to_fluentd(const std::string &conf, bool packed = false,
+                           const std::string &compress = "",
+                           bool ack = false);
+    // Write JSON lines instead of msgpack to files. Call before
+    // output_to_file().
+    void set_json_output(bool json) { this->json_output_ = json; }
+    // With compress ("gzip" or "zstd") or a rotation limit, output goes
+    // to segment files PATH.<time>[.gz|.zst] written in background;
+    // dict is a zstd dictionary file.
+    void output_to_file(const std::string &fpath,
+                        const std::string &compress = "",
+                        size_t rotate_bytes = 0, time_t rotate_interval = 0,
+                        const std::string &dict = "");
     fluent::MsgQueue* output_to_queue();
     
     // Use HEX string in log message instead of binary data.
     void enable_hexdata_log() { this->tcph_->enable_hexdata_log(); }
     void disable_hexdata_log() { this->tcph_->disable_hexdata_log(); }
     bool hexdata_log() const { return this->tcph_->hexdata_log(); }
+
+    // Log decoded application message instead of raw segment data.
+    void enable_decoded_log() { this->tcph_->enable_decoded_log(); }
+    void disable_decoded_log() { this->tcph_->disable_decoded_log(); }
+    bool decoded_log() const { return this->tcph_->decoded_log(); }
+
+    // Hold connections to targets with zero window (active mode only).
+    void enable_tarpit(size_t max_flows = Tarpit::DEFAULT_MAX_FLOWS);
+
+    // Log events are queued for a writer thread. Backlog is the size of
+    // the queue in bytes, and full queue drops events unless blocking.
+    void set_log_backlog(size_t size) { this->evlog_->set_backlog(size); }
+    void set_log_blocking(bool block) {
+      this->evlog_->set_overflow(block ? EventLog::BLOCK : EventLog::DROP);
+    }
+    uint64_t log_drops() const { return this->evlog_->drops(); }
+
+    // Fluentd output goes through a spool in dir, which keeps batches in
+    // memory and then on disk while fluentd is slow or down. Call before
+    // output_to_fluentd(). The spool is closed at the end of run().
+    void set_spool(const std::string &dir,
+                   size_t mem_budget = SpoolSink::DEFAULT_MEM_BUDGET,
+                   size_t disk_budget = SpoolSink::DEFAULT_DISK_BUDGET);
+    uint64_t spool_drops() const {
+      return (this->spool_ ? this->spool_->drops() : 0);
+    }
+
+    // Send replies through PACKET_TX_RING (active mode only).
+    void enable_tx_ring(bool qdisc_bypass = false);
+    uint64_t tx_drops() const {
+      return (this->sock_ ? this->sock_->tx_drops() : 0);
+    }
     
+    // Rebuild targets from the same arguments and files in background
+    // while running. reload_target() can be called from any thread, and
+    // enable_reload_signal() makes SIGHUP do the same.
+    void reload_target();
+    void enable_reload_signal();
+
     void run();
   };
 }
@@ -27,6 +27,7 @@
 #ifndef SRC_PKT_H__
 #define SRC_PKT_H__
 
+#include <string.h>
 #include <sstream>
 #include "./rawsock.h"
 
@@ -34,8 +35,10 @@ namespace lurker {
 
   static const u_int16_t ETHERTYPE_ARP =  0x0806;
   static const u_int16_t ETHERTYPE_IP  =  0x0800;
+  static const u_int16_t ETHERTYPE_IPV6 = 0x86DD;
   static const size_t ETHER_ADDR_LEN = 6;
   static const size_t IPV4_ADDR_LEN  = 4;
+  static const size_t IPV6_ADDR_LEN  = 16;
   struct ether_header {
     u_int8_t dst_[ETHER_ADDR_LEN];
     u_int8_t src_[ETHER_ADDR_LEN];
@@ -103,6 +106,79 @@ namespace lurker {
     u_int16_t chksum_;    // checksum
     u_int16_t urgptr_;    // urgent pointer
   } __attribute__((packed));  
+
+  struct ipv6_header {
+    u_int32_t flags_;      // version, traffic class, flow label
+    u_int16_t data_len_;   // payload length
+    u_int8_t  next_hdr_;   // next header
+    u_int8_t  hop_limit_;  // hop limit
+    u_int8_t  src_[IPV6_ADDR_LEN];
+    u_int8_t  dst_[IPV6_ADDR_LEN];
+  } __attribute__((packed));
+
+  struct pseudo_ipv6_header {
+    u_int8_t  src_[IPV6_ADDR_LEN];
+    u_int8_t  dst_[IPV6_ADDR_LEN];
+    u_int32_t len_;        // upper layer packet length
+    u_int8_t  x0_[3];
+    u_int8_t  next_hdr_;
+  } __attribute__((packed));
+
+  static const u_int8_t ICMP_ECHO_REPLY    = 0;
+  static const u_int8_t ICMP_ECHO_REQUEST  = 8;
+  static const u_int8_t ICMP6_ECHO_REQUEST = 128;
+  static const u_int8_t ICMP6_ECHO_REPLY   = 129;
+  static const u_int8_t ICMP6_NEIGHBOR_SOLICIT = 135;
+  static const u_int8_t ICMP6_NEIGHBOR_ADVERT  = 136;
+  struct icmp_header {
+    u_int8_t  type_;
+    u_int8_t  code_;
+    u_int16_t chksum_;    // checksum
+    u_int16_t id_;        // identifier (echo)
+    u_int16_t seq_;       // sequence number (echo)
+  } __attribute__((packed));
+
+  // Neighbor Advertisement with target link-layer address option
+  // (RFC 4861, 4.4).
+  static const u_int32_t ND_NA_FLAG_SOLICITED = 0x40000000;
+  static const u_int32_t ND_NA_FLAG_OVERRIDE  = 0x20000000;
+  static const u_int8_t  ND_OPT_TARGET_HW     = 2;
+  struct nd_advert {
+    u_int8_t  type_;
+    u_int8_t  code_;
+    u_int16_t chksum_;
+    u_int32_t flags_;
+    u_int8_t  target_[IPV6_ADDR_LEN];
+    u_int8_t  opt_type_;
+    u_int8_t  opt_len_;    // in units of 8 octets
+    u_int8_t  hw_addr_[ETHER_ADDR_LEN];
+  } __attribute__((packed));
+
+  // One's complement sum of 16 bit words (RFC 1071). Words are summed in
+  // network byte order as they are in the packet. len must be even.
+  inline uint32_t chksum_add(uint32_t sum, const void *ptr, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t*>(ptr);
+    for (size_t i = 0; i + 1 < len; i += 2) {
+      uint16_t w;
+      ::memcpy(&w, p + i, sizeof(w));
+      sum += w;
+    }
+    return sum;
+  }
+  inline uint16_t chksum_fold(uint32_t sum) {
+    while (sum >> 16) {
+      sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+  }
+  // Update checksum hc for a 16 bit word changed from m to m1 without
+  // summing the whole data again (RFC 1624, eqn. 3).
+  inline uint16_t chksum_update(uint16_t hc, uint16_t m, uint16_t m1) {
+    uint32_t sum = static_cast<uint16_t>(~hc);
+    sum += static_cast<uint16_t>(~m);
+    sum += m1;
+    return chksum_fold(sum);
+  }
 }
 
 
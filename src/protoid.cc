@@ -0,0 +1,309 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "./protoid.h"
+
+namespace lurker {
+  struct BuiltinSignature {
+    const char *proto_;
+    int offset_;
+    const char *pattern_;
+    size_t len_;
+  };
+
+#define SIG(proto, offset, pattern) \
+  {(proto), (offset), (pattern), sizeof(pattern) - 1}
+
+  // Specific signatures first, because the first matched one is chosen.
+  static const BuiltinSignature BUILTIN_SIGNATURE[] = {
+    SIG("sip", 0, "OPTIONS sip:"),
+    SIG("sip", 0, "REGISTER sip:"),
+    SIG("sip", 0, "INVITE sip:"),
+    SIG("rtsp", 0, "OPTIONS rtsp://"),
+    SIG("rtsp", 0, "DESCRIBE rtsp://"),
+    SIG("http2", 0, "PRI * HTTP/2.0\r\n"),
+    SIG("http", 0, "GET "),
+    SIG("http", 0, "POST "),
+    SIG("http", 0, "HEAD "),
+    SIG("http", 0, "PUT "),
+    SIG("http", 0, "DELETE "),
+    SIG("http", 0, "OPTIONS "),
+    SIG("http", 0, "CONNECT "),
+    SIG("http", 0, "TRACE "),
+    SIG("http", 0, "PATCH "),
+    SIG("http", 0, "PROPFIND "),
+    SIG("tls", 0, "\x16\x03\x00"),
+    SIG("tls", 0, "\x16\x03\x01"),
+    SIG("tls", 0, "\x16\x03\x02"),
+    SIG("tls", 0, "\x16\x03\x03"),
+    SIG("ssh", 0, "SSH-"),
+    SIG("smb", 4, "\xffSMB"),
+    SIG("smb", 4, "\xfeSMB"),
+    SIG("netbios-ssn", 0, "\x81\x00\x00"),
+    SIG("rdp", -1, "Cookie: mstshash="),
+    SIG("rdp", 0, "\x03\x00\x00\x13\x0e\xe0"),
+    SIG("rdp", 0, "\x03\x00\x00\x2b\x26\xe0"),
+    SIG("ntlmssp", -1, "NTLMSSP\0"),
+    SIG("redis", 0, "*1\r\n$"),
+    SIG("redis", 0, "*2\r\n$"),
+    SIG("redis", 0, "*3\r\n$"),
+    SIG("redis", 0, "PING\r\n"),
+    SIG("redis", 0, "INFO\r\n"),
+    SIG("memcached", 0, "stats\r\n"),
+    SIG("memcached", 0, "version\r\n"),
+    SIG("mongodb", 12, "\xd4\x07\x00\x00"),
+    SIG("mongodb", 12, "\xdd\x07\x00\x00"),
+    SIG("mssql", 0, "\x12\x01\x00"),
+    SIG("postgresql", 0, "\x00\x00\x00\x08\x04\xd2\x16\x2f"),
+    SIG("postgresql", 4, "\x00\x03\x00\x00user\0"),
+    SIG("mqtt", 2, "\x00\x04MQTT"),
+    SIG("mqtt", 3, "\x00\x04MQTT"),
+    SIG("vnc", 0, "RFB 003."),
+    SIG("jdwp", 0, "JDWP-Handshake"),
+    SIG("adb", 0, "CNXN"),
+    SIG("bitcoin", 0, "\xf9\xbe\xb4\xd9"),
+    SIG("x11", 0, "l\x00\x0b\x00"),
+    SIG("x11", 0, "B\x00\x00\x0b"),
+    SIG("smtp", 0, "EHLO "),
+    SIG("smtp", 0, "HELO "),
+    SIG("ftp", 0, "USER "),
+    SIG("imap", -1, " CAPABILITY\r\n"),
+    SIG("socks5", 0, "\x05\x01\x00"),
+    SIG("socks5", 0, "\x05\x02\x00\x02"),
+    SIG("socks4", 0, "\x04\x01\x00"),
+    SIG("telnet", 0, "\xff\xfb"),
+    SIG("telnet", 0, "\xff\xfc"),
+    SIG("telnet", 0, "\xff\xfd"),
+    SIG("telnet", 0, "\xff\xfe"),
+  };
+
+#undef SIG
+
+  ProtoIdent::ProtoIdent() {
+  }
+  ProtoIdent::~ProtoIdent() {
+  }
+
+  bool ProtoIdent::add(const std::string &proto, const void *pattern,
+                       size_t len, int offset) {
+    if (this->ac_.compiled()) {
+      this->errmsg_ = "signatures are already compiled";
+      return false;
+    }
+    if (len == 0 || len > DEPTH ||
+        (offset >= 0 && offset + len > DEPTH)) {
+      std::stringstream ss;
+      ss << "signature of " << proto << " is out of inspected range";
+      this->errmsg_ = ss.str();
+      return false;
+    }
+
+    size_t idx;
+    auto it = this->proto_idx_.find(proto);
+    if (it == this->proto_idx_.end()) {
+      idx = this->proto_.size();
+      this->proto_.push_back(proto);
+      this->proto_idx_.insert(std::make_pair(proto, idx));
+    } else {
+      idx = it->second;
+    }
+
+    this->ac_.add(pattern, len, this->sig_proto_.size());
+    this->sig_proto_.push_back(idx);
+    this->sig_offset_.push_back((offset < 0) ? -1 : offset);
+    return true;
+  }
+
+  bool unescape_pattern(const std::string &src, std::string *dst) {
+    for (size_t i = 0; i < src.length(); i++) {
+      if (src[i] != '\\') {
+        dst->push_back(src[i]);
+        continue;
+      }
+
+      if (++i >= src.length()) {
+        return false;
+      }
+      switch (src[i]) {
+      case 'r': dst->push_back('\r'); break;
+      case 'n': dst->push_back('\n'); break;
+      case 't': dst->push_back('\t'); break;
+      case '0': dst->push_back('\0'); break;
+      case '\\': dst->push_back('\\'); break;
+      case '"': dst->push_back('"'); break;
+      case 'x':
+        if (i + 2 < src.length() &&
+            isxdigit(src[i + 1]) && isxdigit(src[i + 2])) {
+          dst->push_back(static_cast<char>
+                         (strtol(src.substr(i + 1, 2).c_str(), nullptr, 16)));
+          i += 2;
+        } else {
+          return false;
+        }
+        break;
+      default:
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool ProtoIdent::load(const std::string &fpath) {
+    std::ifstream ifs(fpath);
+    if (ifs.fail()) {
+      this->errmsg_ = "can not open signature file: " + fpath;
+      return false;
+    }
+
+    std::string line;
+    size_t lineno = 0;
+    while (getline(ifs, line)) {
+      lineno++;
+      size_t s = line.find_first_not_of(" \t");
+      if (s == std::string::npos || line[s] == '#') {
+        continue;
+      }
+
+      std::stringstream ss(line);
+      std::string proto, offset;
+      ss >> proto >> offset;
+      size_t q1 = line.find('"');
+      size_t q2 = line.rfind('"');
+      std::string pattern;
+      char *e;
+      int off = -1;
+      if (offset != "*") {
+        off = strtol(offset.c_str(), &e, 0);
+        if (offset.empty() || *e != '\0' || off < 0) {
+          off = -2;
+        }
+      }
+
+      if (q1 == std::string::npos || q1 == q2 || off == -2 ||
+          !unescape_pattern(line.substr(q1 + 1, q2 - q1 - 1), &pattern)) {
+        std::stringstream es;
+        es << "invalid signature at " << fpath << ":" << lineno;
+        this->errmsg_ = es.str();
+        return false;
+      }
+
+      if (!this->add(proto, pattern.data(), pattern.length(), off)) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool ProtoIdent::compile() {
+    // Built-in signatures are added last, so user's ones take priority.
+    const size_t n = sizeof(BUILTIN_SIGNATURE) / sizeof(BUILTIN_SIGNATURE[0]);
+    for (size_t i = 0; i < n && !this->ac_.compiled(); i++) {
+      const BuiltinSignature &s = BUILTIN_SIGNATURE[i];
+      this->add(s.proto_, s.pattern_, s.len_, s.offset_);
+    }
+
+    if (!this->ac_.compile()) {
+      this->errmsg_ = "failed to compile protocol signatures";
+      return false;
+    }
+    return true;
+  }
+
+  class SignatureMatch : public swarm::AhoCorasick::Callback {
+  private:
+    const swarm::AhoCorasick &ac_;
+    const std::vector<int> &sig_offset_;
+    uint32_t offset_;
+
+  public:
+    int best_;
+    SignatureMatch(const swarm::AhoCorasick &ac,
+                   const std::vector<int> &sig_offset, uint32_t offset) :
+      ac_(ac), sig_offset_(sig_offset), offset_(offset), best_(-1) {
+    }
+    bool match(int pat_id, size_t end) {
+      if (this->best_ >= 0 && this->best_ < pat_id) {
+        return true;  // lower priority
+      }
+      int sig_offset = this->sig_offset_[pat_id];
+      size_t start = this->offset_ + end - this->ac_.pattern_len(pat_id);
+      if (sig_offset < 0 || static_cast<size_t>(sig_offset) == start) {
+        this->best_ = pat_id;
+      }
+      return (this->best_ != 0);  // nothing can beat the first signature
+    }
+  };
+
+  const char *ProtoIdent::identify(State *st, const void *data, size_t len,
+                                   uint32_t offset) const {
+    if (st->done_ || !this->ac_.compiled()) {
+      return this->name(*st);
+    }
+
+    const uint8_t *ptr = static_cast<const uint8_t*>(data);
+    if (offset < st->next_) {
+      // Retransmitted data. Skip bytes that were already inspected.
+      uint32_t d = st->next_ - offset;
+      if (d >= len) {
+        return nullptr;
+      }
+      ptr += d;
+      len -= d;
+      offset = st->next_;
+    } else if (offset > st->next_) {
+      // Lost segment. Patterns can not continue across the gap.
+      st->ac_state_ = swarm::AhoCorasick::ROOT;
+    }
+
+    if (offset >= DEPTH) {
+      st->done_ = 1;
+      return nullptr;
+    }
+
+    size_t n = std::min(len, DEPTH - offset);
+    SignatureMatch m(this->ac_, this->sig_offset_, offset);
+    st->ac_state_ = this->ac_.scan(ptr, n, &m, st->ac_state_);
+    st->next_ = offset + n;
+
+    if (m.best_ >= 0) {
+      st->proto_ = this->sig_proto_[m.best_] + 1;
+      st->done_ = 1;
+      return this->name(*st);
+    }
+
+    if (st->next_ >= DEPTH) {
+      st->done_ = 1;
+    }
+    return nullptr;
+  }
+}
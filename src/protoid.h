@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2014 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_PROTOID_H__
+#define SRC_PROTOID_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "./swarm/utils/aho-corasick.h"
+
+namespace lurker {
+  // Decode \xNN, \r, \n, \t, \0, \\ and \" escapes of a pattern string.
+  bool unescape_pattern(const std::string &src, std::string *dst);
+
+  // ----------------------------------------------------------------
+  // class ProtoIdent:
+  // Identifies application protocol from the first DEPTH bytes of client
+  // data in a TCP session. Signatures are literal byte patterns with an
+  // offset from the beginning of the stream (or -1 for anywhere) and are
+  // compiled into one Aho-Corasick automaton. If several signatures
+  // match, the one registered first wins. Built-in signatures are added by
+  // compile() after the ones given by add() and load().
+  //
+  class ProtoIdent {
+  public:
+    static const size_t DEPTH = 256;  // inspected bytes of client stream
+
+    // Per-session matching state, zero filled at session creation.
+    struct State {
+      uint32_t ac_state_;
+      uint32_t next_;    // expected stream offset of next segment
+      uint16_t proto_;   // index of protocol + 1, 0 is unknown
+      uint8_t done_;
+    };
+
+  private:
+    // Signature index is pattern ID of ac_ and also its priority.
+    std::vector<size_t> sig_proto_;
+    std::vector<int> sig_offset_;
+    std::vector<std::string> proto_;
+    std::map<std::string, size_t> proto_idx_;
+    swarm::AhoCorasick ac_;
+    std::string errmsg_;
+
+  public:
+    ProtoIdent();
+    ~ProtoIdent();
+    bool add(const std::string &proto, const void *pattern, size_t len,
+             int offset);
+    // Signature file format is one signature per line:
+    //   <protocol> <offset|*> "<pattern>"
+    // Pattern accepts \xNN, \r, \n, \t, \0, \\ and \" escapes.
+    bool load(const std::string &fpath);
+    bool compile();
+    size_t size() const { return this->sig_proto_.size(); }
+    const std::string &errmsg() const { return this->errmsg_; }
+
+    // Feed a client segment starting at stream offset. Returns protocol
+    // name if identified (now or by a former segment), nullptr otherwise.
+    const char *identify(State *st, const void *data, size_t len,
+                         uint32_t offset) const;
+    // Protocol name already identified by the state or nullptr.
+    const char *name(const State &st) const {
+      return (st.proto_ > 0) ? this->proto_[st.proto_ - 1].c_str() : nullptr;
+    }
+  };
+}
+
+#endif  // SRC_PROTOID_H__
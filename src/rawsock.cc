@@ -65,6 +65,8 @@
 #include <sys/socket.h>
 #include <net/if.h>
 #include <netinet/ether.h>
+#include <sys/mman.h>
+#include <errno.h>
 
 #elif __unix // all unices not caught above
 // Unix
@@ -77,13 +79,21 @@
 
 namespace lurker {
   RawSock::RawSock(const std::string &dev_name) : 
-    sock_(0), dev_name_(dev_name), hw_addr_set_(false), pr_addr_set_(false) {
+    sock_(0), txq_count_(0), ring_(nullptr), ring_size_(0), ring_frames_(0),
+    ring_head_(0), ring_pending_(0), tx_drops_(0), dev_name_(dev_name),
+    hw_addr_set_(false), pr_addr_set_(false) {
     if (!this->open()) {
       std::cerr << this->err_.str() << std::endl;
     }
   }
   RawSock::~RawSock() {
     if (this->sock_ > 0) {
+      this->flush();
+#ifdef __linux
+      if (this->ring_) {
+        munmap(this->ring_, this->ring_size_);
+      }
+#endif
       ::close(this->sock_);
     }
   }
@@ -109,6 +119,27 @@ namespace lurker {
     return (this->pr_addr_set_) ? this->pr_addr_ : nullptr;
   }
 
+  int RawSock::enqueue(const void *ptr, size_t len) {
+    if (this->ring_) {
+      return this->ring_enqueue(ptr, len);
+    }
+
+    if (len > TXQ_FRAME_LEN) {
+      if (this->flush() < 0) {
+        return -1;
+      }
+      return this->write(const_cast<void*>(ptr), len);
+    }
+
+    if (this->txq_count_ == TXQ_LEN && this->flush() < 0) {
+      return -1;
+    }
+    memcpy(this->txq_[this->txq_count_], ptr, len);
+    this->txq_len_[this->txq_count_] = len;
+    this->txq_count_++;
+    return len;
+  }
+
   bool RawSock::get_pr_addr(const std::string &dev_name, uint8_t *pr_addr,
                             size_t len) {
     int fd;
@@ -220,6 +251,29 @@ namespace lurker {
     return rc;
   }
 
+  bool RawSock::enable_tx_ring(size_t frames, bool qdisc_bypass) {
+    this->err_ << "PACKET_TX_RING is not supported";
+    return false;
+  }
+  int RawSock::ring_enqueue(const void *ptr, size_t len) {
+    return -1;
+  }
+  int RawSock::ring_flush() {
+    return -1;
+  }
+
+  int RawSock::flush() {
+    size_t n = this->txq_count_;
+    this->txq_count_ = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (::write(this->sock_, this->txq_[i], this->txq_len_[i]) < 0) {
+        this->err_ << strerror(errno);
+        return -1;
+      }
+    }
+    return n;
+  }
+
 #elif __linux
 // linux
 
@@ -275,6 +329,143 @@ namespace lurker {
     return rc;
   }
 
+  bool RawSock::enable_tx_ring(size_t frames, bool qdisc_bypass) {
+    if (this->ring_) {
+      return true;
+    }
+    if (this->flush() < 0) {
+      return false;
+    }
+
+    int ver = TPACKET_V2;
+    if (setsockopt(this->sock_, SOL_PACKET, PACKET_VERSION, &ver,
+                   sizeof(ver)) < 0) {
+      this->err_ << "setsockopt, PACKET_VERSION: " << strerror(errno);
+      return false;
+    }
+
+    if (qdisc_bypass) {
+#ifdef PACKET_QDISC_BYPASS
+      int val = 1;
+      if (setsockopt(this->sock_, SOL_PACKET, PACKET_QDISC_BYPASS, &val,
+                     sizeof(val)) < 0) {
+        this->err_ << "setsockopt, PACKET_QDISC_BYPASS: " << strerror(errno);
+        return false;
+      }
+#else
+      this->err_ << "PACKET_QDISC_BYPASS is not supported";
+      return false;
+#endif
+    }
+
+    // Ring is made of whole blocks of frames.
+    const size_t per_block = RING_BLOCK_SIZE / RING_FRAME_SIZE;
+    size_t blocks = (frames + per_block - 1) / per_block;
+    if (blocks == 0) {
+      blocks = 1;
+    }
+    struct tpacket_req req;
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = RING_BLOCK_SIZE;
+    req.tp_block_nr = blocks;
+    req.tp_frame_size = RING_FRAME_SIZE;
+    req.tp_frame_nr = blocks * per_block;
+    if (setsockopt(this->sock_, SOL_PACKET, PACKET_TX_RING, &req,
+                   sizeof(req)) < 0) {
+      this->err_ << "setsockopt, PACKET_TX_RING: " << strerror(errno);
+      return false;
+    }
+
+    size_t size = req.tp_block_size * req.tp_block_nr;
+    void *ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                      this->sock_, 0);
+    if (ring == MAP_FAILED) {
+      this->err_ << "mmap: " << strerror(errno);
+      return false;
+    }
+
+    this->ring_ = static_cast<uint8_t*>(ring);
+    this->ring_size_ = size;
+    this->ring_frames_ = req.tp_frame_nr;
+    this->ring_head_ = 0;
+    this->ring_pending_ = 0;
+    return true;
+  }
+
+  int RawSock::ring_enqueue(const void *ptr, size_t len) {
+    // Frame data starts where the kernel expects it for TPACKET_V2.
+    static const size_t data_off =
+      TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+    if (data_off + len > RING_FRAME_SIZE) {
+      this->err_ << "frame too large for tx ring: " << len;
+      return -1;
+    }
+
+    uint8_t *frame = this->ring_ + this->ring_head_ * RING_FRAME_SIZE;
+    auto *hdr = reinterpret_cast<struct tpacket2_hdr*>(frame);
+    if (hdr->tp_status != TP_STATUS_AVAILABLE &&
+        hdr->tp_status != TP_STATUS_WRONG_FORMAT) {
+      // Kernel has not sent this slot yet, so the ring is full. Frames
+      // already there are kicked but this one is dropped, not waited on.
+      this->ring_flush();
+      this->tx_drops_++;
+      return 0;
+    }
+
+    memcpy(frame + data_off, ptr, len);
+    hdr->tp_len = len;
+    __sync_synchronize();
+    hdr->tp_status = TP_STATUS_SEND_REQUEST;
+    this->ring_head_ = (this->ring_head_ + 1) % this->ring_frames_;
+    this->ring_pending_++;
+    return len;
+  }
+
+  int RawSock::ring_flush() {
+    size_t n = this->ring_pending_;
+    if (n == 0) {
+      return 0;
+    }
+    this->ring_pending_ = 0;
+    if (::send(this->sock_, nullptr, 0, MSG_DONTWAIT) < 0 &&
+        errno != EAGAIN && errno != ENOBUFS) {
+      this->err_ << "send: " << strerror(errno);
+      return -1;
+    }
+    return n;
+  }
+
+  int RawSock::flush() {
+    if (this->ring_) {
+      return this->ring_flush();
+    }
+
+    struct mmsghdr msg[TXQ_LEN];
+    struct iovec iov[TXQ_LEN];
+    size_t n = this->txq_count_;
+    this->txq_count_ = 0;
+
+    memset(msg, 0, sizeof(struct mmsghdr) * n);
+    for (size_t i = 0; i < n; i++) {
+      iov[i].iov_base = this->txq_[i];
+      iov[i].iov_len = this->txq_len_[i];
+      msg[i].msg_hdr.msg_iov = &iov[i];
+      msg[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // sendmmsg() may send only a part; the rest is retried.
+    size_t sent = 0;
+    while (sent < n) {
+      int rc = ::sendmmsg(this->sock_, msg + sent, n - sent, 0);
+      if (rc < 0) {
+        this->err_ << "sendmmsg: " << strerror(errno);
+        return -1;
+      }
+      sent += rc;
+    }
+    return n;
+  }
+
 #elif __unix // all unices not caught above
 // Unix
 #error
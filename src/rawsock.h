@@ -28,11 +28,35 @@
 #define SRC_RAWSOCK_H__
 
 #include <sstream>
+#include <stdint.h>
+#include "./swarm/swarm.h"
 
 namespace lurker {
   class RawSock {
+  public:
+    // Small frames (ARP, SYN-ACK, neighbor advertisement) can be queued
+    // and sent together by flush().
+    static const size_t TXQ_LEN = 64;
+    static const size_t TXQ_FRAME_LEN = 128;
+    // PACKET_TX_RING mode (Linux): frames are written into the mmapped
+    // ring instead, and flush() kicks the kernel with one send().
+    static const size_t DEFAULT_RING_FRAMES = 1024;
+    static const size_t RING_FRAME_SIZE = 2048;
+    static const size_t RING_BLOCK_SIZE = 1 << 16;
+
   private:    
     int sock_;
+    uint8_t txq_[TXQ_LEN][TXQ_FRAME_LEN];
+    size_t txq_len_[TXQ_LEN];
+    size_t txq_count_;
+    uint8_t *ring_;
+    size_t ring_size_;
+    size_t ring_frames_;
+    size_t ring_head_;
+    size_t ring_pending_;
+    uint64_t tx_drops_;
+    int ring_enqueue(const void *ptr, size_t len);
+    int ring_flush();
     std::stringstream err_;
     std::string errmsg_;
     const std::string &dev_name_;
@@ -51,10 +75,35 @@ namespace lurker {
     bool open();
     bool ready();
     int write(void *ptr, size_t len);
+    // Copies a frame into the queue, flushing it first if full. A frame
+    // too large to queue is written at once after the queued ones. In tx
+    // ring mode, returns 0 if the frame is dropped because the ring is
+    // full (counted in tx_drops()).
+    int enqueue(const void *ptr, size_t len);
+    // Sends queued frames, with one system call where possible. Returns
+    // number of frames sent, or -1 if sending failed.
+    int flush();
+    // Switches to PACKET_TX_RING mode, optionally bypassing the qdisc
+    // layer (PACKET_QDISC_BYPASS). Returns false if not available.
+    bool enable_tx_ring(size_t frames = DEFAULT_RING_FRAMES,
+                        bool qdisc_bypass = false);
+    bool tx_ring() const { return (this->ring_ != nullptr); }
+    // Number of frames dropped because the ring was full.
+    uint64_t tx_drops() const { return this->tx_drops_; }
     const std::string &errmsg();
     const uint8_t* hw_addr() const;
     const uint8_t* pr_addr() const;
   };
+
+  // Flushes frames queued to the socket at the end of each batch of
+  // captured packets.
+  class TxFlushTask : public swarm::Task {
+  private:
+    RawSock *sock_;
+  public:
+    explicit TxFlushTask(RawSock *sock) : sock_(sock) {}
+    void exec(const struct timespec &tv) { this->sock_->flush(); }
+  };
 }
 
 
@@ -0,0 +1,423 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <iostream>
+#include "./rotate.h"
+
+namespace lurker {
+  const char RotatingFileSink::IDX_MAGIC[9] = "LRKIDX01";
+  static const size_t OUT_BYTES = 1 << 18;
+  static const uint32_t ZSTD_SKIPPABLE = 0x184D2A5B;
+
+  static void put_le(std::vector<uint8_t> *buf, uint64_t v, int len) {
+    for (int i = 0; i < len; i++) {
+      buf->push_back(static_cast<uint8_t>(v >> (i * 8)));
+    }
+  }
+
+  RotatingFileSink::RotatingFileSink(const std::string &path,
+                                     Compress compress) :
+    path_(path), compress_(compress), level_(0),
+    rotate_bytes_(DEFAULT_ROTATE_BYTES), rotate_interval_(0),
+    stopping_(false), running_(false), fd_(-1), opened_(0), written_(0),
+    raw_(0), frame_raw_(0), codec_(nullptr) {
+  }
+  RotatingFileSink::~RotatingFileSink() {
+    this->close();
+    if (this->codec_ == nullptr) {
+      return;
+    }
+    if (this->compress_ == PackedForwardEncoder::GZIP) {
+      z_stream *zs = static_cast<z_stream*>(this->codec_);
+      deflateEnd(zs);
+      delete zs;
+    }
+#ifdef HAVE_ZSTD
+    if (this->compress_ == PackedForwardEncoder::ZSTD) {
+      ZSTD_freeCCtx(static_cast<ZSTD_CCtx*>(this->codec_));
+    }
+#endif
+  }
+
+  void RotatingFileSink::set_rotate(size_t bytes, time_t interval) {
+    this->rotate_bytes_ = bytes;
+    this->rotate_interval_ = interval;
+  }
+
+  bool RotatingFileSink::load_dictionary(const std::string &fpath) {
+    if (this->compress_ != PackedForwardEncoder::ZSTD) {
+      this->errmsg_ = "dictionary is only for zstd output";
+      return false;
+    }
+    std::ifstream ifs(fpath.c_str(), std::ios::binary);
+    if (!ifs.is_open()) {
+      this->errmsg_ = "can not open dictionary: " + fpath;
+      return false;
+    }
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    this->dict_ = ss.str();
+    return true;
+  }
+
+  const char *RotatingFileSink::suffix() const {
+    switch (this->compress_) {
+    case PackedForwardEncoder::GZIP: return ".gz";
+    case PackedForwardEncoder::ZSTD: return ".zst";
+    default: return "";
+    }
+  }
+
+  bool RotatingFileSink::open() {
+    if (!PackedForwardEncoder::supported(this->compress_)) {
+      this->errmsg_ = "zstd is not supported in this build";
+      return false;
+    }
+
+    if (this->compress_ == PackedForwardEncoder::GZIP) {
+      z_stream *zs = new z_stream;
+      memset(zs, 0, sizeof(*zs));
+      int level = (this->level_ > 0 ? this->level_ : Z_DEFAULT_COMPRESSION);
+      if (deflateInit2(zs, level, Z_DEFLATED, 15 + 16, 8,
+                       Z_DEFAULT_STRATEGY) != Z_OK) {
+        delete zs;
+        this->errmsg_ = "can not initialize gzip";
+        return false;
+      }
+      this->codec_ = zs;
+    }
+#ifdef HAVE_ZSTD
+    if (this->compress_ == PackedForwardEncoder::ZSTD) {
+      ZSTD_CCtx *zc = ZSTD_createCCtx();
+      if (this->level_ > 0) {
+        ZSTD_CCtx_setParameter(zc, ZSTD_c_compressionLevel, this->level_);
+      }
+      // Frames are compressed independently, so the window covers a
+      // whole frame; the dictionary helps at its start.
+      int wlog = 10;
+      while ((static_cast<size_t>(1) << wlog) < FRAME_BYTES) {
+        wlog++;
+      }
+      ZSTD_CCtx_setParameter(zc, ZSTD_c_windowLog, wlog);
+      ZSTD_CCtx_setParameter(zc, ZSTD_c_enableLongDistanceMatching, 1);
+      if (!this->dict_.empty()) {
+        size_t rc = ZSTD_CCtx_loadDictionary(zc, this->dict_.data(),
+                                             this->dict_.size());
+        if (ZSTD_isError(rc)) {
+          ZSTD_freeCCtx(zc);
+          this->errmsg_ = std::string("invalid zstd dictionary: ") +
+            ZSTD_getErrorName(rc);
+          return false;
+        }
+      }
+      this->codec_ = zc;
+    }
+#endif
+    this->out_.resize(OUT_BYTES);
+
+    if (pthread_create(&this->th_, nullptr, RotatingFileSink::writer_thread,
+                       this) != 0) {
+      this->errmsg_ = std::string("can not start file writer thread: ") +
+        strerror(errno);
+      return false;
+    }
+    this->running_ = true;
+    return true;
+  }
+
+  void RotatingFileSink::close() {
+    if (!this->running_) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lk(this->lock_);
+      this->stopping_ = true;
+    }
+    this->cond_.notify_one();
+    pthread_join(this->th_, nullptr);
+    this->running_ = false;
+  }
+
+  bool RotatingFileSink::write(const struct iovec *iov, int iovcnt) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      len += iov[i].iov_len;
+    }
+
+    std::unique_lock<std::mutex> lk(this->lock_);
+    if (!this->error_.empty()) {
+      this->errmsg_.swap(this->error_);
+      this->error_.clear();
+      return false;
+    }
+    while (!this->queue_.empty() && this->queue_.size() + len > MAX_QUEUE) {
+      this->room_.wait(lk);
+    }
+    for (int i = 0; i < iovcnt; i++) {
+      const uint8_t *p = static_cast<const uint8_t*>(iov[i].iov_base);
+      this->queue_.insert(this->queue_.end(), p, p + iov[i].iov_len);
+    }
+    this->ends_.push_back(this->queue_.size());
+    lk.unlock();
+    this->cond_.notify_one();
+    return true;
+  }
+
+  // Reported by the next write().
+  void RotatingFileSink::set_error(const std::string &msg) {
+    std::lock_guard<std::mutex> lk(this->lock_);
+    this->error_ = msg;
+  }
+
+  bool RotatingFileSink::put(const uint8_t *data, size_t len) {
+    struct iovec iov = {const_cast<uint8_t*>(data), len};
+    if (!LogSink::writev_all(this->fd_, &iov, 1)) {
+      this->set_error("log file write error: " + this->seg_ + ": " +
+                      strerror(errno));
+      return false;
+    }
+    this->written_ += len;
+    return true;
+  }
+
+  // Compresses data into the current frame, and ends the frame if end.
+  bool RotatingFileSink::compress(const uint8_t *data, size_t len,
+                                  bool end) {
+    if (this->compress_ == PackedForwardEncoder::NONE) {
+      return this->put(data, len);
+    }
+    if (this->compress_ == PackedForwardEncoder::GZIP) {
+      z_stream *zs = static_cast<z_stream*>(this->codec_);
+      int flush = end ? Z_FINISH : Z_NO_FLUSH;
+      zs->next_in = const_cast<Bytef*>(data);
+      zs->avail_in = len;
+      int rc;
+      do {
+        zs->next_out = this->out_.data();
+        zs->avail_out = this->out_.size();
+        rc = ::deflate(zs, flush);
+        if (rc == Z_STREAM_ERROR) {
+          this->set_error("gzip error");
+          return false;
+        }
+        size_t n = this->out_.size() - zs->avail_out;
+        if (n > 0 && !this->put(this->out_.data(), n)) {
+          return false;
+        }
+      } while (zs->avail_out == 0 || (end && rc != Z_STREAM_END));
+      if (end) {
+        deflateReset(zs);
+      }
+      return true;
+    }
+#ifdef HAVE_ZSTD
+    if (this->compress_ == PackedForwardEncoder::ZSTD) {
+      ZSTD_CCtx *zc = static_cast<ZSTD_CCtx*>(this->codec_);
+      ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
+      ZSTD_inBuffer in = {data, len, 0};
+      size_t rest;
+      do {
+        ZSTD_outBuffer out = {this->out_.data(), this->out_.size(), 0};
+        rest = ZSTD_compressStream2(zc, &out, &in, mode);
+        if (ZSTD_isError(rest)) {
+          this->set_error(std::string("zstd error: ") +
+                          ZSTD_getErrorName(rest));
+          return false;
+        }
+        if (out.pos > 0 && !this->put(this->out_.data(), out.pos)) {
+          return false;
+        }
+      } while (end ? (rest != 0) : (in.pos < in.size));
+      return true;
+    }
+#endif
+    return false;
+  }
+
+  bool RotatingFileSink::open_segment() {
+    time_t now = time(nullptr);
+    struct tm tm;
+    char ts[32];
+    localtime_r(&now, &tm);
+    strftime(ts, sizeof(ts), "%Y%m%d-%H%M%S", &tm);
+
+    // Add a number if rotated twice in a second.
+    std::string seg = this->path_ + "." + ts + this->suffix();
+    for (int i = 1; ::access(seg.c_str(), F_OK) == 0 ||
+           ::access((seg + ".part").c_str(), F_OK) == 0; i++) {
+      std::stringstream ss;
+      ss << this->path_ << "." << ts << "_" << i << this->suffix();
+      seg = ss.str();
+    }
+
+    const std::string part = seg + ".part";
+    int fd = ::open(part.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      this->set_error("can not open log file: " + part + ": " +
+                      strerror(errno));
+      return false;
+    }
+    this->fd_ = fd;
+    this->seg_ = seg;
+    this->opened_ = now;
+    this->written_ = 0;
+    this->raw_ = 0;
+    this->frame_raw_ = 0;
+    this->index_.clear();
+    return true;
+  }
+
+  bool RotatingFileSink::write_index() {
+    std::vector<uint8_t> idx;
+    for (size_t i = 0; i < this->index_.size(); i++) {
+      put_le(&idx, this->index_[i].off_, 8);
+      put_le(&idx, this->index_[i].raw_, 8);
+      put_le(&idx, static_cast<uint64_t>(this->index_[i].time_), 8);
+    }
+    put_le(&idx, this->index_.size(), 4);
+    idx.insert(idx.end(), IDX_MAGIC, IDX_MAGIC + 8);
+
+    std::vector<uint8_t> buf;
+    if (this->compress_ == PackedForwardEncoder::GZIP) {
+      // Empty gzip member carrying the index in extra field "LX".
+      static const uint8_t head[] = {0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 255};
+      buf.assign(head, head + sizeof(head));
+      put_le(&buf, idx.size() + 4, 2);
+      buf.push_back('L');
+      buf.push_back('X');
+      put_le(&buf, idx.size(), 2);
+      buf.insert(buf.end(), idx.begin(), idx.end());
+      static const uint8_t tail[] = {3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+      buf.insert(buf.end(), tail, tail + sizeof(tail));
+    } else {
+      put_le(&buf, ZSTD_SKIPPABLE, 4);
+      put_le(&buf, idx.size(), 4);
+      buf.insert(buf.end(), idx.begin(), idx.end());
+    }
+    return this->put(buf.data(), buf.size());
+  }
+
+  bool RotatingFileSink::seal_segment() {
+    bool ok = true;
+    if (this->compress_ != PackedForwardEncoder::NONE) {
+      if (this->frame_raw_ > 0) {
+        ok = this->compress(nullptr, 0, true);
+      }
+      ok = ok && this->write_index();
+    }
+    // Sealed segments are not read back soon; keep them out of page
+    // cache used by capture.
+    fdatasync(this->fd_);
+    posix_fadvise(this->fd_, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(this->fd_);
+    this->fd_ = -1;
+    const std::string part = this->seg_ + ".part";
+    if (::rename(part.c_str(), this->seg_.c_str()) != 0) {
+      this->set_error("can not rename log file: " + part + ": " +
+                      strerror(errno));
+      return false;
+    }
+    return ok;
+  }
+
+  void RotatingFileSink::run() {
+    std::vector<uint8_t> buf;
+    std::vector<size_t> ends;
+    std::unique_lock<std::mutex> lk(this->lock_);
+    while (true) {
+      if (this->queue_.empty() && !this->stopping_) {
+        if (this->fd_ >= 0 && this->rotate_interval_ > 0) {
+          std::chrono::system_clock::time_point until =
+            std::chrono::system_clock::from_time_t(this->opened_ +
+                                                   this->rotate_interval_);
+          this->cond_.wait_until(lk, until);
+        } else {
+          this->cond_.wait(lk);
+        }
+      }
+      buf.swap(this->queue_);
+      ends.swap(this->ends_);
+      bool stopping = this->stopping_;
+      lk.unlock();
+      this->room_.notify_all();
+
+      size_t pos = 0;
+      for (size_t i = 0; i < ends.size(); i++) {
+        if (this->fd_ < 0 && !this->open_segment()) {
+          break;
+        }
+        if (this->frame_raw_ == 0) {
+          IndexEntry e = {this->written_, this->raw_, time(nullptr)};
+          this->index_.push_back(e);
+        }
+        size_t len = ends[i] - pos;
+        this->compress(buf.data() + pos, len, false);
+        pos = ends[i];
+        this->raw_ += len;
+        this->frame_raw_ += len;
+        if (this->compress_ != PackedForwardEncoder::NONE &&
+            this->frame_raw_ >= FRAME_BYTES) {
+          this->compress(nullptr, 0, true);
+          this->frame_raw_ = 0;
+        }
+        if ((this->rotate_bytes_ > 0 &&
+             this->written_ >= this->rotate_bytes_) ||
+            (this->frame_raw_ == 0 && this->index_.size() >= MAX_FRAMES)) {
+          this->seal_segment();
+        }
+      }
+      buf.clear();
+      ends.clear();
+
+      if (this->fd_ >= 0 &&
+          (stopping || (this->rotate_interval_ > 0 && time(nullptr) >=
+                        this->opened_ + this->rotate_interval_))) {
+        this->seal_segment();
+      }
+      lk.lock();
+      if (stopping && this->queue_.empty()) {
+        break;
+      }
+    }
+  }
+
+  void *RotatingFileSink::writer_thread(void *obj) {
+    static_cast<RotatingFileSink*>(obj)->run();
+    return nullptr;
+  }
+}
@@ -0,0 +1,134 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_ROTATE_H__
+#define SRC_ROTATE_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include "./logsink.h"
+#include "./encoder.h"
+
+namespace lurker {
+  // ----------------------------------------------------------------
+  // class RotatingFileSink:
+  // Writes log output into segment files named PATH.YYYYmmdd-HHMMSS
+  // (plus .gz or .zst), started when the current one reaches
+  // rotate_bytes or is rotate_interval seconds old. Compression and
+  // file I/O run in a background thread; write() only copies a batch
+  // into its queue, and waits if the queue is full.
+  //
+  // Compressed output is split into independent frames of about
+  // FRAME_BYTES of input, each starting at a batch boundary. When a
+  // segment is sealed, an index of its frames is appended as a gzip
+  // member or zstd skippable frame, so the file still decompresses as a
+  // whole and readers can seek to any frame:
+  //
+  //   entry   [u64 file offset][u64 input offset][i64 time] x count
+  //   trailer [u32 count]["LRKIDX01"]
+  //
+  // All in little endian. The trailer ends the file for zstd, and is
+  // followed by the 10 byte tail of the gzip member for gzip. A segment
+  // being written has a ".part" suffix.
+  //
+  class RotatingFileSink : public LogSink {
+  public:
+    static const size_t DEFAULT_ROTATE_BYTES = 1 << 28;    // 256 MB
+    static const size_t FRAME_BYTES = 1 << 23;             // 8 MB
+    static const size_t MAX_FRAMES = 2048;                 // per segment
+    static const size_t MAX_QUEUE = 1 << 26;               // 64 MB
+    static const char IDX_MAGIC[9];
+    typedef PackedForwardEncoder::Compress Compress;
+
+  private:
+    struct IndexEntry {
+      uint64_t off_;
+      uint64_t raw_;
+      int64_t time_;
+    };
+
+    std::string path_;
+    Compress compress_;
+    int level_;
+    size_t rotate_bytes_;
+    time_t rotate_interval_;
+    std::string dict_;
+
+    // Guarded by lock_.
+    std::mutex lock_;
+    std::condition_variable cond_, room_;
+    std::vector<uint8_t> queue_;
+    std::vector<size_t> ends_;         // batch boundaries in queue_
+    std::string error_;
+    bool stopping_;
+
+    // Used by the background thread only.
+    pthread_t th_;
+    bool running_;
+    int fd_;
+    std::string seg_;                  // final path of current segment
+    time_t opened_;
+    uint64_t written_;                 // file bytes of segment
+    uint64_t raw_;                     // input bytes of segment
+    size_t frame_raw_;                 // input bytes of current frame
+    std::vector<IndexEntry> index_;
+    void *codec_;                      // z_stream or ZSTD_CCtx
+    std::vector<uint8_t> out_;
+
+    const char *suffix() const;
+    bool open_segment();
+    bool seal_segment();
+    bool put(const uint8_t *data, size_t len);
+    bool compress(const uint8_t *data, size_t len, bool end);
+    bool write_index();
+    void set_error(const std::string &msg);
+    void run();
+    static void *writer_thread(void *obj);
+
+  public:
+    explicit RotatingFileSink(const std::string &path,
+                              Compress compress = PackedForwardEncoder::NONE);
+    ~RotatingFileSink();
+    // 0 disables the limit. Not while running.
+    void set_rotate(size_t bytes, time_t interval);
+    void set_level(int level) { this->level_ = level; }
+    // Loads zstd dictionary (e.g. made by "zstd --train") used for all
+    // frames. Readers need the same dictionary.
+    bool load_dictionary(const std::string &fpath);
+    bool open();
+    // Writes out queued batches, seals the segment and stops the thread.
+    void close();
+    bool write(const struct iovec *iov, int iovcnt);
+  };
+}
+
+
+#endif  // SRC_ROTATE_H__
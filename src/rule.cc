@@ -0,0 +1,614 @@
+/*
+ * Copyright (c) 2014 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include "./rule.h"
+#include "./protoid.h"
+
+namespace lurker {
+  // ----------------------------------------------------------------
+  // RuleSet::Parser converts a rule expression into postfix program and
+  // registers its atoms to RuleSet.
+  class RuleSet::Parser {
+  private:
+    RuleSet *rs_;
+    const std::string &expr_;
+    size_t pos_;
+    std::vector<Op> *prog_;
+    std::string errmsg_;
+
+    bool fail(const std::string &msg) {
+      if (this->errmsg_.empty()) {
+        std::stringstream ss;
+        ss << msg << " at column " << this->pos_ + 1;
+        this->errmsg_ = ss.str();
+      }
+      return false;
+    }
+    void skip_space() {
+      while (this->pos_ < this->expr_.length() &&
+             isspace(this->expr_[this->pos_])) {
+        this->pos_++;
+      }
+    }
+    bool eof() {
+      this->skip_space();
+      return this->pos_ >= this->expr_.length();
+    }
+    bool keyword(const char *word) {
+      this->skip_space();
+      size_t len = ::strlen(word);
+      size_t end = this->pos_ + len;
+      if (this->expr_.compare(this->pos_, len, word) == 0 &&
+          (end >= this->expr_.length() || !isalnum(this->expr_[end]))) {
+        this->pos_ = end;
+        return true;
+      }
+      return false;
+    }
+    void emit(OpCode code, uint16_t atom = 0) {
+      Op op;
+      op.code_ = code;
+      op.atom_ = atom;
+      this->prog_->push_back(op);
+    }
+
+    bool parse_expr();
+    bool parse_term();
+    bool parse_factor();
+    bool parse_literal();
+    bool parse_regex();
+    bool parse_int(int *v);
+    int parse_flags();
+    bool new_atom(int min_offset, int max_offset, size_t len,
+                  uint16_t *id);
+
+  public:
+    Parser(RuleSet *rs, const std::string &expr, std::vector<Op> *prog) :
+      rs_(rs), expr_(expr), pos_(0), prog_(prog) {}
+    bool parse() {
+      if (!this->parse_expr()) {
+        return false;
+      }
+      if (!this->eof()) {
+        return this->fail("unexpected token");
+      }
+      return true;
+    }
+    const std::string &errmsg() const { return this->errmsg_; }
+  };
+
+  bool RuleSet::Parser::parse_expr() {
+    if (!this->parse_term()) {
+      return false;
+    }
+    while (this->keyword("or")) {
+      if (!this->parse_term()) {
+        return false;
+      }
+      this->emit(OP_OR);
+    }
+    return true;
+  }
+
+  bool RuleSet::Parser::parse_term() {
+    if (!this->parse_factor()) {
+      return false;
+    }
+    while (this->keyword("and")) {
+      if (!this->parse_factor()) {
+        return false;
+      }
+      this->emit(OP_AND);
+    }
+    return true;
+  }
+
+  bool RuleSet::Parser::parse_factor() {
+    if (this->keyword("not")) {
+      if (!this->parse_factor()) {
+        return false;
+      }
+      this->emit(OP_NOT);
+      return true;
+    }
+
+    if (this->eof()) {
+      return this->fail("unexpected end of rule");
+    }
+
+    switch (this->expr_[this->pos_]) {
+    case '(':
+      this->pos_++;
+      if (!this->parse_expr()) {
+        return false;
+      }
+      if (this->eof() || this->expr_[this->pos_] != ')') {
+        return this->fail("missing ')'");
+      }
+      this->pos_++;
+      return true;
+
+    case '"':
+      return this->parse_literal();
+
+    case '/':
+      return this->parse_regex();
+
+    default:
+      return this->fail("unexpected token");
+    }
+  }
+
+  bool RuleSet::Parser::parse_int(int *v) {
+    const char *s = this->expr_.c_str() + this->pos_;
+    char *e;
+    if (!isdigit(*s)) {
+      return false;
+    }
+    long n = strtol(s, &e, 10);
+    if (n > static_cast<long>(DEPTH)) {
+      return false;
+    }
+    *v = n;
+    this->pos_ += (e - s);
+    return true;
+  }
+
+  int RuleSet::Parser::parse_flags() {
+    int flags = 0;
+    if (this->pos_ < this->expr_.length() && this->expr_[this->pos_] == 'i') {
+      flags |= swarm::RegexDfa::NOCASE;
+      this->pos_++;
+    }
+    return flags;
+  }
+
+  bool RuleSet::Parser::new_atom(int min_offset, int max_offset, size_t len,
+                                 uint16_t *id) {
+    if (this->rs_->atom_.size() >= UINT16_MAX) {
+      return this->fail("too many patterns");
+    }
+    Atom atom;
+    atom.min_offset_ = min_offset;
+    atom.max_offset_ = max_offset;
+    atom.len_ = len;
+    atom.slot_ = -1;
+    *id = this->rs_->atom_.size();
+    this->rs_->atom_.push_back(atom);
+    this->rs_->atom_rule_.resize(this->rs_->atom_.size());
+    return true;
+  }
+
+  bool RuleSet::Parser::parse_literal() {
+    // pos_ is at opening '"'
+    size_t s = ++this->pos_;
+    while (this->pos_ < this->expr_.length() &&
+           this->expr_[this->pos_] != '"') {
+      this->pos_ += (this->expr_[this->pos_] == '\\') ? 2 : 1;
+    }
+    if (this->pos_ >= this->expr_.length()) {
+      return this->fail("missing '\"'");
+    }
+
+    std::string lit;
+    if (!unescape_pattern(this->expr_.substr(s, this->pos_ - s), &lit)) {
+      return this->fail("invalid escape in literal");
+    }
+    this->pos_++;
+    if (lit.empty()) {
+      return this->fail("empty literal");
+    }
+
+    int flags = this->parse_flags();
+    int min_offset = -1, max_offset = -1;
+    if (this->pos_ < this->expr_.length() && this->expr_[this->pos_] == '@') {
+      this->pos_++;
+      if (!this->parse_int(&min_offset)) {
+        return this->fail("invalid offset");
+      }
+      max_offset = min_offset;
+      if (this->pos_ < this->expr_.length() &&
+          this->expr_[this->pos_] == '-') {
+        this->pos_++;
+        if (!this->parse_int(&max_offset) || max_offset < min_offset) {
+          return this->fail("invalid offset");
+        }
+      }
+    }
+
+    size_t reach = (max_offset < 0 ? 0 : max_offset) + lit.length();
+    if (reach > DEPTH) {
+      return this->fail("literal is out of inspected range");
+    }
+
+    uint16_t id;
+    if (!this->new_atom(min_offset, max_offset, lit.length(), &id)) {
+      return false;
+    }
+    if (!this->rs_->dfa_.add_literal(lit.data(), lit.length(), id, flags)) {
+      return this->fail(this->rs_->dfa_.errmsg());
+    }
+    this->emit(OP_ATOM, id);
+    return true;
+  }
+
+  bool RuleSet::Parser::parse_regex() {
+    // pos_ is at opening '/'. "\/" in regex is a literal slash.
+    std::string re;
+    this->pos_++;
+    while (this->pos_ < this->expr_.length() &&
+           this->expr_[this->pos_] != '/') {
+      char c = this->expr_[this->pos_++];
+      if (c == '\\' && this->pos_ < this->expr_.length()) {
+        char n = this->expr_[this->pos_++];
+        if (n != '/') {
+          re.push_back(c);
+        }
+        c = n;
+      }
+      re.push_back(c);
+    }
+    if (this->pos_ >= this->expr_.length()) {
+      return this->fail("missing '/'");
+    }
+    this->pos_++;
+
+    int flags = this->parse_flags();
+    uint16_t id;
+    if (!this->new_atom(-1, -1, 0, &id)) {
+      return false;
+    }
+    if (!this->rs_->dfa_.add(re, id, flags)) {
+      return this->fail(this->rs_->dfa_.errmsg());
+    }
+    this->emit(OP_ATOM, id);
+    return true;
+  }
+
+
+  // ----------------------------------------------------------------
+  // RuleSet
+
+  RuleSet::RuleSet() : n_slot_(0) {
+  }
+  RuleSet::~RuleSet() {
+  }
+
+  bool RuleSet::add(const std::string &name, const std::string &expr) {
+    if (this->dfa_.compiled()) {
+      this->errmsg_ = "rules are already compiled";
+      return false;
+    }
+    if (name.empty() || name.find_first_not_of(
+          "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_.-")
+        != std::string::npos) {
+      this->errmsg_ = "invalid rule name: " + name;
+      return false;
+    }
+    if (this->rule_idx_.find(name) != this->rule_idx_.end()) {
+      this->errmsg_ = "duplicated rule name: " + name;
+      return false;
+    }
+    if (this->rule_.size() >= UINT16_MAX) {
+      this->errmsg_ = "too many rules";
+      return false;
+    }
+
+    Rule rule;
+    rule.name_ = name;
+    Parser psr(this, expr, &rule.prog_);
+    if (!psr.parse()) {
+      this->errmsg_ = "rule " + name + ": " + psr.errmsg();
+      return false;
+    }
+
+    // Check depth of evaluation stack.
+    size_t depth = 0, max_depth = 0;
+    for (size_t i = 0; i < rule.prog_.size(); i++) {
+      if (rule.prog_[i].code_ == OP_ATOM) {
+        max_depth = std::max(max_depth, ++depth);
+      } else if (rule.prog_[i].code_ != OP_NOT) {
+        depth--;
+      }
+    }
+    if (max_depth > STACK_MAX) {
+      this->errmsg_ = "rule " + name + ": expression is too complex";
+      return false;
+    }
+
+    // A rule must not be true without any atom (e.g. "not X" alone).
+    State empty;
+    ::memset(&empty, 0, sizeof(empty));
+    if (this->eval(rule, empty, DEPTH) != V_FALSE) {
+      this->errmsg_ = "rule " + name + ": matches without any pattern";
+      return false;
+    }
+
+    // A rule of atoms joined only by OR is true once any atom matches.
+    // Atoms of other rules need a bit in State.
+    size_t n_atom = 0;
+    bool has_not = false, compound = false;
+    for (size_t i = 0; i < rule.prog_.size(); i++) {
+      n_atom += (rule.prog_[i].code_ == OP_ATOM);
+      has_not = has_not || (rule.prog_[i].code_ == OP_NOT);
+      compound = compound || (rule.prog_[i].code_ == OP_AND ||
+                              rule.prog_[i].code_ == OP_NOT);
+    }
+    if (compound && this->n_slot_ + n_atom > ATOM_SLOT_MAX) {
+      std::stringstream ss;
+      ss << "rule " << name << ": too many patterns in rules using and/not "
+         << "(" << ATOM_SLOT_MAX << " at most)";
+      this->errmsg_ = ss.str();
+      return false;
+    }
+
+    size_t idx = this->rule_.size();
+    for (size_t i = 0; i < rule.prog_.size(); i++) {
+      if (rule.prog_[i].code_ == OP_ATOM) {
+        uint16_t id = rule.prog_[i].atom_;
+        Atom &a = this->atom_[id];
+        if (compound && a.slot_ < 0) {
+          a.slot_ = this->n_slot_++;
+        }
+        if (has_not) {
+          // Unmatched atom is false once no match can start in range.
+          size_t end = (a.min_offset_ >= 0) ? a.max_offset_ + a.len_ : DEPTH;
+          this->settle_.push_back((end < DEPTH) ? end : DEPTH);
+        }
+        std::vector<uint16_t> &r = this->atom_rule_[id];
+        if (r.empty() || r.back() != idx) {
+          r.push_back(idx);
+        }
+      }
+    }
+    if (has_not) {
+      this->not_rule_.push_back(idx);
+    }
+    this->rule_.push_back(rule);
+    this->rule_idx_.insert(std::make_pair(name, idx));
+    return true;
+  }
+
+  bool RuleSet::load(const std::string &fpath) {
+    std::ifstream ifs(fpath);
+    if (ifs.fail()) {
+      this->errmsg_ = "can not open rule file: " + fpath;
+      return false;
+    }
+
+    std::string line;
+    size_t lineno = 0;
+    while (getline(ifs, line)) {
+      lineno++;
+      size_t s = line.find_first_not_of(" \t");
+      if (s == std::string::npos || line[s] == '#') {
+        continue;
+      }
+
+      size_t c = line.find(':', s);
+      size_t e = (c == std::string::npos) ? c :
+        line.find_last_not_of(" \t", c - 1);
+      if (c == std::string::npos || e == std::string::npos || e < s ||
+          !this->add(line.substr(s, e - s + 1), line.substr(c + 1))) {
+        std::stringstream es;
+        es << "invalid rule at " << fpath << ":" << lineno;
+        if (c != std::string::npos) {
+          es << ", " << this->errmsg_;
+        }
+        this->errmsg_ = es.str();
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool RuleSet::compile() {
+    if (this->rule_.empty()) {
+      this->errmsg_ = "no rule to compile";
+      return false;
+    }
+    if (!this->dfa_.compile()) {
+      this->errmsg_ = "failed to compile rules: " + this->dfa_.errmsg();
+      return false;
+    }
+    std::sort(this->settle_.begin(), this->settle_.end());
+    this->settle_.erase(std::unique(this->settle_.begin(),
+                                    this->settle_.end()),
+                        this->settle_.end());
+    return true;
+  }
+
+  RuleSet::Truth RuleSet::atom_value(uint16_t id, const State &st,
+                                     uint32_t pos) const {
+    const Atom &a = this->atom_[id];
+    if (a.slot_ >= 0 && (st.atom_bm_[a.slot_ / 8] & (1 << (a.slot_ % 8)))) {
+      return V_TRUE;
+    }
+    if (pos >= DEPTH || (a.min_offset_ >= 0 &&
+                         pos >= a.max_offset_ + a.len_)) {
+      return V_FALSE;
+    }
+    return V_UNKNOWN;
+  }
+
+  RuleSet::Truth RuleSet::eval(const Rule &rule, const State &st,
+                               uint32_t pos) const {
+    Truth stack[STACK_MAX];
+    size_t sp = 0;
+
+    for (size_t i = 0; i < rule.prog_.size(); i++) {
+      const Op &op = rule.prog_[i];
+      switch (op.code_) {
+      case OP_ATOM:
+        stack[sp++] = this->atom_value(op.atom_, st, pos);
+        break;
+      case OP_AND:
+        sp--;
+        stack[sp - 1] = std::min(stack[sp - 1], stack[sp]);
+        break;
+      case OP_OR:
+        sp--;
+        stack[sp - 1] = std::max(stack[sp - 1], stack[sp]);
+        break;
+      case OP_NOT:
+        stack[sp - 1] = static_cast<Truth>(V_TRUE - stack[sp - 1]);
+        break;
+      }
+    }
+
+    return (sp == 1) ? stack[0] : V_FALSE;
+  }
+
+  bool RuleSet::fire(State *st, uint16_t r) const {
+    uint16_t *last = st->fired_ + st->n_fired_;
+    if (st->n_fired_ >= FIRED_SLOT || std::find(st->fired_, last, r) != last) {
+      return false;
+    }
+    st->fired_[st->n_fired_++] = r;
+    return true;
+  }
+
+  size_t RuleSet::on_match(State *st, uint16_t id) const {
+    // Rules of OR only fire at once. Others are evaluated when the atom
+    // is matched first, with the stream position before the segment:
+    // atoms settled within the segment are left to inspect().
+    const Atom &a = this->atom_[id];
+    const std::vector<uint16_t> &rules = this->atom_rule_[id];
+    if (a.slot_ < 0) {
+      return (!rules.empty() && this->fire(st, rules[0])) ? 1 : 0;
+    }
+    uint8_t bit = (1 << (a.slot_ % 8));
+    if (st->atom_bm_[a.slot_ / 8] & bit) {
+      return 0;
+    }
+    st->atom_bm_[a.slot_ / 8] |= bit;
+
+    size_t fired = 0;
+    for (size_t j = 0; j < rules.size(); j++) {
+      if (this->eval(this->rule_[rules[j]], *st, st->next_) == V_TRUE &&
+          this->fire(st, rules[j])) {
+        fired++;
+      }
+    }
+    return fired;
+  }
+
+  class AtomMatch : public swarm::RegexDfa::Callback {
+  private:
+    const RuleSet *rs_;
+    RuleSet::State *st_;
+    uint32_t offset_;
+
+  public:
+    size_t fired_;
+    AtomMatch(const RuleSet *rs, RuleSet::State *st, uint32_t offset) :
+      rs_(rs), st_(st), offset_(offset), fired_(0) {
+    }
+    bool match(int id, size_t end) {
+      const RuleSet::Atom &a = this->rs_->atom_[id];
+      if (a.min_offset_ >= 0) {
+        int start = this->offset_ + end - a.len_;
+        if (start < a.min_offset_ || a.max_offset_ < start) {
+          return true;
+        }
+      }
+      this->fired_ += this->rs_->on_match(this->st_, id);
+      return true;
+    }
+  };
+
+  size_t RuleSet::inspect(State *st, const void *data, size_t len,
+                          uint32_t offset) const {
+    if (st->done_ || !this->dfa_.compiled()) {
+      return 0;
+    }
+
+    const uint8_t *ptr = static_cast<const uint8_t*>(data);
+    if (offset < st->next_) {
+      // Retransmitted data. Skip bytes that were already inspected.
+      uint32_t d = st->next_ - offset;
+      if (d >= len) {
+        return 0;
+      }
+      ptr += d;
+      len -= d;
+      offset = st->next_;
+    } else if (offset > st->next_) {
+      // Lost segment. Patterns can not continue across the gap.
+      st->dfa_state_ = this->dfa_.search_state();
+    }
+
+    uint32_t prev = st->next_;
+    AtomMatch m(this, st, offset);
+    if (offset < DEPTH) {
+      size_t n = std::min(len, DEPTH - offset);
+      st->dfa_state_ = this->dfa_.scan(ptr, n, &m, st->dfa_state_);
+      st->next_ = offset + n;
+    } else {
+      st->next_ = DEPTH;
+    }
+
+    // Rules using NOT may become true only when an unmatched atom turns
+    // to false, i.e. when the stream passes one of settle_.
+    size_t fired = m.fired_;
+    auto it = std::upper_bound(this->settle_.begin(), this->settle_.end(),
+                               prev);
+    if (it != this->settle_.end() && *it <= st->next_) {
+      for (size_t i = 0; i < this->not_rule_.size(); i++) {
+        uint16_t r = this->not_rule_[i];
+        if (this->eval(this->rule_[r], *st, st->next_) == V_TRUE &&
+            this->fire(st, r)) {
+          fired++;
+        }
+      }
+    }
+
+    if (st->next_ >= DEPTH || st->n_fired_ >= FIRED_SLOT ||
+        st->n_fired_ >= this->rule_.size()) {
+      st->done_ = 1;
+    }
+    return fired;
+  }
+
+  std::string RuleSet::names(const State &st) const {
+    std::string s;
+    for (size_t i = 0; i < st.n_fired_; i++) {
+      if (i > 0) {
+        s += ',';
+      }
+      s += this->rule_[st.fired_[i]].name_;
+    }
+    return s;
+  }
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2014 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_RULE_H__
+#define SRC_RULE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "./swarm/utils/regex-dfa.h"
+
+namespace lurker {
+  class AtomMatch;
+
+  // ----------------------------------------------------------------
+  // class RuleSet:
+  // Tags TCP sessions by rules over the first DEPTH bytes of client data.
+  // A rule is a boolean expression of patterns (atoms), and all atoms of
+  // all rules are compiled into one RegexDfa, so the client stream is
+  // scanned only once regardless of the number of rules. A rule of atoms
+  // joined by OR fires when one matches. Other rules keep a bit per atom in
+  // the session, and are evaluated in three-valued logic: an atom not
+  // matched yet is unknown until the stream passes its offset range or
+  // DEPTH. A rule fires only when it is true whatever unknown atoms turn
+  // out to be, so the result does not depend on segmentation. A rule
+  // fires at most once per session.
+  //
+  class RuleSet {
+  public:
+    static const size_t DEPTH = 4096;   // inspected bytes of client stream
+    static const size_t FIRED_SLOT = 8;   // fired rules kept per session
+    static const size_t ATOM_BM_SIZE = 26;  // bytes of atom bitmap
+    // Atoms of rules using AND or NOT, in all rules.
+    static const size_t ATOM_SLOT_MAX = ATOM_BM_SIZE * 8;
+    static const size_t STACK_MAX = 32;   // nesting limit of expression
+
+    // Per-session matching state, zero filled at session creation.
+    struct State {
+      uint32_t dfa_state_;
+      uint32_t next_;    // expected stream offset of next segment
+      uint8_t done_;
+      uint8_t n_fired_;
+      uint16_t fired_[FIRED_SLOT];
+      uint8_t atom_bm_[ATOM_BM_SIZE];   // matched atoms by slot
+    };
+
+  private:
+    enum OpCode { OP_ATOM, OP_AND, OP_OR, OP_NOT };
+    struct Op {
+      OpCode code_;
+      uint16_t atom_;
+    };
+    struct Atom {
+      int min_offset_;   // range of start offset for literal, -1 is any
+      int max_offset_;
+      size_t len_;       // literal length, 0 for regex
+      int slot_;         // bit in State::atom_bm_, -1 in OR only rule
+    };
+    // Three-valued logic: AND is min, OR is max and NOT is 2 - x.
+    enum Truth { V_FALSE = 0, V_UNKNOWN = 1, V_TRUE = 2 };
+    struct Rule {
+      std::string name_;
+      std::vector<Op> prog_;   // postfix expression
+    };
+    class Parser;
+    friend class AtomMatch;
+
+    std::vector<Atom> atom_;
+    std::vector<Rule> rule_;
+    std::vector<std::vector<uint16_t> > atom_rule_;  // atom -> rules
+    std::vector<uint16_t> not_rule_;    // rules using NOT
+    std::vector<uint32_t> settle_;      // offsets where NOT atoms settle
+    size_t n_slot_;
+    std::map<std::string, size_t> rule_idx_;
+    swarm::RegexDfa dfa_;
+    std::string errmsg_;
+
+    // Value of rules and atoms when the stream is inspected up to pos.
+    Truth eval(const Rule &rule, const State &st, uint32_t pos) const;
+    Truth atom_value(uint16_t id, const State &st, uint32_t pos) const;
+    // Fires rule r if not yet. Returns true if newly fired.
+    bool fire(State *st, uint16_t r) const;
+    size_t on_match(State *st, uint16_t atom) const;
+
+  public:
+    RuleSet();
+    ~RuleSet();
+    // Expression syntax (precedence: not > and > or):
+    //   expr := term ("or" term)* ; term := factor ("and" factor)*
+    //   factor := "not" factor | "(" expr ")" | atom
+    //   atom := "literal"[i][@N[-M]] | /regex/[i]
+    // Literal accepts \xNN, \r, \n, \t, \0, \\ and \" escapes. 'i' suffix
+    // ignores ASCII case. @N requires the literal to start at stream
+    // offset N, @N-M within N to M. See RegexDfa for regex syntax.
+    bool add(const std::string &name, const std::string &expr);
+    // Rules using AND or NOT can have ATOM_SLOT_MAX atoms in total.
+    // Rule file format is one rule per line:
+    //   <name>: <expr>
+    // Lines beginning with '#' are comments.
+    bool load(const std::string &fpath);
+    bool compile();
+    size_t size() const { return this->rule_.size(); }
+    const std::string &errmsg() const { return this->errmsg_; }
+
+    // Feed a client segment starting at stream offset. Returns number of
+    // rules newly fired by the segment.
+    size_t inspect(State *st, const void *data, size_t len,
+                   uint32_t offset) const;
+    // Comma separated names of fired rules, empty if none.
+    std::string names(const State &st) const;
+  };
+}
+
+#endif  // SRC_RULE_H__
@@ -33,19 +33,124 @@
 #include "./pkt.h"
 
 namespace lurker {
-  Spoofer::Spoofer(swarm::Swarm *sw, fluent::Logger *logger, RawSock *sock) :
-    sw_(sw), sock_(sock), logger_(logger) {
+  Spoofer::Spoofer(swarm::Swarm *sw, EventLog *logger, RawSock *sock) :
+    sw_(sw), sock_(sock), logger_(logger), dns_cache_(nullptr) {
     assert(this->sw_);
     this->req_h_ = this->sw_->set_handler("arp.request", this);
     this->rep_h_ = this->sw_->set_handler("arp.reply",   this);
+    this->ns_h_  = this->sw_->set_handler("icmp6.ns",    this);
     this->req_id_ = this->sw_->lookup_event_id("arp.request");
     this->rep_id_ = this->sw_->lookup_event_id("arp.reply");
+    this->ns_id_  = this->sw_->lookup_event_id("icmp6.ns");
+    this->ether_src_  = this->sw_->lookup_value_id("ether.src");
+    this->arp_src_pr_ = this->sw_->lookup_value_id("arp.src_pr");
+    this->arp_dst_pr_ = this->sw_->lookup_value_id("arp.dst_pr");
+    this->arp_src_hw_ = this->sw_->lookup_value_id("arp.src_hw");
+    this->arp_dst_hw_ = this->sw_->lookup_value_id("arp.dst_hw");
+    this->ipv6_src_   = this->sw_->lookup_value_id("ipv6.src");
+    this->ns_target_  = this->sw_->lookup_value_id("icmp6.ns_target");
+    this->init_arp_templates();
+    this->init_na_template();
   }
   Spoofer::~Spoofer() {
     this->sw_->unset_handler(this->req_h_);
     this->sw_->unset_handler(this->rep_h_);
+    this->sw_->unset_handler(this->ns_h_);
+  }
+
+  void Spoofer::init_arp_templates() {
+    memset(this->arp_rep_, 0, sizeof(this->arp_rep_));
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->arp_rep_);
+    auto *arp_hdr = reinterpret_cast<struct arp_header*>(eth_hdr + 1);
+    assert(sizeof(this->arp_rep_) ==
+           sizeof(struct ether_header) + sizeof(struct arp_header));
+
+    eth_hdr->type_ = htons(ETHERTYPE_ARP);
+    arp_hdr->hw_addr_fmt_ = htons(ARPHRD_ETHER);
+    arp_hdr->pr_addr_fmt_ = htons(ETHERTYPE_IP);
+    arp_hdr->hw_addr_len_ = ETHER_ADDR_LEN;
+    arp_hdr->pr_addr_len_ = IPV4_ADDR_LEN;
+    arp_hdr->op_ = htons(ARPOP_REPLY);
+    if (this->sock_ && this->sock_->hw_addr()) {
+      memcpy(eth_hdr->src_, this->sock_hw_addr(), ETHER_ADDR_LEN);
+      memcpy(arp_hdr->src_hw_addr_, this->sock_hw_addr(), ETHER_ADDR_LEN);
+    }
+
+    // Request is broadcast from the interface's own addresses.
+    memcpy(this->arp_req_, this->arp_rep_, sizeof(this->arp_req_));
+    eth_hdr = reinterpret_cast<struct ether_header*>(this->arp_req_);
+    arp_hdr = reinterpret_cast<struct arp_header*>(eth_hdr + 1);
+    memset(eth_hdr->dst_, ~0, ETHER_ADDR_LEN);
+    arp_hdr->op_ = htons(ARPOP_REQUEST);
+    if (this->sock_ && this->sock_->pr_addr()) {
+      memcpy(arp_hdr->src_pr_addr_, this->sock_pr_addr(), IPV4_ADDR_LEN);
+    }
+  }
+
+  void Spoofer::init_na_template() {
+    memset(this->na_, 0, sizeof(this->na_));
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->na_);
+    auto *ipv6_hdr = reinterpret_cast<struct ipv6_header*>(eth_hdr + 1);
+    auto *na = reinterpret_cast<struct nd_advert*>(ipv6_hdr + 1);
+    assert(sizeof(this->na_) == sizeof(struct ether_header) +
+           sizeof(struct ipv6_header) + sizeof(struct nd_advert));
+
+    if (this->sock_ && this->sock_->hw_addr()) {
+      memcpy(eth_hdr->src_, this->sock_hw_addr(), ETHER_ADDR_LEN);
+      memcpy(na->hw_addr_, this->sock_hw_addr(), ETHER_ADDR_LEN);
+    }
+    eth_hdr->type_ = htons(ETHERTYPE_IPV6);
+
+    // Hop limit must be 255 or receivers discard ND messages.
+    ipv6_hdr->flags_ = htonl(0x60000000);
+    ipv6_hdr->data_len_ = htons(sizeof(struct nd_advert));
+    ipv6_hdr->next_hdr_ = IPPROTO_ICMPV6;
+    ipv6_hdr->hop_limit_ = 255;
+
+    na->type_ = ICMP6_NEIGHBOR_ADVERT;
+    na->flags_ = htonl(ND_NA_FLAG_SOLICITED | ND_NA_FLAG_OVERRIDE);
+    na->opt_type_ = ND_OPT_TARGET_HW;
+    na->opt_len_ = 1;
+
+    struct pseudo_ipv6_header pseudo;
+    memset(&pseudo, 0, sizeof(pseudo));
+    pseudo.len_ = htonl(sizeof(struct nd_advert));
+    pseudo.next_hdr_ = IPPROTO_ICMPV6;
+    this->na_sum_ = chksum_add(chksum_add(0, &pseudo, sizeof(pseudo)),
+                               na, sizeof(struct nd_advert));
   }
   
+  void Spoofer::set_dns_cache(const DnsCache *dns_cache) {
+    this->dns_cache_ = dns_cache;
+  }
+
+  void Spoofer::set_dst_names(Event *msg,
+                              const swarm::Property &p,
+                              swarm::val_id addr_value) {
+    if (this->dns_cache_) {
+      char buf[512];
+      size_t addr_len;
+      void *addr = p.value(addr_value).ptr(&addr_len);
+      size_t len = this->dns_cache_->lookup(addr, addr_len, p.tv_sec(),
+                                            buf, sizeof(buf));
+      if (len > 0) {
+        msg->set("dst_names", buf, len);
+      }
+    }
+  }
+
+  void Spoofer::set_arp(Event *msg, const swarm::Property &p) {
+    size_t len;
+    const void *ptr = p.value(this->arp_src_pr_).ptr(&len);
+    msg->set_addr("src_addr", ptr, len);
+    ptr = p.value(this->arp_dst_pr_).ptr(&len);
+    msg->set_addr("dst_addr", ptr, len);
+    ptr = p.value(this->arp_src_hw_).ptr(&len);
+    msg->set_mac("src_hw", ptr, len);
+    ptr = p.value(this->arp_dst_hw_).ptr(&len);
+    msg->set_mac("dst_hw", ptr, len);
+  }
+
   // Routing to callback function.
   void Spoofer::recv(swarm::ev_id eid, const  swarm::Property &p) {
     if (eid == this->req_id_) {
@@ -54,151 +159,160 @@ namespace lurker {
     if (eid == this->rep_id_) {
       this->handle_arp_reply(p);
     }
+    if (eid == this->ns_id_) {
+      this->handle_ns(p);
+    }
   }
   
-  bool Spoofer::write(uint8_t *buf, size_t buf_len,
-                      const std::string &ev_name) {
+  bool Spoofer::write(uint8_t *buf, size_t buf_len, const char *ev_name) {
     bool rc = false;
     
     if (this->sock_) {
-      if (this->sock_->write(buf, buf_len) < 0) {
+      int len = this->sock_->enqueue(buf, buf_len);
+      if (len < 0) {
         if (this->logger_) {
-          fluent::Message *msg =
+          Event *msg =
             this->logger_->retain_message("lurker.error");
           msg->set("event", ev_name);
           msg->set("message", this->sock_->errmsg());
           this->logger_->emit(msg);
         }
       } else {
-        rc = true;
+        // Zero means dropped at full tx ring.
+        rc = (len > 0);
       }
     }
 
     return rc;
   }
   
-  uint8_t* Spoofer::build_arp_request(void *addr, size_t *len) {
-    const uint8_t *hw_addr =  this->sock_hw_addr();
-    const uint8_t *pr_addr =  this->sock_pr_addr();
-    assert(hw_addr);
-
-    if (pr_addr) {
+  uint8_t* Spoofer::build_arp_request(const void *addr, size_t *len) {
+    if (this->sock_pr_addr() == nullptr) {
       // Can not send ARP request if the interface has no IP address.
-      size_t buf_len =
-        sizeof(struct ether_header) + sizeof(struct arp_header);
-      uint8_t *buf = reinterpret_cast<uint8_t *>(malloc(buf_len));
-      
-      struct ether_header *eth_hdr 
-        = reinterpret_cast<struct ether_header*>(buf);
-      struct arp_header *arp_hdr 
-        = reinterpret_cast<struct arp_header*>(buf +
-                                               sizeof(struct ether_header));
-      memset(eth_hdr->dst_, ~0, ETHER_ADDR_LEN);
-      for (size_t i = 0; i < ETHER_ADDR_LEN; i++) {
-        printf("[%d] = 0x%02X\n", eth_hdr->dst_[i]);
-      }
-      eth_hdr->type_ = htons(ETHERTYPE_ARP);
-
-      arp_hdr->hw_addr_fmt_ = htons(ARPHRD_ETHER);
-      arp_hdr->pr_addr_fmt_ = htons(ETHERTYPE_IP);
-      arp_hdr->hw_addr_len_ = IPV4_ADDR_LEN;
-      arp_hdr->pr_addr_len_ = ETHER_ADDR_LEN;
-      arp_hdr->op_ = htons(ARPOP_REQUEST);
-
-      const size_t pr_len = IPV4_ADDR_LEN;
-      const size_t hw_len = ETHER_ADDR_LEN;
-
-      memcpy(arp_hdr->src_hw_addr_, hw_addr, hw_len);
-      memcpy(arp_hdr->src_pr_addr_, pr_addr, pr_len);
-      memset(arp_hdr->dst_hw_addr_, 0, hw_len);
-      memcpy(arp_hdr->dst_pr_addr_, addr, pr_len);
-
-      *len = buf_len;
-      return buf;
-    } else {
       return nullptr;
     }
+
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->arp_req_);
+    auto *arp_hdr = reinterpret_cast<struct arp_header*>(eth_hdr + 1);
+    memcpy(arp_hdr->dst_pr_addr_, addr, IPV4_ADDR_LEN);
+
+    *len = ARP_LEN;
+    return this->arp_req_;
   }
 
   uint8_t* Spoofer::build_arp_reply(const swarm::Property &p, size_t *len) {
-    size_t buf_len = sizeof(struct ether_header) + sizeof(struct arp_header);
-    uint8_t *buf = reinterpret_cast<uint8_t *>(malloc(buf_len));
-
-    struct ether_header *eth_hdr 
-      = reinterpret_cast<struct ether_header*>(buf);
-    struct arp_header *arp_hdr 
-      = reinterpret_cast<struct arp_header*>(buf +
-                                             sizeof(struct ether_header));
-    
-    memcpy(eth_hdr->dst_, p.value("ether.src").ptr(), ETHER_ADDR_LEN);
-    eth_hdr->type_ = htons(ETHERTYPE_ARP);
-
-    arp_hdr->hw_addr_fmt_ = htons(ARPHRD_ETHER);
-    arp_hdr->pr_addr_fmt_ = htons(ETHERTYPE_IP);
-    arp_hdr->hw_addr_len_ = 6;
-    arp_hdr->pr_addr_len_ = 4;
-    arp_hdr->op_ = htons(ARPOP_REPLY);
+    const uint8_t *eth_src = p.value(this->ether_src_).ptr();
+    const uint8_t *src_hw = p.value(this->arp_src_hw_).ptr();
+    const uint8_t *src_pr = p.value(this->arp_src_pr_).ptr();
+    const uint8_t *dst_pr = p.value(this->arp_dst_pr_).ptr();
+    if (eth_src == nullptr || src_hw == nullptr || src_pr == nullptr ||
+        dst_pr == nullptr) {
+      return nullptr;
+    }
 
-    const size_t pr_len = IPV4_ADDR_LEN;
-    const size_t hw_len = ETHER_ADDR_LEN;
-    
-    memcpy(arp_hdr->src_hw_addr_, this->sock_hw_addr(), hw_len);
-    memcpy(arp_hdr->src_pr_addr_, p.value("arp.dst_pr").ptr(), pr_len);
-    memcpy(arp_hdr->dst_hw_addr_, p.value("arp.src_hw").ptr(), hw_len);
-    memcpy(arp_hdr->dst_pr_addr_, p.value("arp.src_pr").ptr(), pr_len);
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->arp_rep_);
+    auto *arp_hdr = reinterpret_cast<struct arp_header*>(eth_hdr + 1);
+    memcpy(eth_hdr->dst_, eth_src, ETHER_ADDR_LEN);
+    memcpy(arp_hdr->src_pr_addr_, dst_pr, IPV4_ADDR_LEN);
+    memcpy(arp_hdr->dst_hw_addr_, src_hw, ETHER_ADDR_LEN);
+    memcpy(arp_hdr->dst_pr_addr_, src_pr, IPV4_ADDR_LEN);
 
-    *len = buf_len;
-    return buf;
+    *len = ARP_LEN;
+    return this->arp_rep_;
   }
   
   
-  void Spoofer::free_arp_reply(uint8_t *ptr) {
-    free(ptr);
-  }
+  uint8_t* Spoofer::build_na_reply(const swarm::Property &p, size_t *len) {
+    static const uint8_t unspec[IPV6_ADDR_LEN] = {0};
+    const uint8_t *src = p.value(this->ipv6_src_).ptr();
+    const uint8_t *target = p.value(this->ns_target_).ptr();
+    if (src == nullptr || target == nullptr ||
+        memcmp(src, unspec, IPV6_ADDR_LEN) == 0) {
+      return nullptr;
+    }
+
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->na_);
+    auto *ipv6_hdr = reinterpret_cast<struct ipv6_header*>(eth_hdr + 1);
+    auto *na = reinterpret_cast<struct nd_advert*>(ipv6_hdr + 1);
+
+    memcpy(eth_hdr->dst_, p.value(this->ether_src_).ptr(), ETHER_ADDR_LEN);
+    memcpy(ipv6_hdr->src_, target, IPV6_ADDR_LEN);
+    memcpy(ipv6_hdr->dst_, src, IPV6_ADDR_LEN);
+    memcpy(na->target_, target, IPV6_ADDR_LEN);
 
-  void Spoofer::free_arp_request(uint8_t *ptr) {
-    free(ptr);
+    // Target address is in both pseudo header (as source) and message.
+    uint32_t tgt_sum = chksum_add(0, target, IPV6_ADDR_LEN);
+    na->chksum_ = chksum_fold(this->na_sum_ + 2 * tgt_sum +
+                              chksum_add(0, src, IPV6_ADDR_LEN));
+
+    *len = NA_LEN;
+    return this->na_;
   }
-  
 
   StaticSpoofer::StaticSpoofer(swarm::Swarm *sw, TargetSet *target_set,
-                               fluent::Logger *logger, RawSock *sock) :
+                               EventLog *logger, RawSock *sock) :
     Spoofer(sw, logger, sock), target_set_(target_set) {
   }
   StaticSpoofer::~StaticSpoofer() {
   }
   void StaticSpoofer::handle_arp_request(const swarm::Property &p) {
     bool replied = false;
-    size_t addr_len;
-    void *dst_addr = p.value("arp.dst_pr").ptr(&addr_len);
-    const void *sock_addr = this->sock_pr_addr();
-    if (this->target_set_->has(p.value("arp.dst_pr").repr()) &&
-        this->has_sock() && 
+    const uint8_t *dst_addr = p.value(this->arp_dst_pr_).ptr();
+    const uint8_t *sock_addr =
+      this->has_sock() ? this->sock_pr_addr() : nullptr;
+    if (dst_addr && this->has_sock() &&
+        this->target_set_->has(dst_addr, IPV4_ADDR_LEN) &&
         (sock_addr == nullptr || 
-        0 != memcmp(dst_addr, sock_addr , addr_len))) {
+         0 != memcmp(dst_addr, sock_addr, IPV4_ADDR_LEN))) {
       size_t buf_len;
       uint8_t* buf = build_arp_reply(p, &buf_len);
-      replied =  this->write(buf, buf_len, "arp-reply");
-      free_arp_reply(buf);
+      if (buf) {
+        replied = this->write(buf, buf_len, "arp-reply");
+      }
     }
 
     if (this->logger_) {
-      fluent::Message *msg = this->logger_->retain_message("lurker.arp_req");
+      Event *msg = this->logger_->retain_message("lurker.arp_req");
       msg->set_ts(p.tv_sec());
-      msg->set("src_addr", p.value("arp.src_pr").repr());
-      msg->set("dst_addr", p.value("arp.dst_pr").repr());
-      msg->set("src_hw", p.value("arp.src_hw").repr());
-      msg->set("dst_hw", p.value("arp.dst_hw").repr());
+      this->set_arp(msg, p);
       msg->set("replied", replied);
+      this->set_dst_names(msg, p, this->arp_dst_pr_);
       this->logger_->emit(msg);
     }    
   }
   void StaticSpoofer::handle_arp_reply(const swarm::Property &p) {
     // Nothing to do.
   }
+  void StaticSpoofer::handle_ns(const swarm::Property &p) {
+    bool replied = false;
+    const uint8_t *target = p.value(this->ns_target_).ptr();
+    if (target && this->target_set_->has(target, IPV6_ADDR_LEN) &&
+        this->has_sock()) {
+      size_t buf_len;
+      uint8_t* buf = build_na_reply(p, &buf_len);
+      if (buf) {
+        replied = this->write(buf, buf_len, "ndp-advert");
+      }
+    }
+
+    if (this->logger_) {
+      Event *msg = this->logger_->retain_message("lurker.ndp_ns");
+      msg->set_ts(p.tv_sec());
+      size_t len;
+      const void *ptr = p.value(this->ipv6_src_).ptr(&len);
+      msg->set_addr("src_addr", ptr, len);
+      ptr = p.value(this->ns_target_).ptr(&len);
+      msg->set_addr("dst_addr", ptr, len);
+      ptr = p.value(this->ether_src_).ptr(&len);
+      msg->set_mac("src_hw", ptr, len);
+      msg->set("replied", replied);
+      this->set_dst_names(msg, p, this->ns_target_);
+      this->logger_->emit(msg);
+    }
+  }
 
 
-  DynamicSpoofer::DynamicSpoofer(swarm::Swarm *sw, fluent::Logger *logger,
+  DynamicSpoofer::DynamicSpoofer(swarm::Swarm *sw, EventLog *logger,
                                  RawSock *sock) :
     Spoofer(sw, logger, sock) {
   }
@@ -206,67 +320,63 @@ namespace lurker {
   }
   
   void DynamicSpoofer::handle_arp_request(const swarm::Property &p) {
-    const std::string &src_addr = p.value("arp.src_pr").repr();
-    const std::string &dst_addr = p.value("arp.dst_pr").repr();
+    const uint8_t *src_pr = p.value(this->arp_src_pr_).ptr();
+    const uint8_t *dst_pr = p.value(this->arp_dst_pr_).ptr();
+    if (src_pr == nullptr || dst_pr == nullptr) {
+      return;
+    }
+    uint32_t src_addr, dst_addr;
+    memcpy(&src_addr, src_pr, sizeof(src_addr));
+    memcpy(&dst_addr, dst_pr, sizeof(dst_addr));
+    this->disg_addrs_.tick(p.tv_sec());
 
     // Remove source address from target address set.
-    if (this->disg_addrs_.find(src_addr) != this->disg_addrs_.end()) {
-      debug(true, "remove: %s", src_addr.c_str());
-      this->disg_addrs_.erase(src_addr);
+    if (this->disg_addrs_.remove(src_addr)) {
       return;
     }
 
     // Reply if the address is target.
-    const time_t timeout = 5;
-    auto it = this->disg_addrs_.find(dst_addr);
-    if (it != this->disg_addrs_.end() &&
-        it->second + timeout > p.tv_sec()) {
-
+    if (this->disg_addrs_.ask(dst_addr) != DisguiseTable::FREE) {
       bool replied = false;
       if (this->has_sock()) {
         size_t buf_len;
         uint8_t* buf = build_arp_reply(p, &buf_len);
-        replied =  this->write(buf, buf_len, "arp-reply");
-        free_arp_reply(buf);
+        if (buf) {
+          replied = this->write(buf, buf_len, "arp-reply");
+        }
       }
 
-      fluent::Message *msg = this->logger_->retain_message("lurker.arp_req");
+      Event *msg = this->logger_->retain_message("lurker.arp_req");
       msg->set_ts(p.tv_sec());
-      msg->set("src_addr", p.value("arp.src_pr").repr());
-      msg->set("dst_addr", p.value("arp.dst_pr").repr());
-      msg->set("src_hw", p.value("arp.src_hw").repr());
-      msg->set("dst_hw", p.value("arp.dst_hw").repr());
+      this->set_arp(msg, p);
       msg->set("replied", replied);
+      this->set_dst_names(msg, p, this->arp_dst_pr_);
       this->logger_->emit(msg);
       
     } else if (src_addr != dst_addr) {
-      // If not Gratuitous ARP, register the address and timestamp.
+      // If not Gratuitous ARP, probe the address. It is registered only
+      // if the request is sent and the table has room.
       size_t buf_len;
-      uint8_t* buf = build_arp_request(p.value("arp.dst_pr").ptr(),
-                                       &buf_len);
-      if (buf) {
-        if (this->write(buf, buf_len, "arp-request")) {
-          // Register the IP address and timestamp if request is sent.
-          this->disg_addrs_.insert(std::make_pair(dst_addr, p.tv_sec())); 
-          debug(true, "add: %s", dst_addr.c_str());
-        }
-        free_arp_request(buf);
-      }      
+      uint8_t* buf = build_arp_request(dst_pr, &buf_len);
+      if (buf && this->write(buf, buf_len, "arp-request")) {
+        this->disg_addrs_.probe(dst_addr, p.tv_sec());
+      }
     }
   }
   void DynamicSpoofer::handle_arp_reply(const swarm::Property &p) {
     const uint8_t *hw_addr =  this->sock_hw_addr();
     assert(hw_addr);
     
-    if (memcmp(p.value("arp.src_hw").ptr(), hw_addr, ETHER_ADDR_LEN) != 0) {
+    const uint8_t *src_pr = p.value(this->arp_src_pr_).ptr();
+    const uint8_t *src_hw = p.value(this->arp_src_hw_).ptr();
+    if (src_pr && src_hw && memcmp(src_hw, hw_addr, ETHER_ADDR_LEN) != 0) {
       // Ignore arp reply from ownself.
-      const std::string &src_addr = p.value("arp.src_pr").repr();
-      
+      uint32_t src_addr;
+      memcpy(&src_addr, src_pr, sizeof(src_addr));
+      this->disg_addrs_.tick(p.tv_sec());
+
       // Remove source address from target address set.
-      if (this->disg_addrs_.find(src_addr) != this->disg_addrs_.end()) {
-        debug(true, "remove: %s", src_addr.c_str());
-        this->disg_addrs_.erase(src_addr);
-      }      
+      this->disg_addrs_.remove(src_addr);
     }
   }
   
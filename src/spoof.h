@@ -28,36 +28,61 @@
 #define SRC_ARP_H__
 
 #include <set>
-#include <fluent.hpp>
+#include "./eventlog.h"
 #include "./rawsock.h"
 #include "./target.h"
+#include "./dnscache.h"
+#include "./disguise.h"
 
 namespace lurker {
   class Spoofer : public swarm::Handler {
   private:
     swarm::Swarm *sw_;
     RawSock *sock_;
-    swarm::ev_id req_id_, rep_id_;
-    swarm::hdlr_id req_h_, rep_h_;
+    swarm::ev_id req_id_, rep_id_, ns_id_;
+    swarm::hdlr_id req_h_, rep_h_, ns_h_;
+
+    // ARP and Neighbor Advertisement frames are prebuilt from the
+    // interface's addresses. Only addresses of the peer are patched per
+    // request, and frames are queued to the socket to be sent in batches.
+    static const size_t ARP_LEN = 42;
+    uint8_t arp_rep_[ARP_LEN];
+    uint8_t arp_req_[ARP_LEN];
+    void init_arp_templates();
+
+    static const size_t NA_LEN = 86;
+    uint8_t na_[NA_LEN];
+    uint32_t na_sum_;   // partial sum of pseudo header and fixed fields
+    void init_na_template();
 
     virtual void handle_arp_request(const swarm::Property &p) {};
     virtual void handle_arp_reply(const swarm::Property &p) {};
+    virtual void handle_ns(const swarm::Property &p) {};
     
   protected:
-    fluent::Logger *logger_;
+    EventLog *logger_;
+    const DnsCache *dns_cache_;
+    swarm::val_id ether_src_, arp_src_pr_, arp_dst_pr_, arp_src_hw_,
+      arp_dst_hw_, ipv6_src_, ns_target_;
+    // Names of the address in value addr_value (e.g. arp_dst_pr_).
+    void set_dst_names(Event *msg, const swarm::Property &p,
+                       swarm::val_id addr_value);
+    void set_arp(Event *msg, const swarm::Property &p);
     bool has_sock() const { return (this->sock_ != nullptr); }
-    bool write(uint8_t *buf, size_t buf_len, const std::string &ev_name);
+    bool write(uint8_t *buf, size_t buf_len, const char *ev_name);
     const uint8_t* sock_hw_addr() const { return this->sock_->hw_addr(); }
     const uint8_t* sock_pr_addr() const { return this->sock_->pr_addr(); }
+    // Builders return the patched template (not to be freed), or nullptr
+    // if the frame can not or must not be sent.
     uint8_t* build_arp_reply(const swarm::Property &p, size_t *len);
-    uint8_t* build_arp_request(void *addr, size_t *len);
-    void free_arp_reply(uint8_t *ptr);
-    void free_arp_request(uint8_t *ptr);
+    uint8_t* build_arp_request(const void *addr, size_t *len);
+    uint8_t* build_na_reply(const swarm::Property &p, size_t *len);
     
   public:
-    Spoofer(swarm::Swarm *sw, fluent::Logger *logger=nullptr,
+    Spoofer(swarm::Swarm *sw, EventLog *logger=nullptr,
             RawSock *sock=nullptr);
     ~Spoofer();
+    void set_dns_cache(const DnsCache *dns_cache);
     void recv(swarm::ev_id eid, const swarm::Property &p);
   };
   
@@ -66,23 +91,24 @@ namespace lurker {
     TargetSet *target_set_;
     void handle_arp_request(const swarm::Property &p);
     void handle_arp_reply(const swarm::Property &p);    
+    void handle_ns(const swarm::Property &p);
 
   public:
     StaticSpoofer(swarm::Swarm *sw, TargetSet *target_set,
-                  fluent::Logger *logger=nullptr, RawSock *sock=nullptr);
+                  EventLog *logger=nullptr, RawSock *sock=nullptr);
     ~StaticSpoofer();
   };
   
   class DynamicSpoofer : public Spoofer {
   private:
-    std::map<std::string, time_t> disg_addrs_; // Disguise addresses
+    DisguiseTable disg_addrs_; // Disguise addresses
     
     // protected:
     void handle_arp_request(const swarm::Property &p);
     void handle_arp_reply(const swarm::Property &p);
     
   public:
-    DynamicSpoofer(swarm::Swarm *sw, fluent::Logger *logger=nullptr,
+    DynamicSpoofer(swarm::Swarm *sw, EventLog *logger=nullptr,
                    RawSock *sock=nullptr);
     ~DynamicSpoofer();
   };
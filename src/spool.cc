@@ -0,0 +1,444 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include "./spool.h"
+
+namespace lurker {
+  // Segment record: [u32 magic][u32 data length][u16 chunk count]
+  // [u8 id length, id]... [data]
+  static const size_t REC_HDR = 10;
+  static const uint64_t FIRST_SEQ = 1ULL << 32;  // room to save before it
+  static const char SEG_SUFFIX[] = ".spool";
+
+  static void put32(std::vector<uint8_t> *buf, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      buf->push_back(static_cast<uint8_t>(v >> (24 - i * 8)));
+    }
+  }
+  static uint32_t get32(const uint8_t *p) {
+    return (static_cast<uint32_t>(p[0]) << 24) |
+      (static_cast<uint32_t>(p[1]) << 16) |
+      (static_cast<uint32_t>(p[2]) << 8) | p[3];
+  }
+
+  SpoolSink::SpoolSink(LogSink *sink, const std::string &dir) :
+    sink_(sink), dir_(dir), mem_budget_(DEFAULT_MEM_BUDGET),
+    disk_budget_(DEFAULT_DISK_BUDGET), mem_bytes_(0), disk_bytes_(0),
+    next_seq_(FIRST_SEQ), wfd_(-1), stopping_(false), rpos_(0), drops_(0),
+    running_(false) {
+  }
+  SpoolSink::~SpoolSink() {
+    this->close();
+    for (size_t i = 0; i < this->mem_.size(); i++) {
+      delete this->mem_[i];
+    }
+    delete this->sink_;
+  }
+
+  void SpoolSink::set_budget(size_t mem, size_t disk) {
+    this->mem_budget_ = mem;
+    this->disk_budget_ = disk;
+  }
+
+  std::string SpoolSink::seg_path(uint64_t seq) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx",
+             static_cast<unsigned long long>(seq));
+    return this->dir_ + "/" + name + SEG_SUFFIX;
+  }
+
+  bool SpoolSink::open() {
+    if (::mkdir(this->dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+      this->errmsg_ = "can not create spool directory: " + this->dir_ +
+        ": " + strerror(errno);
+      return false;
+    }
+    DIR *dir = ::opendir(this->dir_.c_str());
+    if (dir == nullptr) {
+      this->errmsg_ = "can not open spool directory: " + this->dir_ +
+        ": " + strerror(errno);
+      return false;
+    }
+
+    // Segments left by previous run, sent before new batches.
+    std::vector<uint64_t> seqs;
+    struct dirent *ent;
+    while ((ent = ::readdir(dir)) != nullptr) {
+      const char *name = ent->d_name;
+      char *end;
+      if (strlen(name) != 16 + sizeof(SEG_SUFFIX) - 1) {
+        continue;
+      }
+      uint64_t seq = strtoull(name, &end, 16);
+      if (end != name + 16 || strcmp(end, SEG_SUFFIX) != 0) {
+        continue;
+      }
+      seqs.push_back(seq);
+    }
+    ::closedir(dir);
+    std::sort(seqs.begin(), seqs.end());
+
+    for (size_t i = 0; i < seqs.size(); i++) {
+      const std::string path = this->seg_path(seqs[i]);
+      struct stat st;
+      if (::stat(path.c_str(), &st) != 0) {
+        continue;
+      }
+      if (st.st_size == 0) {
+        ::unlink(path.c_str());
+        continue;
+      }
+      Segment seg = {seqs[i], static_cast<size_t>(st.st_size)};
+      this->seg_.push_back(seg);
+      this->disk_bytes_ += seg.size_;
+      this->next_seq_ = seqs[i] + 1;
+    }
+
+    if (pthread_create(&this->th_, nullptr, SpoolSink::sender_thread,
+                       this) != 0) {
+      this->errmsg_ = std::string("can not start spool thread: ") +
+        strerror(errno);
+      return false;
+    }
+    this->running_ = true;
+    return true;
+  }
+
+  void SpoolSink::close() {
+    if (!this->running_) {
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lk(this->lock_);
+      this->stopping_ = true;
+    }
+    this->cond_.notify_one();
+    pthread_join(this->th_, nullptr);
+    this->running_ = false;
+
+    std::lock_guard<std::mutex> lk(this->lock_);
+    this->save_memory();
+    if (this->wfd_ >= 0) {
+      ::close(this->wfd_);
+      this->wfd_ = -1;
+    }
+  }
+
+  void SpoolSink::rec_header(std::vector<uint8_t> *hdr, size_t len,
+                             const std::vector<std::string> &chunks) {
+    hdr->clear();
+    put32(hdr, REC_MAGIC);
+    put32(hdr, static_cast<uint32_t>(len));
+    hdr->push_back(static_cast<uint8_t>(chunks.size() >> 8));
+    hdr->push_back(static_cast<uint8_t>(chunks.size()));
+    for (size_t i = 0; i < chunks.size(); i++) {
+      size_t n = std::min(chunks[i].size(), static_cast<size_t>(255));
+      hdr->push_back(static_cast<uint8_t>(n));
+      hdr->insert(hdr->end(), chunks[i].begin(), chunks[i].begin() + n);
+    }
+  }
+
+  // Called with lock_ held.
+  bool SpoolSink::append(const struct iovec *iov, int iovcnt,
+                         const std::vector<std::string> &chunks,
+                         size_t len) {
+    std::vector<uint8_t> hdr;
+    rec_header(&hdr, len, chunks);
+    size_t rec_len = hdr.size() + len;
+    if (this->disk_bytes_ + rec_len > this->disk_budget_) {
+      this->errmsg_ = "log spool is full: " + this->dir_;
+      return false;
+    }
+
+    if (this->wfd_ >= 0 &&
+        this->seg_.back().size_ + rec_len > SEGMENT_BYTES) {
+      ::close(this->wfd_);
+      this->wfd_ = -1;
+    }
+    if (this->wfd_ < 0) {
+      uint64_t seq = this->next_seq_;
+      const std::string path = this->seg_path(seq);
+      int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+      if (fd < 0) {
+        this->errmsg_ = "can not open spool segment: " + path + ": " +
+          strerror(errno);
+        return false;
+      }
+      this->next_seq_++;
+      this->wfd_ = fd;
+      Segment seg = {seq, 0};
+      this->seg_.push_back(seg);
+    }
+
+    std::vector<struct iovec> v(iov, iov + iovcnt);
+    struct iovec h = {hdr.data(), hdr.size()};
+    v.insert(v.begin(), h);
+    Segment &seg = this->seg_.back();
+    if (!LogSink::writev_all(this->wfd_, v.data(), v.size())) {
+      this->errmsg_ = std::string("log spool write error: ") +
+        strerror(errno);
+      // Cut a partial record, then seal the segment. If that fails too,
+      // the reader stops at the broken record.
+      if (::ftruncate(this->wfd_, seg.size_) != 0) {
+        this->errmsg_ += std::string(", ") + strerror(errno);
+      }
+      ::close(this->wfd_);
+      this->wfd_ = -1;
+      return false;
+    }
+    seg.size_ += rec_len;
+    this->disk_bytes_ += rec_len;
+    return true;
+  }
+
+  // Called with lock_ held and the sender stopped. Batches in memory
+  // are older than all segments, so they go to a segment before them.
+  void SpoolSink::save_memory() {
+    if (this->mem_.empty()) {
+      return;
+    }
+    uint64_t seq = this->seg_.empty() ?
+      this->next_seq_++ : this->seg_.front().seq_ - 1;
+    const std::string path = this->seg_path(seq);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+      std::cerr << "can not save log spool: " << path << ": "
+                << strerror(errno) << std::endl;
+      this->drops_ += this->mem_.size();
+      return;
+    }
+
+    std::vector<uint8_t> hdr;
+    while (!this->mem_.empty()) {
+      Batch *b = this->mem_.front();
+      rec_header(&hdr, b->data_.size(), b->chunk_);
+      struct iovec v[2] = {
+        {hdr.data(), hdr.size()},
+        {b->data_.data(), b->data_.size()},
+      };
+      if (!LogSink::writev_all(fd, v, 2)) {
+        std::cerr << "log spool write error: " << strerror(errno)
+                  << std::endl;
+        this->drops_ += this->mem_.size();
+        break;
+      }
+      this->mem_.pop_front();
+      this->mem_bytes_ -= b->data_.size();
+      delete b;
+    }
+    ::close(fd);
+  }
+
+  bool SpoolSink::write(const struct iovec *iov, int iovcnt) {
+    static const std::vector<std::string> no_chunk;
+    return this->write(iov, iovcnt, no_chunk);
+  }
+
+  bool SpoolSink::write(const struct iovec *iov, int iovcnt,
+                        const std::vector<std::string> &chunks) {
+    size_t len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+      len += iov[i].iov_len;
+    }
+
+    {
+      std::lock_guard<std::mutex> lk(this->lock_);
+      // Once spilled to disk, batches keep going there until the sender
+      // catches up, so they are sent in order.
+      if (this->seg_.empty() &&
+          this->mem_bytes_ + len <= this->mem_budget_) {
+        Batch *b = new Batch();
+        b->data_.reserve(len);
+        for (int i = 0; i < iovcnt; i++) {
+          const uint8_t *p = static_cast<const uint8_t*>(iov[i].iov_base);
+          b->data_.insert(b->data_.end(), p, p + iov[i].iov_len);
+        }
+        b->chunk_ = chunks;
+        this->mem_.push_back(b);
+        this->mem_bytes_ += len;
+      } else if (!this->append(iov, iovcnt, chunks, len)) {
+        this->drops_++;
+        return false;
+      }
+    }
+    this->cond_.notify_one();
+    return true;
+  }
+
+  bool SpoolSink::send_batch(Batch *b) {
+    struct iovec iov = {b->data_.data(), b->data_.size()};
+    return this->sink_->write(&iov, 1, b->chunk_);
+  }
+
+  // Sends batches of a sealed segment from rpos_. A broken record ends
+  // the segment.
+  bool SpoolSink::send_segment(const Segment &seg) {
+    const std::string path = this->seg_path(seg.seq_);
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+      std::cerr << "can not read log spool: " << path << ": "
+                << strerror(errno) << std::endl;
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      return true;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    if (size == 0) {
+      ::close(fd);
+      return true;
+    }
+    void *map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+      std::cerr << "can not map log spool: " << path << ": "
+                << strerror(errno) << std::endl;
+      return true;
+    }
+    ::madvise(map, size, MADV_SEQUENTIAL);
+
+    const uint8_t *p = static_cast<const uint8_t*>(map);
+    bool ok = true;
+    std::vector<std::string> chunks;
+    while (this->rpos_ < size) {
+      size_t pos = this->rpos_;
+      if (size - pos < REC_HDR || get32(p + pos) != REC_MAGIC) {
+        break;
+      }
+      size_t len = get32(p + pos + 4);
+      size_t n = (static_cast<size_t>(p[pos + 8]) << 8) | p[pos + 9];
+      pos += REC_HDR;
+      chunks.clear();
+      for (size_t i = 0; i < n && pos < size; i++) {
+        size_t id_len = p[pos++];
+        if (id_len > size - pos) {
+          break;
+        }
+        chunks.push_back(std::string(reinterpret_cast<const char*>(p + pos),
+                                     id_len));
+        pos += id_len;
+      }
+      if (chunks.size() != n || len > size - pos) {
+        break;
+      }
+
+      struct iovec iov = {const_cast<uint8_t*>(p + pos), len};
+      if (!this->sink_->write(&iov, 1, chunks)) {
+        ok = false;
+        break;
+      }
+      this->rpos_ = pos + len;
+    }
+    if (ok && this->rpos_ < size) {
+      std::cerr << "broken log spool record in " << path << std::endl;
+    }
+    ::munmap(map, size);
+    return ok;
+  }
+
+  void SpoolSink::run() {
+    int retry = MIN_RETRY;
+    bool failing = false;
+    std::unique_lock<std::mutex> lk(this->lock_);
+    while (true) {
+      // Disk segments are left for next run at stop.
+      if (this->stopping_ && (failing || this->mem_.empty())) {
+        break;
+      }
+      if (this->mem_.empty() && this->seg_.empty()) {
+        this->cond_.wait(lk);
+        continue;
+      }
+
+      bool ok;
+      if (!this->mem_.empty()) {
+        Batch *b = this->mem_.front();
+        lk.unlock();
+        ok = this->send_batch(b);
+        lk.lock();
+        if (ok) {
+          this->mem_.pop_front();
+          this->mem_bytes_ -= b->data_.size();
+          delete b;
+        }
+      } else {
+        Segment seg = this->seg_.front();
+        if (this->wfd_ >= 0 && this->seg_.size() == 1) {
+          // Seal the segment to read; next batch starts a new one.
+          ::close(this->wfd_);
+          this->wfd_ = -1;
+        }
+        lk.unlock();
+        ok = this->send_segment(seg);
+        lk.lock();
+        if (ok) {
+          ::unlink(this->seg_path(seg.seq_).c_str());
+          this->seg_.pop_front();
+          this->disk_bytes_ -= seg.size_;
+          this->rpos_ = 0;
+        }
+      }
+
+      if (ok) {
+        if (failing) {
+          std::cerr << "log output recovered" << std::endl;
+        }
+        failing = false;
+        retry = MIN_RETRY;
+        continue;
+      }
+      if (!failing) {
+        std::cerr << "log output error: " << this->sink_->errmsg()
+                  << ", spooling" << std::endl;
+        failing = true;
+      }
+      std::chrono::steady_clock::time_point until =
+        std::chrono::steady_clock::now() + std::chrono::seconds(retry);
+      while (!this->stopping_ &&
+             this->cond_.wait_until(lk, until) != std::cv_status::timeout) {
+      }
+      retry = std::min(retry * 2, static_cast<int>(MAX_RETRY));
+    }
+  }
+
+  void *SpoolSink::sender_thread(void *obj) {
+    static_cast<SpoolSink*>(obj)->run();
+    return nullptr;
+  }
+}
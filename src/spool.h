@@ -0,0 +1,123 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_SPOOL_H__
+#define SRC_SPOOL_H__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "./logsink.h"
+
+namespace lurker {
+  // ----------------------------------------------------------------
+  // class SpoolSink:
+  // Queue in front of a slow or unreliable sink. Batches written by the
+  // log writer thread are kept in memory up to mem_budget, and appended
+  // to segment files in a directory beyond it, up to disk_budget; a
+  // sender thread writes them to the sink in order, retrying after
+  // errors. A batch is dropped only when both budgets are exhausted.
+  //
+  // Segments are read by mmap once they are sealed, and removed when all
+  // their batches are written. Segments left in the directory are sent
+  // after restart, and batches in memory are saved to a segment on
+  // close, so a batch may be sent twice but is not lost.
+  //
+  class SpoolSink : public LogSink {
+  public:
+    static const size_t DEFAULT_MEM_BUDGET = 1 << 24;      // 16 MB
+    static const size_t DEFAULT_DISK_BUDGET = 1 << 30;     // 1 GB
+    static const size_t SEGMENT_BYTES = 1 << 26;           // 64 MB
+    static const int MIN_RETRY = 1;                        // seconds
+    static const int MAX_RETRY = 30;
+    static const uint32_t REC_MAGIC = 0x4c524b53;          // "LRKS"
+
+  private:
+    struct Batch {
+      std::vector<uint8_t> data_;
+      std::vector<std::string> chunk_;
+    };
+    struct Segment {
+      uint64_t seq_;
+      size_t size_;
+    };
+
+    LogSink *sink_;
+    std::string dir_;
+    size_t mem_budget_, disk_budget_;
+
+    // Guarded by lock_.
+    std::mutex lock_;
+    std::condition_variable cond_;
+    std::deque<Batch*> mem_;
+    size_t mem_bytes_;
+    std::deque<Segment> seg_;          // back is open for append if wfd_
+    size_t disk_bytes_;
+    uint64_t next_seq_;
+    int wfd_;
+    bool stopping_;
+
+    size_t rpos_;                      // read offset in seg_.front()
+    std::atomic<uint64_t> drops_;
+    pthread_t th_;
+    bool running_;
+
+    std::string seg_path(uint64_t seq) const;
+    static void rec_header(std::vector<uint8_t> *hdr, size_t len,
+                           const std::vector<std::string> &chunks);
+    bool append(const struct iovec *iov, int iovcnt,
+                const std::vector<std::string> &chunks, size_t len);
+    void save_memory();
+    bool send_segment(const Segment &seg);
+    bool send_batch(Batch *b);
+    void run();
+    static void *sender_thread(void *obj);
+
+  public:
+    // Takes ownership of sink.
+    SpoolSink(LogSink *sink, const std::string &dir);
+    ~SpoolSink();
+    void set_budget(size_t mem, size_t disk);
+    // Creates dir if needed, finds segments left in it and starts the
+    // sender thread.
+    bool open();
+    // Stops the sender thread after it writes batches in memory, or
+    // saves them to disk if the sink is failing.
+    void close();
+    bool write(const struct iovec *iov, int iovcnt);
+    bool write(const struct iovec *iov, int iovcnt,
+               const std::vector<std::string> &chunks);
+    uint64_t drops() const { return this->drops_.load(); }
+  };
+}
+
+
+#endif  // SRC_SPOOL_H__
@@ -72,6 +72,9 @@ namespace swarm {
   bool Decoder::accept (const Property &p) {
     return false;
   }
+  bool Decoder::set_session_filter (SessionFilter *filter) {
+    return false;
+  }
 
   Decoder::Decoder (NetDec *nd) : nd_(nd) {
   }
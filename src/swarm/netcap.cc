@@ -108,6 +108,19 @@ namespace swarm {
     NetCap *nc = reinterpret_cast<NetCap*>(w->data);
     debug(false,  "IO_event: %d", revents);
     nc->handler(revents);
+
+    if (!nc->batch_task_.empty()) {
+      double tv = ev_now(EV_A);
+      double tv_sec, tv_nsec;
+      struct timespec ts;
+      tv_nsec = modf(tv, &tv_sec);
+      ts.tv_sec  = static_cast<time_t>(tv_sec);
+      ts.tv_nsec = static_cast<long>(tv_nsec * 1e+9);
+      for (auto it = nc->batch_task_.begin(); it != nc->batch_task_.end();
+           it++) {
+        it->second->exec(ts);
+      }
+    }
   }
 
   void NetCap::handle_timeout(EV_P_ struct ev_timer *w, int revents) {
@@ -139,10 +152,15 @@ namespace swarm {
     this->last_id_++;
     return ent->id();
   }
+  task_id NetCap::set_batch_task(Task *task) {
+    task_id id = this->last_id_++;
+    this->batch_task_.insert(std::make_pair(id, task));
+    return id;
+  }
   bool NetCap::unset_task(task_id id) {
     auto it = this->task_entry_.find(id);
     if (this->task_entry_.end() == it) {
-      return false;
+      return (this->batch_task_.erase(id) > 0);
     } else {
       TaskEntry *ent = it->second;
       this->task_entry_.erase(it->first);
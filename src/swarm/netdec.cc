@@ -300,6 +300,21 @@ namespace swarm {
     return true;
   }
 
+  bool NetDec::set_session_filter (const std::string &dec_name,
+                                   SessionFilter *filter) {
+    dec_id d_id = this->lookup_dec_id (dec_name);
+    if (d_id == DEC_NULL || !this->dec_mod_[d_id]) {
+      this->errmsg_ = "no such decoder name: " + dec_name;
+      return false;
+    }
+
+    if (!this->dec_mod_[d_id]->set_session_filter (filter)) {
+      this->errmsg_ = "decoder does not support session filter: " + dec_name;
+      return false;
+    }
+    return true;
+  }
+
 
   // -------------------------------------------------------------------------------
   // NetDec Handler
@@ -184,7 +184,7 @@ namespace swarm {
   }
 
   void Property::addr2str (void * addr, size_t len, std::string *s) {
-    char buf[32];
+    char buf[INET6_ADDRSTRLEN];
     if (len == 4) {
       ::inet_ntop (AF_INET, addr, buf, sizeof (buf));
       s->assign (buf);
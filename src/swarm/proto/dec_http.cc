@@ -24,13 +24,371 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#include "../swarm/decode.h"
+#include "../utils/lru-hash.h"
+#include "../debug.h"
 
 namespace swarm {
-  class HttpRequestDecoder {
+  // Find the first byte that is c1 or c2 in [p, ep). SSE2 compares 16
+  // bytes at once and the tail is checked byte by byte.
+  static inline const byte_t *scan_byte2(const byte_t *p, const byte_t *ep,
+                                         byte_t c1, byte_t c2) {
+#ifdef __SSE2__
+    const __m128i v1 = _mm_set1_epi8(static_cast<char>(c1));
+    const __m128i v2 = _mm_set1_epi8(static_cast<char>(c2));
+    for (; ep - p >= 16; p += 16) {
+      const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      const int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(d, v1),
+                                                   _mm_cmpeq_epi8(d, v2)));
+      if (m != 0) {
+        return p + __builtin_ctz(m);
+      }
+    }
+#endif
+    for (; p < ep; p++) {
+      if (*p == c1 || *p == c2) {
+        return p;
+      }
+    }
+    return nullptr;
+  }
+
+  // --------------------------------------------------------------
+  // HttpSession keeps a request header that is split into several
+  // segments. Requests in one segment never create HttpSession.
+  class HttpSession : public LRUHash::Node {
+  public:
+    static const size_t KEY_MAX = 64;
+    static const size_t BUF_MAX = 4096;
+
   private:
+    uint8_t key_[KEY_MAX];
+    size_t key_len_;
+    uint64_t hash_;
+    time_t ts_;
+    byte_t buf_[BUF_MAX];
+    size_t len_;
+    size_t resume_;  // Header end search restarts here
+
   public:
-    HttpRequestDecoder ();
+    HttpSession(const void *key, size_t key_len, uint64_t hash) :
+      key_len_(key_len), hash_(hash), ts_(0), len_(0), resume_(0) {
+      assert(key_len <= KEY_MAX);
+      ::memcpy(this->key_, key, key_len);
+    }
+    ~HttpSession() {}
+    uint64_t hash() { return this->hash_; }
+    bool match(const void *key, size_t len) {
+      return (this->key_len_ == len && 0 == ::memcmp(this->key_, key, len));
+    }
+    void set_ts(time_t ts) { this->ts_ = ts; }
+    time_t ts() const { return this->ts_; }
+
+    bool pending() const { return (this->len_ > 0); }
+    const byte_t *buf() const { return this->buf_; }
+    size_t len() const { return this->len_; }
+    size_t resume() const { return this->resume_; }
+    void set_resume(size_t resume) { this->resume_ = resume; }
+    bool append(const byte_t *data, size_t len) {
+      if (this->len_ + len > BUF_MAX) {
+        return false;
+      }
+      ::memcpy(this->buf_ + this->len_, data, len);
+      this->len_ += len;
+      return true;
+    }
+    // Buffer is not cleared because values of current packet may refer it.
+    void reset() {
+      this->len_ = 0;
+      this->resume_ = 0;
+    }
   };
 
+
+  // --------------------------------------------------------------
+  // HttpRequestDecoder parses HTTP/1.x request line and header fields in
+  // client data of tcp_ssn. All values refer segment data (or buffer of
+  // HttpSession for split request) without copy.
+  class HttpRequestDecoder : public Decoder {
+  private:
+    static const size_t METHOD_MIN = 3;
+    static const size_t METHOD_MAX = 16;
+    static const size_t SSN_MAX = 1024;
+    static const time_t TIMEOUT = 30;
+
+    ev_id EV_REQ_;
+    val_id P_METHOD_, P_URI_, P_VERSION_, P_HOST_, P_UA_;
+    val_id P_HDR_, P_HDR_NAME_, P_HDR_VAL_, P_BODY_, P_SEG_USED_;
+    val_id P_SEG_;
+    LRUHash *ssn_table_;
+    size_t ssn_count_;
+    time_t last_ts_;
+
+    static bool is_request(const byte_t *p, size_t len);
+    static size_t find_header_end(const byte_t *p, size_t len,
+                                  size_t *resume);
+    bool parse(Property *p, const byte_t *data, size_t hdr_len, size_t len);
+    HttpSession *fetch_session(Property *p, bool create);
+    void timeout_session(time_t tv_sec);
+
+  public:
+    explicit HttpRequestDecoder (NetDec * nd);
+    ~HttpRequestDecoder ();
+    void setup (NetDec * nd);
+    static Decoder * New (NetDec * nd) { return new HttpRequestDecoder (nd); }
+    bool decode (Property *p);
+  };
+
+  HttpRequestDecoder::HttpRequestDecoder (NetDec * nd) :
+    Decoder (nd), ssn_count_(0), last_ts_(0) {
+    this->EV_REQ_ = nd->assign_event ("http.request", "HTTP Request");
+
+    this->P_METHOD_  = nd->assign_value ("http.method", "HTTP Method");
+    this->P_URI_     = nd->assign_value ("http.uri", "HTTP Request URI");
+    this->P_VERSION_ = nd->assign_value ("http.version", "HTTP Version");
+    this->P_HOST_    = nd->assign_value ("http.host", "HTTP Host Header");
+    this->P_UA_      = nd->assign_value ("http.user_agent",
+                                         "HTTP User-Agent Header");
+    this->P_HDR_     = nd->assign_value ("http.header",
+                                         "HTTP Header Fields (raw)");
+    this->P_HDR_NAME_ = nd->assign_value ("http.hdr_name",
+                                          "HTTP Header Field Name");
+    this->P_HDR_VAL_  = nd->assign_value ("http.hdr_value",
+                                          "HTTP Header Field Value");
+    this->P_BODY_    = nd->assign_value ("http.body",
+                                         "HTTP Message Body in segment");
+    this->P_SEG_USED_ = nd->assign_value ("http.segment",
+                                          "Segment data used by HTTP");
+
+    this->ssn_table_ = new LRUHash(TIMEOUT * 2, 0x3ff);
+  }
+  HttpRequestDecoder::~HttpRequestDecoder () {
+    this->ssn_table_->prog(TIMEOUT * 2);
+    HttpSession *ssn;
+    while (nullptr !=
+           (ssn = static_cast<HttpSession*>(this->ssn_table_->pop()))) {
+      delete ssn;
+    }
+    delete this->ssn_table_;
+  }
+
+  void HttpRequestDecoder::setup (NetDec * nd) {
+    this->P_SEG_ = nd->lookup_value_id ("tcp_ssn.segment");
+  }
+
+  bool HttpRequestDecoder::is_request(const byte_t *p, size_t len) {
+    // Request line starts with method token (upper case letters) and SP.
+    size_t i;
+    for (i = 0; i < len && i <= METHOD_MAX; i++) {
+      if (p[i] == ' ') {
+        break;
+      }
+      if (p[i] < 'A' || 'Z' < p[i]) {
+        return false;
+      }
+    }
+    return (METHOD_MIN <= i && i <= METHOD_MAX && i < len);
+  }
+
+  size_t HttpRequestDecoder::find_header_end(const byte_t *p, size_t len,
+                                             size_t *resume) {
+    // Search an empty line ("\r\n\r\n" or "\n\n") from *resume. Returns
+    // length of request line and header fields including the empty line,
+    // or 0 if not found. *resume is moved to the position to restart.
+    const byte_t *ep = p + len;
+    const byte_t *lf = p + *resume;
+
+    while (nullptr != (lf = scan_byte2(lf, ep, '\n', '\n'))) {
+      if (lf + 1 < ep && lf[1] == '\n') {
+        return (lf + 2) - p;
+      }
+      if (lf + 2 < ep && lf[1] == '\r' && lf[2] == '\n') {
+        return (lf + 3) - p;
+      }
+      if (lf + 2 >= ep) {
+        // Need next segment to check the line.
+        *resume = lf - p;
+        return 0;
+      }
+      lf++;
+    }
+
+    *resume = len;
+    return 0;
+  }
+
+  bool HttpRequestDecoder::parse(Property *p, const byte_t *data,
+                                 size_t hdr_len, size_t len) {
+    byte_t *d = const_cast<byte_t*>(data);
+    const byte_t *ep = data + hdr_len;
+
+    // Request line: method SP request-target SP HTTP-version CRLF
+    const byte_t *sp1 = scan_byte2(data, ep, ' ', '\n');
+    if (sp1 == nullptr || *sp1 != ' ') {
+      return false;
+    }
+    const byte_t *uri = sp1 + 1;
+    const byte_t *eol = scan_byte2(uri, ep, '\n', '\n');
+    assert(eol != nullptr);  // ep is after empty line
+    const byte_t *le = (eol > uri && eol[-1] == '\r') ? eol - 1 : eol;
+    const byte_t *sp2 = le;
+    while (sp2 > uri && sp2[-1] != ' ') {
+      sp2--;
+    }
+    if (sp2 == uri) {
+      // HTTP/0.9 style "GET /path" without version
+      sp2 = le + 1;
+    }
+
+    p->set (this->P_METHOD_, d, sp1 - data);
+    p->set (this->P_URI_, d + (uri - data), (sp2 - 1) - uri);
+    if (sp2 < le) {
+      p->set (this->P_VERSION_, d + (sp2 - data), le - sp2);
+    }
+
+    // Header fields: field-name ":" OWS field-value OWS CRLF
+    const byte_t *hdr = eol + 1;
+    p->set (this->P_HDR_, d + (hdr - data), ep - hdr);
+
+    for (const byte_t *line = hdr; line < ep; line = eol + 1) {
+      eol = scan_byte2(line, ep, '\n', '\n');
+      if (eol == nullptr) {
+        break;
+      }
+      le = (eol > line && eol[-1] == '\r') ? eol - 1 : eol;
+      if (le == line) {
+        break;  // empty line, end of header
+      }
+
+      const byte_t *colon = scan_byte2(line, le, ':', ':');
+      if (colon == nullptr) {
+        continue;  // broken field, just skip
+      }
+      const byte_t *vs = colon + 1, *ve = le;
+      while (vs < ve && (*vs == ' ' || *vs == '\t')) {
+        vs++;
+      }
+      while (ve > vs && (ve[-1] == ' ' || ve[-1] == '\t')) {
+        ve--;
+      }
+
+      const size_t n_len = colon - line;
+      byte_t *n_ptr = d + (line - data), *v_ptr = d + (vs - data);
+      p->set (this->P_HDR_NAME_, n_ptr, n_len);
+      p->set (this->P_HDR_VAL_, v_ptr, ve - vs);
+
+      if (n_len == 4 && 0 == ::strncasecmp("Host",
+                                           reinterpret_cast<char*>(n_ptr), 4)) {
+        p->set (this->P_HOST_, v_ptr, ve - vs);
+      } else if (n_len == 10 &&
+                 0 == ::strncasecmp("User-Agent",
+                                    reinterpret_cast<char*>(n_ptr), 10)) {
+        p->set (this->P_UA_, v_ptr, ve - vs);
+      }
+    }
+
+    if (len > hdr_len) {
+      p->set (this->P_BODY_, d + hdr_len, len - hdr_len);
+    }
+
+    p->push_event (this->EV_REQ_);
+    return true;
+  }
+
+  void HttpRequestDecoder::timeout_session(time_t tv_sec) {
+    if (this->last_ts_ > 0 && this->last_ts_ < tv_sec) {
+      this->ssn_table_->prog(tv_sec - this->last_ts_);
+    }
+    this->last_ts_ = tv_sec;
+
+    HttpSession *ssn;
+    while (nullptr !=
+           (ssn = static_cast<HttpSession*>(this->ssn_table_->pop()))) {
+      if (ssn->ts() + TIMEOUT < tv_sec) {
+        delete ssn;
+        this->ssn_count_--;
+      } else {
+        this->ssn_table_->put(TIMEOUT, ssn);
+      }
+    }
+  }
+
+  HttpSession *HttpRequestDecoder::fetch_session(Property *p, bool create) {
+    size_t key_len;
+    const void *key = p->ssn_label(&key_len);
+    HttpSession *ssn = static_cast<HttpSession*>
+      (this->ssn_table_->get(p->hash_value(), key, key_len));
+
+    if (!ssn && create && this->ssn_count_ < SSN_MAX &&
+        key_len <= HttpSession::KEY_MAX) {
+      ssn = new HttpSession(key, key_len, p->hash_value());
+      this->ssn_table_->put(TIMEOUT, ssn);
+      this->ssn_count_++;
+    }
+
+    if (ssn) {
+      ssn->set_ts(p->tv_sec());
+    }
+    return ssn;
+  }
+
+  bool HttpRequestDecoder::decode (Property *p) {
+    size_t seg_len;
+    byte_t *seg = p->value(this->P_SEG_).ptr(&seg_len);
+    if (seg == nullptr || seg_len == 0) {
+      return false;
+    }
+
+    this->timeout_session(p->tv_sec());
+
+    const byte_t *data = seg;
+    size_t len = seg_len, resume = 0;
+    HttpSession *ssn = (this->ssn_count_ > 0) ?
+      this->fetch_session(p, false) : nullptr;
+
+    if (ssn && ssn->pending()) {
+      // Continued header of request in previous segment(s).
+      if (!ssn->append(seg, seg_len)) {
+        debug(false, "too long request header");
+        ssn->reset();
+        return false;
+      }
+      data = ssn->buf();
+      len = ssn->len();
+      resume = ssn->resume();
+    } else if (!is_request(seg, seg_len)) {
+      return false;
+    }
+
+    size_t hdr_len = find_header_end(data, len, &resume);
+    if (hdr_len == 0) {
+      // Header is not completed yet, wait next segment.
+      if (ssn == nullptr) {
+        ssn = this->fetch_session(p, true);
+        if (ssn == nullptr || !ssn->append(seg, seg_len)) {
+          return false;
+        }
+      }
+      ssn->set_resume(resume);
+      // The segment is not marked as used until the request is parsed,
+      // so it is still logged as raw data if the header never completes.
+      return true;
+    }
+
+    bool rc = this->parse(p, data, hdr_len, len);
+    if (ssn) {
+      ssn->reset();
+    }
+    if (rc) {
+      p->set (this->P_SEG_USED_, seg, seg_len);
+    }
+    return rc;
+  }
+
+  INIT_DECODER (http, HttpRequestDecoder::New);
 }  // namespace swarm
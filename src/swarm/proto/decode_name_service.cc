@@ -24,18 +24,17 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <sstream>
+#include <stdio.h>
+#include <ctype.h>
 #include "./decode_name_service.h"
 #include "./debug.h"
 
 namespace swarm {
   std::string NameServiceDecoder::VarNameServiceData::repr() const {
     std::string s;
+    size_t len;
+    const byte_t * ptr = this->ptr(&len);
 
-    size_t r_len;
-    byte_t * r_ptr = this->ptr(&r_len);
-
-    bool rc = false;
     switch (this->type_) {
     case  1: s = this->ip4(); break;  // A
     case 28: s = this->ip6(); break;  // AAAA
@@ -45,12 +44,11 @@ namespace swarm {
     case 12:  // PTR
     case 15:  // MX
       {
-        size_t len;
-        byte_t * ptr = this->ptr(&len);
-        byte_t * rp
-          = NameServiceDecoder::parse_label (ptr, len, this->base_ptr_,
-                                             this->total_len_, &s);
-        if (rp == NULL) {
+        size_t n_len;
+        const char * n = this->name(&n_len);
+        if (n) {
+          s.assign(n, n_len);
+        } else {
           s = Value::null_;
         }
       }
@@ -58,24 +56,20 @@ namespace swarm {
 
     case 16: // TXT
       {
-        std::stringstream ss;
-        size_t len, d_len;
-        byte_t * start_ptr = this->ptr(&len);
-        debug(0, "len = %zd", len);
-        for (byte_t *p = start_ptr; p - start_ptr < len; p += d_len) {
-          if (p > start_ptr) {
-            ss << ",";
-          }
-          d_len = *p;
-          p += 1;          
-          debug(0, "d_len = %d, p - s (%d)", d_len, p - start_ptr);
-
-          if (p - start_ptr + d_len > len) {
+        // character-strings are joined by ","
+        s.reserve(len);
+        for (size_t i = 0; i < len; ) {
+          const size_t d_len = ptr[i];
+          i += 1;
+          if (i + d_len > len) {
             break;
           }
-          ss << std::string(reinterpret_cast<char *>(p), d_len);
+          if (i > 1) {
+            s.push_back(',');
+          }
+          s.append(reinterpret_cast<const char *>(ptr + i), d_len);
+          i += d_len;
         }
-        s = ss.str();
       }
       break;
 
@@ -87,46 +81,96 @@ namespace swarm {
 
     default:
       {
-        std::stringstream ss;
-        size_t len;
-        byte_t *p, *start_ptr = this->ptr(&len);
         debug (0, "unsupported name service type: %d", this->type_);
-        for(p = start_ptr; p - start_ptr < len; p++) {
-          char c = static_cast<char>(*p);
-          ss << (isprint(c) ? c : '.');
+        s.resize(len);
+        for (size_t i = 0; i < len; i++) {
+          s[i] = isprint(ptr[i]) ? static_cast<char>(ptr[i]) : '.';
         }
-        s = ss.str();
       }
     }
     return s;
   }
 
+  const char *NameServiceDecoder::VarNameServiceData::name(size_t *len) const {
+    if (!this->decoded_) {
+      size_t d_len;
+      const byte_t * d_ptr = this->ptr(&d_len);
+      const byte_t * rp = nullptr;
+
+      this->decoded_ = true;
+      this->name_len_ = 0;
+
+      switch (this->type_) {
+      case  2:  // NS
+      case  5:  // CNAME
+      case  6:  // SOA (MNAME)
+      case 12:  // PTR
+        rp = d_ptr;
+        break;
+      case 15:  // MX has 16bit preference before exchange name
+        rp = (d_len > 2) ? d_ptr + 2 : nullptr;
+        break;
+      }
+
+      if (rp == nullptr ||
+          nullptr == NameServiceDecoder::parse_label (rp, this->base_ptr_,
+                                                      this->total_len_,
+                                                      this->name_,
+                                                      &this->name_len_)) {
+        this->name_len_ = 0;
+      }
+    }
+
+    if (this->name_len_ == 0) {
+      return nullptr;
+    }
+    *len = this->name_len_;
+    return this->name_;
+  }
+
   void NameServiceDecoder::VarNameServiceData::set_data (byte_t * ptr,
                                                          size_t len,
                                                          u_int16_t type,
-                                                         byte_t * base_ptr,
+                                                         const byte_t * base_ptr,
                                                          size_t total_len) {
     this->set (ptr, len);
     this->type_ = type;
     this->base_ptr_ = base_ptr;
     this->total_len_ = total_len;
+    this->decoded_ = false;
   }
 
   std::string NameServiceDecoder::VarNameServiceName::repr() const {
     size_t len;
-    byte_t * ptr = this->ptr(&len);
-    byte_t * rp;
-    std::string s;
-    rp = NameServiceDecoder::parse_label (ptr, len, this->base_ptr_,
-                                          this->total_len_, &s);
-    return (rp != NULL) ? s : Value::null_;
+    const char * n = this->name(&len);
+    return (n != nullptr) ? std::string(n, len) : Value::null_;
+  }
+
+  const char *NameServiceDecoder::VarNameServiceName::name(size_t *len) const {
+    if (!this->decoded_) {
+      this->decoded_ = true;
+      if (nullptr == NameServiceDecoder::parse_label (this->ptr(),
+                                                      this->base_ptr_,
+                                                      this->total_len_,
+                                                      this->name_,
+                                                      &this->name_len_)) {
+        this->name_len_ = 0;
+      }
+    }
+
+    if (this->name_len_ == 0) {
+      return nullptr;
+    }
+    *len = this->name_len_;
+    return this->name_;
   }
 
   void NameServiceDecoder::VarNameServiceName::set_data
-  (byte_t * ptr, size_t len, byte_t * base_ptr, size_t total_len) {
+  (byte_t * ptr, size_t len, const byte_t * base_ptr, size_t total_len) {
     this->set (ptr, len);
     this->base_ptr_ = base_ptr;
     this->total_len_ = total_len;
+    this->decoded_ = false;
   }
 
   NameServiceDecoder::NameServiceDecoder (NetDec * nd,
@@ -158,12 +202,15 @@ namespace swarm {
       std::string name_key = bn + "." + base + "_name";
       std::string type_key = bn + "." + base + "_type";
       std::string data_key = bn + "." + base + "_data";
+      std::string ttl_key  = bn + "." + base + "_ttl";
       this->NS_NAME[i] = nd->assign_value(name_key, desc + " Name",
                                           new FacNameServiceName ());
       this->NS_TYPE[i] = nd->assign_value(type_key, desc + " Type",
                                           new FacType ());
       this->NS_DATA[i] = nd->assign_value(data_key, desc + " Data",
                                           new FacNameServiceData ());
+      this->NS_TTL[i]  = nd->assign_value(ttl_key, desc + " TTL",
+                                          new FacNum ());
     }
   }
 
@@ -184,13 +231,11 @@ namespace swarm {
 
     p->push_event (this->EV_NS_PKT_);
 
-    int rr_count[4], rr_delim[4];
+    int rr_count[4];
     rr_count[RR_QD] = ntohs (hdr->qd_count_);
     rr_count[RR_AN] = ntohs (hdr->an_count_);
     rr_count[RR_NS] = ntohs (hdr->ns_count_);
     rr_count[RR_AR] = ntohs (hdr->ar_count_);
-    int rr_total =
-      rr_count[RR_QD] + rr_count[RR_AN] + rr_count[RR_NS] + rr_count[RR_AR];
 
     for (int i = 0; i < 4; i++) {
       if (rr_count[i] > 0) {
@@ -198,92 +243,85 @@ namespace swarm {
       }
     }
 
-    for (int i = 0; i < 4; i++) {
-      rr_delim[i] = (i == 0 ? 0 : (rr_delim[i - 1] + rr_count[i - 1]));
-    }
-
     debug (DEBUG, "trans_id:0x%04X, flags:%04X, qd=%d, an=%d, ns=%d, ar=%d",
            hdr->trans_id_, hdr->flags_, rr_count[RR_QD], rr_count[RR_AN],
            rr_count[RR_NS], rr_count[RR_AR]);
 
-    const size_t total_len = p->remain ();
-    byte_t *ptr = p->payload (total_len);
+    const size_t remain = p->remain ();
+    byte_t *ptr = p->payload (remain);
     assert (ptr != NULL);
-    const byte_t * ep = base_ptr + hdr_len + total_len;
+    // Compression pointers are offsets from the top of message (header).
+    const size_t total_len = hdr_len + remain;
+    const byte_t * ep = base_ptr + total_len;
 
     p->set (this->P_ID_, &(hdr->trans_id_), sizeof (hdr->trans_id_));
     u_int32_t query = htonl(((hdr->flags_ & NS_FLAG_MASK_QUERY) > 0) ? 1 : 0);
     p->copy (this->P_QUERY_, &(query), sizeof(query));
 
-    // parsing resource record
-    int target = 0, rr_c = 0;
-    for (int c = 0; c < rr_total; c++) {
-      while (rr_c >= rr_count[target]) {
-        rr_c = 0;
-        target++;
-        assert (target < RR_CNT);
-      }
-      rr_c++;
-
-      int remain = ep - ptr;
-      // assert (ep - ptr > 0);
-      if (ep <= ptr) {
-        return false;
-      }
-
-      VarNameServiceName * vn =
-        dynamic_cast <VarNameServiceName*> (p->retain (this->NS_NAME[target]));
-      assert (vn != NULL);
-      vn->set_data (ptr, remain, base_ptr, total_len);
-
-      if (NULL == (ptr = NameServiceDecoder::parse_label (ptr, remain, base_ptr,
-                                                          total_len, NULL))) {
-        debug (DEBUG, "label parse error");
-        break;
-      }
-
-      // assert (ep - ptr);
-      if (ep <= ptr) {
-        return false;
-      }
-
-      if (ep - ptr < static_cast<int>(sizeof (struct ns_rr_header))) {
-        debug (DEBUG, "not enough length: %ld", ep - ptr);
-        break;
-      }
-      struct ns_rr_header * rr_hdr =
-        reinterpret_cast <struct ns_rr_header*>(ptr);
-      ptr += sizeof (struct ns_rr_header);
+    // parsing resource record. Every record consumes at least 5 bytes, so
+    // the loop stops by running out of data even if counts are forged.
+    for (int target = RR_QD; target < RR_CNT; target++) {
+      for (int c = 0; c < rr_count[target]; c++) {
+        if (ep <= ptr) {
+          return false;
+        }
 
-      // set value
-      p->set (this->NS_TYPE[target], &(rr_hdr->type_),
-              sizeof (rr_hdr->type_));
+        // Values are created by FacNameServiceName/FacNameServiceData
+        // assigned in constructor, then static_cast is safe.
+        VarNameServiceName * vn =
+          static_cast <VarNameServiceName*> (p->retain (this->NS_NAME[target]));
+        assert (vn != NULL);
+        vn->set_data (ptr, ep - ptr, base_ptr, total_len);
+
+        const byte_t * np =
+          NameServiceDecoder::parse_label (ptr, base_ptr, total_len);
+        if (np == nullptr) {
+          debug (DEBUG, "label parse error");
+          return true;
+        }
+        ptr = const_cast<byte_t *>(np);
 
-      // has resource data field
-      if (c >= rr_count[RR_QD]) {
-        if (ep - ptr < static_cast<int>(sizeof (struct ns_ans_header))) {
+        if (ep - ptr < static_cast<int>(sizeof (struct ns_rr_header))) {
           debug (DEBUG, "not enough length: %ld", ep - ptr);
-          break;
-        }
-        struct ns_ans_header * ans_hdr =
-          reinterpret_cast<struct ns_ans_header*> (ptr);
-        ptr += sizeof (struct ns_ans_header);
-        const size_t rd_len = ntohs (ans_hdr->rd_len_);
-
-        if (ep - ptr < static_cast<int>(rd_len)) {
-          debug (DEBUG, "not match resource record len(%zd) and remain (%zd)",
-                 rd_len, ep - ptr);
-          break;
+          return true;
         }
+        struct ns_rr_header * rr_hdr =
+          reinterpret_cast <struct ns_rr_header*>(ptr);
+        ptr += sizeof (struct ns_rr_header);
 
         // set value
-        VarNameServiceData * v = dynamic_cast <VarNameServiceData*>
-          (p->retain (this->NS_DATA[target]));
-        assert (v != NULL);
-        v->set_data (ptr, rd_len, htons (rr_hdr->type_), base_ptr, total_len);
+        p->set (this->NS_TYPE[target], &(rr_hdr->type_),
+                sizeof (rr_hdr->type_));
+
+        // has resource data field
+        if (target != RR_QD) {
+          if (ep - ptr < static_cast<int>(sizeof (struct ns_ans_header))) {
+            debug (DEBUG, "not enough length: %ld", ep - ptr);
+            return true;
+          }
+          struct ns_ans_header * ans_hdr =
+            reinterpret_cast<struct ns_ans_header*> (ptr);
+          ptr += sizeof (struct ns_ans_header);
+          p->set (this->NS_TTL[target], &(ans_hdr->ttl_),
+                  sizeof (ans_hdr->ttl_));
+          const size_t rd_len = ntohs (ans_hdr->rd_len_);
+
+          if (ep - ptr < static_cast<int>(rd_len)) {
+            debug (DEBUG, "not match resource record len(%zd) and remain (%ld)",
+                   rd_len, ep - ptr);
+            return true;
+          }
 
-        // seek pointer
-        ptr += rd_len;
+          // set value
+          VarNameServiceData * v = static_cast <VarNameServiceData*>
+            (p->retain (this->NS_DATA[target]));
+          assert (v != NULL);
+          v->set_data (ptr, rd_len, ntohs (rr_hdr->type_), base_ptr,
+                       total_len);
+
+          // seek pointer
+          ptr += rd_len;
+        }
       }
     }
 
@@ -300,98 +338,102 @@ namespace swarm {
   };
 
 
-  byte_t * NameServiceDecoder::parse_label (byte_t * p, size_t remain,
-                                    const byte_t * sp,
-                                    const size_t total_len,
-                                            std::string * s) {
-    const size_t min_len = 1;
-    const size_t dst_len = 2;
-    const size_t max_len = 256;
-    size_t len = 0;
-
-    bool DEBUG = false;
-    if (s) {
-      s->erase ();
+  const byte_t * NameServiceDecoder::parse_label (const byte_t * p,
+                                                  const byte_t * sp,
+                                                  size_t total_len,
+                                                  char * buf,
+                                                  size_t * buf_len) {
+    const bool DEBUG = false;
+    const byte_t * ep = sp + total_len;
+    const byte_t * rp = nullptr;  // return point after the first jump
+    size_t name_len = 0;          // length of name on the wire
+    size_t w = 0;                 // written length to buf
+    size_t jmp_count = 0;
+
+    if (p < sp || p >= ep) {
+      return nullptr;
     }
 
-    byte_t * rp = NULL;
-
-    while (len < max_len) {
-      if (remain < min_len) {
-        debug (DEBUG, "not enough length: %zd", remain);
-        return NULL;
+    // Each iteration either follows a pointer (bounded by MAX_JUMP) or
+    // consumes a label (bounded by NAME_MAX_LEN), so loop ends in bounded
+    // steps for any input.
+    for (;;) {
+      if (p >= ep) {
+        debug (DEBUG, "not enough length");
+        return nullptr;
       }
 
+      const size_t c = *p;
+
       // jump if needed
-      if ((*p & 0xC0) == 0xC0) {
-        if (remain < dst_len) {
-          debug (DEBUG, "not enough jump destination length: %zd", remain);
-          return NULL;
+      if ((c & 0xC0) == 0xC0) {
+        if (ep - p < 2) {
+          debug (DEBUG, "not enough jump destination length");
+          return nullptr;
         }
 
-        u_int16_t * h = reinterpret_cast <u_int16_t *>(p);
-        u_int16_t jmp = (ntohs (*h) & 0x3FFF);
-
-        if (jmp >= total_len) {
-          debug (DEBUG, "invalid jump point: %d", jmp);
-          return NULL;
+        const size_t jmp = ((c & 0x3F) << 8) | p[1];
+        if (jmp >= total_len || ++jmp_count > MAX_JUMP) {
+          debug (DEBUG, "invalid jump point: %zd (%zd)", jmp, jmp_count);
+          return nullptr;
         }
-        if (rp == NULL) {
-          rp = p + dst_len;
+        if (rp == nullptr) {
+          rp = p + 2;
         }
-        p = const_cast<byte_t*> (&(sp[jmp]));
-        remain = total_len - (jmp);
+        p = sp + jmp;
+        continue;
+      }
+
+      if ((c & 0xC0) != 0) {
+        // 0x40 and 0x80 are extended/reserved label types
+        debug (DEBUG, "unsupported label type: 0x%02zX", c);
+        return nullptr;
       }
 
-      // retain payload
-      int data_len = *p;
-      if (data_len == 0) {
-        return (rp == NULL ? p + 1 : rp);
+      if (c == 0) {
+        if (buf_len) {
+          *buf_len = w;
+        }
+        return (rp == nullptr ? p + 1 : rp);
       }
-      if (data_len + min_len >= remain) {
-        debug (DEBUG, "invalid data length: %d (remain:%zd)",
-               data_len, remain);
-        return NULL;
+
+      name_len += c + 1;
+      if (name_len > NAME_MAX_LEN || c + 1 >= static_cast<size_t>(ep - p)) {
+        debug (DEBUG, "invalid data length: %zd (remain:%ld)", c, ep - p);
+        return nullptr;
       }
 
-      if (s) {
-        s->append (reinterpret_cast<char*>(p + 1), data_len);
-        s->append (".", 1);
+      if (buf) {
+        ::memcpy (buf + w, p + 1, c);
+        w += c;
+        buf[w++] = '.';
       }
-      len += data_len;
 
-      p += data_len + 1;
-      remain -= data_len + 1;
+      p += c + 1;
     }
-
-    // if exiting loop, 
-    debug (DEBUG, "too long domain name (invalid)");
-    return NULL;
   }
 
   std::string NameServiceDecoder::VarType::repr() const {
     u_int16_t type = this->ntoh <u_int16_t>();
-    std::string s;
+    const char * s = nullptr;
     switch (type) {
-    case  1: s.assign ("A"); break;
-    case  2: s.assign ("NS"); break;
-    case  5: s.assign ("CNAME"); break;
-    case  6: s.assign ("SOA"); break;
-    case 12: s.assign ("PTR"); break;
-    case 15: s.assign ("MX"); break;
-    case 16: s.assign ("TXT"); break;
-    case 28: s.assign ("AAAA"); break;
+    case  1: s = "A";     break;
+    case  2: s = "NS";    break;
+    case  5: s = "CNAME"; break;
+    case  6: s = "SOA";   break;
+    case 12: s = "PTR";   break;
+    case 15: s = "MX";    break;
+    case 16: s = "TXT";   break;
+    case 28: s = "AAAA";  break;
     default:
       {
-        std::stringstream ss;
-        ss << type;
-        s = ss.str();
+        char buf[8];
+        snprintf (buf, sizeof (buf), "%u", type);
+        return std::string (buf);
       }
-      break;
     }
 
-    debug(0, "type = %u, %s", type, s.c_str());
-    return s;
+    return std::string (s);
   }
 
 }  // namespace swarm
@@ -66,11 +66,6 @@ namespace swarm {
       return ((flags & 0x0001) > 0);
     }
 
-    inline static byte_t * parse_label (byte_t * p, size_t remain,
-                                        const byte_t * sp,
-                                        const size_t total_len,
-                                        std::string * s);
-
     const std::string base_name_;
     ev_id EV_NS_PKT_, EV_TYPE_[4];
     val_id P_ID_;
@@ -78,19 +73,43 @@ namespace swarm {
     val_id NS_NAME[4];
     val_id NS_TYPE[4];
     val_id NS_DATA[4];
+    val_id NS_TTL[4];
 
   public:
+    // Limits of RFC1035: 255 octets for a name on the wire. Compression
+    // pointers are followed at most MAX_JUMP times so that a looping name
+    // can not make the parser spin.
+    static const size_t NAME_MAX_LEN = 255;
+    static const size_t NAME_BUF_LEN = NAME_MAX_LEN + 1;
+    static const size_t MAX_JUMP = 16;
+
+    // Walk a (possibly compressed) name that starts at p inside the message
+    // [sp, sp + total_len). Returns the position right after the name in
+    // the record or nullptr if the name is broken. The dotted name is
+    // written to buf (NAME_BUF_LEN bytes at least) only if buf is given.
+    static const byte_t * parse_label (const byte_t * p, const byte_t * sp,
+                                       size_t total_len, char * buf = nullptr,
+                                       size_t * buf_len = nullptr);
+
     // VarNameServiceData for data part of record
     class VarNameServiceData : public Value {
     private:
       u_int16_t type_;
-      byte_t * base_ptr_;
+      const byte_t * base_ptr_;
       size_t total_len_;
+      mutable char name_[NAME_BUF_LEN];
+      mutable size_t name_len_;
+      mutable bool decoded_;
 
     public:
       std::string repr() const;
+      u_int16_t type () const { return this->type_; }
+      // Domain name in data part (NS, CNAME, PTR, MX, SOA). It is decoded
+      // into own buffer at first call and nullptr is returned for other
+      // record types or broken names.
+      const char * name (size_t * len) const;
       void set_data (byte_t * ptr, size_t len, u_int16_t type,
-                     byte_t * base_ptr, size_t total_len);
+                     const byte_t * base_ptr, size_t total_len);
     };
 
     class FacNameServiceData : public ValueFactory {
@@ -101,12 +120,17 @@ namespace swarm {
     // VarNameServiceName for data part of record
     class VarNameServiceName : public Value {
     private:
-      byte_t * base_ptr_;
+      const byte_t * base_ptr_;
       size_t total_len_;
+      mutable char name_[NAME_BUF_LEN];
+      mutable size_t name_len_;
+      mutable bool decoded_;
 
     public:
       std::string repr () const;
-      void set_data (byte_t * ptr, size_t len, byte_t * base_ptr,
+      // Decoded name, see VarNameServiceData::name ()
+      const char * name (size_t * len) const;
+      void set_data (byte_t * ptr, size_t len, const byte_t * base_ptr,
                      size_t total_len);
     };
     class FacNameServiceName : public ValueFactory {
@@ -0,0 +1,135 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "../swarm/decode.h"
+
+
+namespace swarm {
+
+  class IcmpDecoder : public Decoder {
+  private:
+    static const u_int8_t ECHO_REPLY   = 0;
+    static const u_int8_t ECHO_REQUEST = 8;
+    static const u_int16_t IP_MF      = 0x2000;  // more fragments flag
+    static const u_int16_t IP_OFFMASK = 0x1fff;  // fragment offset
+
+    struct icmp_header {
+      u_int8_t  type_;
+      u_int8_t  code_;
+      u_int16_t chksum_;  // checksum
+      u_int16_t id_;      // identifier (echo)
+      u_int16_t seq_;     // sequence number (echo)
+    } __attribute__((packed));
+
+    ev_id EV_PKT_, EV_ECHO_;
+    val_id P_TYPE_, P_CODE_, P_CHKSUM_, P_ID_, P_SEQ_, P_DATA_;
+    val_id P_IP_PL_, P_IP_FRAG_;
+
+  public:
+    explicit IcmpDecoder (NetDec * nd) : Decoder (nd) {
+      this->EV_PKT_  = nd->assign_event ("icmp.packet", "ICMP Packet");
+      this->EV_ECHO_ = nd->assign_event ("icmp.echo", "ICMP Echo Request");
+
+      this->P_TYPE_ = nd->assign_value ("icmp.type", "ICMP Type",
+                                        new FacNum ());
+      this->P_CODE_ = nd->assign_value ("icmp.code", "ICMP Code",
+                                        new FacNum ());
+      this->P_CHKSUM_ = nd->assign_value ("icmp.chksum", "ICMP Checksum");
+      this->P_ID_   = nd->assign_value ("icmp.id", "ICMP Echo Identifier",
+                                        new FacNum ());
+      this->P_SEQ_  = nd->assign_value ("icmp.seq", "ICMP Echo Sequence",
+                                        new FacNum ());
+      this->P_DATA_ = nd->assign_value ("icmp.data", "ICMP Echo Data");
+    }
+    void setup (NetDec * nd) {
+      this->P_IP_PL_ = nd->lookup_value_id ("ipv4.payload");
+      this->P_IP_FRAG_ = nd->lookup_value_id ("ipv4.frag");
+    };
+
+    static Decoder * New (NetDec * nd) { return new IcmpDecoder (nd); }
+
+    bool decode (Property *p) {
+      // IPv4 fragments are not reassembled. A later fragment carries no
+      // ICMP header, and a first one only a part of echo data.
+      const u_int32_t frag = p->value (this->P_IP_FRAG_).uint32 ();
+      if ((frag & IP_OFFMASK) != 0) {
+        return true;
+      }
+
+      auto hdr = reinterpret_cast <struct icmp_header *>
+        (p->payload (sizeof (struct icmp_header)));
+
+      if (hdr == nullptr) {
+        return false;
+      }
+
+      p->set (this->P_TYPE_, &(hdr->type_), sizeof (hdr->type_));
+      p->set (this->P_CODE_, &(hdr->code_), sizeof (hdr->code_));
+      p->set (this->P_CHKSUM_, &(hdr->chksum_), sizeof (hdr->chksum_));
+      p->push_event (this->EV_PKT_);
+
+      if (hdr->type_ != ECHO_REQUEST && hdr->type_ != ECHO_REPLY) {
+        return true;
+      }
+
+      p->set (this->P_ID_,  &(hdr->id_),  sizeof (hdr->id_));
+      p->set (this->P_SEQ_, &(hdr->seq_), sizeof (hdr->seq_));
+      if ((frag & IP_MF) != 0) {
+        return true;
+      }
+
+      // Echo data is the rest of IP payload. It is set only when whole
+      // data is captured, so that a reply can echo it back.
+      size_t pl_len;
+      const byte_t *pl = p->value (this->P_IP_PL_).ptr (&pl_len);
+      if (pl == nullptr) {
+        return true;
+      }
+      const byte_t *end = pl + pl_len;
+      const byte_t *data_ptr = reinterpret_cast <const byte_t *> (hdr + 1);
+      if (data_ptr > end) {
+        return false;
+      }
+
+      size_t data_len = end - data_ptr;
+      if (data_len > 0) {
+        byte_t *data = p->payload (data_len);
+        if (data == nullptr) {
+          return true;
+        }
+        p->set (this->P_DATA_, data, data_len);
+      }
+
+      if (hdr->type_ == ECHO_REQUEST) {
+        p->push_event (this->EV_ECHO_);
+      }
+      return true;
+    }
+  };
+
+  INIT_DECODER (icmp, IcmpDecoder::New);
+}  // namespace swarm
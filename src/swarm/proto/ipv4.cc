@@ -59,7 +59,7 @@ namespace swarm {
     } __attribute__((packed));
 
     ev_id EV_IPV4_PKT_;
-    val_id P_PROTO_, P_SRC_, P_DST_, P_TLEN_, P_PL_;
+    val_id P_PROTO_, P_SRC_, P_DST_, P_TLEN_, P_FRAG_, P_PL_;
     dec_id D_ICMP_;
     dec_id D_UDP_;
     dec_id D_TCP_;
@@ -78,6 +78,9 @@ namespace swarm {
                                          new FacIPv4 ());
       this->P_TLEN_  = nd->assign_value ("ipv4.total", "IPv4 Total Length",
                                          new FacNum());
+      this->P_FRAG_  = nd->assign_value ("ipv4.frag",
+                                         "IPv4 Flags and Fragment Offset",
+                                         new FacNum());
       this->P_PL_    = nd->assign_value ("ipv4.payload", "IPv4 Data Payload");
     }
     void setup (NetDec * nd) {
@@ -105,6 +108,7 @@ namespace swarm {
       p->set (this->P_SRC_,   &(hdr->src_), sizeof (hdr->src_));
       p->set (this->P_DST_,   &(hdr->dst_), sizeof (hdr->dst_));
       p->set (this->P_TLEN_,  &(hdr->total_len_), sizeof (hdr->total_len_));
+      p->set (this->P_FRAG_,  &(hdr->offset_), sizeof (hdr->offset_));
 
       // just moving to next protocol header
       auto opt = p->payload (hdr_len - base_len);
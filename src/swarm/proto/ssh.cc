@@ -0,0 +1,430 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "../swarm/decode.h"
+#include "../utils/lru-hash.h"
+#include "../utils/digest.h"
+#include "../debug.h"
+
+namespace swarm {
+  // --------------------------------------------------------------
+  // SshSession keeps client identification string until client KEXINIT
+  // arrives, and KEXINIT packet that is split into several segments.
+  // Sessions and buffers are taken from pools of SshDecoder, so nothing
+  // is allocated per session.
+  struct SshBuffer {
+    static const size_t BUF_MAX = 4096;
+    byte_t data_[BUF_MAX];
+    size_t len_;
+    SshBuffer *next_;
+  };
+
+  class SshSession : public LRUHash::Node {
+  public:
+    static const size_t KEY_MAX = 64;
+    static const size_t BANNER_MAX = 255;  // RFC 4253 4.2
+
+    uint8_t key_[KEY_MAX];
+    size_t key_len_;
+    uint64_t hash_;
+    time_t ts_;
+    byte_t banner_[BANNER_MAX];
+    size_t banner_len_;
+    SshBuffer *buf_;
+    bool done_;
+    SshSession *next_;  // free list
+
+    SshSession() : key_len_(0), hash_(0), ts_(0), banner_len_(0),
+                   buf_(nullptr), done_(false), next_(nullptr) {}
+    ~SshSession() {}
+    void init(const void *key, size_t key_len, uint64_t hash) {
+      assert(key_len <= KEY_MAX);
+      ::memcpy(this->key_, key, key_len);
+      this->key_len_ = key_len;
+      this->hash_ = hash;
+      this->banner_len_ = 0;
+      this->buf_ = nullptr;
+      this->done_ = false;
+    }
+    uint64_t hash() { return this->hash_; }
+    bool match(const void *key, size_t len) {
+      return (this->key_len_ == len && 0 == ::memcmp(this->key_, key, len));
+    }
+  };
+
+
+  // --------------------------------------------------------------
+  // SshDecoder parses client identification string (banner) and client
+  // KEXINIT in client data of tcp_ssn, and computes HASSH.
+  class SshDecoder : public Decoder {
+  private:
+    static const size_t SSN_POOL = 4096;
+    static const size_t BUF_POOL = 256;
+    static const time_t TIMEOUT = 10;  // KEXINIT follows in an RTT
+    static const size_t PACKET_MAX = 35000;  // RFC 4253 6.1
+    static const uint8_t MSG_KEXINIT = 20;
+    static const size_t HASSH_MAX = SshBuffer::BUF_MAX;
+
+    // Character classes of identification string
+    static const uint8_t C_VCHAR = 0x01;  // printable, not SP
+    static const uint8_t C_DELIM = 0x02;  // '-'
+
+    ev_id EV_CLIENT_;
+    val_id P_BANNER_, P_PROTO_, P_SOFTWARE_, P_COMMENTS_;
+    val_id P_HASSH_, P_HASSH_ALGO_, P_SEG_USED_;
+    val_id P_SEG_;
+    LRUHash *ssn_table_;
+    time_t last_ts_;
+
+    SshSession *ssn_pool_, *ssn_free_;
+    SshBuffer *buf_pool_, *buf_free_;
+    uint8_t char_class_[256];
+    char hassh_algo_[HASSH_MAX];
+    char hassh_[Md5::DIGEST_LEN * 2 + 1];
+
+    bool parse_banner(Property *p, const byte_t *line, size_t len);
+    bool parse_kexinit(Property *p, const byte_t *pkt, size_t len);
+    static size_t packet_size(const byte_t *p, size_t len);
+    SshSession *fetch_session(Property *p, bool create);
+    void release_session(SshSession *ssn);
+    SshBuffer *alloc_buffer();
+    void release_buffer(SshSession *ssn);
+    void timeout_session(time_t tv_sec);
+
+  public:
+    explicit SshDecoder (NetDec * nd);
+    ~SshDecoder ();
+    void setup (NetDec * nd);
+    static Decoder * New (NetDec * nd) { return new SshDecoder (nd); }
+    bool decode (Property *p);
+  };
+
+  SshDecoder::SshDecoder (NetDec * nd) : Decoder (nd), last_ts_(0) {
+    this->EV_CLIENT_ = nd->assign_event ("ssh.client",
+                                         "SSH client identification/KEXINIT");
+
+    this->P_BANNER_   = nd->assign_value ("ssh.banner",
+                                          "SSH Identification String");
+    this->P_PROTO_    = nd->assign_value ("ssh.proto_version",
+                                          "SSH Protocol Version");
+    this->P_SOFTWARE_ = nd->assign_value ("ssh.software",
+                                          "SSH Software Version");
+    this->P_COMMENTS_ = nd->assign_value ("ssh.comments",
+                                          "SSH Identification Comments");
+    this->P_HASSH_    = nd->assign_value ("ssh.hassh", "HASSH Fingerprint");
+    this->P_HASSH_ALGO_ = nd->assign_value ("ssh.hassh_algorithms",
+                                            "HASSH Algorithms String");
+    this->P_SEG_USED_ = nd->assign_value ("ssh.segment",
+                                          "Segment data used by SSH");
+
+    this->ssn_table_ = new LRUHash(TIMEOUT * 2, 0x3ff);
+
+    // Pools are allocated at once and linked to free lists.
+    this->ssn_pool_ = new SshSession[SSN_POOL];
+    this->buf_pool_ = new SshBuffer[BUF_POOL];
+    this->ssn_free_ = nullptr;
+    this->buf_free_ = nullptr;
+    for (size_t i = 0; i < SSN_POOL; i++) {
+      this->ssn_pool_[i].next_ = this->ssn_free_;
+      this->ssn_free_ = &this->ssn_pool_[i];
+    }
+    for (size_t i = 0; i < BUF_POOL; i++) {
+      this->buf_pool_[i].next_ = this->buf_free_;
+      this->buf_free_ = &this->buf_pool_[i];
+    }
+
+    for (size_t c = 0; c < 256; c++) {
+      this->char_class_[c] = (0x21 <= c && c <= 0x7e) ? C_VCHAR : 0;
+    }
+    this->char_class_['-'] |= C_DELIM;
+  }
+  SshDecoder::~SshDecoder () {
+    delete this->ssn_table_;
+    delete [] this->ssn_pool_;
+    delete [] this->buf_pool_;
+  }
+
+  void SshDecoder::setup (NetDec * nd) {
+    this->P_SEG_ = nd->lookup_value_id ("tcp_ssn.segment");
+  }
+
+  bool SshDecoder::parse_banner(Property *p, const byte_t *line,
+                                size_t len) {
+    // SSH-protoversion-softwareversion SP comments (CR LF is removed)
+    byte_t *d = const_cast<byte_t*>(line);
+    const uint8_t *cls = this->char_class_;
+    size_t i = 4, proto, sw, sw_end;
+
+    for (proto = i; i < len && (cls[line[i]] & C_VCHAR) &&
+           !(cls[line[i]] & C_DELIM); i++);
+    if (i == proto || i >= len || line[i] != '-') {
+      return false;
+    }
+    p->set (this->P_PROTO_, d + proto, i - proto);
+
+    for (sw = ++i; i < len && (cls[line[i]] & C_VCHAR) &&
+           !(cls[line[i]] & C_DELIM); i++);
+    // Some clients put '-' in softwareversion, accept it
+    for (; i < len && (cls[line[i]] & C_VCHAR); i++);
+    sw_end = i;
+    if (sw_end == sw) {
+      return false;
+    }
+    p->set (this->P_SOFTWARE_, d + sw, sw_end - sw);
+
+    if (i < len && line[i] == ' ' && i + 1 < len) {
+      p->set (this->P_COMMENTS_, d + i + 1, len - i - 1);
+    }
+    p->set (this->P_BANNER_, d, len);
+    return true;
+  }
+
+  size_t SshDecoder::packet_size(const byte_t *p, size_t len) {
+    // Returns size of binary packet if p looks like beginning of
+    // KEXINIT. 0 means not KEXINIT, and 1 means need more data.
+    if (len < 6) {
+      return 1;
+    }
+    size_t pkt_len = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    uint8_t pad_len = p[4];
+    if (pkt_len < 1 + pad_len + 1 + 16U || PACKET_MAX < pkt_len ||
+        pad_len < 4 || p[5] != MSG_KEXINIT) {
+      return 0;
+    }
+    return 4 + pkt_len;
+  }
+
+  bool SshDecoder::parse_kexinit(Property *p, const byte_t *pkt, size_t len) {
+    // byte SSH_MSG_KEXINIT, byte[16] cookie, then name-lists:
+    // kex, host key, enc c2s, enc s2c, mac c2s, mac s2c, comp c2s, ...
+    static const bool use[] = {true, false, true, false, true, false, true};
+    const size_t n_list = sizeof(use) / sizeof(use[0]);
+    const byte_t *ep = pkt + 4 + ((pkt[0] << 24) | (pkt[1] << 16) |
+                                  (pkt[2] << 8) | pkt[3]) - pkt[4];
+    const byte_t *ptr = pkt + 6 + 16;
+    size_t h_len = 0;
+
+    for (size_t k = 0; k < n_list; k++) {
+      if (ep - ptr < 4) {
+        return false;
+      }
+      size_t l = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) | ptr[3];
+      ptr += 4;
+      if (static_cast<size_t>(ep - ptr) < l) {
+        return false;
+      }
+      if (use[k]) {
+        if (h_len + l + 1 > sizeof(this->hassh_algo_)) {
+          return false;
+        }
+        if (h_len > 0) {
+          this->hassh_algo_[h_len++] = ';';
+        }
+        ::memcpy(this->hassh_algo_ + h_len, ptr, l);
+        h_len += l;
+      }
+      ptr += l;
+    }
+
+    uint8_t digest[Md5::DIGEST_LEN];
+    Md5 md5;
+    md5.update(this->hassh_algo_, h_len);
+    md5.finish(digest);
+    hex_digest(digest, sizeof(digest), this->hassh_);
+
+    p->set (this->P_HASSH_ALGO_, reinterpret_cast<byte_t*>(this->hassh_algo_),
+            h_len);
+    p->set (this->P_HASSH_, reinterpret_cast<byte_t*>(this->hassh_),
+            Md5::DIGEST_LEN * 2);
+    return true;
+  }
+
+  void SshDecoder::timeout_session(time_t tv_sec) {
+    if (this->last_ts_ > 0 && this->last_ts_ < tv_sec) {
+      this->ssn_table_->prog(tv_sec - this->last_ts_);
+    }
+    this->last_ts_ = tv_sec;
+
+    SshSession *ssn;
+    while (nullptr !=
+           (ssn = static_cast<SshSession*>(this->ssn_table_->pop()))) {
+      if (ssn->ts_ + TIMEOUT < tv_sec) {
+        this->release_session(ssn);
+      } else {
+        this->ssn_table_->put(TIMEOUT, ssn);
+      }
+    }
+  }
+
+  SshSession *SshDecoder::fetch_session(Property *p, bool create) {
+    size_t key_len;
+    const void *key = p->ssn_label(&key_len);
+    SshSession *ssn = static_cast<SshSession*>
+      (this->ssn_table_->get(p->hash_value(), key, key_len));
+
+    if (!ssn && create && this->ssn_free_ != nullptr &&
+        key_len <= SshSession::KEY_MAX) {
+      ssn = this->ssn_free_;
+      this->ssn_free_ = ssn->next_;
+      ssn->init(key, key_len, p->hash_value());
+      this->ssn_table_->put(TIMEOUT, ssn);
+    }
+
+    if (ssn) {
+      ssn->ts_ = p->tv_sec();
+    }
+    return ssn;
+  }
+
+  void SshDecoder::release_session(SshSession *ssn) {
+    this->release_buffer(ssn);
+    ssn->next_ = this->ssn_free_;
+    this->ssn_free_ = ssn;
+  }
+
+  SshBuffer *SshDecoder::alloc_buffer() {
+    SshBuffer *buf = this->buf_free_;
+    if (buf) {
+      this->buf_free_ = buf->next_;
+      buf->len_ = 0;
+    }
+    return buf;
+  }
+
+  void SshDecoder::release_buffer(SshSession *ssn) {
+    if (ssn->buf_) {
+      ssn->buf_->next_ = this->buf_free_;
+      this->buf_free_ = ssn->buf_;
+      ssn->buf_ = nullptr;
+    }
+  }
+
+  bool SshDecoder::decode (Property *p) {
+    // One event is pushed per session, with KEXINIT if the client sends
+    // it. A segment is marked as used only when the event is pushed, so
+    // segments waiting for the rest are still logged as raw data.
+    size_t seg_len;
+    byte_t *seg = p->value(this->P_SEG_).ptr(&seg_len);
+    if (seg == nullptr || seg_len == 0) {
+      return false;
+    }
+
+    this->timeout_session(p->tv_sec());
+
+    SshSession *ssn = this->fetch_session(p, false);
+    if (ssn && ssn->done_) {
+      return false;
+    }
+
+    const byte_t *data = seg;
+    size_t len = seg_len;
+    bool used = false;
+
+    if (ssn == nullptr) {
+      // Identification string must be in the first segment.
+      if (len < 4 || 0 != ::memcmp(seg, "SSH-", 4)) {
+        return false;
+      }
+      size_t max = (len < SshSession::BANNER_MAX) ?
+        len : SshSession::BANNER_MAX;
+      const byte_t *lf = static_cast<const byte_t*>(::memchr(seg, '\n', max));
+      if (lf == nullptr) {
+        return false;
+      }
+      size_t line_len = (lf > seg && lf[-1] == '\r') ? lf - 1 - seg : lf - seg;
+      if (!this->parse_banner(p, seg, line_len)) {
+        return false;
+      }
+      used = true;
+      data = lf + 1;
+      len = seg_len - (data - seg);
+
+      // Keep identification string to report it with KEXINIT.
+      if (packet_size(data, len) == 1 || packet_size(data, len) > len) {
+        if (nullptr != (ssn = this->fetch_session(p, true))) {
+          ::memcpy(ssn->banner_, seg, line_len);
+          ssn->banner_len_ = line_len;
+        }
+      }
+    } else {
+      this->parse_banner(p, ssn->banner_, ssn->banner_len_);
+    }
+
+    bool wait = false;
+    if (ssn && ssn->buf_) {
+      // Continued KEXINIT in previous segment(s).
+      SshBuffer *buf = ssn->buf_;
+      if (buf->len_ + len > SshBuffer::BUF_MAX) {
+        len = 0;
+      } else {
+        ::memcpy(buf->data_ + buf->len_, data, len);
+        buf->len_ += len;
+        data = buf->data_;
+        len = buf->len_;
+      }
+    } else if (len == 0 && ssn) {
+      // Identification string only, wait KEXINIT.
+      wait = true;
+    }
+
+    if (len > 0) {
+      size_t pkt_size = packet_size(data, len);
+      if (pkt_size > 1 && pkt_size <= len) {
+        if (this->parse_kexinit(p, data, pkt_size)) {
+          used = true;
+        }
+      } else if (pkt_size != 0 && ssn && pkt_size <= SshBuffer::BUF_MAX) {
+        // Wait rest of KEXINIT.
+        if (ssn->buf_ == nullptr &&
+            nullptr != (ssn->buf_ = this->alloc_buffer())) {
+          ::memcpy(ssn->buf_->data_, data, len);
+          ssn->buf_->len_ = len;
+        }
+        wait = (ssn->buf_ != nullptr);
+      }
+    }
+
+    if (wait) {
+      return false;
+    }
+    if (ssn) {
+      ssn->done_ = true;
+      this->release_buffer(ssn);
+    }
+
+    // The identification string is reported even if KEXINIT is broken,
+    // but a later segment is marked only when it completes KEXINIT.
+    if (used) {
+      p->set (this->P_SEG_USED_, seg, seg_len);
+    }
+    p->push_event (this->EV_CLIENT_);
+    return true;
+  }
+
+  INIT_DECODER (ssh, SshDecoder::New);
+}  // namespace swarm
@@ -45,6 +45,12 @@ namespace swarm {
   };
 
   class TcpSession : public LRUHash::Node {
+  public:
+    // Zero-filled area that handlers can use to keep per-session state
+    // through "tcp_ssn.ext" value.
+    static const size_t EXT_SIZE = TCP_SSN_EXT_SIZE;
+
+  private:
     static const u_int8_t FIN  = 0x01;
     static const u_int8_t SYN  = 0x02;
     static const u_int8_t RST  = 0x04;
@@ -85,6 +91,8 @@ namespace swarm {
       ~Node() {};
       inline TcpStat stat() const { return this->stat_; }
       bool updated() const { return this->updated_; }
+      bool avail_seq() const { return this->avail_seq_; }
+      uint32_t base_seq() const { return this->base_seq_; }
 
       void update_stat(TcpStat stat) {
         this->stat_ = stat;
@@ -261,6 +269,7 @@ namespace swarm {
 
     } server_, client_;
     FlowDir dir_;
+    byte_t ext_[EXT_SIZE];
 
   public:
     TcpSession(const void *key, size_t key_len, uint64_t hash)
@@ -272,6 +281,7 @@ namespace swarm {
 
       ::memset(&this->server_, 0, sizeof(this->server_));
       ::memset(&this->client_, 0, sizeof(this->client_));
+      ::memset(this->ext_, 0, sizeof(this->ext_));
     }
     ~TcpSession() {
       if(this->key_) {
@@ -302,6 +312,12 @@ namespace swarm {
     inline TcpStat client_stat() const {
       return this->client_.stat();
     }
+    byte_t *ext() { return this->ext_; }
+    // Offset of the segment from beginning of the sender's stream.
+    inline uint32_t stream_offset(FlowDir dir, uint32_t seq) const {
+      const Node *sender = (this->dir_ == dir) ? &this->client_ : &this->server_;
+      return (sender->avail_seq()) ? seq - sender->base_seq() - 1 : 0;
+    }
     inline bool is_data_available(FlowDir dir) const {
       const Node *sender = (this->dir_ == dir) ? &this->client_ : &this->server_;
       if (!sender->updated() && sender->stat() == ESTABLISHED) {
@@ -373,19 +389,32 @@ namespace swarm {
 
       return rc;
     }
+
+    // Prime a fresh session with the handshake that a SessionFilter has
+    // vouched for but that was never tracked: the client sent SYN with
+    // seq - 1 and the server answered SYN|ACK with ack - 1.
+    void establish(uint32_t seq, uint32_t ack, FlowDir dir) {
+      assert(this->dir_ == DIR_NIL);
+      const FlowDir rev = (dir == DIR_L2R) ? DIR_R2L : DIR_L2R;
+      this->update(SYN, seq - 1, 0, 0, dir);
+      this->update(SYN | ACK, ack - 1, seq, 0, rev);
+    }
   };
 
   class TcpSsnDecoder : public Decoder {
   private:
     ev_id EV_EST_, EV_DATA_;
-    val_id P_SEG_, P_TO_SERVER_;
+    val_id P_SEG_, P_TO_SERVER_, P_OFFSET_, P_EXT_;
     val_id P_TCP_HDR_, P_TCP_SEQ_, P_TCP_ACK_, P_TCP_FLAGS_;
     LRUHash *ssn_table_;
+    SessionFilter *filter_;
     time_t last_ts_;
     static const time_t TIMEOUT = 300;
+    // Application decoders that receive client to server segment data.
+    std::vector<dec_id> app_dec_;
 
   public:
-    explicit TcpSsnDecoder (NetDec * nd) : Decoder (nd), last_ts_(0) {
+    explicit TcpSsnDecoder (NetDec * nd) : Decoder (nd), filter_(nullptr), last_ts_(0) {
       this->EV_EST_ = nd->assign_event ("tcp_ssn.established",
                                         "TCP session established");
       this->EV_DATA_ = nd->assign_event ("tcp_ssn.data", 
@@ -394,6 +423,11 @@ namespace swarm {
       this->P_SEG_ = nd->assign_value ("tcp_ssn.segment", "TCP segment data");
       this->P_TO_SERVER_ = 
         nd->assign_value ("tcp_ssn.to_server", "Packet to server");
+      this->P_OFFSET_ =
+        nd->assign_value ("tcp_ssn.offset", "Segment offset in stream",
+                          new FacNum());
+      this->P_EXT_ =
+        nd->assign_value ("tcp_ssn.ext", "Per-session handler area");
 
       this->ssn_table_ = new LRUHash(3600, 0xffff);
     }
@@ -413,10 +447,23 @@ namespace swarm {
       this->P_TCP_SEQ_ = nd->lookup_value_id("tcp.seq");
       this->P_TCP_ACK_ = nd->lookup_value_id("tcp.ack");
       this->P_TCP_FLAGS_ = nd->lookup_value_id("tcp.flags");
+
+      static const char *app_dec[] = {"http", "tls", "ssh"};
+      for (size_t i = 0; i < sizeof(app_dec) / sizeof(app_dec[0]); i++) {
+        dec_id d = nd->lookup_dec_id(app_dec[i]);
+        if (d != DEC_NULL) {
+          this->app_dec_.push_back(d);
+        }
+      }
     };
 
     static Decoder * New (NetDec * nd) { return new TcpSsnDecoder (nd); }
 
+    bool set_session_filter (SessionFilter *filter) {
+      this->filter_ = filter;
+      return true;
+    }
+
     void timeout_session(time_t tv_sec) {
       // session timeout 
       if (this->last_ts_ > 0 && this->last_ts_ < tv_sec) {
@@ -437,7 +484,8 @@ namespace swarm {
 
     TcpSession *fetch_session(Property *p) {
       // Lookup TcpSession object from ssn_table_ LRU hash table.
-      // If not existing, create new TcpSession and return the one.
+      // If not existing, create new TcpSession and return the one unless
+      // the session filter rejects the packet (then return nullptr).
 
       size_t key_len;
       const void *ssn_key = p->ssn_label(&key_len);
@@ -445,8 +493,22 @@ namespace swarm {
         (this->ssn_table_->get(p->hash_value(), ssn_key, key_len));
 
       if (!ssn) {
+        SessionFilter::Verdict v = SessionFilter::ADMIT;
+        if (this->filter_) {
+          v = this->filter_->admit(*p);
+          if (v == SessionFilter::REJECT) {
+            return nullptr;
+          }
+        }
+
         ssn = new TcpSession(ssn_key, key_len, p->hash_value());
         this->ssn_table_->put(TIMEOUT, ssn);
+
+        if (v == SessionFilter::ESTABLISH) {
+          ssn->establish(p->value(this->P_TCP_SEQ_).ntoh <uint32_t> (),
+                         p->value(this->P_TCP_ACK_).ntoh <uint32_t> (),
+                         p->dir());
+        }
       }
 
       ssn->set_ts(p->tv_sec());
@@ -457,6 +519,9 @@ namespace swarm {
       this->timeout_session(p->tv_sec());
 
       TcpSession *ssn = this->fetch_session(p);
+      if (!ssn) {
+        return false;
+      }
       size_t data_len = p->remain();
 
       uint8_t flags = p->value(this->P_TCP_FLAGS_).ntoh <uint8_t> ();
@@ -483,8 +548,18 @@ namespace swarm {
             } else {
               debug(DBG, "seg_data: %zd", data_len);
             }
+            uint32_t offset = htonl(ssn->stream_offset(p->dir(), seq));
             p->set(this->P_SEG_, data, data_len);
+            p->copy(this->P_OFFSET_, &offset, sizeof(offset));
+            p->set(this->P_EXT_, ssn->ext(), TcpSession::EXT_SIZE);
             p->push_event (this->EV_DATA_);
+
+            // Application decoders refer tcp_ssn.segment instead of payload.
+            if (to_server) {
+              for (size_t i = 0; i < this->app_dec_.size(); i++) {
+                this->emit(this->app_dec_[i], p);
+              }
+            }
           }
         }
       }
@@ -0,0 +1,709 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+#include "../swarm/decode.h"
+#include "../utils/lru-hash.h"
+#include "../utils/digest.h"
+#include "../debug.h"
+
+namespace swarm {
+  // --------------------------------------------------------------
+  // TlsSession keeps a TLS record with ClientHello that is split into
+  // several segments. The buffer is allocated only while the record is
+  // pending, so sessions that are waiting for timeout are small.
+  class TlsSession : public LRUHash::Node {
+  public:
+    static const size_t KEY_MAX = 64;
+    static const size_t BUF_MAX = 8192;
+
+  private:
+    uint8_t key_[KEY_MAX];
+    size_t key_len_;
+    uint64_t hash_;
+    time_t ts_;
+    byte_t *buf_;
+    size_t len_;
+
+  public:
+    TlsSession(const void *key, size_t key_len, uint64_t hash) :
+      key_len_(key_len), hash_(hash), ts_(0), buf_(nullptr), len_(0) {
+      assert(key_len <= KEY_MAX);
+      ::memcpy(this->key_, key, key_len);
+    }
+    ~TlsSession() { this->release(); }
+    uint64_t hash() { return this->hash_; }
+    bool match(const void *key, size_t len) {
+      return (this->key_len_ == len && 0 == ::memcmp(this->key_, key, len));
+    }
+    void set_ts(time_t ts) { this->ts_ = ts; }
+    time_t ts() const { return this->ts_; }
+
+    bool pending() const { return (this->buf_ != nullptr); }
+    const byte_t *buf() const { return this->buf_; }
+    size_t len() const { return this->len_; }
+    bool append(const byte_t *data, size_t len) {
+      if (this->len_ + len > BUF_MAX) {
+        return false;
+      }
+      if (this->buf_ == nullptr &&
+          nullptr == (this->buf_ = static_cast<byte_t*>(::malloc(BUF_MAX)))) {
+        return false;
+      }
+      ::memcpy(this->buf_ + this->len_, data, len);
+      this->len_ += len;
+      return true;
+    }
+    void release() {
+      ::free(this->buf_);
+      this->buf_ = nullptr;
+      this->len_ = 0;
+    }
+  };
+
+  // Bounds checked reader of TLS vectors. Once out of range, every read
+  // returns 0 and ok() becomes false.
+  class TlsReader {
+  private:
+    const byte_t *p_, *ep_;
+    bool ok_;
+
+  public:
+    TlsReader(const byte_t *p, size_t len) : p_(p), ep_(p + len), ok_(true) {}
+    bool ok() const { return this->ok_; }
+    bool empty() const { return this->p_ >= this->ep_; }
+    size_t remain() const { return (this->ok_) ? this->ep_ - this->p_ : 0; }
+    const byte_t *ptr() const { return this->p_; }
+    const byte_t *skip(size_t n) {
+      if (!this->ok_ || static_cast<size_t>(this->ep_ - this->p_) < n) {
+        this->ok_ = false;
+        return nullptr;
+      }
+      const byte_t *r = this->p_;
+      this->p_ += n;
+      return r;
+    }
+    uint8_t u8() {
+      const byte_t *r = this->skip(1);
+      return (r) ? r[0] : 0;
+    }
+    uint16_t u16() {
+      const byte_t *r = this->skip(2);
+      return (r) ? ((r[0] << 8) | r[1]) : 0;
+    }
+    uint32_t u24() {
+      const byte_t *r = this->skip(3);
+      return (r) ? ((r[0] << 16) | (r[1] << 8) | r[2]) : 0;
+    }
+    // Split vector with length field of n_len bytes.
+    TlsReader vec(size_t n_len) {
+      size_t len = (n_len == 1) ? this->u8() : this->u16();
+      const byte_t *r = this->skip(len);
+      TlsReader sub(r, (r) ? len : 0);
+      sub.ok_ = this->ok_;
+      return sub;
+    }
+  };
+
+  // Fixed size string writer. Once overflow, content is not appended.
+  class TlsStrBuf {
+  private:
+    char *buf_;
+    size_t cap_, len_;
+    bool ok_;
+
+  public:
+    TlsStrBuf(char *buf, size_t cap) : buf_(buf), cap_(cap), len_(0),
+                                       ok_(true) {}
+    bool ok() const { return this->ok_; }
+    size_t len() const { return this->len_; }
+    char *buf() const { return this->buf_; }
+    void put(const char *s, size_t len) {
+      if (this->ok_ && this->len_ + len <= this->cap_) {
+        ::memcpy(this->buf_ + this->len_, s, len);
+        this->len_ += len;
+      } else {
+        this->ok_ = false;
+      }
+    }
+    void put(char c) { this->put(&c, 1); }
+    void dec(unsigned n) {
+      char tmp[8];
+      size_t i = sizeof(tmp);
+      do {
+        tmp[--i] = '0' + (n % 10);
+        n /= 10;
+      } while (n > 0);
+      this->put(tmp + i, sizeof(tmp) - i);
+    }
+    void hex4(uint16_t n) {
+      static const char HEX[] = "0123456789abcdef";
+      char tmp[4] = {HEX[(n >> 12) & 0xf], HEX[(n >> 8) & 0xf],
+                     HEX[(n >> 4) & 0xf], HEX[n & 0xf]};
+      this->put(tmp, sizeof(tmp));
+    }
+  };
+
+
+  // --------------------------------------------------------------
+  // TlsDecoder parses ClientHello in client data of tcp_ssn and
+  // computes JA3 and JA4 fingerprints. Parsed values refer segment data
+  // or buffers of the decoder, nothing is allocated per packet.
+  class TlsDecoder : public Decoder {
+  private:
+    static const size_t SSN_MAX = 65536;
+    static const size_t PENDING_MAX = 1024;
+    static const time_t TIMEOUT = 30;
+    static const size_t RECORD_MAX = 16384 + 2048;
+    // A record has at most RECORD_MAX / 2 list items, and an item of 2
+    // bytes is at most 6 characters in decimal ("65535-"), so lists and
+    // strings sized from RECORD_MAX can not be truncated.
+    static const size_t ITEM_MAX = RECORD_MAX / 2;
+    static const size_t STR_MAX = RECORD_MAX * 3 + 64;
+
+    static const uint8_t CONTENT_HANDSHAKE = 22;
+    static const uint8_t HS_CLIENT_HELLO = 1;
+    static const uint16_t EXT_SNI = 0x0000;
+    static const uint16_t EXT_GROUPS = 0x000a;
+    static const uint16_t EXT_POINT_FMT = 0x000b;
+    static const uint16_t EXT_SIG_ALGS = 0x000d;
+    static const uint16_t EXT_ALPN = 0x0010;
+    static const uint16_t EXT_VERSIONS = 0x002b;
+
+    ev_id EV_HELLO_;
+    val_id P_VERSION_, P_SNI_, P_ALPN_, P_CIPHERS_, P_EXTS_;
+    val_id P_JA3_, P_JA3_HASH_, P_JA4_, P_SEG_USED_;
+    val_id P_SEG_;
+    LRUHash *ssn_table_;
+    size_t ssn_count_, pending_count_;
+    time_t last_ts_;
+
+    // Work area of a ClientHello. Split record is copied to rec_ to
+    // release the session buffer before parsing.
+    byte_t rec_[TlsSession::BUF_MAX];
+    uint16_t cipher_[ITEM_MAX], ext_[ITEM_MAX], group_[ITEM_MAX];
+    uint16_t sig_alg_[ITEM_MAX];
+    uint8_t point_fmt_[ITEM_MAX];
+    size_t n_cipher_, n_ext_, n_group_, n_sig_alg_, n_point_fmt_;
+    char ja3_[STR_MAX], ja4_[64], ja3_hash_[Md5::DIGEST_LEN * 2 + 1];
+    char alpn_[1024], ciphers_[STR_MAX], exts_[STR_MAX];
+    char ja4_tmp_[STR_MAX];
+
+    static bool is_grease(uint16_t v) {
+      return ((v & 0x0f0f) == 0x0a0a && (v >> 8) == (v & 0xff));
+    }
+    static bool is_hello(const byte_t *p, size_t len);
+    void parse_ext(Property *p, uint16_t type, TlsReader r,
+                   uint16_t *version, TlsStrBuf *alpn, const byte_t **alpn1,
+                   size_t *alpn1_len, bool *has_sni);
+    bool parse(Property *p, const byte_t *hello, size_t len);
+    size_t make_ja3(uint16_t version);
+    void make_ja4(uint16_t version, bool has_sni, const byte_t *alpn,
+                  size_t alpn_len);
+    TlsSession *fetch_session(Property *p, bool create);
+    void release_session(TlsSession *ssn);
+    void timeout_session(time_t tv_sec);
+
+  public:
+    explicit TlsDecoder (NetDec * nd);
+    ~TlsDecoder ();
+    void setup (NetDec * nd);
+    static Decoder * New (NetDec * nd) { return new TlsDecoder (nd); }
+    bool decode (Property *p);
+  };
+
+  TlsDecoder::TlsDecoder (NetDec * nd) :
+    Decoder (nd), ssn_count_(0), pending_count_(0), last_ts_(0) {
+    this->EV_HELLO_ = nd->assign_event ("tls.client_hello",
+                                        "TLS ClientHello");
+
+    this->P_VERSION_  = nd->assign_value ("tls.version",
+                                          "TLS ClientHello Version",
+                                          new FacNum());
+    this->P_SNI_      = nd->assign_value ("tls.sni", "TLS Server Name");
+    this->P_ALPN_     = nd->assign_value ("tls.alpn",
+                                          "TLS ALPN Protocols (comma separated)");
+    this->P_CIPHERS_  = nd->assign_value ("tls.ciphers",
+                                          "TLS Cipher Suites (JA3 format)");
+    this->P_EXTS_     = nd->assign_value ("tls.extensions",
+                                          "TLS Extensions (JA3 format)");
+    this->P_JA3_      = nd->assign_value ("tls.ja3", "JA3 String");
+    this->P_JA3_HASH_ = nd->assign_value ("tls.ja3_hash", "JA3 Fingerprint");
+    this->P_JA4_      = nd->assign_value ("tls.ja4", "JA4 Fingerprint");
+    this->P_SEG_USED_ = nd->assign_value ("tls.segment",
+                                          "Segment data used by TLS");
+
+    this->ssn_table_ = new LRUHash(TIMEOUT * 2, 0x3ff);
+  }
+  TlsDecoder::~TlsDecoder () {
+    this->ssn_table_->prog(TIMEOUT * 2);
+    TlsSession *ssn;
+    while (nullptr !=
+           (ssn = static_cast<TlsSession*>(this->ssn_table_->pop()))) {
+      delete ssn;
+    }
+    delete this->ssn_table_;
+  }
+
+  void TlsDecoder::setup (NetDec * nd) {
+    this->P_SEG_ = nd->lookup_value_id ("tcp_ssn.segment");
+  }
+
+  bool TlsDecoder::is_hello(const byte_t *p, size_t len) {
+    // Check record header (type, version, length) and handshake type as
+    // far as len, because the header itself may be split.
+    if (len < 1 || p[0] != CONTENT_HANDSHAKE ||
+        (len >= 2 && p[1] != 3) || (len >= 3 && p[2] > 4)) {
+      return false;
+    }
+    if (len >= 5) {
+      size_t rec_len = (p[3] << 8) | p[4];
+      if (rec_len < 4 || RECORD_MAX < rec_len) {
+        return false;
+      }
+    }
+    return (len < 6 || p[5] == HS_CLIENT_HELLO);
+  }
+
+  void TlsDecoder::parse_ext(Property *p, uint16_t type, TlsReader r,
+                             uint16_t *version, TlsStrBuf *alpn,
+                             const byte_t **alpn1, size_t *alpn1_len,
+                             bool *has_sni) {
+    switch (type) {
+    case EXT_SNI: {
+      *has_sni = true;
+      TlsReader list = r.vec(2);
+      while (list.ok() && !list.empty()) {
+        uint8_t name_type = list.u8();
+        TlsReader name = list.vec(2);
+        if (list.ok() && name_type == 0) {
+          p->set (this->P_SNI_, const_cast<byte_t*>(name.ptr()),
+                  name.remain());
+          break;
+        }
+      }
+      break;
+    }
+
+    case EXT_ALPN: {
+      TlsReader list = r.vec(2);
+      while (list.ok() && !list.empty()) {
+        size_t len = list.u8();
+        const byte_t *proto = list.skip(len);
+        if (proto == nullptr) {
+          break;
+        }
+        if (*alpn1 == nullptr) {
+          *alpn1 = proto;
+          *alpn1_len = len;
+        }
+        if (alpn->len() > 0) {
+          alpn->put(',');
+        }
+        alpn->put(reinterpret_cast<const char*>(proto), len);
+      }
+      break;
+    }
+
+    case EXT_GROUPS: {
+      TlsReader list = r.vec(2);
+      while (list.ok() && !list.empty() && this->n_group_ < ITEM_MAX) {
+        uint16_t v = list.u16();
+        if (!list.ok()) {
+          break;  // odd length
+        }
+        this->group_[this->n_group_++] = v;
+      }
+      break;
+    }
+
+    case EXT_POINT_FMT: {
+      TlsReader list = r.vec(1);
+      while (list.ok() && !list.empty() && this->n_point_fmt_ < ITEM_MAX) {
+        this->point_fmt_[this->n_point_fmt_++] = list.u8();
+      }
+      break;
+    }
+
+    case EXT_SIG_ALGS: {
+      TlsReader list = r.vec(2);
+      while (list.ok() && !list.empty() && this->n_sig_alg_ < ITEM_MAX) {
+        uint16_t v = list.u16();
+        if (!list.ok()) {
+          break;  // odd length
+        }
+        this->sig_alg_[this->n_sig_alg_++] = v;
+      }
+      break;
+    }
+
+    case EXT_VERSIONS: {
+      TlsReader list = r.vec(1);
+      while (list.ok() && !list.empty()) {
+        uint16_t v = list.u16();
+        if (list.ok() && !is_grease(v) && v > *version) {
+          *version = v;
+        }
+      }
+      break;
+    }
+    }
+  }
+
+  size_t TlsDecoder::make_ja3(uint16_t version) {
+    // SSLVersion,Ciphers,Extensions,EllipticCurves,EllipticCurvePointFormats
+    // in decimal, GREASE values are excluded.
+    TlsStrBuf s(this->ja3_, sizeof(this->ja3_));
+    s.dec(version);
+
+    const uint16_t *list[] = {this->cipher_, this->ext_, this->group_};
+    const size_t count[] = {this->n_cipher_, this->n_ext_, this->n_group_};
+    for (size_t k = 0; k < 3; k++) {
+      s.put(',');
+      bool first = true;
+      for (size_t i = 0; i < count[k]; i++) {
+        if (!is_grease(list[k][i])) {
+          if (!first) {
+            s.put('-');
+          }
+          s.dec(list[k][i]);
+          first = false;
+        }
+      }
+    }
+    s.put(',');
+    for (size_t i = 0; i < this->n_point_fmt_; i++) {
+      if (i > 0) {
+        s.put('-');
+      }
+      s.dec(this->point_fmt_[i]);
+    }
+
+    uint8_t digest[Md5::DIGEST_LEN];
+    Md5 md5;
+    md5.update(s.buf(), s.len());
+    md5.finish(digest);
+    hex_digest(digest, sizeof(digest), this->ja3_hash_);
+    // Not expected with STR_MAX, but a cut string is not a fingerprint.
+    return (s.ok()) ? s.len() : 0;
+  }
+
+  void TlsDecoder::make_ja4(uint16_t version, bool has_sni,
+                            const byte_t *alpn, size_t alpn_len) {
+    // JA4: <proto><version><sni><#cipher><#ext><alpn>_<ciphers>_<exts>
+    TlsStrBuf a(this->ja4_, sizeof(this->ja4_));
+    a.put('t');
+    switch (version) {
+    case 0x0304: a.put("13", 2); break;
+    case 0x0303: a.put("12", 2); break;
+    case 0x0302: a.put("11", 2); break;
+    case 0x0301: a.put("10", 2); break;
+    case 0x0300: a.put("s3", 2); break;
+    case 0x0200: a.put("s2", 2); break;
+    default:     a.put("00", 2); break;
+    }
+    a.put(has_sni ? 'd' : 'i');
+
+    // Drop GREASE and sort cipher and extension lists in place.
+    size_t nc = 0, ne = 0, ne_all = 0;
+    for (size_t i = 0; i < this->n_cipher_; i++) {
+      if (!is_grease(this->cipher_[i])) {
+        this->cipher_[nc++] = this->cipher_[i];
+      }
+    }
+    for (size_t i = 0; i < this->n_ext_; i++) {
+      uint16_t e = this->ext_[i];
+      if (!is_grease(e)) {
+        ne_all++;
+        if (e != EXT_SNI && e != EXT_ALPN) {
+          this->ext_[ne++] = e;
+        }
+      }
+    }
+    std::sort(this->cipher_, this->cipher_ + nc);
+    std::sort(this->ext_, this->ext_ + ne);
+
+    a.dec(std::min<size_t>(nc, 99) / 10);
+    a.dec(std::min<size_t>(nc, 99) % 10);
+    a.dec(std::min<size_t>(ne_all, 99) / 10);
+    a.dec(std::min<size_t>(ne_all, 99) % 10);
+
+    if (alpn_len == 0) {
+      a.put("00", 2);
+    } else if (isalnum(alpn[0]) && isalnum(alpn[alpn_len - 1])) {
+      a.put(static_cast<char>(alpn[0]));
+      a.put(static_cast<char>(alpn[alpn_len - 1]));
+    } else {
+      static const char HEX[] = "0123456789abcdef";
+      a.put(HEX[alpn[0] >> 4]);
+      a.put(HEX[alpn[alpn_len - 1] & 0xf]);
+    }
+
+    // Truncated SHA-256 of the sorted lists.
+    uint8_t digest[Sha256::DIGEST_LEN];
+    char hex[Sha256::DIGEST_LEN * 2 + 1];
+    for (size_t k = 0; k < 2; k++) {
+      TlsStrBuf s(this->ja4_tmp_, sizeof(this->ja4_tmp_));
+      const uint16_t *list = (k == 0) ? this->cipher_ : this->ext_;
+      const size_t n = (k == 0) ? nc : ne;
+      for (size_t i = 0; i < n; i++) {
+        if (i > 0) {
+          s.put(',');
+        }
+        s.hex4(list[i]);
+      }
+      if (k == 1 && this->n_sig_alg_ > 0) {
+        s.put('_');
+        for (size_t i = 0; i < this->n_sig_alg_; i++) {
+          if (i > 0) {
+            s.put(',');
+          }
+          s.hex4(this->sig_alg_[i]);
+        }
+      }
+
+      a.put('_');
+      if (n == 0) {
+        a.put("000000000000", 12);
+      } else {
+        Sha256 sha;
+        sha.update(s.buf(), s.len());
+        sha.finish(digest);
+        hex_digest(digest, sizeof(digest), hex);
+        a.put(hex, 12);
+      }
+    }
+    a.put('\0');
+  }
+
+  bool TlsDecoder::parse(Property *p, const byte_t *hello, size_t len) {
+    TlsReader r(hello, len);
+    this->n_cipher_ = this->n_ext_ = this->n_group_ = 0;
+    this->n_sig_alg_ = this->n_point_fmt_ = 0;
+
+    const byte_t *ver = r.skip(2);
+    r.skip(32);  // random
+    r.vec(1);    // legacy_session_id
+    TlsReader ciphers = r.vec(2);
+    r.vec(1);    // legacy_compression_methods
+    if (!r.ok() || ver == nullptr) {
+      return false;
+    }
+
+    const uint16_t client_version = (ver[0] << 8) | ver[1];
+    p->set (this->P_VERSION_, const_cast<byte_t*>(ver), 2);
+
+    TlsStrBuf cs(this->ciphers_, sizeof(this->ciphers_));
+    while (ciphers.ok() && !ciphers.empty() && this->n_cipher_ < ITEM_MAX) {
+      uint16_t c = ciphers.u16();
+      if (!ciphers.ok()) {
+        break;  // odd length
+      }
+      this->cipher_[this->n_cipher_++] = c;
+      if (!is_grease(c)) {
+        if (cs.len() > 0) {
+          cs.put('-');
+        }
+        cs.dec(c);
+      }
+    }
+
+    uint16_t version = client_version;
+    bool has_sni = false;
+    const byte_t *alpn1 = nullptr;
+    size_t alpn1_len = 0;
+    TlsStrBuf alpn(this->alpn_, sizeof(this->alpn_));
+    TlsStrBuf es(this->exts_, sizeof(this->exts_));
+
+    // Extensions are optional in ClientHello before TLS 1.3.
+    if (!r.empty()) {
+      TlsReader exts = r.vec(2);
+      while (exts.ok() && !exts.empty() && this->n_ext_ < ITEM_MAX) {
+        uint16_t type = exts.u16();
+        TlsReader body = exts.vec(2);
+        if (!exts.ok()) {
+          break;
+        }
+        this->ext_[this->n_ext_++] = type;
+        if (!is_grease(type)) {
+          if (es.len() > 0) {
+            es.put('-');
+          }
+          es.dec(type);
+        }
+        this->parse_ext(p, type, body, &version, &alpn, &alpn1, &alpn1_len,
+                        &has_sni);
+      }
+    }
+
+    if (cs.ok()) {
+      p->set (this->P_CIPHERS_, reinterpret_cast<byte_t*>(cs.buf()),
+              cs.len());
+    }
+    if (es.ok()) {
+      p->set (this->P_EXTS_, reinterpret_cast<byte_t*>(es.buf()), es.len());
+    }
+    if (alpn.len() > 0 && alpn.ok()) {
+      p->set (this->P_ALPN_, reinterpret_cast<byte_t*>(alpn.buf()),
+              alpn.len());
+    }
+
+    size_t ja3_len = this->make_ja3(client_version);
+    if (ja3_len > 0) {
+      p->set (this->P_JA3_, reinterpret_cast<byte_t*>(this->ja3_), ja3_len);
+      p->set (this->P_JA3_HASH_, reinterpret_cast<byte_t*>(this->ja3_hash_),
+              Md5::DIGEST_LEN * 2);
+    }
+    this->make_ja4(version, has_sni, alpn1, alpn1_len);
+    p->set (this->P_JA4_, reinterpret_cast<byte_t*>(this->ja4_),
+            ::strlen(this->ja4_));
+
+    p->push_event (this->EV_HELLO_);
+    return true;
+  }
+
+  void TlsDecoder::timeout_session(time_t tv_sec) {
+    if (this->last_ts_ > 0 && this->last_ts_ < tv_sec) {
+      this->ssn_table_->prog(tv_sec - this->last_ts_);
+    }
+    this->last_ts_ = tv_sec;
+
+    TlsSession *ssn;
+    while (nullptr !=
+           (ssn = static_cast<TlsSession*>(this->ssn_table_->pop()))) {
+      if (ssn->ts() + TIMEOUT < tv_sec) {
+        this->release_session(ssn);
+        delete ssn;
+        this->ssn_count_--;
+      } else {
+        this->ssn_table_->put(TIMEOUT, ssn);
+      }
+    }
+  }
+
+  TlsSession *TlsDecoder::fetch_session(Property *p, bool create) {
+    size_t key_len;
+    const void *key = p->ssn_label(&key_len);
+    TlsSession *ssn = static_cast<TlsSession*>
+      (this->ssn_table_->get(p->hash_value(), key, key_len));
+
+    if (!ssn && create && this->ssn_count_ < SSN_MAX &&
+        key_len <= TlsSession::KEY_MAX) {
+      ssn = new TlsSession(key, key_len, p->hash_value());
+      this->ssn_table_->put(TIMEOUT, ssn);
+      this->ssn_count_++;
+    }
+
+    if (ssn) {
+      ssn->set_ts(p->tv_sec());
+    }
+    return ssn;
+  }
+
+  void TlsDecoder::release_session(TlsSession *ssn) {
+    if (ssn->pending()) {
+      ssn->release();
+      this->pending_count_--;
+    }
+  }
+
+  bool TlsDecoder::decode (Property *p) {
+    size_t seg_len;
+    byte_t *seg = p->value(this->P_SEG_).ptr(&seg_len);
+    if (seg == nullptr || seg_len == 0) {
+      return false;
+    }
+
+    this->timeout_session(p->tv_sec());
+
+    const byte_t *data = seg;
+    size_t len = seg_len;
+    TlsSession *ssn = (this->ssn_count_ > 0) ?
+      this->fetch_session(p, false) : nullptr;
+
+    if (ssn && ssn->pending()) {
+      // Continued record of ClientHello in previous segment(s).
+      if (!ssn->append(seg, seg_len)) {
+        debug(false, "too long ClientHello");
+        this->release_session(ssn);
+        return false;
+      }
+      data = ssn->buf();
+      len = ssn->len();
+    }
+
+    if (!is_hello(data, len)) {
+      if (ssn) {
+        this->release_session(ssn);
+      }
+      return false;
+    }
+
+    // ClientHello fragmented into several records is not supported.
+    const size_t rec_len = (len < 5) ? 0 : (data[3] << 8) | data[4];
+    const size_t hs_len = (len < 9) ? 0 :
+      (data[6] << 16) | (data[7] << 8) | data[8];
+    if (len >= 9 && hs_len + 4 > rec_len) {
+      if (ssn) {
+        this->release_session(ssn);
+      }
+      return false;
+    }
+
+    if (len < 5 + rec_len || len < 9) {
+      // Record is not completed yet, wait next segment.
+      if (ssn == nullptr || !ssn->pending()) {
+        if (this->pending_count_ >= PENDING_MAX ||
+            5 + rec_len > TlsSession::BUF_MAX ||
+            nullptr == (ssn = this->fetch_session(p, true)) ||
+            !ssn->append(seg, seg_len)) {
+          return false;
+        }
+        this->pending_count_++;
+      }
+      // The segment is not marked as used until the ClientHello is parsed,
+      // so it is still logged as raw data if the record never completes.
+      return true;
+    }
+
+    if (ssn && ssn->pending()) {
+      ::memcpy(this->rec_, data, 5 + rec_len);
+      data = this->rec_;
+      this->release_session(ssn);
+    }
+    if (!this->parse(p, data + 9, hs_len)) {
+      return false;
+    }
+    p->set (this->P_SEG_USED_, seg, seg_len);
+    return true;
+  }
+
+  INIT_DECODER (tls, TlsDecoder::New);
+}  // namespace swarm
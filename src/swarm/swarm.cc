@@ -65,10 +65,19 @@ namespace swarm {
     return this->netdec_->unset_handler(h_id);
   }
 
+  bool Swarm::set_session_filter(const std::string &dec_name,
+                                 SessionFilter *filter) {
+    return this->netdec_->set_session_filter(dec_name, filter);
+  }
+
   task_id Swarm::set_periodic_task(Task *task, float interval) {
     assert(this->netcap_);
     return this->netcap_->set_periodic_task(task, interval);
   }
+  task_id Swarm::set_batch_task(Task *task) {
+    assert(this->netcap_);
+    return this->netcap_->set_batch_task(task);
+  }
   bool Swarm::unset_task(task_id t_id) {
     assert(this->netcap_);
     return this->netcap_->unset_task(t_id);
@@ -113,5 +122,10 @@ namespace swarm {
   }
   Handler::~Handler () {
   }
+
+  SessionFilter::SessionFilter () {
+  }
+  SessionFilter::~SessionFilter () {
+  }
   
 } // namespace swarm
@@ -45,6 +45,7 @@ namespace swarm {
   class NetDec;
   class NetCap;
   class Handler;
+  class SessionFilter;
   class Task;
 
   // ----------------------------------------------------------
@@ -60,8 +61,11 @@ namespace swarm {
     hdlr_id set_handler(const std::string &ev_name, Handler *hdlr);
     hdlr_id set_handler(const ev_id eid, Handler *hdlr);
     bool unset_handler(hdlr_id h_id);
+    bool set_session_filter(const std::string &dec_name,
+                            SessionFilter *filter);
 
     task_id set_periodic_task(Task *task, float interval);
+    task_id set_batch_task(Task *task);
     bool unset_task(task_id t_id);
 
     ev_id lookup_event_id(const std::string &ev_name) const;
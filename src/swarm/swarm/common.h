@@ -47,6 +47,9 @@ namespace swarm {
   const dec_id   DEC_BASE =  0;
   const task_id  TASK_NULL = 0;
 
+  // Size of per-session handler area given as "tcp_ssn.ext".
+  const size_t   TCP_SSN_EXT_SIZE = 64;
+
   class Property;
   class ValueSet;
   class ValueEntry;
@@ -37,6 +37,8 @@
 #include "./value.h"
 
 namespace swarm {
+  class SessionFilter;
+
   class Decoder {
   private:
     NetDec * nd_;
@@ -50,6 +52,8 @@ namespace swarm {
     virtual void setup (NetDec *nd) = 0;
     virtual bool decode (Property *p) = 0;
     virtual bool accept (const Property &p);
+    // Returns false if the decoder keeps no session state to filter.
+    virtual bool set_session_filter (SessionFilter *filter);
   };
 
 
@@ -63,6 +63,7 @@ namespace swarm {
     ev_io watcher_;
     ev_timer timeout_;
     std::map<task_id, TaskEntry*> task_entry_;
+    std::map<task_id, Task*> batch_task_;
     task_id last_id_;
 
     virtual bool setup() = 0;
@@ -89,6 +90,9 @@ namespace swarm {
     bool start (float timeout = 0);
 
     task_id set_periodic_task(Task *task, float interval);
+    // Batch task is executed after each batch of packets read by one I/O
+    // event, e.g. to flush replies queued while decoding them.
+    task_id set_batch_task(Task *task);
     bool unset_task(task_id id);
 
     const std::string &errmsg () const;
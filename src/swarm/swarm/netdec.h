@@ -44,6 +44,24 @@ namespace swarm {
     virtual void recv (ev_id eid, const Property &p) = 0;
   };
 
+  // ----------------------------------------------------------
+  // SessionFilter
+  // Consulted by a stateful decoder (e.g. tcp_ssn) before it allocates
+  // state for a packet that matches no existing session. REJECT drops
+  // the packet without any allocation, ESTABLISH creates the session as
+  // if the handshake had already been observed.
+  class SessionFilter {
+  public:
+    enum Verdict {
+      ADMIT,
+      REJECT,
+      ESTABLISH,
+    };
+    SessionFilter ();
+    virtual ~SessionFilter ();
+    virtual Verdict admit (const Property &p) = 0;
+  };
+
 
   class HandlerEntry {
   private:
@@ -124,6 +142,8 @@ namespace swarm {
     bool unload_decoder (dec_id d_id);
     bool bind_decoder (dec_id d_id, const std::string &tgt_dec_name);
     bool unbind_decoder (dec_id d_id, const std::string &tgt_dec_name);
+    bool set_session_filter (const std::string &dec_name,
+                             SessionFilter *filter);
 
     // Handler
     hdlr_id set_handler (ev_id eid, Handler * hdlr);
@@ -0,0 +1,183 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <assert.h>
+#include <deque>
+#include <map>
+
+#include "./aho-corasick.h"
+
+namespace swarm {
+  const AhoCorasick::state_t AhoCorasick::ROOT;
+
+  AhoCorasick::AhoCorasick() : class_size_(0), compiled_(false) {
+    ::memset(this->class_, 0, sizeof(this->class_));
+  }
+  AhoCorasick::~AhoCorasick() {
+  }
+
+  bool AhoCorasick::add(const void *pattern, size_t len, int id) {
+    if (this->compiled_ || len == 0 || id < 0) {
+      return false;
+    }
+
+    Pattern pat;
+    pat.data_.assign(static_cast<const char*>(pattern), len);
+    pat.id_ = id;
+    this->pattern_.push_back(pat);
+
+    if (this->pat_len_.size() <= static_cast<size_t>(id)) {
+      this->pat_len_.resize(id + 1, 0);
+    }
+    this->pat_len_[id] = len;
+    return true;
+  }
+
+  size_t AhoCorasick::state_size() const {
+    return (this->class_size_ > 0) ?
+      this->delta_.size() / this->class_size_ : 0;
+  }
+
+  bool AhoCorasick::compile() {
+    if (this->compiled_ || this->pattern_.empty()) {
+      return false;
+    }
+
+    // Equivalence classes: class 0 is for bytes not in any pattern.
+    this->class_size_ = 1;
+    for (size_t i = 0; i < this->pattern_.size(); i++) {
+      const std::string &d = this->pattern_[i].data_;
+      for (size_t j = 0; j < d.length(); j++) {
+        uint8_t c = static_cast<uint8_t>(d[j]);
+        if (this->class_[c] == 0) {
+          this->class_[c] = this->class_size_++;
+        }
+      }
+      this->start_.add(static_cast<uint8_t>(d[0]));
+    }
+    const size_t cs = this->class_size_;
+
+    // Build trie. Sparse std::map edges are used only while building.
+    std::vector<std::map<uint8_t, state_t> > go(1);
+    std::vector<std::vector<int> > out(1);
+    for (size_t i = 0; i < this->pattern_.size(); i++) {
+      const std::string &d = this->pattern_[i].data_;
+      state_t s = ROOT;
+      for (size_t j = 0; j < d.length(); j++) {
+        uint8_t k = this->class_[static_cast<uint8_t>(d[j])];
+        auto it = go[s].find(k);
+        if (it == go[s].end()) {
+          state_t n = go.size();
+          go.push_back(std::map<uint8_t, state_t>());
+          out.push_back(std::vector<int>());
+          go[s].insert(std::make_pair(k, n));
+          s = n;
+        } else {
+          s = it->second;
+        }
+      }
+      out[s].push_back(this->pattern_[i].id_);
+    }
+
+    // Convert to DFA by BFS over failure links.
+    const size_t n_state = go.size();
+    std::vector<state_t> fail(n_state, ROOT);
+    this->delta_.assign(n_state * cs, ROOT);
+    std::deque<state_t> queue;
+
+    for (size_t k = 0; k < cs; k++) {
+      auto it = go[ROOT].find(k);
+      if (it != go[ROOT].end()) {
+        this->delta_[ROOT * cs + k] = it->second;
+        queue.push_back(it->second);
+      }
+    }
+
+    while (!queue.empty()) {
+      state_t s = queue.front();
+      queue.pop_front();
+      const std::vector<int> &f_out = out[fail[s]];
+      out[s].insert(out[s].end(), f_out.begin(), f_out.end());
+
+      for (size_t k = 0; k < cs; k++) {
+        auto it = go[s].find(k);
+        if (it != go[s].end()) {
+          fail[it->second] = this->delta_[fail[s] * cs + k];
+          this->delta_[s * cs + k] = it->second;
+          queue.push_back(it->second);
+        } else {
+          this->delta_[s * cs + k] = this->delta_[fail[s] * cs + k];
+        }
+      }
+    }
+
+    // Flatten outputs.
+    this->out_idx_.resize(n_state + 1);
+    this->out_.clear();
+    for (size_t s = 0; s < n_state; s++) {
+      this->out_idx_[s] = this->out_.size();
+      this->out_.insert(this->out_.end(), out[s].begin(), out[s].end());
+    }
+    this->out_idx_[n_state] = this->out_.size();
+
+    this->compiled_ = true;
+    return true;
+  }
+
+  AhoCorasick::state_t AhoCorasick::scan(const void *data, size_t len,
+                                         Callback *cb, state_t state) const {
+    if (!this->compiled_) {
+      return state;
+    }
+
+    const uint8_t *base = static_cast<const uint8_t*>(data);
+    const uint8_t *p = base, *ep = base + len;
+    const size_t cs = this->class_size_;
+    const state_t *delta = &this->delta_[0];
+
+    while (p < ep) {
+      if (state == ROOT) {
+        p = this->start_.skip(p, ep);
+        if (p == ep) {
+          break;
+        }
+      }
+
+      state = delta[state * cs + this->class_[*p]];
+      p++;
+
+      const uint32_t ob = this->out_idx_[state], oe = this->out_idx_[state + 1];
+      for (uint32_t i = ob; i < oe; i++) {
+        if (cb && !cb->match(this->out_[i], p - base)) {
+          return state;
+        }
+      }
+    }
+
+    return state;
+  }
+}  // namespace swarm
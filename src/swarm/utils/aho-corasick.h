@@ -0,0 +1,94 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_UTILS_AHO_CORASICK_H__
+#define SRC_UTILS_AHO_CORASICK_H__
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include "./byte-filter.h"
+
+namespace swarm {
+  // ----------------------------------------------------------------
+  // class AhoCorasick:
+  // Multi-pattern matcher compiled into a DFA. Bytes are mapped to
+  // equivalence classes (bytes not in any pattern share one class) to
+  // keep the transition table small. While the automaton is in the root
+  // state, bytes that can not start any pattern are skipped by
+  // ByteFilter.
+  //
+  // scan() takes and returns automaton state, so a stream that is split
+  // into several buffers can be matched without re-scanning.
+  //
+  class AhoCorasick {
+  public:
+    typedef uint32_t state_t;
+    static const state_t ROOT = 0;
+
+    class Callback {
+    public:
+      virtual ~Callback() {}
+      // end is offset of the next byte of matched pattern in the scanned
+      // buffer. Return false to stop scanning.
+      virtual bool match(int pat_id, size_t end) = 0;
+    };
+
+  private:
+    struct Pattern {
+      std::string data_;
+      int id_;
+    };
+    std::vector<Pattern> pattern_;
+    std::vector<size_t> pat_len_;  // length of pattern by id
+
+    uint8_t class_[256];           // byte -> equivalence class
+    size_t class_size_;
+    std::vector<state_t> delta_;   // state * class_size_ + class -> state
+    std::vector<uint32_t> out_idx_;  // outputs of state s are
+    std::vector<int> out_;           // out_[out_idx_[s]..out_idx_[s+1])
+    ByteFilter start_;             // bytes that can start a pattern
+    bool compiled_;
+
+  public:
+    AhoCorasick();
+    ~AhoCorasick();
+    // Register pattern before compile(). id must be >= 0.
+    bool add(const void *pattern, size_t len, int id);
+    bool compile();
+    bool compiled() const { return this->compiled_; }
+    size_t size() const { return this->pattern_.size(); }
+    size_t state_size() const;
+    size_t pattern_len(int id) const {
+      return (id >= 0 && static_cast<size_t>(id) < this->pat_len_.size()) ?
+        this->pat_len_[id] : 0;
+    }
+    state_t scan(const void *data, size_t len, Callback *cb,
+                 state_t state = ROOT) const;
+  };
+}  // namespace swarm
+
+#endif  // SRC_UTILS_AHO_CORASICK_H__
@@ -0,0 +1,102 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BF_HAS_SSSE3_PATH
+#endif
+
+#include "./byte-filter.h"
+
+namespace swarm {
+  ByteFilter::ByteFilter() {
+    this->clear();
+  }
+  ByteFilter::~ByteFilter() {
+  }
+
+  void ByteFilter::clear() {
+    ::memset(this->set_, 0, sizeof(this->set_));
+    ::memset(this->nib_lo_, 0, sizeof(this->nib_lo_));
+    ::memset(this->nib_hi_, 0, sizeof(this->nib_hi_));
+    this->all_ = false;
+  }
+
+  void ByteFilter::add(uint8_t c) {
+    // A byte is a candidate if both nibble entries share a bucket bit.
+    // Bucket is chosen by high nibble, so false positives come only from
+    // bytes that share the bucket.
+    uint8_t bit = 1 << ((c >> 4) & 0x7);
+    this->set_[c] = true;
+    this->nib_lo_[c & 0xf] |= bit;
+    this->nib_hi_[c >> 4] |= bit;
+
+    this->all_ = true;
+    for (size_t i = 0; i < 256 && this->all_; i++) {
+      this->all_ = this->set_[i];
+    }
+  }
+
+#ifdef BF_HAS_SSSE3_PATH
+  __attribute__((target("ssse3")))
+  static const uint8_t *skip_ssse3(const uint8_t *p, const uint8_t *ep,
+                                   const uint8_t *lo, const uint8_t *hi) {
+    const __m128i t_lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo));
+    const __m128i t_hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; ep - p >= 16; p += 16) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      __m128i l = _mm_shuffle_epi8(t_lo, _mm_and_si128(d, mask));
+      __m128i h = _mm_shuffle_epi8(t_hi,
+                                   _mm_and_si128(_mm_srli_epi16(d, 4), mask));
+      int m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(l, h), zero));
+      if (m != 0xffff) {
+        return p + __builtin_ctz(~m & 0xffff);
+      }
+    }
+    return p;
+  }
+#endif
+
+  const uint8_t *ByteFilter::skip(const uint8_t *p, const uint8_t *ep) const {
+    if (this->all_) {
+      return p;
+    }
+#ifdef BF_HAS_SSSE3_PATH
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_ssse3) {
+      p = skip_ssse3(p, ep, this->nib_lo_, this->nib_hi_);
+    }
+#endif
+    while (p < ep && !this->set_[*p]) {
+      p++;
+    }
+    return p;
+  }
+}  // namespace swarm
@@ -0,0 +1,59 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_UTILS_BYTE_FILTER_H__
+#define SRC_UTILS_BYTE_FILTER_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace swarm {
+  // ----------------------------------------------------------------
+  // class ByteFilter:
+  // Finds the next byte in a set of candidate bytes. Used as prefilter
+  // of automata that stay in their start state for most bytes. With
+  // SSSE3 (checked at runtime), 16 bytes are tested at once by nibble
+  // tables as Teddy does; false positives of the nibble test are removed
+  // by the exact table.
+  //
+  class ByteFilter {
+  private:
+    bool set_[256];
+    uint8_t nib_lo_[16], nib_hi_[16];
+    bool all_;
+
+  public:
+    ByteFilter();
+    ~ByteFilter();
+    void clear();
+    void add(uint8_t c);
+    bool has(uint8_t c) const { return this->set_[c]; }
+    // Returns the first candidate byte in [p, ep) or ep.
+    const uint8_t *skip(const uint8_t *p, const uint8_t *ep) const;
+  };
+}  // namespace swarm
+
+#endif  // SRC_UTILS_BYTE_FILTER_H__
@@ -0,0 +1,310 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "./digest.h"
+
+namespace swarm {
+  static inline uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+  }
+  static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  // ----------------------------------------------------------------
+  // MD5 (RFC 1321)
+
+  void Md5::init() {
+    this->st_[0] = 0x67452301;
+    this->st_[1] = 0xefcdab89;
+    this->st_[2] = 0x98badcfe;
+    this->st_[3] = 0x10325476;
+    this->len_ = 0;
+  }
+
+  void Md5::block(const uint8_t *p) {
+    static const uint32_t K[64] = {
+      0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+      0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+      0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+      0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+      0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+      0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+      0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+      0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+      0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+      0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+      0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+    };
+    static const int R[64] = {
+      7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+      5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+      4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+      6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+    };
+
+    uint32_t m[16];
+    for (int i = 0; i < 16; i++) {
+      m[i] = p[i * 4] | (p[i * 4 + 1] << 8) | (p[i * 4 + 2] << 16) |
+        (static_cast<uint32_t>(p[i * 4 + 3]) << 24);
+    }
+
+    uint32_t a = this->st_[0], b = this->st_[1];
+    uint32_t c = this->st_[2], d = this->st_[3];
+    for (int i = 0; i < 64; i++) {
+      uint32_t f;
+      int g;
+      if (i < 16) {
+        f = (b & c) | (~b & d);
+        g = i;
+      } else if (i < 32) {
+        f = (d & b) | (~d & c);
+        g = (5 * i + 1) & 0xf;
+      } else if (i < 48) {
+        f = b ^ c ^ d;
+        g = (3 * i + 5) & 0xf;
+      } else {
+        f = c ^ (b | ~d);
+        g = (7 * i) & 0xf;
+      }
+      uint32_t t = d;
+      d = c;
+      c = b;
+      b = b + rotl(a + f + K[i] + m[g], R[i]);
+      a = t;
+    }
+
+    this->st_[0] += a;
+    this->st_[1] += b;
+    this->st_[2] += c;
+    this->st_[3] += d;
+  }
+
+  void Md5::update(const void *data, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    size_t used = this->len_ & 0x3f;
+    this->len_ += len;
+
+    if (used > 0) {
+      size_t n = (64 - used < len) ? 64 - used : len;
+      ::memcpy(this->buf_ + used, p, n);
+      p += n;
+      len -= n;
+      if (used + n < 64) {
+        return;
+      }
+      this->block(this->buf_);
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+      this->block(p);
+    }
+    ::memcpy(this->buf_, p, len);
+  }
+
+  void Md5::finish(uint8_t *digest) {
+    uint64_t bits = this->len_ * 8;
+    uint8_t pad[72] = {0x80};
+    size_t used = this->len_ & 0x3f;
+    size_t pad_len = (used < 56) ? 56 - used : 120 - used;
+    for (int i = 0; i < 8; i++) {
+      pad[pad_len + i] = static_cast<uint8_t>(bits >> (i * 8));
+    }
+    this->update(pad, pad_len + 8);
+
+    for (int i = 0; i < 4; i++) {
+      for (int j = 0; j < 4; j++) {
+        digest[i * 4 + j] = static_cast<uint8_t>(this->st_[i] >> (j * 8));
+      }
+    }
+  }
+
+  // ----------------------------------------------------------------
+  // SHA-256 (FIPS 180-4)
+
+  void Sha256::init() {
+    static const uint32_t H[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    ::memcpy(this->st_, H, sizeof(H));
+    this->len_ = 0;
+  }
+
+  void Sha256::block(const uint8_t *p) {
+    static const uint32_t K[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+      0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+      0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+      0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+      0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+      0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+      0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+      0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+      0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    };
+
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = (static_cast<uint32_t>(p[i * 4]) << 24) | (p[i * 4 + 1] << 16) |
+        (p[i * 4 + 2] << 8) | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t v[8];
+    ::memcpy(v, this->st_, sizeof(v));
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+      uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+      uint32_t t1 = v[7] + s1 + ch + K[i] + w[i];
+      uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+      uint32_t mj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+      uint32_t t2 = s0 + mj;
+      v[7] = v[6];
+      v[6] = v[5];
+      v[5] = v[4];
+      v[4] = v[3] + t1;
+      v[3] = v[2];
+      v[2] = v[1];
+      v[1] = v[0];
+      v[0] = t1 + t2;
+    }
+
+    for (int i = 0; i < 8; i++) {
+      this->st_[i] += v[i];
+    }
+  }
+
+  void Sha256::update(const void *data, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    size_t used = this->len_ & 0x3f;
+    this->len_ += len;
+
+    if (used > 0) {
+      size_t n = (64 - used < len) ? 64 - used : len;
+      ::memcpy(this->buf_ + used, p, n);
+      p += n;
+      len -= n;
+      if (used + n < 64) {
+        return;
+      }
+      this->block(this->buf_);
+    }
+    for (; len >= 64; p += 64, len -= 64) {
+      this->block(p);
+    }
+    ::memcpy(this->buf_, p, len);
+  }
+
+  void Sha256::finish(uint8_t *digest) {
+    uint64_t bits = this->len_ * 8;
+    uint8_t pad[72] = {0x80};
+    size_t used = this->len_ & 0x3f;
+    size_t pad_len = (used < 56) ? 56 - used : 120 - used;
+    for (int i = 0; i < 8; i++) {
+      pad[pad_len + i] = static_cast<uint8_t>(bits >> ((7 - i) * 8));
+    }
+    this->update(pad, pad_len + 8);
+
+    for (int i = 0; i < 8; i++) {
+      for (int j = 0; j < 4; j++) {
+        digest[i * 4 + j] = static_cast<uint8_t>(this->st_[i] >> ((3 - j) * 8));
+      }
+    }
+  }
+
+  // ----------------------------------------------------------------
+  // SipHash-2-4 (Aumasson and Bernstein, 2012)
+
+  static inline uint64_t rotl64(uint64_t x, int n) {
+    return (x << n) | (x >> (64 - n));
+  }
+  static inline uint64_t load64le(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+      v = (v << 8) | p[i];
+    }
+    return v;
+  }
+  static inline void sip_round(uint64_t *v) {
+    v[0] += v[1]; v[1] = rotl64(v[1], 13); v[1] ^= v[0];
+    v[0] = rotl64(v[0], 32);
+    v[2] += v[3]; v[3] = rotl64(v[3], 16); v[3] ^= v[2];
+    v[0] += v[3]; v[3] = rotl64(v[3], 21); v[3] ^= v[0];
+    v[2] += v[1]; v[1] = rotl64(v[1], 17); v[1] ^= v[2];
+    v[2] = rotl64(v[2], 32);
+  }
+
+  uint64_t siphash24(const uint8_t *key, const void *data, size_t len) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint64_t k0 = load64le(key), k1 = load64le(key + 8);
+    uint64_t v[4] = {
+      k0 ^ 0x736f6d6570736575ULL,
+      k1 ^ 0x646f72616e646f6dULL,
+      k0 ^ 0x6c7967656e657261ULL,
+      k1 ^ 0x7465646279746573ULL,
+    };
+
+    const uint8_t *end = p + (len & ~static_cast<size_t>(7));
+    for (; p < end; p += 8) {
+      uint64_t m = load64le(p);
+      v[3] ^= m;
+      sip_round(v);
+      sip_round(v);
+      v[0] ^= m;
+    }
+
+    uint64_t b = static_cast<uint64_t>(len) << 56;
+    for (size_t i = 0; i < (len & 7); i++) {
+      b |= static_cast<uint64_t>(p[i]) << (i * 8);
+    }
+    v[3] ^= b;
+    sip_round(v);
+    sip_round(v);
+    v[0] ^= b;
+
+    v[2] ^= 0xff;
+    for (int i = 0; i < 4; i++) {
+      sip_round(v);
+    }
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+  }
+
+  void hex_digest(const uint8_t *data, size_t len, char *out) {
+    static const char HEX[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+      out[i * 2]     = HEX[data[i] >> 4];
+      out[i * 2 + 1] = HEX[data[i] & 0xf];
+    }
+    out[len * 2] = '\0';
+  }
+}  // namespace swarm
@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_UTILS_DIGEST_H__
+#define SRC_UTILS_DIGEST_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace swarm {
+  // ----------------------------------------------------------------
+  // Small MD5 and SHA-256 implementations for fingerprints (JA3, JA4,
+  // HASSH). They keep state in the object and never allocate memory.
+  //
+  class Md5 {
+  public:
+    static const size_t DIGEST_LEN = 16;
+    Md5() { this->init(); }
+    void init();
+    void update(const void *data, size_t len);
+    void finish(uint8_t *digest);
+
+  private:
+    uint32_t st_[4];
+    uint64_t len_;
+    uint8_t buf_[64];
+    void block(const uint8_t *p);
+  };
+
+  class Sha256 {
+  public:
+    static const size_t DIGEST_LEN = 32;
+    Sha256() { this->init(); }
+    void init();
+    void update(const void *data, size_t len);
+    void finish(uint8_t *digest);
+
+  private:
+    uint32_t st_[8];
+    uint64_t len_;
+    uint8_t buf_[64];
+    void block(const uint8_t *p);
+  };
+
+  // SipHash-2-4 keyed hash with a 128 bit key, for values that must not
+  // be predictable from outside (e.g. SYN cookies).
+  static const size_t SIPHASH_KEY_LEN = 16;
+  uint64_t siphash24(const uint8_t *key, const void *data, size_t len);
+
+  // Write lower case hex string of data (2 * len chars and '\0') to out.
+  void hex_digest(const uint8_t *data, size_t len, char *out);
+}  // namespace swarm
+
+#endif  // SRC_UTILS_DIGEST_H__
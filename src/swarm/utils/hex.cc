@@ -0,0 +1,173 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_HAS_SIMD_PATH
+#endif
+
+#include "./hex.h"
+
+namespace swarm {
+  static const char hex_digit[] = "0123456789ABCDEF";
+
+#ifdef HEX_HAS_SIMD_PATH
+  // Returns number of bytes converted, a multiple of 16.
+  __attribute__((target("ssse3")))
+  static size_t hex_ssse3(const uint8_t *p, size_t len, char *dst) {
+    const __m128i digit =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex_digit));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; len - i >= 16; i += 16) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+      __m128i hi = _mm_shuffle_epi8(digit,
+                                    _mm_and_si128(_mm_srli_epi16(d, 4), mask));
+      __m128i lo = _mm_shuffle_epi8(digit, _mm_and_si128(d, mask));
+      __m128i *out = reinterpret_cast<__m128i*>(dst + i * 2);
+      _mm_storeu_si128(out, _mm_unpacklo_epi8(hi, lo));
+      _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(hi, lo));
+    }
+    return i;
+  }
+
+  __attribute__((target("avx2")))
+  static size_t hex_avx2(const uint8_t *p, size_t len, char *dst) {
+    const __m256i digit = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex_digit)));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; len - i >= 32; i += 32) {
+      __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+      __m256i hi = _mm256_shuffle_epi8(
+          digit, _mm256_and_si256(_mm256_srli_epi16(d, 4), mask));
+      __m256i lo = _mm256_shuffle_epi8(digit, _mm256_and_si256(d, mask));
+      // Unpack works in 128 bit lanes; put the lanes back in order.
+      __m256i a = _mm256_unpacklo_epi8(hi, lo);
+      __m256i b = _mm256_unpackhi_epi8(hi, lo);
+      __m256i *out = reinterpret_cast<__m256i*>(dst + i * 2);
+      _mm256_storeu_si256(out, _mm256_permute2x128_si256(a, b, 0x20));
+      _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    return i;
+  }
+
+  // Output byte j of block k is a digit (j % 3 == 0: high, 1: low) of
+  // input byte (16 * k + j) / 3, or separator (j % 3 == 2).
+  static const uint8_t sep_hi[3][16] = {
+    {0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02, 0x80,
+     0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80, 0x05},
+    {0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80, 0x80,
+     0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0a, 0x80},
+    {0x80, 0x0b, 0x80, 0x80, 0x0c, 0x80, 0x80, 0x0d,
+     0x80, 0x80, 0x0e, 0x80, 0x80, 0x0f, 0x80, 0x80},
+  };
+  static const uint8_t sep_lo[3][16] = {
+    {0x80, 0x00, 0x80, 0x80, 0x01, 0x80, 0x80, 0x02,
+     0x80, 0x80, 0x03, 0x80, 0x80, 0x04, 0x80, 0x80},
+    {0x05, 0x80, 0x80, 0x06, 0x80, 0x80, 0x07, 0x80,
+     0x80, 0x08, 0x80, 0x80, 0x09, 0x80, 0x80, 0x0a},
+    {0x80, 0x80, 0x0b, 0x80, 0x80, 0x0c, 0x80, 0x80,
+     0x0d, 0x80, 0x80, 0x0e, 0x80, 0x80, 0x0f, 0x80},
+  };
+  static const uint8_t sep_pos[3][16] = {
+    {0x00, 0x00, 0xff, 0x00, 0x00, 0xff, 0x00, 0x00,
+     0xff, 0x00, 0x00, 0xff, 0x00, 0x00, 0xff, 0x00},
+    {0x00, 0xff, 0x00, 0x00, 0xff, 0x00, 0x00, 0xff,
+     0x00, 0x00, 0xff, 0x00, 0x00, 0xff, 0x00, 0x00},
+    {0xff, 0x00, 0x00, 0xff, 0x00, 0x00, 0xff, 0x00,
+     0x00, 0xff, 0x00, 0x00, 0xff, 0x00, 0x00, 0xff},
+  };
+
+  // 16 bytes into 48 chars, the last one a separator, so it is used only
+  // while more bytes follow.
+  __attribute__((target("ssse3")))
+  static size_t hex_sep_ssse3(const uint8_t *p, size_t len, char sep,
+                              char *dst) {
+    const __m128i digit =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex_digit));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i sep_v = _mm_set1_epi8(sep);
+    size_t i = 0;
+    for (; len - i > 16; i += 16) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+      __m128i hi = _mm_shuffle_epi8(digit,
+                                    _mm_and_si128(_mm_srli_epi16(d, 4), mask));
+      __m128i lo = _mm_shuffle_epi8(digit, _mm_and_si128(d, mask));
+      __m128i *out = reinterpret_cast<__m128i*>(dst + i * 3);
+      for (int k = 0; k < 3; k++) {
+        __m128i h = _mm_shuffle_epi8(hi, _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(sep_hi[k])));
+        __m128i l = _mm_shuffle_epi8(lo, _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(sep_lo[k])));
+        __m128i s = _mm_and_si128(sep_v, _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(sep_pos[k])));
+        _mm_storeu_si128(out + k, _mm_or_si128(_mm_or_si128(h, l), s));
+      }
+    }
+    return i;
+  }
+#endif
+
+  void hex_encode(const void *src, size_t len, char *dst) {
+    const uint8_t *p = static_cast<const uint8_t*>(src);
+    size_t i = 0;
+#ifdef HEX_HAS_SIMD_PATH
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_avx2 && len >= 32) {
+      i = hex_avx2(p, len, dst);
+    }
+    if (has_ssse3 && len - i >= 16) {
+      i += hex_ssse3(p + i, len - i, dst + i * 2);
+    }
+#endif
+    for (; i < len; i++) {
+      dst[i * 2] = hex_digit[p[i] >> 4];
+      dst[i * 2 + 1] = hex_digit[p[i] & 0xf];
+    }
+  }
+
+  size_t hex_encode(const void *src, size_t len, char sep, char *dst) {
+    const uint8_t *p = static_cast<const uint8_t*>(src);
+    size_t i = 0;
+#ifdef HEX_HAS_SIMD_PATH
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    if (has_ssse3 && len > 16) {
+      i = hex_sep_ssse3(p, len, sep, dst);
+    }
+#endif
+    char *q = dst + i * 3;
+    for (; i < len; i++) {
+      *q++ = hex_digit[p[i] >> 4];
+      *q++ = hex_digit[p[i] & 0xf];
+      if (i + 1 < len) {
+        *q++ = sep;
+      }
+    }
+    return (len > 0) ? len * 3 - 1 : 0;
+  }
+}  // namespace swarm
@@ -0,0 +1,772 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <sstream>
+
+#include "./regex-dfa.h"
+
+namespace swarm {
+  const RegexDfa::state_t RegexDfa::INIT;
+
+  // ----------------------------------------------------------------
+  // RegexDfa::Parser converts a pattern to syntax tree and builds NFA
+  // states of RegexDfa from the tree.
+  class RegexDfa::Parser {
+  private:
+    static const int REP_MAX = 1000;
+
+    enum NodeType { N_SET, N_CAT, N_ALT, N_REP, N_EMPTY };
+    struct Node {
+      NodeType type_;
+      int set_;
+      std::vector<int> child_;
+      int min_, max_;  // max_ < 0 means infinity
+    };
+
+    RegexDfa *dfa_;
+    const std::string &re_;
+    size_t pos_;
+    bool nocase_;
+    std::vector<Node> node_;
+    std::string errmsg_;
+
+    int new_node(NodeType type) {
+      Node n;
+      n.type_ = type;
+      n.set_ = -1;
+      n.min_ = n.max_ = 0;
+      this->node_.push_back(n);
+      return this->node_.size() - 1;
+    }
+    void fold(std::vector<bool> *set) const {
+      if (this->nocase_) {
+        for (int c = 'a'; c <= 'z'; c++) {
+          if ((*set)[c] || (*set)[toupper(c)]) {
+            (*set)[c] = (*set)[toupper(c)] = true;
+          }
+        }
+      }
+    }
+    int set_node(std::vector<bool> &set) {
+      this->fold(&set);
+      int n = this->new_node(N_SET);
+      this->node_[n].set_ = this->dfa_->new_set(set);
+      return n;
+    }
+    bool fail(const char *msg) {
+      if (this->errmsg_.empty()) {
+        std::stringstream ss;
+        ss << msg << " at " << this->pos_ << " of /" << this->re_ << "/";
+        this->errmsg_ = ss.str();
+      }
+      return false;
+    }
+    bool eof() const { return this->pos_ >= this->re_.length(); }
+    char peek() const { return this->re_[this->pos_]; }
+
+    bool parse_alt(int *n);
+    bool parse_cat(int *n);
+    bool parse_rep(int *n);
+    bool parse_atom(int *n);
+    bool parse_class(int *n);
+    bool parse_escape(std::vector<bool> *set, bool *single, uint8_t *c);
+    bool parse_int(int *v);
+
+  public:
+    Parser(RegexDfa *dfa, const std::string &re, int flags) :
+      dfa_(dfa), re_(re), pos_(0), nocase_((flags & NOCASE) != 0) {}
+    bool parse(int *root, bool *anchored);
+    int build(int n, int s);
+    bool nullable(int n) const;
+    const std::string &errmsg() const { return this->errmsg_; }
+  };
+
+  bool RegexDfa::Parser::parse(int *root, bool *anchored) {
+    *anchored = false;
+    if (!this->eof() && this->peek() == '^') {
+      *anchored = true;
+      this->pos_++;
+    }
+    if (!this->parse_alt(root)) {
+      return false;
+    }
+    if (!this->eof()) {
+      return this->fail("unbalanced ')'");
+    }
+    return true;
+  }
+
+  bool RegexDfa::Parser::parse_alt(int *n) {
+    int c;
+    if (!this->parse_cat(&c)) {
+      return false;
+    }
+    if (this->eof() || this->peek() != '|') {
+      *n = c;
+      return true;
+    }
+
+    int alt = this->new_node(N_ALT);
+    this->node_[alt].child_.push_back(c);
+    while (!this->eof() && this->peek() == '|') {
+      this->pos_++;
+      if (!this->parse_cat(&c)) {
+        return false;
+      }
+      this->node_[alt].child_.push_back(c);
+    }
+    *n = alt;
+    return true;
+  }
+
+  bool RegexDfa::Parser::parse_cat(int *n) {
+    int cat = this->new_node(N_CAT);
+    while (!this->eof() && this->peek() != '|' && this->peek() != ')') {
+      int r;
+      if (!this->parse_rep(&r)) {
+        return false;
+      }
+      this->node_[cat].child_.push_back(r);
+    }
+    *n = cat;
+    return true;
+  }
+
+  bool RegexDfa::Parser::parse_int(int *v) {
+    size_t s = this->pos_;
+    *v = 0;
+    while (!this->eof() && isdigit(this->peek()) && *v <= REP_MAX) {
+      *v = *v * 10 + (this->peek() - '0');
+      this->pos_++;
+    }
+    return (s < this->pos_);
+  }
+
+  bool RegexDfa::Parser::parse_rep(int *n) {
+    int a;
+    if (!this->parse_atom(&a)) {
+      return false;
+    }
+
+    while (!this->eof()) {
+      int min, max;
+      char c = this->peek();
+      if (c == '*') {
+        min = 0;
+        max = -1;
+      } else if (c == '+') {
+        min = 1;
+        max = -1;
+      } else if (c == '?') {
+        min = 0;
+        max = 1;
+      } else if (c == '{') {
+        this->pos_++;
+        if (!this->parse_int(&min)) {
+          return this->fail("invalid repetition");
+        }
+        max = min;
+        if (!this->eof() && this->peek() == ',') {
+          this->pos_++;
+          max = -1;
+          if (!this->eof() && isdigit(this->peek())) {
+            this->parse_int(&max);
+          }
+        }
+        if (this->eof() || this->peek() != '}' || REP_MAX < min ||
+            REP_MAX < max || (max >= 0 && max < min)) {
+          return this->fail("invalid repetition");
+        }
+      } else {
+        break;
+      }
+      this->pos_++;
+      if (!this->eof() && this->peek() == '?') {
+        this->pos_++;  // lazy quantifier is same as greedy for matching
+      }
+
+      int rep = this->new_node(N_REP);
+      this->node_[rep].child_.push_back(a);
+      this->node_[rep].min_ = min;
+      this->node_[rep].max_ = max;
+      a = rep;
+    }
+
+    *n = a;
+    return true;
+  }
+
+  bool RegexDfa::Parser::parse_escape(std::vector<bool> *set, bool *single,
+                                      uint8_t *c) {
+    // pos_ is after '\'
+    if (this->eof()) {
+      return this->fail("trailing '\\'");
+    }
+    char e = this->peek();
+    this->pos_++;
+    *single = true;
+
+    switch (e) {
+    case 'n': *c = '\n'; break;
+    case 'r': *c = '\r'; break;
+    case 't': *c = '\t'; break;
+    case '0': *c = '\0'; break;
+    case 'x':
+      if (this->pos_ + 2 > this->re_.length() ||
+          !isxdigit(this->re_[this->pos_]) ||
+          !isxdigit(this->re_[this->pos_ + 1])) {
+        return this->fail("invalid \\x escape");
+      }
+      *c = strtol(this->re_.substr(this->pos_, 2).c_str(), nullptr, 16);
+      this->pos_ += 2;
+      break;
+
+    case 'd': case 'D': case 'w': case 'W': case 's': case 'S': {
+      *single = false;
+      bool neg = isupper(e);
+      for (int b = 0; b < 256; b++) {
+        bool in = false;
+        switch (tolower(e)) {
+        case 'd': in = isdigit(b); break;
+        case 'w': in = (isalnum(b) || b == '_') && b < 0x80; break;
+        case 's': in = (b == ' ' || ('\t' <= b && b <= '\r')); break;
+        }
+        if (in != neg) {
+          (*set)[b] = true;
+        }
+      }
+      break;
+    }
+
+    default:
+      if (isalnum(e)) {
+        return this->fail("unknown escape");
+      }
+      *c = e;
+      break;
+    }
+
+    if (*single) {
+      (*set)[*c] = true;
+    }
+    return true;
+  }
+
+  bool RegexDfa::Parser::parse_class(int *n) {
+    // pos_ is after '['
+    std::vector<bool> set(256, false);
+    bool neg = false;
+    if (!this->eof() && this->peek() == '^') {
+      neg = true;
+      this->pos_++;
+    }
+
+    bool first = true;
+    while (!this->eof() && (first || this->peek() != ']')) {
+      first = false;
+      uint8_t lo = this->peek(), hi;
+      bool single = true;
+      this->pos_++;
+      if (lo == '\\' && !this->parse_escape(&set, &single, &lo)) {
+        return false;
+      }
+      if (!single) {
+        continue;
+      }
+
+      if (this->pos_ + 1 < this->re_.length() && this->peek() == '-' &&
+          this->re_[this->pos_ + 1] != ']') {
+        this->pos_++;
+        hi = this->peek();
+        this->pos_++;
+        if (hi == '\\') {
+          std::vector<bool> tmp(256, false);
+          if (!this->parse_escape(&tmp, &single, &hi) || !single) {
+            return this->fail("invalid range");
+          }
+        }
+        if (hi < lo) {
+          return this->fail("invalid range");
+        }
+        for (int b = lo; b <= hi; b++) {
+          set[b] = true;
+        }
+      } else {
+        set[lo] = true;
+      }
+    }
+    if (this->eof()) {
+      return this->fail("missing ']'");
+    }
+    this->pos_++;
+
+    if (neg) {
+      this->fold(&set);  // [^a] excludes also 'A' with NOCASE
+      set.flip();
+    }
+    *n = this->set_node(set);
+    return true;
+  }
+
+  bool RegexDfa::Parser::parse_atom(int *n) {
+    char c = this->peek();
+    this->pos_++;
+
+    switch (c) {
+    case '(':
+      if (this->re_.compare(this->pos_, 2, "?:") == 0) {
+        this->pos_ += 2;
+      }
+      if (!this->parse_alt(n)) {
+        return false;
+      }
+      if (this->eof() || this->peek() != ')') {
+        return this->fail("missing ')'");
+      }
+      this->pos_++;
+      return true;
+
+    case '[':
+      return this->parse_class(n);
+
+    case '.': {
+      std::vector<bool> set(256, true);
+      *n = this->set_node(set);
+      return true;
+    }
+
+    case '\\': {
+      std::vector<bool> set(256, false);
+      bool single;
+      uint8_t b;
+      if (!this->parse_escape(&set, &single, &b)) {
+        return false;
+      }
+      *n = this->set_node(set);
+      return true;
+    }
+
+    case '*': case '+': case '?': case '{':
+      this->pos_--;
+      return this->fail("nothing to repeat");
+
+    case '^': case '$':
+      this->pos_--;
+      return this->fail("unsupported anchor");
+
+    default: {
+      std::vector<bool> set(256, false);
+      set[static_cast<uint8_t>(c)] = true;
+      *n = this->set_node(set);
+      return true;
+    }
+    }
+  }
+
+  bool RegexDfa::Parser::nullable(int n) const {
+    const Node &nd = this->node_[n];
+    switch (nd.type_) {
+    case N_SET: return false;
+    case N_EMPTY: return true;
+    case N_REP: return (nd.min_ == 0 || this->nullable(nd.child_[0]));
+    case N_CAT:
+      for (size_t i = 0; i < nd.child_.size(); i++) {
+        if (!this->nullable(nd.child_[i])) {
+          return false;
+        }
+      }
+      return true;
+    case N_ALT:
+      for (size_t i = 0; i < nd.child_.size(); i++) {
+        if (this->nullable(nd.child_[i])) {
+          return true;
+        }
+      }
+      return false;
+    }
+    return false;
+  }
+
+  int RegexDfa::Parser::build(int n, int s) {
+    // Build NFA of node n from entry state s and return exit state.
+    const Node nd = this->node_[n];
+    std::vector<NfaState> &nfa = this->dfa_->nfa_;
+
+    switch (nd.type_) {
+    case N_SET: {
+      int c = this->dfa_->new_state();
+      int e = this->dfa_->new_state();
+      nfa[s].eps_.push_back(c);
+      nfa[c].set_ = nd.set_;
+      nfa[c].next_ = e;
+      return e;
+    }
+
+    case N_EMPTY:
+      return s;
+
+    case N_CAT:
+      for (size_t i = 0; i < nd.child_.size(); i++) {
+        s = this->build(nd.child_[i], s);
+      }
+      return s;
+
+    case N_ALT: {
+      int e = this->dfa_->new_state();
+      for (size_t i = 0; i < nd.child_.size(); i++) {
+        int c = this->dfa_->new_state();
+        nfa[s].eps_.push_back(c);
+        int ce = this->build(nd.child_[i], c);
+        nfa[ce].eps_.push_back(e);
+      }
+      return e;
+    }
+
+    case N_REP: {
+      for (int i = 0; i < nd.min_; i++) {
+        s = this->build(nd.child_[0], s);
+      }
+      if (nd.max_ < 0) {
+        int l = this->dfa_->new_state();
+        nfa[s].eps_.push_back(l);
+        int le = this->build(nd.child_[0], l);
+        nfa[le].eps_.push_back(l);
+        return l;
+      } else {
+        int e = this->dfa_->new_state();
+        for (int i = nd.min_; i < nd.max_; i++) {
+          nfa[s].eps_.push_back(e);
+          s = this->build(nd.child_[0], s);
+        }
+        nfa[s].eps_.push_back(e);
+        return e;
+      }
+    }
+    }
+    return s;
+  }
+
+
+  // ----------------------------------------------------------------
+  // RegexDfa
+
+  RegexDfa::RegexDfa(size_t state_max) :
+    state_max_(state_max), class_size_(0), search_(INIT), compiled_(false) {
+    ::memset(this->class_, 0, sizeof(this->class_));
+  }
+  RegexDfa::~RegexDfa() {
+  }
+
+  int RegexDfa::new_state() {
+    NfaState s;
+    s.set_ = -1;
+    s.next_ = -1;
+    s.accept_ = -1;
+    this->nfa_.push_back(s);
+    return this->nfa_.size() - 1;
+  }
+
+  int RegexDfa::new_set(const std::vector<bool> &set) {
+    for (size_t i = 0; i < this->char_set_.size(); i++) {
+      if (this->char_set_[i] == set) {
+        return i;
+      }
+    }
+    this->char_set_.push_back(set);
+    return this->char_set_.size() - 1;
+  }
+
+  bool RegexDfa::add(const std::string &regex, int id, int flags) {
+    if (this->compiled_ || id < 0) {
+      this->errmsg_ = "can not add pattern";
+      return false;
+    }
+
+    const size_t nfa_size = this->nfa_.size();
+    Parser psr(this, regex, flags);
+    int root;
+    bool anchored;
+    if (!psr.parse(&root, &anchored)) {
+      this->errmsg_ = psr.errmsg();
+      this->nfa_.resize(nfa_size);
+      return false;
+    }
+    if (psr.nullable(root)) {
+      this->errmsg_ = "pattern matches empty string: /" + regex + "/";
+      this->nfa_.resize(nfa_size);
+      return false;
+    }
+
+    int entry = this->new_state();
+    int exit = psr.build(root, entry);
+    this->nfa_[exit].accept_ = id;
+    if (anchored) {
+      this->anchored_start_.push_back(entry);
+    } else {
+      this->start_.push_back(entry);
+    }
+    return true;
+  }
+
+  bool RegexDfa::add_literal(const void *data, size_t len, int id,
+                             int flags) {
+    static const char META[] = "\\^$.|?*+()[]{}";
+    const uint8_t *p = static_cast<const uint8_t*>(data);
+    std::string re;
+    for (size_t i = 0; i < len; i++) {
+      if (p[i] == 0 || ::strchr(META, p[i])) {
+        char buf[8];
+        snprintf(buf, sizeof(buf), "\\x%02x", p[i]);
+        re += buf;
+      } else {
+        re += static_cast<char>(p[i]);
+      }
+    }
+    return this->add(re, id, flags);
+  }
+
+  size_t RegexDfa::state_size() const {
+    return (this->class_size_ > 0) ?
+      this->delta_.size() / this->class_size_ : 0;
+  }
+
+  // Collect epsilon closure of seeds into out. Only states that have a
+  // char edge or acceptance are kept because others do not affect
+  // transitions. States with negative mark are skipped, and mark is
+  // updated by stamp for visited states.
+  void RegexDfa::closure(const std::vector<int> &seeds,
+                         std::vector<int> *out, std::vector<int> *mark,
+                         int stamp) const {
+    std::vector<int> stack;
+    out->clear();
+    for (size_t i = 0; i < seeds.size(); i++) {
+      int s = seeds[i];
+      if ((*mark)[s] >= 0 && (*mark)[s] != stamp) {
+        (*mark)[s] = stamp;
+        stack.push_back(s);
+      }
+    }
+
+    while (!stack.empty()) {
+      int s = stack.back();
+      stack.pop_back();
+      const NfaState &ns = this->nfa_[s];
+      if (ns.set_ >= 0 || ns.accept_ >= 0) {
+        out->push_back(s);
+      }
+      for (size_t i = 0; i < ns.eps_.size(); i++) {
+        int e = ns.eps_[i];
+        if ((*mark)[e] >= 0 && (*mark)[e] != stamp) {
+          (*mark)[e] = stamp;
+          stack.push_back(e);
+        }
+      }
+    }
+    std::sort(out->begin(), out->end());
+  }
+
+  bool RegexDfa::compile() {
+    if (this->compiled_ ||
+        (this->start_.empty() && this->anchored_start_.empty())) {
+      this->errmsg_ = "no pattern to compile";
+      return false;
+    }
+
+    // Byte equivalence classes: bytes that belong to the same sets.
+    std::map<std::vector<bool>, uint8_t> sig_map;
+    for (size_t b = 0; b < 256; b++) {
+      std::vector<bool> sig(this->char_set_.size());
+      for (size_t i = 0; i < this->char_set_.size(); i++) {
+        sig[i] = this->char_set_[i][b];
+      }
+      std::map<std::vector<bool>, uint8_t>::iterator it = sig_map.find(sig);
+      if (it == sig_map.end()) {
+        it = sig_map.insert(std::make_pair(sig, sig_map.size())).first;
+      }
+      this->class_[b] = it->second;
+    }
+    this->class_size_ = sig_map.size();
+    const size_t cs = this->class_size_;
+
+    std::vector<uint8_t> rep(cs);
+    for (int b = 255; b >= 0; b--) {
+      rep[this->class_[b]] = b;
+    }
+
+    // Every DFA state includes closure of unanchored entries (search
+    // set) implicitly because a match can start at any byte. A DFA state
+    // is identified by the other NFA states only, and search set states
+    // are excluded from closures by negative mark.
+    std::vector<int> mark(this->nfa_.size(), 0);
+    int stamp = 0;
+    std::vector<int> search_set;
+    for (size_t i = 0; i < this->start_.size(); i++) {
+      mark[this->start_[i]] = -1;
+      search_set.push_back(this->start_[i]);
+    }
+    for (size_t i = 0; i < search_set.size(); i++) {
+      const std::vector<int> &eps = this->nfa_[search_set[i]].eps_;
+      for (size_t j = 0; j < eps.size(); j++) {
+        if (mark[eps[j]] >= 0) {
+          mark[eps[j]] = -1;
+          search_set.push_back(eps[j]);
+        }
+      }
+    }
+
+    // Transitions from the search set, shared by all DFA states.
+    std::vector<std::vector<int> > search_next(cs);
+    std::vector<int> targets;
+    for (size_t c = 0; c < cs; c++) {
+      targets.clear();
+      for (size_t i = 0; i < search_set.size(); i++) {
+        const NfaState &ns = this->nfa_[search_set[i]];
+        if (ns.set_ >= 0 && this->char_set_[ns.set_][rep[c]]) {
+          targets.push_back(ns.next_);
+        }
+      }
+      this->closure(targets, &search_next[c], &mark, ++stamp);
+    }
+
+    std::map<std::vector<int>, state_t> state_map;
+    std::vector<std::vector<int> > states;
+    std::vector<int> init;
+    this->closure(this->anchored_start_, &init, &mark, ++stamp);
+    state_map.insert(std::make_pair(init, 0));
+    states.push_back(init);
+    if (!init.empty()) {
+      std::vector<int> empty;
+      state_map.insert(std::make_pair(empty, 1));
+      states.push_back(empty);
+    }
+    this->search_ = state_map[std::vector<int>()];
+
+    this->delta_.clear();
+    std::vector<int> next;
+    for (size_t sid = 0; sid < states.size(); sid++) {
+      if (states.size() > this->state_max_) {
+        std::stringstream ss;
+        ss << "too many DFA states (> " << this->state_max_ << ")";
+        this->errmsg_ = ss.str();
+        this->delta_.clear();
+        return false;
+      }
+
+      for (size_t c = 0; c < cs; c++) {
+        targets.clear();
+        const std::vector<int> &cur = states[sid];
+        for (size_t i = 0; i < cur.size(); i++) {
+          const NfaState &ns = this->nfa_[cur[i]];
+          if (ns.set_ >= 0 && this->char_set_[ns.set_][rep[c]]) {
+            targets.push_back(ns.next_);
+          }
+        }
+        targets.insert(targets.end(), search_next[c].begin(),
+                       search_next[c].end());
+        this->closure(targets, &next, &mark, ++stamp);
+
+        std::map<std::vector<int>, state_t>::iterator it =
+          state_map.find(next);
+        if (it == state_map.end()) {
+          it = state_map.insert(std::make_pair(next, states.size())).first;
+          states.push_back(next);
+        }
+        this->delta_.push_back(it->second);
+      }
+    }
+
+    // Accepted pattern IDs of each state.
+    this->out_idx_.resize(states.size() + 1);
+    this->out_.clear();
+    for (size_t sid = 0; sid < states.size(); sid++) {
+      this->out_idx_[sid] = this->out_.size();
+      const size_t begin = this->out_.size();
+      for (size_t i = 0; i < states[sid].size(); i++) {
+        int a = this->nfa_[states[sid][i]].accept_;
+        if (a >= 0) {
+          this->out_.push_back(a);
+        }
+      }
+      std::sort(this->out_.begin() + begin, this->out_.end());
+      this->out_.erase(std::unique(this->out_.begin() + begin,
+                                   this->out_.end()), this->out_.end());
+    }
+    this->out_idx_[states.size()] = this->out_.size();
+
+    // Prefilter: bytes that leave the search state.
+    for (size_t b = 0; b < 256; b++) {
+      if (this->delta_[this->search_ * cs + this->class_[b]] != this->search_) {
+        this->head_.add(b);
+      }
+    }
+
+    // NFA is not needed any more.
+    std::vector<NfaState>().swap(this->nfa_);
+    std::vector<std::vector<bool> >().swap(this->char_set_);
+    this->compiled_ = true;
+    return true;
+  }
+
+  RegexDfa::state_t RegexDfa::scan(const void *data, size_t len,
+                                   Callback *cb, state_t state) const {
+    if (!this->compiled_) {
+      return state;
+    }
+
+    const uint8_t *base = static_cast<const uint8_t*>(data);
+    const uint8_t *p = base, *ep = base + len;
+    const size_t cs = this->class_size_;
+    const state_t *delta = &this->delta_[0];
+
+    while (p < ep) {
+      if (state == this->search_) {
+        p = this->head_.skip(p, ep);
+        if (p == ep) {
+          break;
+        }
+      }
+
+      state = delta[state * cs + this->class_[*p]];
+      p++;
+
+      const uint32_t ob = this->out_idx_[state], oe = this->out_idx_[state + 1];
+      for (uint32_t i = ob; i < oe; i++) {
+        if (cb && !cb->match(this->out_[i], p - base)) {
+          return state;
+        }
+      }
+    }
+
+    return state;
+  }
+}  // namespace swarm
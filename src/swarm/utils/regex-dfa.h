@@ -0,0 +1,112 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_UTILS_REGEX_DFA_H__
+#define SRC_UTILS_REGEX_DFA_H__
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include "./byte-filter.h"
+
+namespace swarm {
+  // ----------------------------------------------------------------
+  // class RegexDfa:
+  // Compiles a set of regular expressions into one DFA for unanchored
+  // multi-pattern search over a byte stream. Patterns are parsed into
+  // Thompson NFAs and converted by subset construction over byte
+  // equivalence classes when compile() is called. The DFA state is a
+  // single integer, so a caller can keep it per stream and resume
+  // scanning with the next buffer.
+  //
+  // Supported syntax: literal bytes, '.', [...] and [^...] classes,
+  // escapes (\xNN \n \r \t \0 \d \D \w \W \s \S and escaped
+  // metacharacters), groups (...), alternation '|', quantifiers '*',
+  // '+', '?', {m}, {m,} and {m,n}, and leading '^' that anchors the
+  // pattern to the beginning of the stream.
+  //
+  class RegexDfa {
+  public:
+    typedef uint32_t state_t;
+    static const state_t INIT = 0;  // state at beginning of stream
+    static const int NOCASE = 0x01;
+    static const size_t DEFAULT_STATE_MAX = 65536;
+
+    class Callback {
+    public:
+      virtual ~Callback() {}
+      // end is offset of the next byte of the match in the scanned
+      // buffer. Return false to stop scanning.
+      virtual bool match(int id, size_t end) = 0;
+    };
+
+  private:
+    class Parser;
+    struct NfaState {
+      std::vector<int> eps_;
+      int set_;      // index of char_set_, -1 if no char edge
+      int next_;     // target of char edge
+      int accept_;   // pattern ID, -1 if not accepting
+    };
+    std::vector<NfaState> nfa_;
+    std::vector<std::vector<bool> > char_set_;
+    std::vector<int> start_;           // unanchored pattern entries
+    std::vector<int> anchored_start_;  // '^' pattern entries
+
+    size_t state_max_;
+    uint8_t class_[256];
+    size_t class_size_;
+    std::vector<state_t> delta_;
+    std::vector<uint32_t> out_idx_;
+    std::vector<int> out_;
+    state_t search_;     // state that waits a pattern head
+    ByteFilter head_;    // bytes that leave search_ state
+    bool compiled_;
+    std::string errmsg_;
+
+    int new_state();
+    int new_set(const std::vector<bool> &set);
+    void closure(const std::vector<int> &seeds, std::vector<int> *out,
+                 std::vector<int> *mark, int stamp) const;
+
+  public:
+    explicit RegexDfa(size_t state_max = DEFAULT_STATE_MAX);
+    ~RegexDfa();
+    // Add pattern before compile(). id must be >= 0.
+    bool add(const std::string &regex, int id, int flags = 0);
+    bool add_literal(const void *data, size_t len, int id, int flags = 0);
+    bool compile();
+    bool compiled() const { return this->compiled_; }
+    size_t state_size() const;
+    // State to resume unanchored search, e.g. after a gap in the stream.
+    state_t search_state() const { return this->search_; }
+    const std::string &errmsg() const { return this->errmsg_; }
+    state_t scan(const void *data, size_t len, Callback *cb,
+                 state_t state = INIT) const;
+  };
+}  // namespace swarm
+
+#endif  // SRC_UTILS_REGEX_DFA_H__
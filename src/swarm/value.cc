@@ -30,6 +30,7 @@
 #include <assert.h>
 
 #include "./swarm/value.h"
+#include "./utils/hex.h"
 #include "./debug.h"
 
 namespace swarm {
@@ -119,19 +120,11 @@ namespace swarm {
   }
   std::string Value::hex() const {
     byte_t * p = this->ptr_;
-    std::stringstream ss;
 
     if (p) {
-      char t[4];
-      for (size_t i = 0; i < this->len_; i++) {
-        snprintf (t, sizeof (t), "%02X", p[i]);
-        ss << t;
-        if (i < this->len_ - 1) {
-          ss << " ";
-        }
-      }
-
-      return ss.str();
+      std::string s(this->len_ * 3, '\0');
+      s.resize(hex_encode(p, this->len_, ' ', &s[0]));
+      return s;
     } else {
       return Value::null_;
     }
@@ -166,16 +159,8 @@ namespace swarm {
     byte_t * p = this->ptr_;
 
     if (p && this->len_ == 6) {
-      std::stringstream ss;
-      for (size_t i = 0; i < this->len_; i++) {
-        char t[4];
-        snprintf (t, sizeof (t), "%02X", p[i]);
-        ss << t;
-        if (i < this->len_ - 1) {
-          ss << ":";
-        }
-      }
-      return ss.str();
+      char t[18];
+      return std::string(t, hex_encode(p, this->len_, ':', t));
     } else {
       return Value::null_;
     }
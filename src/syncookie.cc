@@ -0,0 +1,109 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <fstream>
+#include "./debug.h"
+#include "./syncookie.h"
+#include "./pkt.h"
+
+namespace lurker {
+  SynCookie::SynCookie(swarm::Swarm *sw, const TargetSet *target) :
+    target_(target), establish_(true) {
+    this->tcp_flags_ = sw->lookup_value_id("tcp.flags");
+    this->tcp_seq_   = sw->lookup_value_id("tcp.seq");
+    this->tcp_ack_   = sw->lookup_value_id("tcp.ack");
+
+    std::ifstream ifs("/dev/urandom", std::ios::binary);
+    if (!ifs.read(reinterpret_cast<char *>(this->key_), sizeof(this->key_))) {
+      // Weak fallback, but cookies still differ among processes.
+      uint64_t seed[2] = {static_cast<uint64_t>(time(nullptr)),
+                          static_cast<uint64_t>(getpid())};
+      ::memcpy(this->key_, seed, sizeof(this->key_));
+    }
+  }
+  SynCookie::~SynCookie() {
+  }
+
+  uint32_t SynCookie::hash(const swarm::Property &p, uint32_t isn,
+                           uint32_t counter) const {
+    // Both SYN and ACK are sent by client, so src is always the client.
+    uint8_t buf[2 * 16 + 2 * sizeof(uint16_t) + 2 * sizeof(uint32_t)];
+    size_t src_len, dst_len, pos = 0;
+    void *src = p.src_addr(&src_len);
+    void *dst = p.dst_addr(&dst_len);
+    if (src == nullptr || dst == nullptr || src_len > 16 || dst_len > 16) {
+      return 0;
+    }
+
+    uint16_t ports[2] = {static_cast<uint16_t>(p.src_port()),
+                         static_cast<uint16_t>(p.dst_port())};
+    ::memcpy(buf + pos, src, src_len);         pos += src_len;
+    ::memcpy(buf + pos, dst, dst_len);         pos += dst_len;
+    ::memcpy(buf + pos, ports, sizeof(ports)); pos += sizeof(ports);
+    ::memcpy(buf + pos, &isn, sizeof(isn));    pos += sizeof(isn);
+    ::memcpy(buf + pos, &counter, sizeof(counter)); pos += sizeof(counter);
+
+    return static_cast<uint32_t>(swarm::siphash24(this->key_, buf, pos));
+  }
+
+  uint32_t SynCookie::make(const swarm::Property &p) const {
+    uint32_t counter = static_cast<uint32_t>(p.tv_sec() / PERIOD);
+    return this->hash(p, p.value(this->tcp_seq_).uint32(), counter);
+  }
+
+  bool SynCookie::check(const swarm::Property &p) const {
+    uint32_t counter = static_cast<uint32_t>(p.tv_sec() / PERIOD);
+    uint32_t isn = p.value(this->tcp_seq_).uint32() - 1;
+    uint32_t cookie = p.value(this->tcp_ack_).uint32() - 1;
+    return (cookie == this->hash(p, isn, counter) ||
+            cookie == this->hash(p, isn, counter - 1));
+  }
+
+  swarm::SessionFilter::Verdict SynCookie::admit(const swarm::Property &p) {
+    static const bool DBG = false;
+    uint32_t flags = p.value(this->tcp_flags_).uint32();
+
+    if (this->target_->has_dst(p)) {
+      // SYN is answered by TcpHandler statelessly and the session starts
+      // from the ACK carrying our cookie.
+      if (this->establish_ &&
+          (flags & (TCP_SYN | TCP_RST | TCP_FIN | TCP_ACK)) == TCP_ACK &&
+          this->check(p)) {
+        return ESTABLISH;
+      }
+      debug(DBG, "no session for %s:%d -> %s:%d", p.src_addr().c_str(),
+            p.src_port(), p.dst_addr().c_str(), p.dst_port());
+      return REJECT;
+    } else if (this->target_->has_src(p)) {
+      // Replies from a target (i.e. our own SYN-ACK) never open a session.
+      return REJECT;
+    }
+
+    return ADMIT;
+  }
+}
@@ -0,0 +1,73 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_SYNCOOKIE_H__
+#define SRC_SYNCOOKIE_H__
+
+#include "./swarm/swarm.h"
+#include "./swarm/utils/digest.h"
+#include "./target.h"
+
+namespace lurker {
+  // ----------------------------------------------------------------
+  // class SynCookie:
+  // Makes SYN-ACK sequence numbers from a keyed hash (SipHash-2-4) of
+  // the connection 4-tuple, the client's ISN and a coarse counter of
+  // packet time, and works as session filter of tcp_ssn decoder. A
+  // handshake ACK to a target is admitted only if it acknowledges a
+  // cookie we could have sent, so no session is allocated for SYN or
+  // spoofed ACK floods. Flows that do not involve targets are admitted
+  // as usual.
+  //
+  class SynCookie : public swarm::SessionFilter {
+  public:
+    // A cookie is accepted while the counter is current or previous one,
+    // i.e. for PERIOD to 2 * PERIOD seconds.
+    static const time_t PERIOD = 64;
+
+  private:
+    uint8_t key_[swarm::SIPHASH_KEY_LEN];
+    const TargetSet *target_;
+    bool establish_;
+    swarm::val_id tcp_flags_, tcp_seq_, tcp_ack_;
+    uint32_t hash(const swarm::Property &p, uint32_t isn,
+                  uint32_t counter) const;
+
+  public:
+    SynCookie(swarm::Swarm *sw, const TargetSet *target);
+    ~SynCookie();
+    // Sequence number of the SYN-ACK replying to SYN packet p.
+    uint32_t make(const swarm::Property &p) const;
+    // True if ack packet p acknowledges a cookie made by make().
+    bool check(const swarm::Property &p) const;
+    Verdict admit(const swarm::Property &p);
+    // If disabled, no session is created for targets even with a valid
+    // cookie (e.g. tarpit keeps its own compact records instead).
+    void set_establish(bool establish) { this->establish_ = establish; }
+  };
+}
+
+#endif  // SRC_SYNCOOKIE_H__
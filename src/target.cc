@@ -16,29 +16,279 @@
  * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
  * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
  * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
- * CONSEQUENTIAL DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
  * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
  * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
- * CONTRACT, STRICT LIABILITY, OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE)
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
  * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
 #include "./target.h"
+#include <arpa/inet.h>
 #include <sstream>
+#include <map>
+#include <algorithm>
+#include <utility>
+#include <fstream>
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace lurker {
-  TargetSet::TargetSet() : count_(0) {
+  // Image file: header, nodes, port set bitmaps and leaves, in host byte
+  // order. Arrays start at 8 byte aligned offsets.
+  static const char IMAGE_MAGIC[8] = {'L', 'R', 'K', 'T', 'G', 'T', 0, 0};
+  static const uint32_t IMAGE_VERSION = 1;
+  static const uint32_t IMAGE_BYTE_ORDER = 0x01020304;
+
+  struct ImageHeader {
+    char magic_[8];
+    uint32_t version_;
+    uint32_t byte_order_;
+    uint32_t root4_, root6_;
+    uint64_t count_;
+    uint64_t node_n_, leaf_n_, port_bm_n_;
+  };
+
+  static size_t image_size(const ImageHeader &hdr, size_t *node_off,
+                           size_t *port_bm_off, size_t *leaf_off) {
+    *node_off = sizeof(ImageHeader);
+    *port_bm_off = *node_off + hdr.node_n_ * sizeof(TargetSet::Node);
+    *leaf_off = *port_bm_off + hdr.port_bm_n_ * sizeof(uint64_t);
+    return *leaf_off + hdr.leaf_n_ * sizeof(uint32_t);
+  }
+
+  // Build time state of compile(): interns port sets and their unions.
+  struct TargetSet::Builder {
+    struct Item {
+      const Prefix *pfx_;
+      uint32_t set_;
+    };
+
+    const TargetSet *ts_;
+    Table *t_;
+    std::map<std::vector<uint64_t>, uint32_t> set_id_;
+    std::map<std::pair<uint32_t, uint32_t>, uint32_t> union_;
+
+    Builder(const TargetSet *ts, Table *t) : ts_(ts), t_(t) {}
+
+    uint32_t intern(const std::vector<uint64_t> &bm) {
+      auto it = this->set_id_.find(bm);
+      if (it != this->set_id_.end()) {
+        return it->second;
+      }
+      uint32_t id = 2 + this->set_id_.size();
+      this->t_->port_bm_buf_.insert(this->t_->port_bm_buf_.end(), bm.begin(),
+                                     bm.end());
+      this->set_id_.insert(std::make_pair(bm, id));
+      return id;
+    }
+
+    uint32_t port_set(const Prefix &pfx) {
+      if (pfx.any_port_) {
+        return ANY_PORT;
+      }
+      std::vector<uint64_t> bm(PORT_BM_WORDS, 0);
+      for (uint32_t p = pfx.port_lo_; p <= pfx.port_hi_; p++) {
+        bm[p / 64] |= (1ULL << (p % 64));
+      }
+      return this->intern(bm);
+    }
+
+    uint32_t unite(uint32_t a, uint32_t b) {
+      if (a == b || b == NO_PORT) {
+        return a;
+      }
+      if (a == NO_PORT) {
+        return b;
+      }
+      if (a == ANY_PORT || b == ANY_PORT) {
+        return ANY_PORT;
+      }
+      if (a > b) {
+        std::swap(a, b);
+      }
+      auto key = std::make_pair(a, b);
+      auto it = this->union_.find(key);
+      if (it != this->union_.end()) {
+        return it->second;
+      }
+      const uint64_t *bm_a = &this->t_->port_bm_buf_[(a - 2) * PORT_BM_WORDS];
+      const uint64_t *bm_b = &this->t_->port_bm_buf_[(b - 2) * PORT_BM_WORDS];
+      std::vector<uint64_t> bm(PORT_BM_WORDS);
+      for (size_t i = 0; i < PORT_BM_WORDS; i++) {
+        bm[i] = bm_a[i] | bm_b[i];
+      }
+      uint32_t id = this->intern(bm);
+      this->union_.insert(std::make_pair(key, id));
+      return id;
+    }
+
+    // Fills node idx for items all under the same (8 * depth) bits, with
+    // port set base inherited from shorter prefixes.
+    void fill(uint32_t idx, const std::vector<Item> &items, size_t depth,
+              uint32_t base) {
+      uint32_t slot[256];
+      std::vector<Item> sub[256];
+      for (size_t s = 0; s < 256; s++) {
+        slot[s] = base;
+      }
+
+      for (size_t i = 0; i < items.size(); i++) {
+        const Prefix *pfx = items[i].pfx_;
+        if (pfx->len_ <= 8 * (depth + 1)) {
+          size_t bits = pfx->len_ - 8 * depth;
+          size_t span = 1 << (8 - bits);
+          size_t first = pfx->addr_[depth] & ~(span - 1);
+          for (size_t s = first; s < first + span; s++) {
+            slot[s] = this->unite(slot[s], items[i].set_);
+          }
+        } else {
+          sub[pfx->addr_[depth]].push_back(items[i]);
+        }
+      }
+
+      // Children of a node are allocated together before any of them is
+      // filled, so they are contiguous.
+      Node node;
+      memset(&node, 0, sizeof(node));
+      size_t n_child = 0;
+      bool first_leaf = true;
+      uint32_t last = NO_PORT;
+      node.leaf_base_ = this->t_->leaf_buf_.size();
+      for (size_t s = 0; s < 256; s++) {
+        if (!sub[s].empty()) {
+          node.child_bm_[s / 64] |= (1ULL << (s % 64));
+          n_child++;
+        } else if (first_leaf || slot[s] != last) {
+          node.leaf_bm_[s / 64] |= (1ULL << (s % 64));
+          this->t_->leaf_buf_.push_back(slot[s]);
+          first_leaf = false;
+          last = slot[s];
+        }
+      }
+      node.child_base_ = this->t_->node_buf_.size();
+      this->t_->node_buf_.resize(this->t_->node_buf_.size() + n_child);
+      this->t_->node_buf_[idx] = node;
+
+      size_t k = 0;
+      for (size_t s = 0; s < 256; s++) {
+        if (!sub[s].empty()) {
+          this->fill(node.child_base_ + k, sub[s], depth + 1, slot[s]);
+          k++;
+        }
+      }
+    }
+
+    uint32_t build(bool v6) {
+      std::vector<Item> items;
+      for (size_t i = 0; i < this->ts_->prefix_.size(); i++) {
+        const Prefix &pfx = this->ts_->prefix_[i];
+        if (pfx.v6_ == v6) {
+          Item item = {&pfx, this->port_set(pfx)};
+          items.push_back(item);
+        }
+      }
+      if (items.empty()) {
+        return NIL;
+      }
+
+      uint32_t root = this->t_->node_buf_.size();
+      this->t_->node_buf_.resize(root + 1);
+      this->fill(root, items, 0, NO_PORT);
+      return root;
+    }
+  };
+
+
+  TargetSet::Table::Table() :
+    node_(nullptr), leaf_(nullptr), port_bm_(nullptr),
+    node_n_(0), leaf_n_(0), port_bm_n_(0), root4_(NIL), root6_(NIL),
+    map_(nullptr), map_len_(0) {
+  }
+  TargetSet::Table::~Table() {
+    if (this->map_) {
+      munmap(this->map_, this->map_len_);
+    }
+  }
+
+
+  TargetSet::TargetSet() :
+    count_(0), loaded_(false), table_(nullptr), epoch_(0), waiting_(false),
+    interrupted_(false) {
   }
   TargetSet::~TargetSet() {
-    for (auto it = this->target_.begin(); it != this->target_.end(); it++) {
-      delete it->second;
+    delete this->table_.load();
+    for (size_t i = 0; i < this->retired_.size(); i++) {
+      delete this->retired_[i].first;
     }
   }
 
+  bool TargetSet::parse_prefix(const std::string &str, Prefix *pfx) {
+    // "<addr>", "<addr>/<len>", "[<addr>]", "[<addr>]/<len>" or
+    // "[<addr>/<len>]".
+    std::string addr = str, len;
+    if (addr.length() > 2 && addr[0] == '[') {
+      size_t close = addr.find(']');
+      if (close == std::string::npos) {
+        return false;
+      }
+      std::string rest = addr.substr(close + 1);
+      addr = addr.substr(1, close - 1);
+      if (!rest.empty()) {
+        if (rest[0] != '/') {
+          return false;
+        }
+        addr += rest;
+      }
+    }
+    size_t slash = addr.find('/');
+    if (slash != std::string::npos) {
+      len = addr.substr(slash + 1);
+      addr = addr.substr(0, slash);
+    }
+
+    memset(pfx->addr_, 0, sizeof(pfx->addr_));
+    size_t max_len;
+    if (inet_pton(AF_INET, addr.c_str(), pfx->addr_) == 1) {
+      pfx->v6_ = false;
+      max_len = 32;
+    } else if (inet_pton(AF_INET6, addr.c_str(), pfx->addr_) == 1) {
+      pfx->v6_ = true;
+      max_len = 128;
+    } else {
+      return false;
+    }
+
+    pfx->len_ = max_len;
+    if (slash != std::string::npos) {
+      char *e;
+      long n = strtol(len.c_str(), &e, 10);
+      if (len.empty() || *e != '\0' || n < 0 ||
+          n > static_cast<long>(max_len)) {
+        return false;
+      }
+      pfx->len_ = n;
+    }
+
+    // Clear host bits, the trie places a prefix by its leading bytes.
+    for (size_t i = pfx->len_; i < max_len; i++) {
+      pfx->addr_[i / 8] &= ~(0x80 >> (i % 8));
+    }
+    return true;
+  }
+
   bool TargetSet::insert(const std::string &target) {
-    size_t p = target.find(":");
+    // Port is after the last ':' because IPv6 address contains ':'.
+    // IPv6 address can be also bracketed as "[2001:db8::1]:80".
+    size_t p = target.rfind(":");
     if (p == std::string::npos) {
       // format is not "<address>:<port>"
       std::stringstream ss;
@@ -51,57 +301,389 @@ namespace lurker {
     std::string addr = target.substr(0, p);
     std::string port = target.substr(p + 1);
 
-    // Convert port number to integer.
-    char *e;
-    bool any_port = true;;
-    int port_num = 0;
-
-    if (port != "*") {
-      port_num = strtol(port.c_str(), &e, 0);
-      any_port = false;
+    Prefix pfx;
+    if (!TargetSet::parse_prefix(addr, &pfx)) {
+      std::stringstream ss;
+      ss << "Invalid address or prefix: " << addr;
+      this->errmsg_ = ss.str();
+      return false;
+    }
 
-      if (*e != '\0') {
+    // Convert port number or range to integers.
+    pfx.any_port_ = (port == "*");
+    pfx.port_lo_ = pfx.port_hi_ = 0;
+    if (!pfx.any_port_) {
+      char *e;
+      long lo = strtol(port.c_str(), &e, 10), hi = lo;
+      if (*e == '-' && e != port.c_str()) {
+        hi = strtol(e + 1, &e, 10);
+      }
+      if (port.empty() || *e != '\0' || lo < 0 || hi > 65535 || lo > hi) {
         // port includes not digit chractor
         std::stringstream ss;
-        ss << "Port number is not digit: " << port;
+        ss << "Port number or range is invalid: " << port;
         this->errmsg_ = ss.str();
         return false;
       }
+      pfx.port_lo_ = lo;
+      pfx.port_hi_ = hi;
     }
 
-    // Insert target address and port number.
-    auto it = this->target_.find(addr);
-    if (it != this->target_.end() && it->second != nullptr) {
-      // Skip if set<int> is nullptr. It means allowing any port.
-      (it->second)->insert(port_num);
-    } else {
-      std::set<int> *port_set = nullptr;
-      if (!any_port) {
-        port_set = new std::set<int>();
-        port_set->insert(port_num);
+    this->prefix_.push_back(pfx);
+    this->count_++;
+    return true;
+  }
+
+  bool TargetSet::import(const std::string &fpath) {
+    if (TargetSet::is_image(fpath)) {
+      return this->load(fpath);
+    }
+
+    std::ifstream ifs(fpath);
+    std::string buf;
+    if (ifs.fail()) {
+      this->errmsg_ = "can not open target file: " + fpath;
+      return false;
+    }
+    while (getline(ifs, buf)) {
+      if (buf.length() > 0 && !this->insert(buf)) {
+        return false;
       }
+    }
+    return true;
+  }
 
-      this->target_.insert(std::make_pair(addr, port_set));
+  bool TargetSet::compile() {
+    if (this->loaded_) {
+      if (!this->prefix_.empty()) {
+        this->errmsg_ = "compiled target image can not be combined with "
+          "other targets";
+        return false;
+      }
+      return true;  // image is already compiled
     }
 
-    this->count_++;
+    Table *t = new Table();
+    Builder builder(this, t);
+    t->root4_ = builder.build(false);
+    t->root6_ = builder.build(true);
+    t->node_ = t->node_buf_.data();
+    t->node_n_ = t->node_buf_.size();
+    t->leaf_ = t->leaf_buf_.data();
+    t->leaf_n_ = t->leaf_buf_.size();
+    t->port_bm_ = t->port_bm_buf_.data();
+    t->port_bm_n_ = t->port_bm_buf_.size();
+    this->publish(t);
     return true;
   }
 
-  bool TargetSet::has(const std::string &addr) const {
-    auto it = this->target_.find(addr);
-    return (it != this->target_.end());
+  bool TargetSet::is_image(const std::string &fpath) {
+    char magic[sizeof(IMAGE_MAGIC)];
+    FILE *fp = fopen(fpath.c_str(), "rb");
+    if (fp == nullptr) {
+      return false;
+    }
+    bool rc = (fread(magic, sizeof(magic), 1, fp) == 1 &&
+               memcmp(magic, IMAGE_MAGIC, sizeof(magic)) == 0);
+    fclose(fp);
+    return rc;
+  }
+
+  bool TargetSet::save(const std::string &fpath) {
+    const Table *t = this->table_.load();
+    if (t == nullptr) {
+      this->errmsg_ = "targets are not compiled";
+      return false;
+    }
+
+    ImageHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic_, IMAGE_MAGIC, sizeof(hdr.magic_));
+    hdr.version_ = IMAGE_VERSION;
+    hdr.byte_order_ = IMAGE_BYTE_ORDER;
+    hdr.root4_ = t->root4_;
+    hdr.root6_ = t->root6_;
+    hdr.count_ = this->count_;
+    hdr.node_n_ = t->node_n_;
+    hdr.leaf_n_ = t->leaf_n_;
+    hdr.port_bm_n_ = t->port_bm_n_;
+
+    // Written aside and renamed, so that processes mapping the old image
+    // keep reading it.
+    const std::string tmp = fpath + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (fp == nullptr) {
+      this->errmsg_ = "can not open image file: " + tmp + ": " +
+        strerror(errno);
+      return false;
+    }
+    bool rc =
+      (fwrite(&hdr, sizeof(hdr), 1, fp) == 1 &&
+       fwrite(t->node_, sizeof(Node), t->node_n_, fp) == t->node_n_ &&
+       fwrite(t->port_bm_, sizeof(uint64_t), t->port_bm_n_, fp) ==
+       t->port_bm_n_ &&
+       fwrite(t->leaf_, sizeof(uint32_t), t->leaf_n_, fp) == t->leaf_n_);
+    rc = (fclose(fp) == 0 && rc);
+    if (!rc || rename(tmp.c_str(), fpath.c_str()) != 0) {
+      this->errmsg_ = "can not write image file: " + fpath + ": " +
+        strerror(errno);
+      unlink(tmp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool TargetSet::load(const std::string &fpath) {
+    if (this->loaded_ || !this->prefix_.empty()) {
+      this->errmsg_ = "compiled target image can not be combined with "
+        "other targets: " + fpath;
+      return false;
+    }
+
+    int fd = open(fpath.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      this->errmsg_ = "can not open image file: " + fpath + ": " +
+        strerror(errno);
+      if (fd >= 0) {
+        close(fd);
+      }
+      return false;
+    }
+    size_t len = st.st_size;
+    void *map = (len >= sizeof(ImageHeader) ?
+                 mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0) :
+                 MAP_FAILED);
+    close(fd);
+    if (map == MAP_FAILED) {
+      this->errmsg_ = "can not map image file: " + fpath;
+      return false;
+    }
+
+    Table *t = new Table();
+    t->map_ = map;
+    t->map_len_ = len;
+
+    const ImageHeader *hdr = static_cast<const ImageHeader*>(map);
+    const uint8_t *base = static_cast<const uint8_t*>(map);
+    size_t node_off, port_bm_off, leaf_off;
+    if (memcmp(hdr->magic_, IMAGE_MAGIC, sizeof(hdr->magic_)) != 0 ||
+        hdr->version_ != IMAGE_VERSION ||
+        hdr->byte_order_ != IMAGE_BYTE_ORDER ||
+        hdr->node_n_ >= NIL || hdr->leaf_n_ >= NIL ||
+        // Bounded by the file size first, so image_size() can not wrap.
+        hdr->node_n_ > len / sizeof(Node) ||
+        hdr->leaf_n_ > len / sizeof(uint32_t) ||
+        hdr->port_bm_n_ > len / sizeof(uint64_t) ||
+        hdr->port_bm_n_ % PORT_BM_WORDS != 0 ||
+        image_size(*hdr, &node_off, &port_bm_off, &leaf_off) != len) {
+      this->errmsg_ = "invalid or incompatible image file: " + fpath;
+      delete t;
+      return false;
+    }
+    t->node_ = reinterpret_cast<const Node*>(base + node_off);
+    t->node_n_ = hdr->node_n_;
+    t->port_bm_ = reinterpret_cast<const uint64_t*>(base + port_bm_off);
+    t->port_bm_n_ = hdr->port_bm_n_;
+    t->leaf_ = reinterpret_cast<const uint32_t*>(base + leaf_off);
+    t->leaf_n_ = hdr->leaf_n_;
+    t->root4_ = hdr->root4_;
+    t->root6_ = hdr->root6_;
+    if (!TargetSet::valid(t)) {
+      this->errmsg_ = "broken image file: " + fpath;
+      delete t;
+      return false;
+    }
+
+    this->count_ = hdr->count_;
+    this->loaded_ = true;
+    this->publish(t);
+    return true;
+  }
+
+  bool TargetSet::valid(const Table *t) {
+    // Lookup trusts indexes in the table, so check them all once.
+    if ((t->root4_ != NIL && t->root4_ >= t->node_n_) ||
+        (t->root6_ != NIL && t->root6_ >= t->node_n_)) {
+      return false;
+    }
+    size_t n_set = 2 + t->port_bm_n_ / PORT_BM_WORDS;
+    for (size_t i = 0; i < t->node_n_; i++) {
+      const Node &node = t->node_[i];
+      size_t n_child = 0, n_leaf = 0;
+      for (size_t w = 0; w < 4; w++) {
+        if (node.child_bm_[w] & node.leaf_bm_[w]) {
+          return false;
+        }
+        n_child += __builtin_popcountll(node.child_bm_[w]);
+        n_leaf += __builtin_popcountll(node.leaf_bm_[w]);
+      }
+      // The first slot without child must start a leaf run.
+      for (size_t w = 0; w < 4; w++) {
+        if (~node.child_bm_[w] != 0) {
+          uint64_t first = ~node.child_bm_[w] & (node.child_bm_[w] + 1);
+          if (!(node.leaf_bm_[w] & first)) {
+            return false;
+          }
+          break;
+        }
+      }
+      if (static_cast<size_t>(node.child_base_) + n_child > t->node_n_ ||
+          static_cast<size_t>(node.leaf_base_) + n_leaf > t->leaf_n_) {
+        return false;
+      }
+    }
+    for (size_t i = 0; i < t->leaf_n_; i++) {
+      if (t->leaf_[i] >= n_set) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void TargetSet::publish(Table *t) {
+    Table *old = this->table_.exchange(t);
+    if (old) {
+      std::lock_guard<std::mutex> lock(this->retired_lock_);
+      this->retired_.push_back(std::make_pair(old, this->epoch_.load()));
+    }
   }
 
-  bool TargetSet::has(const std::string &addr, int port) const {
-    auto it = this->target_.find(addr);
-    if (it != this->target_.end()) {
-      if (it->second == nullptr || ((it->second)->find(port) != (it->second)->end())) {
-        return true;
+  void TargetSet::replace(TargetSet *src) {
+    Table *t = src->table_.exchange(nullptr);
+    assert(t != nullptr);
+    this->prefix_.swap(src->prefix_);
+    this->count_ = src->count_.load();
+    this->loaded_ = src->loaded_;
+    src->prefix_.clear();
+    src->count_ = 0;
+    src->loaded_ = false;
+    this->publish(t);
+  }
+
+  void TargetSet::quiescent() {
+    this->epoch_.fetch_add(1);
+    // The lock is taken only while wait_reclaim() sleeps, not per batch.
+    // waiting_ is set before the waiter reads epoch_, so either it sees
+    // the new epoch or it is notified here.
+    if (this->waiting_.load()) {
+      std::lock_guard<std::mutex> lock(this->retired_lock_);
+      this->reclaim_cv_.notify_all();
+    }
+  }
+
+  bool TargetSet::reclaim() {
+    // A table retired at epoch e may be held by a lookup until the next
+    // quiescent state, i.e. it is free once epoch is beyond e. Tables are
+    // deleted out of the lock, which quiescent() may take.
+    std::vector<Table*> dead;
+    size_t n = 0;
+    {
+      std::lock_guard<std::mutex> lock(this->retired_lock_);
+      uint64_t now = this->epoch_.load();
+      for (size_t i = 0; i < this->retired_.size(); i++) {
+        if (this->retired_[i].second < now) {
+          dead.push_back(this->retired_[i].first);
+        } else {
+          this->retired_[n++] = this->retired_[i];
+        }
       }
+      this->retired_.resize(n);
+    }
+    for (size_t i = 0; i < dead.size(); i++) {
+      delete dead[i];
     }
+    return (n == 0);
+  }
+
+  bool TargetSet::wait_reclaim() {
+    while (!this->reclaim()) {
+      std::unique_lock<std::mutex> lock(this->retired_lock_);
+      uint64_t need = 0;
+      for (size_t i = 0; i < this->retired_.size(); i++) {
+        need = std::max(need, this->retired_[i].second + 1);
+      }
+      this->waiting_ = true;
+      while (this->epoch_.load() < need && !this->interrupted_) {
+        this->reclaim_cv_.wait(lock);
+      }
+      this->waiting_ = false;
+      if (this->interrupted_) {
+        return false;
+      }
+    }
+    return true;
+  }
 
-    return false;
+  void TargetSet::interrupt() {
+    std::lock_guard<std::mutex> lock(this->retired_lock_);
+    this->interrupted_ = true;
+    this->reclaim_cv_.notify_all();
+  }
+
+  uint32_t TargetSet::lookup(const Table *t, const uint8_t *addr,
+                             size_t len) {
+    if (t == nullptr || addr == nullptr) {
+      return NO_PORT;
+    }
+    uint32_t idx = (len == 4) ? t->root4_ : (len == 16) ? t->root6_ : NIL;
+    for (size_t d = 0; idx != NIL && d < len; d++) {
+      const Node &node = t->node_[idx];
+      size_t w = addr[d] / 64, b = addr[d] % 64;
+      uint64_t below = (1ULL << b) - 1;
+
+      size_t n = 0;
+      for (size_t i = 0; i < w; i++) {
+        n += __builtin_popcountll(node.child_bm_[i]);
+      }
+      if (node.child_bm_[w] & (1ULL << b)) {
+        idx = node.child_base_ + n +
+          __builtin_popcountll(node.child_bm_[w] & below);
+        continue;
+      }
+
+      // Slot is in the run started by the last leaf bit at or before it.
+      n = 0;
+      for (size_t i = 0; i < w; i++) {
+        n += __builtin_popcountll(node.leaf_bm_[i]);
+      }
+      n += __builtin_popcountll(node.leaf_bm_[w] & (below | (1ULL << b)));
+      assert(n > 0);
+      return t->leaf_[node.leaf_base_ + n - 1];
+    }
+    return NO_PORT;
+  }
+
+  bool TargetSet::has(const void *addr, size_t len) const {
+    const Table *t = this->table_.load(std::memory_order_acquire);
+    return (TargetSet::lookup(t, static_cast<const uint8_t*>(addr), len) !=
+            NO_PORT);
+  }
+
+  bool TargetSet::has(const void *addr, size_t len, int port) const {
+    const Table *t = this->table_.load(std::memory_order_acquire);
+    uint32_t set = TargetSet::lookup(t, static_cast<const uint8_t*>(addr),
+                                     len);
+    if (set == NO_PORT || port < 0 || port > 65535) {
+      return false;
+    }
+    if (set == ANY_PORT) {
+      return true;
+    }
+    const uint64_t *bm = &t->port_bm_[(set - 2) * PORT_BM_WORDS];
+    return ((bm[port / 64] >> (port % 64)) & 1);
+  }
+
+  bool TargetSet::has_dst(const swarm::Property &p) const {
+    size_t len;
+    const void *addr = p.dst_addr(&len);
+    return (addr != nullptr && this->has(addr, len, p.dst_port()));
+  }
+
+  bool TargetSet::has_src(const swarm::Property &p) const {
+    size_t len;
+    const void *addr = p.src_addr(&len);
+    return (addr != nullptr && this->has(addr, len, p.src_port()));
   }
 
   const std::string &TargetSet::errmsg() const {
@@ -109,4 +691,3 @@ namespace lurker {
   }
 
 }
-
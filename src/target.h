@@ -27,27 +27,149 @@
 #ifndef SRC_TARGET_H__
 #define SRC_TARGET_H__
 
+#include <stdint.h>
 #include <string>
-#include <set>
-#include <map>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "./swarm/swarm.h"
 
 namespace lurker {
+  // ----------------------------------------------------------------
+  // class TargetSet:
+  // Target addresses and ports. An entry is "<prefix>:<ports>" where
+  // prefix is an IPv4 or IPv6 address with optional "/<length>" (IPv6 may
+  // be bracketed, e.g. "[2001:db8::/48]:80") and ports is a number, a
+  // range "<low>-<high>" or "*". A packet matches if any entry covering
+  // its address has its port.
+  //
+  // Entries are compiled into one poptrie-like multibit trie of binary
+  // addresses with stride 8. A node has 256-bit child and leaf bitmaps,
+  // and its children and leaves are stored contiguously, indexed by
+  // popcount. Leaves are pushed down so that each refers to the union of
+  // the port sets covering it, stored once as a 65536-bit bitmap. Lookup
+  // is at most 4 (IPv4) or 16 (IPv6) node visits and one bit test.
+  //
+  // A compiled table can be saved as an image file and loaded with mmap,
+  // so large target lists are compiled once by lurker-targetc and
+  // their pages are shared by processes using them.
+  //
+  // Compiled tables are published with an atomic pointer, so targets can
+  // be replaced while packets are looked up by another thread without
+  // locking. The capture thread reports quiescent state after each batch
+  // of packets and periodically (see TargetSync), and a replaced table is
+  // freed by reclaim() only after that happened once. wait_reclaim()
+  // sleeps until then.
+  //
   class TargetSet {
-  private:    
-    // Target map by IP address (std::string) & port number (int)
-    std::map<std::string, std::set<int>* > target_;
+  public:
+    static const uint32_t NIL = 0xffffffff;
+    static const uint32_t NO_PORT = 0;   // leaf value: not a target
+    static const uint32_t ANY_PORT = 1;  // leaf value: any port
+    static const size_t PORT_BM_WORDS = 65536 / 64;
+
+    struct Node {
+      uint64_t child_bm_[4];
+      uint64_t leaf_bm_[4];   // first slot of each run of same leaf
+      uint32_t child_base_;
+      uint32_t leaf_base_;
+    };
+
+  private:
+    struct Prefix {
+      uint8_t addr_[16];
+      uint8_t len_;           // prefix length in bits
+      bool v6_;
+      uint16_t port_lo_, port_hi_;
+      bool any_port_;
+    };
+    struct Builder;
+
+    std::vector<Prefix> prefix_;
     std::string errmsg_;
-    size_t count_;
-    
+    std::atomic<size_t> count_;        // read by count() on any thread
+
+    // Compiled trie. Arrays point to the buffers filled by compile() or
+    // into an image mapped by load().
+    struct Table {
+      const Node *node_;
+      const uint32_t *leaf_;           // port set id per leaf run
+      const uint64_t *port_bm_;        // PORT_BM_WORDS per port set
+      size_t node_n_, leaf_n_, port_bm_n_;
+      uint32_t root4_, root6_;
+      std::vector<Node> node_buf_;
+      std::vector<uint32_t> leaf_buf_;
+      std::vector<uint64_t> port_bm_buf_;
+      void *map_;
+      size_t map_len_;
+      Table();
+      ~Table();
+    };
+    bool loaded_;                      // table is from load()
+    std::atomic<Table*> table_;
+    std::atomic<uint64_t> epoch_;      // count of quiescent states
+    std::vector<std::pair<Table*, uint64_t> > retired_;
+    std::mutex retired_lock_;          // not taken by lookups
+    std::condition_variable reclaim_cv_;  // signaled by quiescent()
+    std::atomic<bool> waiting_;        // wait_reclaim() is sleeping
+    bool interrupted_;
+
+    static bool parse_prefix(const std::string &str, Prefix *pfx);
+    static bool valid(const Table *t);
+    static uint32_t lookup(const Table *t, const uint8_t *addr, size_t len);
+    void publish(Table *t);
+
   public:
     TargetSet();
     ~TargetSet();
     bool insert(const std::string &target);
-    bool has(const std::string &addr) const;
-    bool has(const std::string &addr, int port) const;
+    // Reads a target list (one entry per line) or a compiled image.
+    bool import(const std::string &fpath);
+    // Compiled image of the table: written by lurker-targetc, mapped
+    // read-only by load() and usable without compile(). An image can
+    // not be combined with other entries.
+    bool save(const std::string &fpath);
+    bool load(const std::string &fpath);
+    static bool is_image(const std::string &fpath);
+    // Builds the trie from inserted entries. Lookups see only entries
+    // inserted before the last compile().
+    bool compile();
+    // Takes entries and compiled table of src (which must be compiled and
+    // is left empty) in place of the current ones. Lookups and count() may
+    // run concurrently on other threads; insert(), import(), compile() and
+    // load() may not.
+    void replace(TargetSet *src);
+    // Called by the thread doing lookups when it holds no table.
+    void quiescent();
+    // Frees replaced tables no longer in use. Returns true if none is
+    // left.
+    bool reclaim();
+    // Blocks until all replaced tables are freed, or interrupt() is
+    // called. Returns true if none is left.
+    bool wait_reclaim();
+    void interrupt();
+    // Address is binary in network byte order, 4 or 16 bytes.
+    bool has(const void *addr, size_t len) const;
+    bool has(const void *addr, size_t len, int port) const;
+    // Destination or source address and port of a decoded packet.
+    bool has_dst(const swarm::Property &p) const;
+    bool has_src(const swarm::Property &p) const;
     size_t count() const { return this->count_; }
     const std::string &errmsg() const;
   };
+
+  // Reports quiescent state of the capture thread to a TargetSet at the
+  // end of each batch of packets. Also set as a periodic task, so that
+  // replaced tables are freed on an idle link too.
+  class TargetSync : public swarm::Task {
+  private:
+    TargetSet *target_;
+  public:
+
+    explicit TargetSync(TargetSet *target) : target_(target) {}
+    void exec(const struct timespec &tv) { this->target_->quiescent(); }
+  };
 }
 
 
@@ -0,0 +1,372 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include "./debug.h"
+#include "./tarpit.h"
+#include "./pkt.h"
+
+namespace lurker {
+  // Interval of the periodic task turning the timer wheel (sec).
+  static const float TICK_INTERVAL = 0.25;
+
+  Tarpit::Tarpit(swarm::Swarm *sw, const TargetSet *target) :
+    sw_(sw), sock_(nullptr), target_(target), cookie_(nullptr), free_(NIL),
+    max_flows_(0), count_(0), tick_(0), pace_(DEFAULT_PACE), sweep_(0),
+    ip_id_(0) {
+    this->pkt_ev_ = this->sw_->lookup_event_id("tcp.packet");
+    this->pkt_hdlr_id_ = this->sw_->set_handler(this->pkt_ev_, this);
+    assert(this->pkt_ev_ != swarm::EV_NULL);
+    assert(this->pkt_hdlr_id_ != swarm::HDLR_NULL);
+    this->tick_task_ = new TarpitTick(this);
+    this->tick_task_id_ = this->sw_->set_periodic_task(this->tick_task_,
+                                                       TICK_INTERVAL);
+    assert(this->tick_task_id_ != swarm::TASK_NULL);
+
+    this->ether_src_ = this->sw_->lookup_value_id("ether.src");
+    this->ether_dst_ = this->sw_->lookup_value_id("ether.dst");
+    this->ipv4_src_  = this->sw_->lookup_value_id("ipv4.src");
+    this->ipv4_dst_  = this->sw_->lookup_value_id("ipv4.dst");
+    this->ipv4_pl_   = this->sw_->lookup_value_id("ipv4.payload");
+    this->tcp_flags_ = this->sw_->lookup_value_id("tcp.flags");
+
+    this->set_max_flows(DEFAULT_MAX_FLOWS);
+
+    // Template of zero window ACK.
+    ::memset(this->ack_, 0, sizeof(this->ack_));
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->ack_);
+    auto *ipv4_hdr = reinterpret_cast<struct ipv4_header*>(eth_hdr + 1);
+    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>(ipv4_hdr + 1);
+    eth_hdr->type_ = htons(ETHERTYPE_IP);
+    ipv4_hdr->hdrlen_ = 5;
+    ipv4_hdr->ver_ = 4;
+    ipv4_hdr->total_len_ = htons(sizeof(struct ipv4_header) +
+                                 sizeof(struct tcp_header));
+    ipv4_hdr->ttl_ = 64;
+    ipv4_hdr->proto_ = IPPROTO_TCP;
+    tcp_hdr->offset_ = sizeof(struct tcp_header) / 4;
+    tcp_hdr->flags_ = TCP_ACK;
+    tcp_hdr->window_ = 0;
+
+    struct pseudo_ipv4_header pseudo;
+    ::memset(&pseudo, 0, sizeof(pseudo));
+    pseudo.proto_ = IPPROTO_TCP;
+    pseudo.th_off_ = htons(sizeof(struct tcp_header));
+    this->ack_ip_sum_ = chksum_add(0, ipv4_hdr, sizeof(struct ipv4_header));
+    this->ack_tcp_sum_ = chksum_add(chksum_add(0, &pseudo, sizeof(pseudo)),
+                                    tcp_hdr, sizeof(struct tcp_header));
+  }
+  Tarpit::~Tarpit() {
+    this->sw_->unset_task(this->tick_task_id_);
+    this->sw_->unset_handler(this->pkt_hdlr_id_);
+    delete this->tick_task_;
+  }
+
+  void Tarpit::set_sock(RawSock *sock) {
+    this->sock_ = sock;
+  }
+  void Tarpit::set_syn_cookie(const SynCookie *cookie) {
+    this->cookie_ = cookie;
+  }
+
+  void Tarpit::set_max_flows(size_t max_flows) {
+    // Existing records are dropped; this is meant for configuration.
+    size_t n = 1;
+    while (n < max_flows) {
+      n <<= 1;
+    }
+    this->max_flows_ = max_flows;
+    this->flow_.clear();
+    this->bucket_.assign(n, static_cast<uint32_t>(NIL));
+    this->free_ = NIL;
+    this->count_ = 0;
+    this->sweep_ = 0;
+    for (size_t i = 0; i < WHEEL_SIZE; i++) {
+      this->wheel_[i] = NIL;
+    }
+  }
+
+  void Tarpit::set_pace(time_t pace) {
+    if (pace < 1) {
+      pace = 1;
+    } else if (pace >= static_cast<time_t>(WHEEL_SIZE)) {
+      pace = WHEEL_SIZE - 1;
+    }
+    this->pace_ = pace;
+  }
+
+  uint32_t Tarpit::flow_hash(uint32_t src, uint32_t dst, uint16_t sport,
+                             uint16_t dport) {
+    uint64_t h = (static_cast<uint64_t>(src) << 32 | dst) *
+      0x9e3779b97f4a7c15ULL;
+    h ^= (static_cast<uint64_t>(sport) << 16 | dport) * 0xc2b2ae3d27d4eb4fULL;
+    return static_cast<uint32_t>(h >> 32);
+  }
+
+  uint32_t Tarpit::lookup(uint32_t src, uint32_t dst, uint16_t sport,
+                          uint16_t dport) const {
+    uint32_t h = Tarpit::flow_hash(src, dst, sport, dport) &
+      (this->bucket_.size() - 1);
+    for (uint32_t i = this->bucket_[h]; i != NIL; i = this->flow_[i].hnext_) {
+      const Flow &f = this->flow_[i];
+      if (f.src_ == src && f.dst_ == dst && f.sport_ == sport &&
+          f.dport_ == dport) {
+        return i;
+      }
+    }
+    return NIL;
+  }
+
+  uint32_t Tarpit::insert(uint32_t src, uint32_t dst, uint16_t sport,
+                          uint16_t dport) {
+    uint32_t idx;
+    if (this->free_ != NIL) {
+      idx = this->free_;
+      this->free_ = this->flow_[idx].hnext_;
+    } else if (this->flow_.size() < this->max_flows_) {
+      idx = this->flow_.size();
+      this->flow_.resize(idx + 1);
+    } else {
+      return NIL;
+    }
+
+    Flow &f = this->flow_[idx];
+    ::memset(&f, 0, sizeof(f));
+    f.src_ = src;
+    f.dst_ = dst;
+    f.sport_ = sport;
+    f.dport_ = dport;
+    f.stat_ = HELD;
+    f.wnext_ = NIL;
+
+    uint32_t h = Tarpit::flow_hash(src, dst, sport, dport) &
+      (this->bucket_.size() - 1);
+    f.hnext_ = this->bucket_[h];
+    this->bucket_[h] = idx;
+    this->count_++;
+    return idx;
+  }
+
+  void Tarpit::release(uint32_t idx) {
+    Flow &f = this->flow_[idx];
+    uint32_t h = Tarpit::flow_hash(f.src_, f.dst_, f.sport_, f.dport_) &
+      (this->bucket_.size() - 1);
+    uint32_t *p = &this->bucket_[h];
+    while (*p != idx) {
+      assert(*p != NIL);
+      p = &this->flow_[*p].hnext_;
+    }
+    *p = f.hnext_;
+
+    f.stat_ = FREE;
+    f.hnext_ = this->free_;
+    this->free_ = idx;
+    this->count_--;
+  }
+
+  void Tarpit::schedule(uint32_t idx, time_t now) {
+    // A flow is queued once however many probes arrive until the tick.
+    Flow &f = this->flow_[idx];
+    if (!f.pending_) {
+      // The wheel may run ahead of packet time by a periodic tick.
+      time_t base = (now < this->tick_ ? this->tick_ : now);
+      size_t slot = (base + this->pace_) % WHEEL_SIZE;
+      f.pending_ = true;
+      f.wnext_ = this->wheel_[slot];
+      this->wheel_[slot] = idx;
+    }
+  }
+
+  void Tarpit::advance(time_t now) {
+    this->tick(now);
+    // Batch tasks run only after captured packets, so replies sent by a
+    // timer are flushed here.
+    if (this->sock_ != nullptr) {
+      this->sock_->flush();
+    }
+  }
+
+  void Tarpit::tick(time_t now) {
+    // Ticks come from both the periodic task and packet time, so a
+    // small step back is ignored; only a large one resets the wheel.
+    if (this->tick_ == 0 ||
+        now + static_cast<time_t>(WHEEL_SIZE) < this->tick_) {
+      this->tick_ = now;
+      return;
+    }
+
+    // Replies of all flows in a slot are sent together. After a long gap
+    // each slot needs to be visited only once.
+    size_t n = 0;
+    while (this->tick_ < now && n < WHEEL_SIZE) {
+      this->tick_++;
+      n++;
+      size_t slot = this->tick_ % WHEEL_SIZE;
+      uint32_t idx = this->wheel_[slot];
+      this->wheel_[slot] = NIL;
+      while (idx != NIL) {
+        Flow &f = this->flow_[idx];
+        uint32_t next = f.wnext_;
+        f.pending_ = false;
+        f.wnext_ = NIL;
+        if (f.stat_ == HELD) {
+          this->reply(f);
+        } else if (f.stat_ == CLOSED) {
+          this->release(idx);
+        }
+        idx = next;
+      }
+
+      for (size_t i = 0; i < SWEEP_PER_TICK && !this->flow_.empty(); i++) {
+        if (this->sweep_ >= this->flow_.size()) {
+          this->sweep_ = 0;
+        }
+        Flow &f = this->flow_[this->sweep_];
+        if (f.stat_ == HELD && !f.pending_ &&
+            f.last_ + IDLE_TIMEOUT < static_cast<uint32_t>(now)) {
+          this->release(this->sweep_);
+        }
+        this->sweep_++;
+      }
+    }
+    if (this->tick_ < now) {
+      this->tick_ = now;
+    }
+  }
+
+  void Tarpit::reply(const Flow &f) {
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->ack_);
+    auto *ipv4_hdr = reinterpret_cast<struct ipv4_header*>(eth_hdr + 1);
+    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>(ipv4_hdr + 1);
+
+    ::memcpy(eth_hdr->src_, f.hw_dst_, ETHER_ADDR_LEN);
+    ::memcpy(eth_hdr->dst_, f.hw_src_, ETHER_ADDR_LEN);
+    ipv4_hdr->src_ = f.dst_;
+    ipv4_hdr->dst_ = f.src_;
+    ipv4_hdr->id_ = htons(this->ip_id_++);
+    tcp_hdr->src_port_ = f.dport_;
+    tcp_hdr->dst_port_ = f.sport_;
+    tcp_hdr->seq_ = htonl(f.seq_);
+    tcp_hdr->ack_ = htonl(f.ack_);
+
+    uint32_t addr_sum = chksum_add(0, &ipv4_hdr->src_, 2 * IPV4_ADDR_LEN);
+    ipv4_hdr->chksum_ = chksum_fold(this->ack_ip_sum_ + addr_sum +
+                                    ipv4_hdr->id_);
+    uint32_t tcp_sum = chksum_add(this->ack_tcp_sum_ + addr_sum,
+                                  &tcp_hdr->src_port_,
+                                  sizeof(tcp_hdr->src_port_) +
+                                  sizeof(tcp_hdr->dst_port_) +
+                                  sizeof(tcp_hdr->seq_) +
+                                  sizeof(tcp_hdr->ack_));
+    tcp_hdr->chksum_ = chksum_fold(tcp_sum);
+
+    if (0 > this->sock_->enqueue(this->ack_, sizeof(this->ack_))) {
+      debug(DBG, "tarpit reply error: %s", this->sock_->errmsg().c_str());
+    }
+  }
+
+  void Tarpit::recv(swarm::ev_id eid, const swarm::Property &p) {
+    if (this->sock_ == nullptr || this->cookie_ == nullptr) {
+      return;
+    }
+    // The periodic task turns the wheel; packet time only catches up.
+    const time_t now = p.tv_sec();
+    this->tick(now);
+
+    size_t seg_len;
+    const uint8_t *seg = p.value(this->ipv4_pl_).ptr(&seg_len);
+    const uint8_t *src = p.value(this->ipv4_src_).ptr();
+    const uint8_t *dst = p.value(this->ipv4_dst_).ptr();
+    if (seg == nullptr || src == nullptr || dst == nullptr ||
+        seg_len < sizeof(struct tcp_header)) {
+      return;
+    }
+    auto *hdr = reinterpret_cast<const struct tcp_header*>(seg);
+    size_t hdr_len = hdr->offset_ * 4;
+    uint8_t flags = hdr->flags_;
+    if (hdr_len > seg_len || (flags & TCP_SYN) ||
+        !(flags & (TCP_ACK | TCP_RST))) {
+      return;
+    }
+
+    uint32_t saddr, daddr;
+    ::memcpy(&saddr, src, sizeof(saddr));
+    ::memcpy(&daddr, dst, sizeof(daddr));
+    uint32_t idx = this->lookup(saddr, daddr, hdr->src_port_, hdr->dst_port_);
+
+    if (idx == NIL) {
+      // New held connection needs the handshake ACK of our SYN cookie.
+      if (!(flags & TCP_ACK) || (flags & TCP_RST) ||
+          !this->cookie_->check(p) ||
+          !this->target_->has_dst(p)) {
+        return;
+      }
+      idx = this->insert(saddr, daddr, hdr->src_port_, hdr->dst_port_);
+      if (idx == NIL) {
+        debug(DBG, "tarpit is full (%zd flows)", this->count_);
+        return;
+      }
+
+      Flow &f = this->flow_[idx];
+      f.seq_ = ntohl(hdr->ack_);
+      f.ack_ = ntohl(hdr->seq_);
+      f.win_ = WINDOW;
+      ::memcpy(f.hw_src_, p.value(this->ether_src_).ptr(), ETHER_ADDR_LEN);
+      ::memcpy(f.hw_dst_, p.value(this->ether_dst_).ptr(), ETHER_ADDR_LEN);
+      debug(DBG, "hold %s:%d", p.src_addr().c_str(), p.src_port());
+    }
+
+    Flow &f = this->flow_[idx];
+    if (f.stat_ != HELD) {
+      return;
+    }
+    if (flags & TCP_RST) {
+      if (f.pending_) {
+        f.stat_ = CLOSED;
+      } else {
+        this->release(idx);
+      }
+      return;
+    }
+
+    f.last_ = static_cast<uint32_t>(now);
+    size_t data_len = seg_len - hdr_len;
+    if (data_len > 0 && ntohl(hdr->seq_) == f.ack_ && f.win_ > 0) {
+      // Data within the window of SYN-ACK is taken, then the window is
+      // closed and only probes are answered.
+      uint8_t take = (data_len < f.win_) ? data_len : f.win_;
+      f.ack_ += take;
+      f.win_ -= take;
+    }
+    // Zero window probes of Linux are pure ACKs with the sequence number
+    // one below what we have acknowledged; they must be answered too, or
+    // the client gives up after tcp_retries2 probes.
+    if (data_len > 0 || (flags & TCP_FIN) ||
+        ntohl(hdr->seq_) == f.ack_ - 1 || f.win_ == 0) {
+      this->schedule(idx, now);
+    }
+  }
+}
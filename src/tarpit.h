@@ -0,0 +1,150 @@
+/*-
+ * Copyright (c) 2013 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SRC_TARPIT_H__
+#define SRC_TARPIT_H__
+
+#include <vector>
+#include "./swarm/swarm.h"
+#include "./rawsock.h"
+#include "./target.h"
+#include "./syncookie.h"
+
+namespace lurker {
+  class TarpitTick;
+
+  // ----------------------------------------------------------------
+  // class Tarpit:
+  // Holds connections to targets open, LaBrea style. SYN-ACK advertises
+  // a tiny window (see TcpHandler::set_synack_window()) and every later
+  // segment is answered with ACK of zero window, so the client's stack
+  // keeps sending window probes for as long as it is willing to wait.
+  //
+  // A held connection costs one fixed size record in a preallocated
+  // table, created when the handshake ACK carries a valid SYN cookie.
+  // Replies to probes are not sent at once but queued in a timer wheel,
+  // and each tick sends all queued replies together. The wheel is turned
+  // by a periodic task of wall clock (TarpitTick), and also by packet
+  // time to catch up. Idle records are reclaimed by an incremental sweep.
+  //
+  class Tarpit : public swarm::Handler {
+  public:
+    static const uint16_t WINDOW = 10;                 // SYN-ACK window
+    static const size_t DEFAULT_MAX_FLOWS = 1 << 18;
+    static const time_t DEFAULT_PACE = 1;              // reply delay (sec)
+    static const time_t IDLE_TIMEOUT = 600;
+
+  private:
+    static const size_t WHEEL_SIZE = 64;
+    static const size_t SWEEP_PER_TICK = 256;
+    static const uint32_t NIL = 0xffffffff;
+    static const bool DBG = false;
+
+    enum FlowStat : uint8_t {
+      FREE = 0,
+      HELD,
+      CLOSED,   // released when taken out of the wheel
+    };
+    struct Flow {             // 48 bytes including padding
+      uint32_t src_, dst_;      // client and target address
+      uint16_t sport_, dport_;
+      uint32_t seq_;            // our sequence number (cookie + 1)
+      uint32_t ack_;            // client's data acknowledged so far
+      uint32_t last_;           // packet time of last segment
+      uint32_t hnext_;          // hash chain or free list
+      uint32_t wnext_;          // timer wheel slot list
+      uint8_t hw_src_[6];       // client side MAC address
+      uint8_t hw_dst_[6];       // our MAC address
+      uint8_t win_;             // remaining window from SYN-ACK
+      FlowStat stat_;
+      bool pending_;            // queued in the wheel
+    };
+
+    swarm::Swarm *sw_;
+    swarm::ev_id pkt_ev_;
+    swarm::hdlr_id pkt_hdlr_id_;
+    TarpitTick *tick_task_;
+    swarm::task_id tick_task_id_;
+    swarm::val_id ether_src_, ether_dst_, ipv4_src_, ipv4_dst_, ipv4_pl_,
+      tcp_flags_;
+
+    RawSock *sock_;
+    const TargetSet *target_;
+    const SynCookie *cookie_;
+
+    std::vector<Flow> flow_;
+    std::vector<uint32_t> bucket_;
+    uint32_t free_;
+    size_t max_flows_;
+    size_t count_;
+    uint32_t wheel_[WHEEL_SIZE];
+    time_t tick_;
+    time_t pace_;
+    size_t sweep_;
+
+    uint8_t ack_[54];
+    uint32_t ack_ip_sum_;
+    uint32_t ack_tcp_sum_;
+    uint16_t ip_id_;
+
+    static uint32_t flow_hash(uint32_t src, uint32_t dst, uint16_t sport,
+                              uint16_t dport);
+    uint32_t lookup(uint32_t src, uint32_t dst, uint16_t sport,
+                    uint16_t dport) const;
+    uint32_t insert(uint32_t src, uint32_t dst, uint16_t sport,
+                    uint16_t dport);
+    void release(uint32_t idx);
+    void schedule(uint32_t idx, time_t now);
+    void tick(time_t now);
+    void reply(const Flow &f);
+
+  public:
+    Tarpit(swarm::Swarm *sw, const TargetSet *target);
+    ~Tarpit();
+    void set_sock(RawSock *sock);
+    void set_syn_cookie(const SynCookie *cookie);
+    // Global cap of held connections, new ones are ignored beyond it.
+    void set_max_flows(size_t max_flows);
+    // Delay of replies to probes in seconds (1 to WHEEL_SIZE - 1).
+    void set_pace(time_t pace);
+    size_t count() const { return this->count_; }
+    void recv(swarm::ev_id eid, const swarm::Property &p);
+    // Sends replies due by now. Called by TarpitTick.
+    void advance(time_t now);
+  };
+
+  // Turns the timer wheel of a Tarpit, so that queued replies are sent
+  // in time even when no packet arrives.
+  class TarpitTick : public swarm::Task {
+  private:
+    Tarpit *tarpit_;
+  public:
+    explicit TarpitTick(Tarpit *tarpit) : tarpit_(tarpit) {}
+    void exec(const struct timespec &tv) { this->tarpit_->advance(tv.tv_sec); }
+  };
+}
+
+#endif  // SRC_TARPIT_H__
@@ -33,44 +33,78 @@
 #include "./pkt.h"
 
 namespace lurker {
-  // IP/TCP checksum calcurator
-  uint16_t header_chksum(uint16_t *ptr, int nbytes) {
-    uint32_t sum = 0;
-    uint16_t oddbyte, answer;
-
-    for (; nbytes > 1; nbytes -= 2) {
-      sum += *ptr++;
-    }
-
-    if (nbytes == 1) {
-      oddbyte = 0;
-      *((uint8_t *)&oddbyte) = *(uint8_t *)ptr;
-      sum += oddbyte;
-    }
-
-    sum = (sum >> 16) + (sum & 0xffff);
-    sum = (sum >> 16) + (sum & 0xffff);
-    answer = ~sum;
-
-    return answer;
-  }
-
   TcpHandler::TcpHandler(swarm::Swarm *sw, TargetSet *target) :
     sw_(sw), sock_(nullptr), target_(target), logger_(nullptr),
-    hexdata_log_(false) {
+    hexdata_log_(false), decoded_log_(false), dns_cache_(nullptr),
+    protoid_(nullptr), ruleset_(nullptr), cookie_(nullptr), ip_id_(0),
+    synack_window_(DEFAULT_SYNACK_WINDOW) {
     this->syn_ev_  = this->sw_->lookup_event_id("tcp.syn"); 
     this->data_ev_ = this->sw_->lookup_event_id("tcp_ssn.data"); 
+    this->http_ev_ = this->sw_->lookup_event_id("http.request");
+    this->tls_ev_  = this->sw_->lookup_event_id("tls.client_hello");
+    this->ssh_ev_  = this->sw_->lookup_event_id("ssh.client");
     this->syn_hdlr_id_  = this->sw_->set_handler(this->syn_ev_, this); 
     this->data_hdlr_id_ = this->sw_->set_handler(this->data_ev_, this); 
+    this->http_hdlr_id_ = this->sw_->set_handler(this->http_ev_, this);
+    this->tls_hdlr_id_  = this->sw_->set_handler(this->tls_ev_, this);
+    this->ssh_hdlr_id_  = this->sw_->set_handler(this->ssh_ev_, this);
 
     assert(this->syn_ev_ != swarm::EV_NULL);
     assert(this->data_ev_ != swarm::EV_NULL);
+    assert(this->http_ev_ != swarm::EV_NULL);
+    assert(this->tls_ev_ != swarm::EV_NULL);
+    assert(this->ssh_ev_ != swarm::EV_NULL);
     assert(this->syn_hdlr_id_ != swarm::HDLR_NULL);
     assert(this->data_hdlr_id_ != swarm::HDLR_NULL);
+    assert(this->http_hdlr_id_ != swarm::HDLR_NULL);
+    assert(this->tls_hdlr_id_ != swarm::HDLR_NULL);
+    assert(this->ssh_hdlr_id_ != swarm::HDLR_NULL);
+
+    this->http_method_  = this->sw_->lookup_value_id("http.method");
+    this->http_uri_     = this->sw_->lookup_value_id("http.uri");
+    this->http_version_ = this->sw_->lookup_value_id("http.version");
+    this->http_host_    = this->sw_->lookup_value_id("http.host");
+    this->http_ua_      = this->sw_->lookup_value_id("http.user_agent");
+    this->http_header_  = this->sw_->lookup_value_id("http.header");
+    this->http_body_    = this->sw_->lookup_value_id("http.body");
+    this->http_seg_     = this->sw_->lookup_value_id("http.segment");
+    this->tls_version_  = this->sw_->lookup_value_id("tls.version");
+    this->tls_sni_      = this->sw_->lookup_value_id("tls.sni");
+    this->tls_alpn_     = this->sw_->lookup_value_id("tls.alpn");
+    this->tls_ciphers_  = this->sw_->lookup_value_id("tls.ciphers");
+    this->tls_exts_     = this->sw_->lookup_value_id("tls.extensions");
+    this->tls_ja3_      = this->sw_->lookup_value_id("tls.ja3");
+    this->tls_ja3_hash_ = this->sw_->lookup_value_id("tls.ja3_hash");
+    this->tls_ja4_      = this->sw_->lookup_value_id("tls.ja4");
+    this->tls_seg_      = this->sw_->lookup_value_id("tls.segment");
+    this->ssh_banner_   = this->sw_->lookup_value_id("ssh.banner");
+    this->ssh_proto_    = this->sw_->lookup_value_id("ssh.proto_version");
+    this->ssh_software_ = this->sw_->lookup_value_id("ssh.software");
+    this->ssh_comments_ = this->sw_->lookup_value_id("ssh.comments");
+    this->ssh_hassh_    = this->sw_->lookup_value_id("ssh.hassh");
+    this->ssh_hassh_algo_ = this->sw_->lookup_value_id("ssh.hassh_algorithms");
+    this->ssh_seg_      = this->sw_->lookup_value_id("ssh.segment");
+    this->ssn_offset_   = this->sw_->lookup_value_id("tcp_ssn.offset");
+    this->ssn_ext_      = this->sw_->lookup_value_id("tcp_ssn.ext");
+    this->ether_src_    = this->sw_->lookup_value_id("ether.src");
+    this->ether_dst_    = this->sw_->lookup_value_id("ether.dst");
+    this->ether_type_   = this->sw_->lookup_value_id("ether.type");
+    this->ipv4_src_     = this->sw_->lookup_value_id("ipv4.src");
+    this->ipv4_dst_     = this->sw_->lookup_value_id("ipv4.dst");
+    this->ipv6_src_     = this->sw_->lookup_value_id("ipv6.src");
+    this->ipv6_dst_     = this->sw_->lookup_value_id("ipv6.dst");
+    this->tcp_src_port_ = this->sw_->lookup_value_id("tcp.src_port");
+    this->tcp_dst_port_ = this->sw_->lookup_value_id("tcp.dst_port");
+    this->tcp_seq_      = this->sw_->lookup_value_id("tcp.seq");
+
+    this->init_synack_template();
   }
   TcpHandler::~TcpHandler() {
     this->sw_->unset_handler(this->syn_hdlr_id_);
     this->sw_->unset_handler(this->data_hdlr_id_);
+    this->sw_->unset_handler(this->http_hdlr_id_);
+    this->sw_->unset_handler(this->tls_hdlr_id_);
+    this->sw_->unset_handler(this->ssh_hdlr_id_);
   }
 
   void TcpHandler::set_sock(RawSock *sock) {
@@ -80,122 +114,285 @@ namespace lurker {
     this->sock_ = nullptr;
   }
 
-  void TcpHandler::set_logger(fluent::Logger *logger) {
+  void TcpHandler::set_logger(EventLog *logger) {
     this->logger_ = logger;
   }
+  void TcpHandler::set_dns_cache(const DnsCache *dns_cache) {
+    this->dns_cache_ = dns_cache;
+  }
+
+  void TcpHandler::set_protoid(const ProtoIdent *protoid) {
+    this->protoid_ = protoid;
+  }
+
+  void TcpHandler::set_ruleset(const RuleSet *ruleset) {
+    this->ruleset_ = ruleset;
+  }
+
+  void TcpHandler::set_syn_cookie(const SynCookie *cookie) {
+    this->cookie_ = cookie;
+  }
+
+  void TcpHandler::set_synack_window(uint16_t window) {
+    this->synack_window_ = window;
+    this->init_synack_template();
+  }
+
+  TcpHandler::SessionExt *TcpHandler::session_ext(const swarm::Property &p)
+    const {
+    size_t len;
+    void *ptr = p.value(this->ssn_ext_).ptr(&len);
+    if (ptr == nullptr || len < sizeof(SessionExt)) {
+      return nullptr;
+    }
+    return static_cast<SessionExt*>(ptr);
+  }
+
+  const char *TcpHandler::session_protocol(const swarm::Property &p,
+                                          bool inspect) {
+    // Identified protocol is kept in the session, so later segments and
+    // decoded messages of the session are also labeled.
+    SessionExt *ext;
+    if (this->protoid_ == nullptr || (ext = this->session_ext(p)) == nullptr) {
+      return nullptr;
+    }
+
+    if (inspect) {
+      size_t len;
+      const void *data = p.value("tcp_ssn.segment").ptr(&len);
+      uint32_t offset = p.value(this->ssn_offset_).uint32();
+      return this->protoid_->identify(&ext->proto_, data, len, offset);
+    } else {
+      return this->protoid_->name(ext->proto_);
+    }
+  }
+
+  std::string TcpHandler::session_rules(const swarm::Property &p,
+                                        bool inspect) {
+    // Names of all rules fired in the session so far.
+    SessionExt *ext;
+    if (this->ruleset_ == nullptr || (ext = this->session_ext(p)) == nullptr) {
+      return std::string();
+    }
+
+    if (inspect) {
+      size_t len;
+      const void *data = p.value("tcp_ssn.segment").ptr(&len);
+      uint32_t offset = p.value(this->ssn_offset_).uint32();
+      this->ruleset_->inspect(&ext->rule_, data, len, offset);
+    }
+    return this->ruleset_->names(ext->rule_);
+  }
+
+  void TcpHandler::set_dst_names(Event *msg,
+                                 const swarm::Property &p) {
+    // Names that resolved to destination address before the access.
+    if (this->dns_cache_) {
+      char buf[512];
+      size_t addr_len;
+      void *addr = p.dst_addr(&addr_len);
+      size_t len = this->dns_cache_->lookup(addr, addr_len, p.tv_sec(),
+                                            buf, sizeof(buf));
+      if (len > 0) {
+        msg->set("dst_names", buf, len);
+      }
+    }
+  }
+
+  void TcpHandler::set_flow(Event *msg, const swarm::Property &p) {
+    size_t len;
+    const void *addr = p.src_addr(&len);
+    msg->set_addr("src_addr", addr, len);
+    addr = p.dst_addr(&len);
+    msg->set_addr("dst_addr", addr, len);
+    msg->set("src_port", p.src_port());
+    msg->set("dst_port", p.dst_port());
+  }
+
+  // Value bytes are copied as they are; null value is "(none)" as str().
+  static void set_value(Event *msg, const char *key, const swarm::Value &v) {
+    size_t len;
+    const void *ptr = v.ptr(&len);
+    if (ptr) {
+      msg->set(key, ptr, len);
+    } else {
+      msg->set(key, v.str());
+    }
+  }
   
 
-  size_t TcpHandler::build_tcp_synack_packet(const swarm::Property &p,
-                                             void *data, size_t len) {
-    // assign header
-    const size_t pkt_len =
-      sizeof(struct ether_header) + sizeof(struct ipv4_header) +
-      sizeof(struct tcp_header);
-    uint8_t *pkt = static_cast<uint8_t*> (malloc(pkt_len));
-    auto *eth_hdr = reinterpret_cast<struct ether_header*>(pkt);
-    auto *ipv4_hdr = reinterpret_cast<struct ipv4_header*>
-      (pkt + sizeof(struct ether_header));
-    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>
-      (pkt + sizeof(struct ether_header) + sizeof(struct ipv4_header));
-
-    // build Ethernet header
-    ::memcpy(eth_hdr->src_, p.value("ether.dst").ptr(), ETHER_ADDR_LEN);
-    ::memcpy(eth_hdr->dst_, p.value("ether.src").ptr(), ETHER_ADDR_LEN);
-    eth_hdr->type_ = htons(ETHERTYPE_IP);
+  void TcpHandler::init_synack_template() {
+    ::memset(this->synack_, 0, sizeof(this->synack_));
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->synack_);
+    auto *ipv4_hdr = reinterpret_cast<struct ipv4_header*>(eth_hdr + 1);
+    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>(ipv4_hdr + 1);
 
-    // build IPv4 header
-    const uint16_t ipv4_tlen = sizeof(struct ipv4_header) + sizeof(struct tcp_header);
+    eth_hdr->type_ = htons(ETHERTYPE_IP);
 
-    void *ipv4_src = p.value("ipv4.src").ptr();
-    void *ipv4_dst = p.value("ipv4.dst").ptr();
     ipv4_hdr->hdrlen_ = 5;
     ipv4_hdr->ver_ = 4;
-    ipv4_hdr->tos_ = 0;
-    ipv4_hdr->total_len_ = htons(ipv4_tlen);
-    ipv4_hdr->id_ = rand();
-    ipv4_hdr->offset_ = 0;
+    ipv4_hdr->total_len_ = htons(sizeof(struct ipv4_header) +
+                                 sizeof(struct tcp_header));
     ipv4_hdr->ttl_ = 64;
     ipv4_hdr->proto_ = IPPROTO_TCP;
-    ipv4_hdr->chksum_ = 0; // should be set
+
+    tcp_hdr->offset_ = sizeof(struct tcp_header) / 4;
+    tcp_hdr->flags_ = (TCP_SYN | TCP_ACK);
+    tcp_hdr->window_ = htons(this->synack_window_);
+
+    // Pseudo header fields except addresses are also fixed.
+    struct pseudo_ipv4_header pseudo;
+    ::memset(&pseudo, 0, sizeof(pseudo));
+    pseudo.proto_ = IPPROTO_TCP;
+    pseudo.th_off_ = htons(sizeof(struct tcp_header));
+
+    this->synack_ip_sum_ = chksum_add(0, ipv4_hdr, sizeof(struct ipv4_header));
+    this->synack_tcp_sum_ = chksum_add(chksum_add(0, &pseudo, sizeof(pseudo)),
+                                       tcp_hdr, sizeof(struct tcp_header));
+
+    // IPv6 has no header checksum, and TCP header is the same.
+    ::memset(this->synack6_, 0, sizeof(this->synack6_));
+    auto *eth6_hdr = reinterpret_cast<struct ether_header*>(this->synack6_);
+    auto *ipv6_hdr = reinterpret_cast<struct ipv6_header*>(eth6_hdr + 1);
+    auto *tcp6_hdr = reinterpret_cast<struct tcp_header*>(ipv6_hdr + 1);
+
+    eth6_hdr->type_ = htons(ETHERTYPE_IPV6);
+    ipv6_hdr->flags_ = htonl(0x60000000);
+    ipv6_hdr->data_len_ = htons(sizeof(struct tcp_header));
+    ipv6_hdr->next_hdr_ = IPPROTO_TCP;
+    ipv6_hdr->hop_limit_ = 64;
+    ::memcpy(tcp6_hdr, tcp_hdr, sizeof(struct tcp_header));
+
+    struct pseudo_ipv6_header pseudo6;
+    ::memset(&pseudo6, 0, sizeof(pseudo6));
+    pseudo6.len_ = htonl(sizeof(struct tcp_header));
+    pseudo6.next_hdr_ = IPPROTO_TCP;
+    this->synack6_tcp_sum_ =
+      chksum_add(chksum_add(0, &pseudo6, sizeof(pseudo6)),
+                 tcp6_hdr, sizeof(struct tcp_header));
+
+    this->isn_ = static_cast<uint32_t>(time(nullptr)) | 1;
+  }
+
+  uint32_t TcpHandler::synack_isn(const swarm::Property &p) {
+    // Returns initial sequence number in network byte order.
+    if (this->cookie_) {
+      return htonl(this->cookie_->make(p));
+    } else {
+      // xorshift32 to pick initial sequence number.
+      this->isn_ ^= this->isn_ << 13;
+      this->isn_ ^= this->isn_ >> 17;
+      this->isn_ ^= this->isn_ << 5;
+      return this->isn_;
+    }
+  }
+
+  uint8_t *TcpHandler::build_tcp_synack_packet(const swarm::Property &p,
+                                               size_t *len) {
+    const uint8_t *ipv4_src = p.value(this->ipv4_src_).ptr();
+    const uint8_t *ipv4_dst = p.value(this->ipv4_dst_).ptr();
+    if (ipv4_src == nullptr || ipv4_dst == nullptr) {
+      return this->build_tcp_synack6_packet(p, len);
+    }
+
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->synack_);
+    auto *ipv4_hdr = reinterpret_cast<struct ipv4_header*>(eth_hdr + 1);
+    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>(ipv4_hdr + 1);
+
+    ::memcpy(eth_hdr->src_, p.value(this->ether_dst_).ptr(), ETHER_ADDR_LEN);
+    ::memcpy(eth_hdr->dst_, p.value(this->ether_src_).ptr(), ETHER_ADDR_LEN);
+
+    // Addresses and ports are swapped from the SYN.
     ::memcpy(&ipv4_hdr->src_, ipv4_dst, IPV4_ADDR_LEN);
     ::memcpy(&ipv4_hdr->dst_, ipv4_src, IPV4_ADDR_LEN);
+    ipv4_hdr->id_ = htons(this->ip_id_++);
+    ::memcpy(&tcp_hdr->src_port_, p.value(this->tcp_dst_port_).ptr(),
+             sizeof(tcp_hdr->src_port_));
+    ::memcpy(&tcp_hdr->dst_port_, p.value(this->tcp_src_port_).ptr(),
+             sizeof(tcp_hdr->dst_port_));
+    tcp_hdr->seq_ = this->synack_isn(p);
+    tcp_hdr->ack_ = htonl(p.value(this->tcp_seq_).uint32() + 1);
 
-    // build TCP header
-    uint16_t sport = p.value("tcp.src_port").ntoh<uint16_t>();
-    uint16_t dport = p.value("tcp.dst_port").ntoh<uint16_t>();
+    uint32_t addr_sum = chksum_add(0, &ipv4_hdr->src_, 2 * IPV4_ADDR_LEN);
+    ipv4_hdr->chksum_ = chksum_fold(this->synack_ip_sum_ + addr_sum +
+                                    ipv4_hdr->id_);
+    uint32_t tcp_sum = this->synack_tcp_sum_ + addr_sum;
+    tcp_sum = chksum_add(tcp_sum, &tcp_hdr->src_port_,
+                         sizeof(tcp_hdr->src_port_) +
+                         sizeof(tcp_hdr->dst_port_) +
+                         sizeof(tcp_hdr->seq_) + sizeof(tcp_hdr->ack_));
+    tcp_hdr->chksum_ = chksum_fold(tcp_sum);
 
-    tcp_hdr->src_port_ = htons(dport);
-    tcp_hdr->dst_port_ = htons(sport);
-    tcp_hdr->seq_ = random();
-    tcp_hdr->ack_ = htonl(p.value("tcp.seq").uint32() + 1);
-    tcp_hdr->offset_ = 0x5;
-    tcp_hdr->x2_ = 0;
-    tcp_hdr->flags_ = (TCP_SYN | TCP_ACK);
-    tcp_hdr->window_ = htons(14480);
-    tcp_hdr->chksum_ = 0;
-    tcp_hdr->urgptr_ = 0;
+    *len = SYNACK_LEN;
+    return this->synack_;
+  }
 
-    ipv4_hdr->chksum_ = header_chksum(reinterpret_cast<uint16_t*>(ipv4_hdr),
-                                      sizeof(struct ipv4_header));
+  uint8_t *TcpHandler::build_tcp_synack6_packet(const swarm::Property &p,
+                                                size_t *len) {
+    const uint8_t *ipv6_src = p.value(this->ipv6_src_).ptr();
+    const uint8_t *ipv6_dst = p.value(this->ipv6_dst_).ptr();
+    if (ipv6_src == nullptr || ipv6_dst == nullptr) {
+      return nullptr;
+    }
 
-    uint8_t buf[1024];
-    struct pseudo_ipv4_header *p_hdr =
-      reinterpret_cast<struct pseudo_ipv4_header*>(buf);
-    p_hdr->src_ = ipv4_hdr->src_;
-    p_hdr->dst_ = ipv4_hdr->dst_;
-    p_hdr->proto_ = IPPROTO_TCP;
-    p_hdr->th_off_ = htons(sizeof(ipv4_header));
-    p_hdr->x0_ = 0;
+    auto *eth_hdr = reinterpret_cast<struct ether_header*>(this->synack6_);
+    auto *ipv6_hdr = reinterpret_cast<struct ipv6_header*>(eth_hdr + 1);
+    auto *tcp_hdr = reinterpret_cast<struct tcp_header*>(ipv6_hdr + 1);
 
-    ::memcpy(buf + sizeof(struct pseudo_ipv4_header), tcp_hdr,
-             sizeof(struct tcp_header));
-    tcp_hdr->chksum_ = header_chksum(reinterpret_cast<uint16_t*>(buf),
-                                     sizeof(struct pseudo_ipv4_header) +
-                                     sizeof(struct tcp_header));
+    ::memcpy(eth_hdr->src_, p.value(this->ether_dst_).ptr(), ETHER_ADDR_LEN);
+    ::memcpy(eth_hdr->dst_, p.value(this->ether_src_).ptr(), ETHER_ADDR_LEN);
 
-    // Copy built packet data to buffer from argument.
-    size_t rc = 0;
-    if (pkt_len < len) {
-      ::memcpy(data, pkt, pkt_len);
-      rc = pkt_len;
-    }
+    ::memcpy(ipv6_hdr->src_, ipv6_dst, IPV6_ADDR_LEN);
+    ::memcpy(ipv6_hdr->dst_, ipv6_src, IPV6_ADDR_LEN);
+    ::memcpy(&tcp_hdr->src_port_, p.value(this->tcp_dst_port_).ptr(),
+             sizeof(tcp_hdr->src_port_));
+    ::memcpy(&tcp_hdr->dst_port_, p.value(this->tcp_src_port_).ptr(),
+             sizeof(tcp_hdr->dst_port_));
+    tcp_hdr->seq_ = this->synack_isn(p);
+    tcp_hdr->ack_ = htonl(p.value(this->tcp_seq_).uint32() + 1);
+
+    uint32_t tcp_sum = chksum_add(this->synack6_tcp_sum_, ipv6_hdr->src_,
+                                  2 * IPV6_ADDR_LEN);
+    tcp_sum = chksum_add(tcp_sum, &tcp_hdr->src_port_,
+                         sizeof(tcp_hdr->src_port_) +
+                         sizeof(tcp_hdr->dst_port_) +
+                         sizeof(tcp_hdr->seq_) + sizeof(tcp_hdr->ack_));
+    tcp_hdr->chksum_ = chksum_fold(tcp_sum);
 
-    free(pkt);
-    return rc;
+    *len = SYNACK6_LEN;
+    return this->synack6_;
   }
 
   void TcpHandler::handle_synpkt(const swarm::Property &p) {
-    if (this->target_->has(p.dst_addr(), p.dst_port())) {
+    if (this->target_->has_dst(p)) {
 
       // Output to logger.
       if (this->logger_) {
-        fluent::Message *msg = this->logger_->retain_message("lurker.tcp_syn");
+        Event *msg = this->logger_->retain_message("lurker.tcp_syn");
         msg->set_ts(p.tv_sec());
-        msg->set("src_addr", p.src_addr());
-        msg->set("dst_addr", p.dst_addr());
-        msg->set("src_port", p.src_port());
-        msg->set("dst_port", p.dst_port());
+        this->set_flow(msg, p);
+        this->set_dst_names(msg, p);
         this->logger_->emit(msg);
       }
 
       if (this->sock_) {
         // activee mode
         size_t hw_len;
-        void *hw_dst = p.value("ether.dst").ptr(&hw_len);
+        void *hw_dst = p.value(this->ether_dst_).ptr(&hw_len);
 
-        if (p.value("ether.type").uint32() != ETHERTYPE_IP ||
+        uint32_t ether_type = p.value(this->ether_type_).uint32();
+        if ((ether_type != ETHERTYPE_IP && ether_type != ETHERTYPE_IPV6) ||
             (0 != memcmp(hw_dst, this->sock_->hw_addr(), hw_len) &&
              hw_len == ETHER_ADDR_LEN)) {
           debug(DBG, "Invalid packet (ether-type=%d (should be %d), dst=%s, hw_len=%zd",
-                p.value("ether.type").uint32(), ETHERTYPE_IP,
-                p.value("ether.dst").repr().c_str(), hw_len);
+                p.value(this->ether_type_).uint32(), ETHERTYPE_IP,
+                p.value(this->ether_dst_).repr().c_str(), hw_len);
         } 
 
-        uint8_t buf[1024];
-        size_t len = TcpHandler::build_tcp_synack_packet(p, buf, sizeof(buf));
-        assert(len > 0);
-        if (0 > this->sock_->write(buf, len)) {
-          fluent::Message *msg = this->logger_->retain_message("lurker.error");
+        size_t len;
+        uint8_t *pkt = this->build_tcp_synack_packet(p, &len);
+        if (pkt && 0 > this->sock_->enqueue(pkt, len)) {
+          Event *msg = this->logger_->retain_message("lurker.error");
           msg->set("message", this->sock_->errmsg());
           msg->set("event", "tcp-syn-reply");
           this->logger_->emit(msg);
@@ -209,43 +406,142 @@ namespace lurker {
   }
 
   void TcpHandler::handle_data(const swarm::Property &p) {
+    const char *proto = nullptr;
+    std::string rules;
+    if (p.value("tcp_ssn.to_server").uint32() &&
+        !p.value("tcp_ssn.segment").is_null()) {
+      proto = this->session_protocol(p, true);
+      rules = this->session_rules(p, true);
+    } else {
+      rules = this->session_rules(p, false);
+    }
+
     if (p.value("tcp_ssn.segment").is_null()) {
       debug(1, "data is null");
+    } else if (this->decoded_log_ && this->is_decoded(p)) {
+      // The segment is logged by handle_http() or handle_tls().
+      return;
     } else {
       if (this->logger_) {
         size_t data_len;
         unsigned char *data_ptr = reinterpret_cast<unsigned char *>
           (p.value("tcp_ssn.segment").ptr(&data_len));
-        fluent::Message *msg = this->logger_->retain_message("lurker.tcp_data");
+        Event *msg = this->logger_->retain_message("lurker.tcp_data");
         msg->set_ts(p.tv_sec());
-        msg->set("hash", p.hash_hex());
-        msg->set("src_addr", p.src_addr());
-        msg->set("dst_addr", p.dst_addr());
-        msg->set("src_port", p.src_port());
-        msg->set("dst_port", p.dst_port());
+        msg->set_hash("hash", p.hash_value());
+        this->set_flow(msg, p);
+        this->set_dst_names(msg, p);
+        if (proto) {
+          msg->set("protocol", proto);
+        }
+        if (!rules.empty()) {
+          msg->set("rules", rules);
+        }
+        // Hex digits are made by the writer thread of EventLog.
         if (this->hexdata_log_) {
-          std::string data;
-          char buf[3];
-          for (size_t i = 0; i < data_len; i++) {
-            snprintf(buf, sizeof(buf), "%02X", data_ptr[i]);
-            data += buf;
-          }
-          // msg->set("hex_data", ss.str());          
-          msg->set("hex_data", data);
+          msg->set_hex("hex_data", data_ptr, data_len);
         } else {
-          std::string data(reinterpret_cast<char*>(data_ptr), data_len);
-          msg->set("data", data);
+          msg->set("data", data_ptr, data_len);
         }
         this->logger_->emit(msg);
       }
     }
   } 
 
+  bool TcpHandler::is_decoded(const swarm::Property &p) const {
+    return (!p.value(this->http_seg_).is_null() ||
+            !p.value(this->tls_seg_).is_null() ||
+            !p.value(this->ssh_seg_).is_null());
+  }
+
+  Event *TcpHandler::new_session_message(const char *tag,
+                                                   const swarm::Property &p) {
+    Event *msg = this->logger_->retain_message(tag);
+    msg->set_ts(p.tv_sec());
+    msg->set_hash("hash", p.hash_value());
+    this->set_flow(msg, p);
+    this->set_dst_names(msg, p);
+    const char *proto = this->session_protocol(p, false);
+    if (proto) {
+      msg->set("protocol", proto);
+    }
+    std::string rules = this->session_rules(p, false);
+    if (!rules.empty()) {
+      msg->set("rules", rules);
+    }
+    return msg;
+  }
+
+  void TcpHandler::handle_http(const swarm::Property &p) {
+    if (this->logger_ && this->decoded_log_) {
+      Event *msg = this->new_session_message("lurker.http_req", p);
+      set_value(msg, "method", p.value(this->http_method_));
+      set_value(msg, "uri", p.value(this->http_uri_));
+      const swarm::Value *opt[] = {
+        &p.value(this->http_version_), &p.value(this->http_host_),
+        &p.value(this->http_ua_), &p.value(this->http_header_),
+        &p.value(this->http_body_),
+      };
+      const char *key[] = {"version", "host", "user_agent", "header", "body"};
+      for (size_t i = 0; i < sizeof(opt) / sizeof(opt[0]); i++) {
+        if (!opt[i]->is_null()) {
+          set_value(msg, key[i], *opt[i]);
+        }
+      }
+      this->logger_->emit(msg);
+    }
+  }
+
+  void TcpHandler::handle_tls(const swarm::Property &p) {
+    if (this->logger_ && this->decoded_log_) {
+      Event *msg = this->new_session_message("lurker.tls_hello", p);
+      msg->set("version",
+               static_cast<int>(p.value(this->tls_version_).uint32()));
+      set_value(msg, "ciphers", p.value(this->tls_ciphers_));
+      set_value(msg, "extensions", p.value(this->tls_exts_));
+      set_value(msg, "ja3", p.value(this->tls_ja3_));
+      set_value(msg, "ja3_hash", p.value(this->tls_ja3_hash_));
+      set_value(msg, "ja4", p.value(this->tls_ja4_));
+      if (!p.value(this->tls_sni_).is_null()) {
+        set_value(msg, "sni", p.value(this->tls_sni_));
+      }
+      if (!p.value(this->tls_alpn_).is_null()) {
+        set_value(msg, "alpn", p.value(this->tls_alpn_));
+      }
+      this->logger_->emit(msg);
+    }
+  }
+
+  void TcpHandler::handle_ssh(const swarm::Property &p) {
+    if (this->logger_ && this->decoded_log_) {
+      Event *msg = this->new_session_message("lurker.ssh_client", p);
+      const swarm::Value *opt[] = {
+        &p.value(this->ssh_banner_), &p.value(this->ssh_proto_),
+        &p.value(this->ssh_software_), &p.value(this->ssh_comments_),
+        &p.value(this->ssh_hassh_), &p.value(this->ssh_hassh_algo_),
+      };
+      const char *key[] = {"banner", "proto_version", "software", "comments",
+                           "hassh", "hassh_algorithms"};
+      for (size_t i = 0; i < sizeof(opt) / sizeof(opt[0]); i++) {
+        if (!opt[i]->is_null()) {
+          set_value(msg, key[i], *opt[i]);
+        }
+      }
+      this->logger_->emit(msg);
+    }
+  }
+
   void TcpHandler::recv(swarm::ev_id eid, const swarm::Property &p) {
     if (eid == this->syn_ev_) {
       this->handle_synpkt(p);
     } else if (eid == this->data_ev_) {
       this->handle_data(p);
+    } else if (eid == this->http_ev_) {
+      this->handle_http(p);
+    } else if (eid == this->tls_ev_) {
+      this->handle_tls(p);
+    } else if (eid == this->ssh_ev_) {
+      this->handle_ssh(p);
     }
   }
 }
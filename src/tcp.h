@@ -29,10 +29,14 @@
 
 #include <sstream>
 #include <ostream>
-#include <fluent.hpp>
+#include "./eventlog.h"
 #include "./swarm/swarm.h"
 #include "./rawsock.h"
 #include "./target.h"
+#include "./dnscache.h"
+#include "./protoid.h"
+#include "./rule.h"
+#include "./syncookie.h"
 
 namespace lurker {
   class TcpHandler : public swarm::Handler {
@@ -40,31 +44,103 @@ namespace lurker {
     swarm::Swarm *sw_;
     swarm::hdlr_id syn_hdlr_id_;
     swarm::hdlr_id data_hdlr_id_;
+    swarm::hdlr_id http_hdlr_id_;
+    swarm::hdlr_id tls_hdlr_id_;
+    swarm::hdlr_id ssh_hdlr_id_;
     swarm::ev_id syn_ev_;
     swarm::ev_id data_ev_;
+    swarm::ev_id http_ev_;
+    swarm::ev_id tls_ev_;
+    swarm::ev_id ssh_ev_;
+    swarm::val_id http_method_, http_uri_, http_version_, http_host_,
+      http_ua_, http_header_, http_body_, http_seg_;
+    swarm::val_id tls_version_, tls_sni_, tls_alpn_, tls_ciphers_, tls_exts_,
+      tls_ja3_, tls_ja3_hash_, tls_ja4_, tls_seg_;
+    swarm::val_id ssh_banner_, ssh_proto_, ssh_software_, ssh_comments_,
+      ssh_hassh_, ssh_hassh_algo_, ssh_seg_;
+    swarm::val_id ssn_offset_, ssn_ext_;
+
+    // Layout of "tcp_ssn.ext" area used by TcpHandler.
+    struct SessionExt {
+      ProtoIdent::State proto_;
+      RuleSet::State rule_;
+    };
+    // session_ext() returns nullptr if the area is too small, which would
+    // silently drop protocol and rule state.
+    static_assert(sizeof(SessionExt) <= swarm::TCP_SSN_EXT_SIZE,
+                  "SessionExt must fit in tcp_ssn.ext area");
 
     RawSock *sock_;
     static const bool DBG = false;
     const TargetSet *target_;
-    fluent::Logger *logger_;
+    EventLog *logger_;
     bool hexdata_log_;
-    static size_t build_tcp_synack_packet(const swarm::Property &p,
-                                          void *buffer, size_t len);
+    bool decoded_log_;
+    const DnsCache *dns_cache_;
+    const ProtoIdent *protoid_;
+    const RuleSet *ruleset_;
+    const SynCookie *cookie_;
+    void set_dst_names(Event *msg, const swarm::Property &p);
+    bool is_decoded(const swarm::Property &p) const;
+    void set_flow(Event *msg, const swarm::Property &p);
+    Event *new_session_message(const char *tag, const swarm::Property &p);
+    SessionExt *session_ext(const swarm::Property &p) const;
+    const char *session_protocol(const swarm::Property &p, bool inspect);
+    std::string session_rules(const swarm::Property &p, bool inspect);
+
+    // SYN-ACK frames (Ethernet, IPv4 or IPv6 and TCP headers) are built
+    // once as templates. Fields fixed for all replies are left as is and
+    // only addresses, ports, IP ID, sequence and ack numbers are patched.
+    // Checksums start from partial sums of the fixed fields.
+    static const size_t SYNACK_LEN = 54;
+    static const size_t SYNACK6_LEN = 74;
+    static const uint16_t DEFAULT_SYNACK_WINDOW = 14480;
+    uint8_t synack_[SYNACK_LEN];
+    uint8_t synack6_[SYNACK6_LEN];
+    uint32_t synack_ip_sum_;
+    uint32_t synack_tcp_sum_;
+    uint32_t synack6_tcp_sum_;
+    uint16_t ip_id_;
+    uint16_t synack_window_;
+    uint32_t isn_;
+    swarm::val_id ether_src_, ether_dst_, ether_type_, ipv4_src_, ipv4_dst_,
+      ipv6_src_, ipv6_dst_, tcp_src_port_, tcp_dst_port_, tcp_seq_;
+    void init_synack_template();
+    uint32_t synack_isn(const swarm::Property &p);
+    uint8_t *build_tcp_synack_packet(const swarm::Property &p, size_t *len);
+    uint8_t *build_tcp_synack6_packet(const swarm::Property &p, size_t *len);
 
   public:
     TcpHandler(swarm::Swarm *sw, TargetSet *target);
     ~TcpHandler();
     void set_sock(RawSock *sock);
     void unset_sock();
-    void set_logger(fluent::Logger *logger);
+    void set_logger(EventLog *logger);
+    void set_dns_cache(const DnsCache *dns_cache);
+    void set_protoid(const ProtoIdent *protoid);
+    void set_ruleset(const RuleSet *ruleset);
+    // SYN-ACK sequence numbers are taken from cookie instead of a PRNG.
+    void set_syn_cookie(const SynCookie *cookie);
+    // Receive window advertised by SYN-ACK (e.g. tiny one for tarpit).
+    void set_synack_window(uint16_t window);
     void recv(swarm::ev_id eid, const  swarm::Property &p);
     void handle_synpkt(const swarm::Property &p);
     void handle_data(const swarm::Property &p);
+    void handle_http(const swarm::Property &p);
+    void handle_tls(const swarm::Property &p);
+    void handle_ssh(const swarm::Property &p);
 
     // Use HEX string in log message instead of binary data.
     void enable_hexdata_log() { this->hexdata_log_ = true; }
     void disable_hexdata_log() { this->hexdata_log_ = false; }
     bool hexdata_log() const { return this->hexdata_log_; }
+
+    // Log decoded application message (e.g. HTTP request, TLS
+    // ClientHello, SSH client identification) instead of lurker.tcp_data
+    // for segments consumed by the decoder.
+    void enable_decoded_log() { this->decoded_log_ = true; }
+    void disable_decoded_log() { this->decoded_log_ = false; }
+    bool decoded_log() const { return this->decoded_log_; }
   };
 
 }
@@ -0,0 +1,325 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/encoder.h"
+#include "../src/eventlog.h"
+#include "../src/logsink.h"
+
+namespace {
+  const time_t TS = 1412345678;
+
+  class NullSink : public lurker::LogSink {
+  public:
+    bool write(const struct iovec *iov, int iovcnt) { return true; }
+  };
+
+  // Keeps records as made by Event, to feed encoders directly.
+  class Recorder : public lurker::Encoder {
+  public:
+    std::vector<std::string> rec_;
+    void encode(const uint8_t *rec, size_t len) {
+      this->rec_.push_back(std::string(reinterpret_cast<const char*>(rec),
+                                       len));
+    }
+  };
+
+  class Records {
+  private:
+    lurker::EventLog log_;
+    Recorder *rec_;
+  public:
+    Records() : rec_(new Recorder()) {
+      this->log_.add_sink(new NullSink(), this->rec_);
+    }
+    lurker::Event *event(const char *tag, time_t ts) {
+      lurker::Event *ev = this->log_.retain_message(tag);
+      ev->set_ts(ts);
+      return ev;
+    }
+    void emit(lurker::Event *ev) { this->log_.emit(ev); }
+    const std::vector<std::string> &rec() const { return this->rec_->rec_; }
+  };
+
+  // Event with a field of each type.
+  void fill(lurker::Event *ev) {
+    const uint8_t addr[] = {10, 0, 0, 1};
+    uint8_t addr6[16];
+    ::inet_pton(AF_INET6, "2001:db8::1", addr6);
+    const uint8_t mac[] = {0x06, 0x35, 0x8a, 0x6d, 0x7d, 0x37};
+    ev->set("str", "abc");
+    ev->set("long", std::string(100, 'x'));
+    ev->set("int", -5);
+    ev->set("int2", -200);
+    ev->set("uint", 300u);
+    ev->set("uint2", 4000000000u);
+    ev->set("bool", true);
+    ev->set_addr("addr", addr, sizeof(addr));
+    ev->set_addr("addr6", addr6, sizeof(addr6));
+    ev->set_mac("mac", mac, sizeof(mac));
+    ev->set_hash("hash", 0x0123456789abcdefULL);
+    ev->set_hex("hex", "\x01\xab\xff", 3);
+  }
+
+  std::string output(lurker::Encoder *enc) {
+    const struct iovec *iov;
+    int n = enc->iovec(&iov);
+    std::string s;
+    for (int i = 0; i < n; i++) {
+      s.append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len);
+    }
+    return s;
+  }
+
+  std::string encode(lurker::Encoder *enc,
+                     const std::vector<std::string> &rec) {
+    for (size_t i = 0; i < rec.size(); i++) {
+      enc->encode(reinterpret_cast<const uint8_t*>(rec[i].data()),
+                  rec[i].size());
+    }
+    return output(enc);
+  }
+
+  std::string hex(const std::string &s) {
+    static const char HEX[] = "0123456789abcdef";
+    std::string h;
+    for (size_t i = 0; i < s.size(); i++) {
+      h += HEX[static_cast<uint8_t>(s[i]) >> 4];
+      h += HEX[s[i] & 0xf];
+    }
+    return h;
+  }
+
+  std::string repeat(const std::string &s, size_t n) {
+    std::string r;
+    for (size_t i = 0; i < n; i++) {
+      r += s;
+    }
+    return r;
+  }
+
+  // [TS, {"addr": ...}] in msgpack, map header to the end.
+  const std::string MSGPACK_FIELDS =
+    "8ca461646472a831302e302e302e31a56164647236ab323030313a6462383a3a31"
+    "a4626f6f6cc3a468617368b030313233343536373839414243444546a3686578a6"
+    "303141424646a3696e74fba4696e7432d1ff38a46c6f6e67d964" +
+    repeat("78", 100) +
+    "a36d6163b130363a33353a38413a36443a37443a3337a3737472a3616263a47569"
+    "6e74cd012ca575696e7432ceee6b2800";
+
+  // JSON escape of a byte as the reference.
+  std::string json_escape(uint8_t c) {
+    char buf[8];
+    switch (c) {
+    case '"':  return "\\\"";
+    case '\\': return "\\\\";
+    case '\n': return "\\n";
+    case '\r': return "\\r";
+    case '\t': return "\\t";
+    }
+    if (c < 0x20 || c >= 0x80) {
+      snprintf(buf, sizeof(buf), "\\u%04X", c);
+      return buf;
+    }
+    return std::string(1, c);
+  }
+}  // namespace
+
+TEST(Encoder, msgpack) {
+  Records r;
+  lurker::Event *ev = r.event("lurker.test", TS);
+  fill(ev);
+  r.emit(ev);
+  ASSERT_EQ(1u, r.rec().size());
+
+  const std::string expect = "93ab6c75726b65722e74657374ce542eaf4e" +
+    MSGPACK_FIELDS;
+  lurker::MsgpackEncoder enc;
+  EXPECT_EQ(expect, hex(encode(&enc, r.rec())));
+  enc.clear();
+  EXPECT_TRUE(enc.empty());
+
+  // Copying long values changes nothing but the iovec.
+  lurker::MsgpackEncoder copy;
+  copy.set_copy(true);
+  EXPECT_EQ(expect, hex(encode(&copy, r.rec())));
+  EXPECT_EQ(expect, hex(std::string(copy.buffer().begin(),
+                                    copy.buffer().end())));
+
+  // Entry of forward protocol: [time, record] without tag.
+  lurker::MsgpackEncoder entry(true);
+  EXPECT_EQ("92ce542eaf4e" + MSGPACK_FIELDS, hex(encode(&entry, r.rec())));
+}
+
+TEST(Encoder, packed_forward) {
+  Records r;
+  lurker::Event *ev = r.event("t.a", TS);
+  ev->set("n", 1);
+  r.emit(ev);
+  ev = r.event("t.b", TS);
+  ev->set("s", "b");
+  r.emit(ev);
+  ev = r.event("t.a", TS + 1);
+  ev->set("n", 2);
+  r.emit(ev);
+
+  // A message per tag: [tag, entries as bin, {"size": n}]
+  lurker::PackedForwardEncoder enc;
+  EXPECT_TRUE(enc.empty());
+  EXPECT_EQ("93a3742e61c41492ce542eaf4e81a16e0192ce542eaf4f81a16e0281a47369"
+            "7a650293a3742e62c40b92ce542eaf4e81a173a16281a473697a6501",
+            hex(encode(&enc, r.rec())));
+  EXPECT_TRUE(enc.chunks().empty());
+
+  EXPECT_FALSE(enc.empty());
+  EXPECT_FALSE(enc.full());
+  EXPECT_FALSE(enc.due(time(nullptr) - 1));
+  EXPECT_TRUE(enc.due(time(nullptr) +
+                      lurker::PackedForwardEncoder::DEFAULT_FLUSH_INTERVAL));
+  enc.set_flush(8, 60);
+  EXPECT_TRUE(enc.full());
+  EXPECT_TRUE(enc.due(time(nullptr)));
+
+  enc.clear();
+  EXPECT_TRUE(enc.empty());
+  EXPECT_FALSE(enc.due(time(nullptr) + 3600));
+}
+
+TEST(Encoder, packed_forward_gzip) {
+  Records r;
+  for (int i = 0; i < 2; i++) {
+    lurker::Event *ev = r.event("t.a", TS + i);
+    ev->set("n", i + 1);
+    r.emit(ev);
+  }
+
+  lurker::PackedForwardEncoder enc(lurker::PackedForwardEncoder::GZIP);
+  const std::string out = encode(&enc, r.rec());
+  ASSERT_LT(7u, out.size());
+  ASSERT_EQ("93a3742e61c4", hex(out.substr(0, 6)));
+  const size_t len = static_cast<uint8_t>(out[6]);
+  ASSERT_LE(7 + len, out.size());
+  EXPECT_EQ("82a473697a6502aa636f6d70726573736564a4677a6970",
+            hex(out.substr(7 + len)));
+
+  uint8_t plain[256];
+  z_stream zs;
+  ::memset(&zs, 0, sizeof(zs));
+  ASSERT_EQ(Z_OK, inflateInit2(&zs, 15 + 16));
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(out.data() + 7));
+  zs.avail_in = len;
+  zs.next_out = plain;
+  zs.avail_out = sizeof(plain);
+  EXPECT_EQ(Z_STREAM_END, inflate(&zs, Z_FINISH));
+  inflateEnd(&zs);
+  EXPECT_EQ("92ce542eaf4e81a16e0192ce542eaf4f81a16e02",
+            hex(std::string(reinterpret_cast<char*>(plain), zs.total_out)));
+}
+
+TEST(Encoder, packed_forward_ack) {
+  Records r;
+  lurker::Event *ev = r.event("t.a", TS);
+  ev->set("n", 1);
+  r.emit(ev);
+  ev = r.event("t.b", TS);
+  ev->set("n", 2);
+  r.emit(ev);
+
+  lurker::PackedForwardEncoder enc(lurker::PackedForwardEncoder::NONE, true);
+  const std::string out = encode(&enc, r.rec());
+  ASSERT_EQ(2u, enc.chunks().size());
+  EXPECT_NE(enc.chunks()[0], enc.chunks()[1]);
+  for (size_t i = 0; i < enc.chunks().size(); i++) {
+    const std::string &id = enc.chunks()[i];
+    EXPECT_EQ(24u, id.size());
+    EXPECT_EQ("==", id.substr(22));
+    // Option map has "chunk" with the id.
+    EXPECT_NE(std::string::npos, out.find("\xa5" "chunk\xb8" + id));
+  }
+  enc.clear();
+  EXPECT_TRUE(enc.chunks().empty());
+}
+
+TEST(Encoder, json) {
+  Records r;
+  lurker::Event *ev = r.event("lurker.test", TS);
+  fill(ev);
+  ev->set("esc", std::string("q\"b\\n\n\x01\x7f\x80\xff", 10));
+  r.emit(ev);
+
+  lurker::JsonEncoder enc;
+  EXPECT_EQ("{\"tag\":\"lurker.test\",\"time\":1412345678,"
+            "\"addr\":\"10.0.0.1\",\"addr6\":\"2001:db8::1\","
+            "\"bool\":true,\"esc\":\"q\\\"b\\\\n\\n\\u0001\x7f\\u0080"
+            "\\u00FF\",\"hash\":\"0123456789ABCDEF\",\"hex\":\"01ABFF\","
+            "\"int\":-5,\"int2\":-200,\"long\":\"" +
+            std::string(100, 'x') + "\",\"mac\":\"06:35:8A:6D:7D:37\","
+            "\"str\":\"abc\",\"uint\":300,\"uint2\":4000000000}\n",
+            encode(&enc, r.rec()));
+}
+
+TEST(Encoder, json_escape) {
+  // Runs found 16 bytes at a time must agree with escaping byte by byte,
+  // wherever special bytes fall in a block.
+  Records r;
+  std::vector<std::string> vals;
+  uint32_t x = 1;
+  for (size_t len = 0; len < 150; len++) {
+    std::string v(len, 'a');
+    for (size_t i = 0; i < len; i++) {
+      x = x * 1103515245 + 12345;
+      if ((x >> 16) % 7 == 0) {
+        v[i] = static_cast<char>(x >> 24);
+      }
+    }
+    vals.push_back(v);
+    lurker::Event *ev = r.event("t", TS);
+    ev->set("v", v);
+    r.emit(ev);
+  }
+
+  for (size_t k = 0; k < 2; k++) {
+    lurker::JsonEncoder enc;
+    enc.set_copy(k == 1);
+    const std::string out = encode(&enc, r.rec());
+    std::string expect;
+    for (size_t i = 0; i < vals.size(); i++) {
+      expect += "{\"tag\":\"t\",\"time\":1412345678,\"v\":\"";
+      for (size_t j = 0; j < vals[i].size(); j++) {
+        expect += json_escape(vals[i][j]);
+      }
+      expect += "\"}\n";
+    }
+    EXPECT_EQ(expect, out);
+  }
+}
@@ -0,0 +1,93 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/swarm/utils/hex.h"
+
+namespace {
+  // Scalar reference of hex_encode.
+  std::string reference(const uint8_t *p, size_t len, char sep) {
+    std::string s;
+    char buf[3];
+    for (size_t i = 0; i < len; i++) {
+      if (i > 0 && sep != '\0') {
+        s += sep;
+      }
+      snprintf(buf, sizeof(buf), "%02X", p[i]);
+      s += buf;
+    }
+    return s;
+  }
+
+  // Input of all byte values in shuffled order.
+  std::vector<uint8_t> input(size_t len) {
+    std::vector<uint8_t> v(len);
+    for (size_t i = 0; i < len; i++) {
+      v[i] = static_cast<uint8_t>(i * 167 + (i >> 8) * 13);
+    }
+    return v;
+  }
+}  // namespace
+
+TEST(HexEncode, known_answer) {
+  char buf[16];
+  swarm::hex_encode("\x00\x9f\xff\x5a", 4, buf);
+  EXPECT_EQ("009FFF5A", std::string(buf, 8));
+  EXPECT_EQ(11u, swarm::hex_encode("\x00\x9f\xff\x5a", 4, ':', buf));
+  EXPECT_EQ("00:9F:FF:5A", std::string(buf, 11));
+  EXPECT_EQ(0u, swarm::hex_encode("", 0, ':', buf));
+}
+
+TEST(HexEncode, compare_with_scalar) {
+  // Lengths and offsets cover the 32 and 16 byte SIMD blocks and the
+  // scalar tail, and nothing is written past the output.
+  const std::vector<uint8_t> src = input(300 + 32);
+  const char GUARD = '#';
+  for (size_t len = 0; len <= 300; len++) {
+    for (size_t off = 0; off < 32; off += (len < 100) ? 1 : 7) {
+      const uint8_t *p = src.data() + off;
+
+      std::string out(len * 2 + 1, GUARD);
+      swarm::hex_encode(p, len, &out[0]);
+      ASSERT_EQ(GUARD, out[len * 2]) << "len " << len;
+      out.resize(len * 2);
+      ASSERT_EQ(reference(p, len, '\0'), out)
+        << "len " << len << " off " << off;
+
+      std::string sep(len * 3 + 1, GUARD);
+      size_t n = swarm::hex_encode(p, len, '-', &sep[0]);
+      ASSERT_EQ((len > 0) ? len * 3 - 1 : 0, n);
+      ASSERT_EQ(GUARD, sep[n]) << "len " << len;
+      sep.resize(n);
+      ASSERT_EQ(reference(p, len, '-'), sep)
+        << "len " << len << " off " << off;
+    }
+  }
+}
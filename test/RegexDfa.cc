@@ -0,0 +1,147 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "./gtest.h"
+#include "../src/swarm/utils/regex-dfa.h"
+
+namespace {
+  typedef std::pair<int, size_t> Match;   // pattern ID and stream offset
+
+  // Collects matches with end offsets in the stream.
+  class Collector : public swarm::RegexDfa::Callback {
+  public:
+    std::vector<Match> match_;
+    size_t base_;
+    Collector() : base_(0) {}
+    bool match(int id, size_t end) {
+      this->match_.push_back(Match(id, this->base_ + end));
+      return true;
+    }
+  };
+
+  std::vector<Match> scan(const swarm::RegexDfa &dfa,
+                          const std::vector<std::string> &segs) {
+    Collector c;
+    swarm::RegexDfa::state_t st = swarm::RegexDfa::INIT;
+    for (size_t i = 0; i < segs.size(); i++) {
+      st = dfa.scan(segs[i].data(), segs[i].size(), &c, st);
+      c.base_ += segs[i].size();
+    }
+    std::sort(c.match_.begin(), c.match_.end());
+    return c.match_;
+  }
+
+  std::vector<Match> scan(const swarm::RegexDfa &dfa, const std::string &s) {
+    return scan(dfa, std::vector<std::string>(1, s));
+  }
+}  // namespace
+
+TEST(RegexDfa, overlapping_literals) {
+  swarm::RegexDfa dfa;
+  ASSERT_TRUE(dfa.add_literal("he", 2, 0));
+  ASSERT_TRUE(dfa.add_literal("she", 3, 1));
+  ASSERT_TRUE(dfa.add_literal("hers", 4, 2));
+  ASSERT_TRUE(dfa.compile());
+
+  std::vector<Match> m = scan(dfa, "ushers");
+  ASSERT_EQ(3u, m.size());
+  EXPECT_EQ(Match(0, 4), m[0]);
+  EXPECT_EQ(Match(1, 4), m[1]);
+  EXPECT_EQ(Match(2, 6), m[2]);
+}
+
+TEST(RegexDfa, syntax) {
+  swarm::RegexDfa dfa;
+  ASSERT_TRUE(dfa.add("a[0-9]{2,3}b", 0));
+  ASSERT_TRUE(dfa.add("x(yz|w)+\\.", 1));
+  ASSERT_TRUE(dfa.add("\\x00\\d\\s", 2));
+  ASSERT_TRUE(dfa.add("[^a-z]q?\\$", 3));
+  ASSERT_TRUE(dfa.compile());
+
+  EXPECT_EQ(1u, scan(dfa, "a12b").size());
+  EXPECT_EQ(1u, scan(dfa, "a123b").size());
+  EXPECT_EQ(0u, scan(dfa, "a1b a1234b").size());
+  EXPECT_EQ(1u, scan(dfa, "xyzwyz.").size());
+  EXPECT_EQ(0u, scan(dfa, "x.").size());
+  EXPECT_EQ(1u, scan(dfa, std::string("\0" "7 ", 3)).size());
+  EXPECT_EQ(1u, scan(dfa, "abcQ$").size());
+  EXPECT_EQ(0u, scan(dfa, "abcq$").size());
+}
+
+TEST(RegexDfa, anchor_and_case) {
+  swarm::RegexDfa dfa;
+  ASSERT_TRUE(dfa.add("^GET ", 0));
+  ASSERT_TRUE(dfa.add_literal("host:", 5, 1, swarm::RegexDfa::NOCASE));
+  ASSERT_TRUE(dfa.compile());
+
+  EXPECT_EQ(std::vector<Match>(1, Match(0, 4)), scan(dfa, "GET /"));
+  EXPECT_EQ(0u, scan(dfa, " GET /").size());
+  EXPECT_EQ(std::vector<Match>(1, Match(1, 7)), scan(dfa, "\r\nHoSt:"));
+  EXPECT_EQ(0u, scan(dfa, "get /").size());
+}
+
+TEST(RegexDfa, split_into_buffers) {
+  // Resuming with the returned state gives the same matches as one scan.
+  swarm::RegexDfa dfa;
+  ASSERT_TRUE(dfa.add("^SSH-[0-9.]+-", 0));
+  ASSERT_TRUE(dfa.add("ab+c", 1));
+  ASSERT_TRUE(dfa.add_literal("needle", 6, 2));
+  ASSERT_TRUE(dfa.compile());
+
+  const std::string s = "SSH-2.0-x abbbc needle abc needl";
+  const std::vector<Match> whole = scan(dfa, s);
+  ASSERT_EQ(4u, whole.size());
+  for (size_t i = 1; i < s.size(); i++) {
+    for (size_t j = i; j < s.size(); j += 7) {
+      std::vector<std::string> segs;
+      segs.push_back(s.substr(0, i));
+      segs.push_back(s.substr(i, j - i));
+      segs.push_back(s.substr(j));
+      EXPECT_EQ(whole, scan(dfa, segs)) << "split at " << i << "," << j;
+    }
+  }
+}
+
+TEST(RegexDfa, reject_bad_pattern) {
+  swarm::RegexDfa dfa;
+  EXPECT_FALSE(dfa.add("a(b", 0));
+  EXPECT_FALSE(dfa.add("[abc", 0));
+  EXPECT_FALSE(dfa.add("a{3,1}", 0));
+  EXPECT_FALSE(dfa.add("x", -1));
+}
+
+TEST(RegexDfa, state_limit) {
+  // (a|b)*a(a|b){n} needs 2^n DFA states.
+  swarm::RegexDfa dfa(64);
+  ASSERT_TRUE(dfa.add("a[ab]{10}", 0));
+  EXPECT_FALSE(dfa.compile());
+  EXPECT_FALSE(dfa.errmsg().empty());
+}
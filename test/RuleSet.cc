@@ -0,0 +1,144 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/rule.h"
+
+namespace {
+  // Feeds segments as one client stream and returns names of fired rules.
+  std::string inspect(const lurker::RuleSet &rs,
+                      const std::vector<std::string> &segs) {
+    lurker::RuleSet::State st;
+    ::memset(&st, 0, sizeof(st));
+    uint32_t offset = 0;
+    for (size_t i = 0; i < segs.size(); i++) {
+      rs.inspect(&st, segs[i].data(), segs[i].size(), offset);
+      offset += segs[i].size();
+    }
+    return rs.names(st);
+  }
+
+  std::string inspect(const lurker::RuleSet &rs, const std::string &s) {
+    return inspect(rs, std::vector<std::string>(1, s));
+  }
+
+  std::vector<std::string> segments(const std::string &a,
+                                    const std::string &b) {
+    std::vector<std::string> segs;
+    segs.push_back(a);
+    segs.push_back(b);
+    return segs;
+  }
+
+  std::string name(const char *prefix, size_t i) {
+    std::stringstream ss;
+    ss << prefix << i;
+    return ss.str();
+  }
+}  // namespace
+
+TEST(RuleSet, or_and) {
+  lurker::RuleSet rs;
+  ASSERT_TRUE(rs.add("get", "\"GET \"@0 and (\"/admin\" or /\\.php[ ?]/)"));
+  ASSERT_TRUE(rs.add("agent", "\"curl/\"i or \"Wget/\"i"));
+  ASSERT_TRUE(rs.compile());
+
+  EXPECT_EQ("get", inspect(rs, "GET /admin HTTP/1.0\r\n"));
+  EXPECT_EQ("get,agent",
+            inspect(rs, "GET /x.php HTTP/1.0\r\nUser-Agent: CURL/7\r\n"));
+  EXPECT_EQ("", inspect(rs, "POST /admin HTTP/1.0\r\n"));
+  EXPECT_EQ("", inspect(rs, " GET /admin"));
+  EXPECT_EQ("get", inspect(rs, segments("GE", "T /admin")));
+  EXPECT_EQ("get", inspect(rs, segments("GET /ad", "min")));
+}
+
+TEST(RuleSet, not_independent_of_segmentation) {
+  // "not" is decided only when the atom can no longer match.
+  lurker::RuleSet rs;
+  ASSERT_TRUE(rs.add("r1", "\"AAA\" and not \"BBB\""));
+  ASSERT_TRUE(rs.add("r2", "\"AAA\" and not \"BBB\"@3-10"));
+  ASSERT_TRUE(rs.compile());
+
+  EXPECT_EQ("", inspect(rs, "AAABBB"));
+  EXPECT_EQ("", inspect(rs, segments("AAA", "BBB")));
+  EXPECT_EQ("", inspect(rs, segments("AAA", std::string(5, '.'))));
+  EXPECT_EQ("r2", inspect(rs, segments("AAA", std::string(20, '.'))));
+  EXPECT_EQ("r1,r2", inspect(rs, segments("AAA",
+                                          std::string(5000, '.'))));
+  EXPECT_EQ("r2,r1", inspect(rs, segments("AAA" + std::string(20, '.'),
+                                          std::string(5000, '.'))));
+  EXPECT_EQ("r2", inspect(rs, segments("AAA" + std::string(20, '.'),
+                                       "BBB" + std::string(5000, '.'))));
+}
+
+TEST(RuleSet, fire_once) {
+  lurker::RuleSet rs;
+  ASSERT_TRUE(rs.add("x", "\"x\""));
+  ASSERT_TRUE(rs.compile());
+  EXPECT_EQ("x", inspect(rs, segments("x x x", "x")));
+}
+
+TEST(RuleSet, many_atoms) {
+  // OR only rules take no atom slot however many atoms they have.
+  lurker::RuleSet rs;
+  std::string expr = "\"a0\"";
+  for (size_t i = 1; i < 300; i++) {
+    expr += " or \"" + name("a", i) + "\"";
+  }
+  ASSERT_TRUE(rs.add("or", expr));
+  for (size_t i = 0; i < lurker::RuleSet::ATOM_SLOT_MAX / 2; i++) {
+    ASSERT_TRUE(rs.add(name("and", i), "\"" + name("p", i) + "q\" and \"" +
+                       name("r", i) + "s\"")) << rs.errmsg();
+  }
+  // Bits for and/not atoms are exhausted, adding is refused.
+  EXPECT_FALSE(rs.add("over", "\"y\" and \"z\""));
+  EXPECT_FALSE(rs.errmsg().empty());
+  ASSERT_TRUE(rs.compile());
+
+  EXPECT_EQ("or", inspect(rs, "a299"));
+  EXPECT_EQ(name("and", lurker::RuleSet::ATOM_SLOT_MAX / 2 - 1),
+            inspect(rs, segments(name("p", lurker::RuleSet::ATOM_SLOT_MAX /
+                                      2 - 1) + "q ",
+                                 name("r", lurker::RuleSet::ATOM_SLOT_MAX /
+                                      2 - 1) + "s")));
+}
+
+TEST(RuleSet, reject_bad_rule) {
+  lurker::RuleSet rs;
+  EXPECT_FALSE(rs.add("n", "not \"Q\""));
+  EXPECT_FALSE(rs.add("p", "\"a\" and (\"b\""));
+  EXPECT_FALSE(rs.add("r", "/a(b/"));
+  EXPECT_FALSE(rs.add("bad name", "\"a\""));
+  ASSERT_TRUE(rs.add("ok", "\"a\""));
+  EXPECT_FALSE(rs.add("ok", "\"b\""));
+  ASSERT_TRUE(rs.compile());
+  EXPECT_FALSE(rs.add("late", "\"c\""));
+}
@@ -0,0 +1,151 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "./packet.h"
+
+namespace {
+  const char *const KEYS[] = {
+    "ssh.banner", "ssh.proto_version", "ssh.software", "ssh.comments",
+    "ssh.hassh", "ssh.hassh_algorithms",
+  };
+
+  const char BANNER[] = "SSH-2.0-OpenSSH_8.9p1 Ubuntu-3";
+  const char HASSH[] = "c001f560064f07fd2a02d1c93cb2c90f";
+  const char HASSH_ALGO[] =
+    "curve25519-sha256,diffie-hellman-group14-sha256;"
+    "chacha20-poly1305@openssh.com,aes128-ctr;hmac-sha2-256;"
+    "none,zlib@openssh.com";
+
+  class SshDecoder : public ::testing::Test {
+  protected:
+    swarm::NetDec nd_;
+    test::Capture *client_;
+
+    virtual void SetUp() {
+      this->nd_.set_default_decoder("ether");
+      this->client_ = new test::Capture(std::vector<std::string>
+                                        (KEYS, KEYS + sizeof(KEYS) /
+                                         sizeof(KEYS[0])));
+      this->nd_.set_handler("ssh.client", this->client_);
+    }
+    virtual void TearDown() {
+      delete this->client_;
+    }
+  };
+
+  // Binary packet of client SSH_MSG_KEXINIT (RFC 4253 7.1).
+  std::string kexinit() {
+    const char *const lists[] = {
+      "curve25519-sha256,diffie-hellman-group14-sha256",
+      "ssh-ed25519,rsa-sha2-512",
+      "chacha20-poly1305@openssh.com,aes128-ctr",
+      "aes256-ctr",
+      "hmac-sha2-256",
+      "hmac-sha1",
+      "none,zlib@openssh.com",
+      "none",
+      "",
+      "",
+    };
+    std::string payload;
+    payload.push_back(20);
+    payload.append(16, 'C');       // cookie
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+      test::put_vec(&payload, lists[i], 4);
+    }
+    payload.push_back(0);          // first_kex_packet_follows
+    test::put_be(&payload, 0, 4);  // reserved
+
+    // Padding makes the packet a multiple of 8, and is at least 4 bytes.
+    size_t pad = 8 - (4 + 1 + payload.size()) % 8;
+    if (pad < 4) {
+      pad += 8;
+    }
+    std::string pkt;
+    test::put_be(&pkt, 1 + payload.size() + pad, 4);
+    pkt.push_back(static_cast<char>(pad));
+    pkt.append(payload);
+    pkt.append(pad, '\0');
+    return pkt;
+  }
+}  // namespace
+
+TEST_F(SshDecoder, banner_and_kexinit) {
+  test::TcpStream s(&this->nd_, 22);
+  s.send(std::string(BANNER) + "\r\n" + kexinit());
+
+  ASSERT_EQ(1u, this->client_->count_);
+  std::map<std::string, std::string> &v = this->client_->value_;
+  EXPECT_EQ(BANNER, v["ssh.banner"]);
+  EXPECT_EQ("2.0", v["ssh.proto_version"]);
+  EXPECT_EQ("OpenSSH_8.9p1", v["ssh.software"]);
+  EXPECT_EQ("Ubuntu-3", v["ssh.comments"]);
+  EXPECT_EQ(HASSH_ALGO, v["ssh.hassh_algorithms"]);
+  EXPECT_EQ(HASSH, v["ssh.hassh"]);
+}
+
+TEST_F(SshDecoder, split_into_segments) {
+  // One event per session, whichever way the stream is segmented.
+  const std::string pkt = kexinit();
+  test::TcpStream s(&this->nd_, 22);
+  s.send(std::string(BANNER) + "\r\n");
+  EXPECT_EQ(0u, this->client_->count_);
+  s.send(pkt.substr(0, 3));
+  s.send(pkt.substr(3, 50));
+  EXPECT_EQ(0u, this->client_->count_);
+  s.send(pkt.substr(53));
+
+  ASSERT_EQ(1u, this->client_->count_);
+  EXPECT_EQ(BANNER, this->client_->value_["ssh.banner"]);
+  EXPECT_EQ(HASSH, this->client_->value_["ssh.hassh"]);
+
+  s.send(pkt);
+  EXPECT_EQ(1u, this->client_->count_);
+}
+
+TEST_F(SshDecoder, no_kexinit) {
+  // Identification string is reported when the next data is not KEXINIT.
+  test::TcpStream s(&this->nd_, 22);
+  s.send("SSH-1.99-PuTTY_Release_0.78\r\n");
+  s.send(std::string(64, 'x'));
+
+  ASSERT_EQ(1u, this->client_->count_);
+  EXPECT_EQ("1.99", this->client_->value_["ssh.proto_version"]);
+  EXPECT_EQ("PuTTY_Release_0.78", this->client_->value_["ssh.software"]);
+  EXPECT_FALSE(this->client_->has("ssh.comments"));
+  EXPECT_FALSE(this->client_->has("ssh.hassh"));
+}
+
+TEST_F(SshDecoder, not_ssh) {
+  test::TcpStream s(&this->nd_, 22);
+  s.send("GET / HTTP/1.0\r\n\r\n");
+  s.send("SSH-2.0-late\r\n");
+  EXPECT_EQ(0u, this->client_->count_);
+}
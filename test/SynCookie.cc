@@ -0,0 +1,174 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string>
+#include "./gtest.h"
+#include "./packet.h"
+#include "../src/syncookie.h"
+#include "../src/pkt.h"
+
+namespace {
+  // Swarm without capture, fed by NetDec directly.
+  class TestSwarm : public swarm::Swarm {
+  public:
+    swarm::NetDec *netdec() { return this->netdec_; }
+  };
+
+  // Makes a cookie for SYN and checks other packets by SynCookie.
+  class Probe : public swarm::Handler {
+  private:
+    lurker::SynCookie *cookie_;
+    swarm::val_id flags_;
+  public:
+    uint32_t made_;
+    bool checked_;
+    swarm::SessionFilter::Verdict verdict_;
+
+    Probe(swarm::Swarm *sw, lurker::SynCookie *cookie) :
+      cookie_(cookie), made_(0), checked_(false),
+      verdict_(swarm::SessionFilter::ADMIT) {
+      this->flags_ = sw->lookup_value_id("tcp.flags");
+    }
+    void recv(swarm::ev_id eid, const swarm::Property &p) {
+      if (p.value(this->flags_).uint32() & TCP_SYN) {
+        this->made_ = this->cookie_->make(p);
+      } else {
+        this->checked_ = this->cookie_->check(p);
+      }
+      this->verdict_ = this->cookie_->admit(p);
+    }
+  };
+
+  const uint32_t CLIENT = 0x0a000001;
+  const uint32_t TARGET = 0x0a000002;
+  const uint32_t OTHER  = 0x0a000003;
+
+  class SynCookie : public ::testing::Test {
+  protected:
+    TestSwarm sw_;
+    lurker::TargetSet target_;
+    lurker::SynCookie *cookie_;
+    Probe *probe_;
+
+    virtual void SetUp() {
+      ASSERT_TRUE(this->target_.insert("10.0.0.2:*"));
+      ASSERT_TRUE(this->target_.compile());
+      this->sw_.netdec()->set_default_decoder("ether");
+      this->cookie_ = new lurker::SynCookie(&this->sw_, &this->target_);
+      this->probe_ = new Probe(&this->sw_, this->cookie_);
+      this->sw_.set_handler("tcp.packet", this->probe_);
+    }
+    virtual void TearDown() {
+      delete this->probe_;
+      delete this->cookie_;
+    }
+
+    uint32_t syn(uint32_t dst, uint16_t sport, uint32_t isn, time_t ts) {
+      test::input(this->sw_.netdec(),
+                  test::tcp_frame(CLIENT, dst, sport, 80, isn, 0,
+                                  TCP_SYN, ""), ts);
+      return this->probe_->made_;
+    }
+    bool ack(uint32_t dst, uint16_t sport, uint32_t seq, uint32_t ack,
+             time_t ts) {
+      test::input(this->sw_.netdec(),
+                  test::tcp_frame(CLIENT, dst, sport, 80, seq, ack,
+                                  TCP_ACK, ""), ts);
+      return this->probe_->checked_;
+    }
+  };
+}  // namespace
+
+TEST(SipHash, known_answer) {
+  // Test vectors of the SipHash paper: key 00..0f, message 00..(len-1).
+  uint8_t key[swarm::SIPHASH_KEY_LEN], msg[64];
+  for (size_t i = 0; i < sizeof(key); i++) {
+    key[i] = i;
+  }
+  for (size_t i = 0; i < sizeof(msg); i++) {
+    msg[i] = i;
+  }
+  EXPECT_EQ(0x726fdb47dd0e0e31ULL, swarm::siphash24(key, msg, 0));
+  EXPECT_EQ(0x74f839c593dc67fdULL, swarm::siphash24(key, msg, 1));
+  EXPECT_EQ(0xab0200f58b01d137ULL, swarm::siphash24(key, msg, 7));
+  EXPECT_EQ(0x93f5f5799a932462ULL, swarm::siphash24(key, msg, 8));
+  EXPECT_EQ(0xa129ca6149be45e5ULL, swarm::siphash24(key, msg, 15));
+  EXPECT_EQ(0x3f2acc7f57c29bdbULL, swarm::siphash24(key, msg, 16));
+  EXPECT_EQ(0x958a324ceb064572ULL, swarm::siphash24(key, msg, 63));
+}
+
+TEST_F(SynCookie, check) {
+  const time_t ts = 1000;
+  const uint32_t isn = 0x12345678;
+  const uint32_t c = this->syn(TARGET, 40000, isn, ts);
+  EXPECT_EQ(c, this->syn(TARGET, 40000, isn, ts + 1));
+  EXPECT_NE(c, this->syn(TARGET, 40001, isn, ts));
+  EXPECT_NE(c, this->syn(TARGET, 40000, isn + 1, ts));
+
+  EXPECT_TRUE(this->ack(TARGET, 40000, isn + 1, c + 1, ts));
+  EXPECT_FALSE(this->ack(TARGET, 40000, isn + 1, c + 2, ts));
+  EXPECT_FALSE(this->ack(TARGET, 40000, isn + 2, c + 1, ts));
+  EXPECT_FALSE(this->ack(TARGET, 40001, isn + 1, c + 1, ts));
+  EXPECT_FALSE(this->ack(OTHER, 40000, isn + 1, c + 1, ts));
+}
+
+TEST_F(SynCookie, period) {
+  // A cookie is valid in its own and the next period only.
+  const time_t P = lurker::SynCookie::PERIOD;
+  const time_t ts = 10 * P;
+  const uint32_t isn = 7;
+  const uint32_t c = this->syn(TARGET, 40000, isn, ts);
+  EXPECT_TRUE(this->ack(TARGET, 40000, isn + 1, c + 1, ts + P - 1));
+  EXPECT_TRUE(this->ack(TARGET, 40000, isn + 1, c + 1, ts + 2 * P - 1));
+  EXPECT_FALSE(this->ack(TARGET, 40000, isn + 1, c + 1, ts + 2 * P));
+  EXPECT_FALSE(this->ack(TARGET, 40000, isn + 1, c + 1, ts - 1));
+}
+
+TEST_F(SynCookie, admit) {
+  const time_t ts = 1000;
+  const uint32_t isn = 100;
+  this->syn(TARGET, 40000, isn, ts);
+  EXPECT_EQ(swarm::SessionFilter::REJECT, this->probe_->verdict_);
+  const uint32_t c = this->probe_->made_;
+
+  this->ack(TARGET, 40000, isn + 1, c + 1, ts);
+  EXPECT_EQ(swarm::SessionFilter::ESTABLISH, this->probe_->verdict_);
+  this->ack(TARGET, 40000, isn + 1, c, ts);
+  EXPECT_EQ(swarm::SessionFilter::REJECT, this->probe_->verdict_);
+
+  this->cookie_->set_establish(false);
+  this->ack(TARGET, 40000, isn + 1, c + 1, ts);
+  EXPECT_EQ(swarm::SessionFilter::REJECT, this->probe_->verdict_);
+
+  // Flows not involving targets are left to tcp_ssn as usual.
+  this->syn(OTHER, 40000, isn, ts);
+  EXPECT_EQ(swarm::SessionFilter::ADMIT, this->probe_->verdict_);
+  test::input(this->sw_.netdec(),
+              test::tcp_frame(TARGET, CLIENT, 80, 40000, c, isn + 1,
+                              TCP_SYN | TCP_ACK, ""), ts);
+  EXPECT_EQ(swarm::SessionFilter::REJECT, this->probe_->verdict_);
+}
@@ -0,0 +1,428 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "../src/target.h"
+
+namespace {
+  // Entry as generated by the test, matched linearly as reference.
+  struct Entry {
+    uint8_t addr_[16];
+    int len_;
+    bool v6_;
+    int lo_, hi_;     // lo_ < 0 means any port
+  };
+
+  class Random {
+    uint64_t x_;
+  public:
+    explicit Random(uint64_t seed) : x_(seed) {}
+    uint32_t next() {
+      this->x_ ^= this->x_ << 13;
+      this->x_ ^= this->x_ >> 7;
+      this->x_ ^= this->x_ << 17;
+      return static_cast<uint32_t>(this->x_ >> 16);
+    }
+    uint32_t next(uint32_t n) { return this->next() % n; }
+  };
+
+  bool linear_match(const std::vector<Entry> &ent, const uint8_t *addr,
+                    bool v6, int port) {
+    for (size_t i = 0; i < ent.size(); i++) {
+      const Entry &e = ent[i];
+      if (e.v6_ != v6 || (e.lo_ >= 0 && (port < e.lo_ || e.hi_ < port))) {
+        continue;
+      }
+      int k;
+      for (k = 0; k < e.len_; k++) {
+        if (((e.addr_[k / 8] ^ addr[k / 8]) & (0x80 >> (k % 8))) != 0) {
+          break;
+        }
+      }
+      if (k == e.len_) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::string format(const Entry &e) {
+    char a[INET6_ADDRSTRLEN], buf[128];
+    inet_ntop(e.v6_ ? AF_INET6 : AF_INET, e.addr_, a, sizeof(a));
+    if (e.lo_ < 0) {
+      snprintf(buf, sizeof(buf), e.v6_ ? "[%s/%d]:*" : "%s/%d:*", a, e.len_);
+    } else {
+      snprintf(buf, sizeof(buf), e.v6_ ? "[%s/%d]:%d-%d" : "%s/%d:%d-%d",
+               a, e.len_, e.lo_, e.hi_);
+    }
+    return std::string(buf);
+  }
+
+  // Random address near a few bases, so that prefixes overlap.
+  void random_addr(Random *r, bool v6, uint8_t *addr) {
+    static const uint8_t base4[] = {10, 0, 192, 168};
+    static const uint8_t base6[] = {0x20, 0x01, 0x0d, 0xb8};
+    memset(addr, 0, 16);
+    size_t len = v6 ? 16 : 4;
+    for (size_t i = 0; i < len; i++) {
+      addr[i] = r->next(256);
+    }
+    // Leading bytes from a small set: fully random, one of two bases or
+    // close to them.
+    uint32_t mode = r->next(4);
+    if (mode > 0) {
+      addr[0] = (v6 ? base6 : base4)[2 * (mode & 1)];
+      addr[1] = (v6 ? base6 : base4)[2 * (mode & 1) + 1];
+      if (mode == 3) {
+        addr[2] = r->next(4);
+      }
+    }
+  }
+
+  uint8_t *addr_of(const char *str, uint8_t *buf) {
+    if (inet_pton(AF_INET, str, buf) != 1 &&
+        inet_pton(AF_INET6, str, buf) != 1) {
+      return nullptr;
+    }
+    return buf;
+  }
+
+  // Image file in a temporary directory, removed at the end of a test.
+  class ImageFile {
+    std::string dir_;
+  public:
+    ImageFile() {
+      char tmpl[] = "/tmp/lurker-test.XXXXXX";
+      this->dir_ = mkdtemp(tmpl);
+    }
+    ~ImageFile() {
+      unlink(this->path("orig").c_str());
+      unlink(this->path("bad").c_str());
+      rmdir(this->dir_.c_str());
+    }
+    std::string path(const char *name) const {
+      return this->dir_ + "/" + name;
+    }
+    std::string read(const char *name) const {
+      std::ifstream ifs(this->path(name).c_str(), std::ios::binary);
+      return std::string(std::istreambuf_iterator<char>(ifs),
+                         std::istreambuf_iterator<char>());
+    }
+    void write(const char *name, const std::string &data) const {
+      std::ofstream ofs(this->path(name).c_str(), std::ios::binary);
+      ofs << data;
+    }
+  };
+
+  // Offsets of counts in the image header (see ImageHeader).
+  const size_t IMG_NODE_N = 32, IMG_LEAF_N = 40, IMG_PORT_BM_N = 48;
+
+  void add_u64(std::string *img, size_t off, uint64_t v) {
+    uint64_t n;
+    memcpy(&n, img->data() + off, sizeof(n));
+    n += v;
+    img->replace(off, sizeof(n), reinterpret_cast<const char*>(&n),
+                 sizeof(n));
+  }
+
+  bool has(const lurker::TargetSet &ts, const char *str, int port) {
+    uint8_t buf[16];
+    size_t len = (strchr(str, ':') != nullptr) ? 16 : 4;
+    return (addr_of(str, buf) && ts.has(buf, len, port));
+  }
+
+  // Replaces targets of ts with a new table of one entry.
+  void replace(lurker::TargetSet *ts, const char *entry) {
+    lurker::TargetSet fresh;
+    fresh.insert(entry);
+    fresh.compile();
+    ts->replace(&fresh);
+  }
+
+  // Runs wait_reclaim() on another thread, as the reload thread does.
+  struct Waiter {
+    lurker::TargetSet *ts_;
+    bool ok_;
+    pthread_t th_;
+
+    static void *run(void *obj) {
+      Waiter *w = static_cast<Waiter*>(obj);
+      w->ok_ = w->ts_->wait_reclaim();
+      return nullptr;
+    }
+    explicit Waiter(lurker::TargetSet *ts) : ts_(ts), ok_(false) {
+      pthread_create(&this->th_, nullptr, Waiter::run, this);
+    }
+    void join() { pthread_join(this->th_, nullptr); }
+  };
+}
+
+TEST(TargetSet, cidr_and_port_range) {
+  lurker::TargetSet ts;
+  EXPECT_TRUE(ts.insert("10.1.0.0/16:80"));
+  EXPECT_TRUE(ts.insert("10.1.2.0/24:8000-8080"));
+  EXPECT_TRUE(ts.insert("10.1.2.3:*"));
+  EXPECT_TRUE(ts.insert("192.168.1.77/24:22"));   // host bits are cleared
+  EXPECT_TRUE(ts.compile());
+  EXPECT_EQ(4U, ts.count());
+
+  EXPECT_TRUE(has(ts, "10.1.0.1", 80));
+  EXPECT_TRUE(has(ts, "10.1.255.255", 80));
+  EXPECT_FALSE(has(ts, "10.2.0.1", 80));
+  EXPECT_FALSE(has(ts, "10.1.0.1", 81));
+  EXPECT_TRUE(has(ts, "10.1.2.200", 8000));
+  EXPECT_TRUE(has(ts, "10.1.2.200", 8080));
+  EXPECT_TRUE(has(ts, "10.1.2.200", 80));
+  EXPECT_FALSE(has(ts, "10.1.2.200", 8081));
+  EXPECT_FALSE(has(ts, "10.1.3.200", 8000));
+  EXPECT_TRUE(has(ts, "10.1.2.3", 1));
+  EXPECT_TRUE(has(ts, "10.1.2.3", 65535));
+  EXPECT_FALSE(has(ts, "10.1.2.4", 1));
+  EXPECT_TRUE(has(ts, "192.168.1.1", 22));
+  EXPECT_FALSE(has(ts, "192.168.2.1", 22));
+  EXPECT_FALSE(has(ts, "10.1.0.1", -1));
+  EXPECT_FALSE(has(ts, "10.1.0.1", 65536));
+
+  uint8_t a[16];
+  EXPECT_TRUE(ts.has(addr_of("10.1.9.9", a), 4));
+  EXPECT_FALSE(ts.has(addr_of("10.9.9.9", a), 4));
+}
+
+TEST(TargetSet, zero_length_prefix) {
+  lurker::TargetSet ts;
+  EXPECT_TRUE(ts.insert("0.0.0.0/0:443"));
+  EXPECT_TRUE(ts.compile());
+  EXPECT_TRUE(has(ts, "1.2.3.4", 443));
+  EXPECT_TRUE(has(ts, "255.255.255.255", 443));
+  EXPECT_FALSE(has(ts, "1.2.3.4", 444));
+  EXPECT_FALSE(has(ts, "2001:db8::1", 443));
+}
+
+TEST(TargetSet, ipv6) {
+  lurker::TargetSet ts;
+  EXPECT_TRUE(ts.insert("[2001:db8::/48]:80"));
+  EXPECT_TRUE(ts.insert("[2001:db8:0:1::]/64:443"));
+  EXPECT_TRUE(ts.insert("2001:db8:ffff::1:22"));
+  EXPECT_TRUE(ts.insert("[fe80::1]:*"));
+  EXPECT_TRUE(ts.insert("10.0.0.0/8:80"));
+  EXPECT_TRUE(ts.compile());
+
+  EXPECT_TRUE(has(ts, "2001:db8::1", 80));
+  EXPECT_TRUE(has(ts, "2001:db8:0:ffff::1", 80));
+  EXPECT_FALSE(has(ts, "2001:db8:1::1", 80));
+  EXPECT_TRUE(has(ts, "2001:db8:0:1::5", 443));
+  EXPECT_FALSE(has(ts, "2001:db8:0:2::5", 443));
+  EXPECT_TRUE(has(ts, "2001:db8:ffff::1", 22));
+  EXPECT_FALSE(has(ts, "2001:db8:ffff::2", 22));
+  EXPECT_TRUE(has(ts, "fe80::1", 12345));
+  EXPECT_FALSE(has(ts, "fe80::2", 12345));
+
+  // IPv4 and IPv6 tables are separate.
+  uint8_t a[16];
+  memset(a, 0, sizeof(a));
+  a[0] = 10;
+  EXPECT_TRUE(ts.has(a, 4, 80));
+  EXPECT_FALSE(ts.has(a, 16, 80));
+}
+
+TEST(TargetSet, reject_bad_entry) {
+  static const char *bad[] = {
+    "10.0.0.1",               // no port
+    "10.0.0.1:",
+    "10.0.0.1:abc",
+    "10.0.0.1:80x",
+    "10.0.0.1:-1",
+    "10.0.0.1:65536",
+    "10.0.0.1:90-80",
+    "10.0.0.1:80-",
+    "10.0.0.1:80-70000",
+    "10.0.0.0/33:80",
+    "10.0.0.0/-1:80",
+    "10.0.0.0/:80",
+    "10.0.0.0/8x:80",
+    "300.0.0.1:80",
+    "example.com:80",
+    "[2001:db8::1:80",
+    "[2001:db8::1]x:80",
+    "[2001:db8::/129]:80",
+    ":80",
+  };
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    lurker::TargetSet ts;
+    EXPECT_FALSE(ts.insert(bad[i])) << bad[i];
+    EXPECT_FALSE(ts.errmsg().empty()) << bad[i];
+    EXPECT_EQ(0U, ts.count()) << bad[i];
+  }
+}
+
+TEST(TargetSet, compare_with_linear_match) {
+  Random r(0x9e3779b97f4a7c15ULL);
+  std::vector<Entry> ent;
+  lurker::TargetSet ts;
+
+  for (size_t i = 0; i < 3000; i++) {
+    Entry e;
+    e.v6_ = (r.next(4) == 0);
+    random_addr(&r, e.v6_, e.addr_);
+    int max_len = e.v6_ ? 128 : 32;
+    // Prefixes of any length from /8 around the bases, some host routes.
+    e.len_ = (r.next(8) == 0) ? max_len : r.next(max_len - 7) + 8;
+    for (int k = e.len_; k < max_len; k++) {
+      e.addr_[k / 8] &= ~(0x80 >> (k % 8));
+    }
+    uint32_t kind = r.next(4);
+    if (kind == 0) {
+      e.lo_ = e.hi_ = -1;
+    } else if (kind == 1) {
+      e.lo_ = e.hi_ = r.next(1024);
+    } else {
+      e.lo_ = r.next(65536);
+      e.hi_ = e.lo_ + r.next((kind == 2) ? 64 : 65536 - e.lo_);
+      if (e.hi_ > 65535) {
+        e.hi_ = 65535;
+      }
+    }
+    ent.push_back(e);
+    ASSERT_TRUE(ts.insert(format(e))) << format(e);
+  }
+  ASSERT_TRUE(ts.compile());
+
+  size_t n_match = 0;
+  for (size_t i = 0; i < 200000; i++) {
+    bool v6 = (r.next(4) == 0);
+    uint8_t addr[16];
+    random_addr(&r, v6, addr);
+    int port = (r.next(2) == 0) ? r.next(1024) : r.next(65536);
+    bool expect = linear_match(ent, addr, v6, port);
+    ASSERT_EQ(expect, ts.has(addr, v6 ? 16 : 4, port)) << i;
+    n_match += expect;
+  }
+  // Both outcomes must be well covered for the comparison to mean much.
+  EXPECT_LT(20000U, n_match);
+  EXPECT_LT(20000U, 200000 - n_match);
+}
+
+TEST(TargetSet, image) {
+  ImageFile img;
+  lurker::TargetSet src;
+  EXPECT_TRUE(src.insert("10.1.0.0/16:80-90"));
+  EXPECT_TRUE(src.insert("[2001:db8::/32]:*"));
+  EXPECT_TRUE(src.compile());
+  ASSERT_TRUE(src.save(img.path("orig")));
+  EXPECT_TRUE(lurker::TargetSet::is_image(img.path("orig")));
+
+  lurker::TargetSet ts;
+  ASSERT_TRUE(ts.load(img.path("orig"))) << ts.errmsg();
+  EXPECT_TRUE(ts.compile());
+  EXPECT_EQ(2U, ts.count());
+  EXPECT_TRUE(has(ts, "10.1.2.3", 85));
+  EXPECT_FALSE(has(ts, "10.1.2.3", 91));
+  EXPECT_TRUE(has(ts, "2001:db8::1", 1));
+  EXPECT_FALSE(ts.insert("10.2.0.0/16:80") && ts.compile());
+}
+
+TEST(TargetSet, reject_corrupted_image) {
+  ImageFile img;
+  lurker::TargetSet src;
+  EXPECT_TRUE(src.insert("10.1.0.0/16:80-90"));
+  EXPECT_TRUE(src.insert("10.1.2.0/24:443"));
+  EXPECT_TRUE(src.compile());
+  ASSERT_TRUE(src.save(img.path("orig")));
+  const std::string orig = img.read("orig");
+  ASSERT_LT(IMG_PORT_BM_N + 8, orig.size());
+
+  std::vector<std::string> bad;
+  // Counts whose byte size wraps around to the same file size.
+  bad.push_back(orig);
+  add_u64(&bad.back(), IMG_PORT_BM_N, 1ULL << 61);
+  bad.push_back(orig);
+  add_u64(&bad.back(), IMG_LEAF_N, 1ULL << 62);
+  bad.push_back(orig);
+  add_u64(&bad.back(), IMG_NODE_N, 1ULL << 63);
+  // Counts not matching the file size.
+  bad.push_back(orig);
+  add_u64(&bad.back(), IMG_PORT_BM_N, lurker::TargetSet::PORT_BM_WORDS);
+  bad.push_back(orig);
+  add_u64(&bad.back(), IMG_NODE_N, 1);
+  // Truncated file and header only.
+  bad.push_back(orig.substr(0, orig.size() - 4));
+  bad.push_back(orig.substr(0, 56));
+  // Port set id of the last leaf out of range.
+  bad.push_back(orig);
+  bad.back().replace(orig.size() - 4, 4, "\xff\xff\xff\x7f", 4);
+  // Bad magic.
+  bad.push_back(orig);
+  bad.back()[0] = 'X';
+
+  for (size_t i = 0; i < bad.size(); i++) {
+    img.write("bad", bad[i]);
+    lurker::TargetSet ts;
+    EXPECT_FALSE(ts.load(img.path("bad"))) << i;
+    EXPECT_FALSE(ts.errmsg().empty()) << i;
+    EXPECT_FALSE(has(ts, "10.1.2.3", 80)) << i;
+  }
+}
+
+TEST(TargetSet, wait_reclaim) {
+  lurker::TargetSet ts;
+  ASSERT_TRUE(ts.insert("10.0.0.1:80"));
+  ASSERT_TRUE(ts.compile());
+  replace(&ts, "10.0.0.2:80");
+  EXPECT_TRUE(has(ts, "10.0.0.2", 80));
+  EXPECT_FALSE(ts.reclaim());
+
+  // Woken by the quiescent state, without polling.
+  Waiter w1(&ts);
+  usleep(10000);
+  ts.quiescent();
+  w1.join();
+  EXPECT_TRUE(w1.ok_);
+  EXPECT_TRUE(ts.reclaim());
+
+  // Nothing to wait for.
+  EXPECT_TRUE(ts.wait_reclaim());
+
+  // interrupt() releases the waiter for shutdown.
+  replace(&ts, "10.0.0.3:80");
+  Waiter w2(&ts);
+  usleep(10000);
+  ts.interrupt();
+  w2.join();
+  EXPECT_FALSE(w2.ok_);
+  ts.quiescent();
+  EXPECT_TRUE(ts.reclaim());
+}
@@ -0,0 +1,212 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "./gtest.h"
+#include "./packet.h"
+
+namespace {
+  const char *const KEYS[] = {
+    "tls.version", "tls.sni", "tls.alpn", "tls.ciphers", "tls.extensions",
+    "tls.ja3", "tls.ja3_hash", "tls.ja4",
+  };
+
+  class TlsDecoder : public ::testing::Test {
+  protected:
+    swarm::NetDec nd_;
+    test::Capture *hello_;
+
+    virtual void SetUp() {
+      this->nd_.set_default_decoder("ether");
+      this->hello_ = new test::Capture(std::vector<std::string>
+                                       (KEYS, KEYS + sizeof(KEYS) /
+                                        sizeof(KEYS[0])));
+      this->nd_.set_handler("tls.client_hello", this->hello_);
+    }
+    virtual void TearDown() {
+      delete this->hello_;
+    }
+  };
+
+  void put_u16_list(std::string *s, const std::vector<uint16_t> &list) {
+    for (size_t i = 0; i < list.size(); i++) {
+      test::put_be(s, list[i], 2);
+    }
+  }
+
+  void put_ext(std::string *s, uint16_t type, const std::string &body) {
+    test::put_be(s, type, 2);
+    test::put_vec(s, body, 2);
+  }
+
+  // Wraps ClientHello body into handshake and record headers.
+  std::string record(const std::string &hello) {
+    std::string hs, rec;
+    hs.push_back(0x01);
+    test::put_vec(&hs, hello, 3);
+    rec.append("\x16\x03\x01", 3);
+    test::put_vec(&rec, hs, 2);
+    return rec;
+  }
+
+  std::string client_hello(uint16_t version, const std::string &ciphers,
+                           const std::string &exts, bool has_exts) {
+    std::string h;
+    test::put_be(&h, version, 2);
+    h.append(32, 'R');
+    h.push_back(0);                 // legacy_session_id
+    test::put_vec(&h, ciphers, 2);
+    h.append("\x01\x00", 2);        // legacy_compression_methods
+    if (has_exts) {
+      test::put_vec(&h, exts, 2);
+    }
+    return record(h);
+  }
+
+  // TLS 1.3 ClientHello with GREASE values, SNI and ALPN.
+  std::string modern_hello() {
+    std::string ciphers;
+    put_u16_list(&ciphers, {0x0a0a, 0x1301, 0x1302, 0xc02b, 0x002f});
+
+    std::string exts, body, list;
+    put_ext(&exts, 0x1a1a, "");
+
+    list.push_back(0);
+    test::put_vec(&list, "example.com", 2);
+    test::put_vec(&body, list, 2);
+    put_ext(&exts, 0, body);
+
+    body.clear();
+    list.clear();
+    put_u16_list(&list, {0x2a2a, 0x001d, 0x0017});
+    test::put_vec(&body, list, 2);
+    put_ext(&exts, 10, body);
+
+    put_ext(&exts, 11, std::string("\x01\x00", 2));
+
+    body.clear();
+    list.clear();
+    put_u16_list(&list, {0x0403, 0x0804, 0x0401});
+    test::put_vec(&body, list, 2);
+    put_ext(&exts, 13, body);
+
+    body.clear();
+    list.clear();
+    test::put_vec(&list, "h2", 1);
+    test::put_vec(&list, "http/1.1", 1);
+    test::put_vec(&body, list, 2);
+    put_ext(&exts, 16, body);
+
+    body.clear();
+    list.clear();
+    put_u16_list(&list, {0x0304, 0x0303});
+    test::put_vec(&body, list, 1);
+    put_ext(&exts, 43, body);
+
+    return client_hello(0x0303, ciphers, exts, true);
+  }
+}  // namespace
+
+TEST_F(TlsDecoder, ja3_ja4) {
+  test::TcpStream s(&this->nd_, 443);
+  s.send(modern_hello());
+
+  ASSERT_EQ(1u, this->hello_->count_);
+  std::map<std::string, std::string> &v = this->hello_->value_;
+  EXPECT_EQ(std::string("\x03\x03", 2), v["tls.version"]);
+  EXPECT_EQ("example.com", v["tls.sni"]);
+  EXPECT_EQ("h2,http/1.1", v["tls.alpn"]);
+  EXPECT_EQ("4865-4866-49195-47", v["tls.ciphers"]);
+  EXPECT_EQ("0-10-11-13-16-43", v["tls.extensions"]);
+  EXPECT_EQ("771,4865-4866-49195-47,0-10-11-13-16-43,29-23,0",
+            v["tls.ja3"]);
+  EXPECT_EQ("85dfd04b48599755b61acdcbd24dbec8", v["tls.ja3_hash"]);
+  EXPECT_EQ("t13d0406h2_52f89ac5ce33_0d385148b956", v["tls.ja4"]);
+}
+
+TEST_F(TlsDecoder, no_extension) {
+  std::string ciphers;
+  put_u16_list(&ciphers, {0x0035, 0x000a});
+  test::TcpStream s(&this->nd_, 443);
+  s.send(client_hello(0x0301, ciphers, "", false));
+
+  ASSERT_EQ(1u, this->hello_->count_);
+  std::map<std::string, std::string> &v = this->hello_->value_;
+  EXPECT_FALSE(this->hello_->has("tls.sni"));
+  EXPECT_FALSE(this->hello_->has("tls.alpn"));
+  EXPECT_EQ("769,53-10,,,", v["tls.ja3"]);
+  EXPECT_EQ("13904eda25d70fb37b9820c09bd4f67b", v["tls.ja3_hash"]);
+  EXPECT_EQ("t10i020000_84f732f1f252_000000000000", v["tls.ja4"]);
+}
+
+TEST_F(TlsDecoder, split_into_segments) {
+  // Fingerprints must not depend on how the record is segmented.
+  const std::string rec = modern_hello();
+  test::TcpStream s(&this->nd_, 443);
+  s.send(rec.substr(0, 3));
+  EXPECT_EQ(0u, this->hello_->count_);
+  s.send(rec.substr(3, 100));
+  EXPECT_EQ(0u, this->hello_->count_);
+  s.send(rec.substr(103));
+
+  ASSERT_EQ(1u, this->hello_->count_);
+  EXPECT_EQ("85dfd04b48599755b61acdcbd24dbec8",
+            this->hello_->value_["tls.ja3_hash"]);
+  EXPECT_EQ("t13d0406h2_52f89ac5ce33_0d385148b956",
+            this->hello_->value_["tls.ja4"]);
+}
+
+TEST_F(TlsDecoder, odd_length_cipher_list) {
+  // The last odd byte is not taken as a cipher.
+  std::string ciphers;
+  put_u16_list(&ciphers, {0x1301, 0x1302});
+  ciphers.push_back(0x13);
+  test::TcpStream s(&this->nd_, 443);
+  s.send(client_hello(0x0303, ciphers, "", false));
+
+  ASSERT_EQ(1u, this->hello_->count_);
+  EXPECT_EQ("4865-4866", this->hello_->value_["tls.ciphers"]);
+  EXPECT_EQ("771,4865-4866,,,", this->hello_->value_["tls.ja3"]);
+}
+
+TEST_F(TlsDecoder, large_hello) {
+  // 4095 ciphers and 2500 empty extensions in one record fill the lists
+  // far beyond usual ClientHello, but must still be fingerprinted whole.
+  std::string ciphers(4095 * 2, '\xff');
+  std::string exts;
+  for (uint16_t i = 0; i < 2500; i++) {
+    put_ext(&exts, 0x1000 + i, "");
+  }
+  test::TcpStream s(&this->nd_, 443);
+  s.send(client_hello(0x0303, ciphers, exts, true));
+
+  ASSERT_EQ(1u, this->hello_->count_);
+  EXPECT_EQ(37075u, this->hello_->value_["tls.ja3"].size());
+  EXPECT_EQ("81de35c2793b7fdbddf771e29d0c7c30",
+            this->hello_->value_["tls.ja3_hash"]);
+}
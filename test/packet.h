@@ -0,0 +1,168 @@
+/*-
+ * Copyright (c) 2015 Masayoshi Mizutani <mizutani@sfc.wide.ad.jp>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED
+ * TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE FOUNDATION OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef TEST_PACKET_H__
+#define TEST_PACKET_H__
+
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../src/swarm/swarm.h"
+
+namespace test {
+  // Builds an Ethernet/IPv4/TCP frame. Addresses are in host order.
+  inline std::vector<uint8_t> tcp_frame(uint32_t src, uint32_t dst,
+                                        uint16_t sport, uint16_t dport,
+                                        uint32_t seq, uint32_t ack,
+                                        uint8_t flags,
+                                        const std::string &data) {
+    std::vector<uint8_t> f(14 + 20 + 20 + data.size());
+    uint8_t *eth = f.data();
+    ::memset(eth, 0x11, 6);
+    ::memset(eth + 6, 0x22, 6);
+    eth[12] = 0x08;
+
+    uint8_t *ip = eth + 14;
+    const uint16_t total = htons(40 + data.size());
+    ip[0] = 0x45;
+    ::memcpy(ip + 2, &total, 2);
+    ip[8] = 64;
+    ip[9] = 6;
+    src = htonl(src);
+    dst = htonl(dst);
+    ::memcpy(ip + 12, &src, 4);
+    ::memcpy(ip + 16, &dst, 4);
+
+    uint8_t *tcp = ip + 20;
+    sport = htons(sport);
+    dport = htons(dport);
+    seq = htonl(seq);
+    ack = htonl(ack);
+    ::memcpy(tcp, &sport, 2);
+    ::memcpy(tcp + 2, &dport, 2);
+    ::memcpy(tcp + 4, &seq, 4);
+    ::memcpy(tcp + 8, &ack, 4);
+    tcp[12] = 0x50;
+    tcp[13] = flags;
+    tcp[14] = tcp[15] = 0xff;
+    ::memcpy(tcp + 20, data.data(), data.size());
+    return f;
+  }
+
+  inline void input(swarm::NetDec *nd, const std::vector<uint8_t> &f,
+                    time_t ts) {
+    struct timeval tv = {ts, 0};
+    nd->input(f.data(), f.size(), tv, f.size());
+  }
+
+  // Feeds frames of one client-server connection to a NetDec, so that
+  // decoders can be tested on streams.
+  class TcpStream {
+  private:
+    swarm::NetDec *nd_;
+    uint32_t client_, server_;
+    uint16_t sport_, dport_;
+    uint32_t seq_, ack_;
+    time_t ts_;
+
+    void input(bool to_server, uint8_t flags, const std::string &data) {
+      if (to_server) {
+        test::input(this->nd_, tcp_frame(this->client_, this->server_,
+                                         this->sport_, this->dport_,
+                                         this->seq_, this->ack_, flags,
+                                         data), this->ts_);
+      } else {
+        test::input(this->nd_, tcp_frame(this->server_, this->client_,
+                                         this->dport_, this->sport_,
+                                         this->ack_, this->seq_, flags,
+                                         data), this->ts_);
+      }
+    }
+
+  public:
+    TcpStream(swarm::NetDec *nd, uint16_t dport) :
+      nd_(nd), client_(0x0a000001), server_(0x0a000002), sport_(40000),
+      dport_(dport), seq_(1000), ack_(5000), ts_(1000) {
+      // 3-way handshake
+      this->input(true, 0x02, "");
+      this->seq_++;
+      this->input(false, 0x12, "");
+      this->ack_++;
+      this->input(true, 0x10, "");
+    }
+
+    // Sends data from client to server as one segment.
+    void send(const std::string &data) {
+      this->input(true, 0x18, data);
+      this->seq_ += data.size();
+    }
+  };
+
+  // Keeps values of the last event as strings.
+  class Capture : public swarm::Handler {
+  private:
+    std::vector<std::string> keys_;
+  public:
+    size_t count_;
+    std::map<std::string, std::string> value_;
+
+    explicit Capture(const std::vector<std::string> &keys) :
+      keys_(keys), count_(0) {}
+    void recv(swarm::ev_id eid, const swarm::Property &p) {
+      this->count_++;
+      this->value_.clear();
+      for (size_t i = 0; i < this->keys_.size(); i++) {
+        const swarm::Value &v = p.value(this->keys_[i]);
+        if (v.ptr() != nullptr) {
+          this->value_[this->keys_[i]] = v.str();
+        }
+      }
+    }
+    bool has(const std::string &key) const {
+      return this->value_.find(key) != this->value_.end();
+    }
+  };
+
+  // Appends a big endian integer of n bytes.
+  inline void put_be(std::string *s, uint32_t v, size_t n) {
+    while (n > 0) {
+      n--;
+      s->push_back(static_cast<char>((v >> (n * 8)) & 0xff));
+    }
+  }
+
+  // Appends data with a big endian length prefix of n bytes.
+  inline void put_vec(std::string *s, const std::string &data, size_t n) {
+    put_be(s, data.size(), n);
+    s->append(data);
+  }
+}  // namespace test
+
+#endif  // TEST_PACKET_H__